@@ -0,0 +1,599 @@
+#include "bcache.h"
+#include "../clib/clib.h"
+#include "../disk/disk.h"
+#include "../sched/sched.h"
+#include "../timer/timer.h"
+#include "../trace/trace.h"
+
+#define SECTOR_SIZE 512
+#define NO_SLOT 0xFFFF
+
+typedef struct {
+  uint32_t lba;
+  uint8_t valid;
+  uint8_t dirty;
+  uint8_t referenced; /* CLOCK second-chance bit */
+  uint8_t writing;    /* copied out by a flush, write not finished yet */
+  uint16_t hash_next;
+  uint64_t dirty_tick; /* timer tick when it first became dirty */
+} bcache_slot_t;
+
+static uint8_t data[BCACHE_SECTORS][SECTOR_SIZE];
+static bcache_slot_t slots[BCACHE_SECTORS];
+static uint16_t buckets[BCACHE_HASH_BUCKETS]; /* slot index + 1, 0 = empty */
+static uint32_t clock_hand = 0;
+static uint32_t dirty_count = 0;
+static bcache_stats_t stats;
+
+static mutex_t cache_lock = MUTEX_INIT;
+/* one writeback at a time, or a stale copy could land after a newer one */
+static mutex_t flush_lock = MUTEX_INIT;
+
+static bcache_mode_t mode = BCACHE_ORDERED;
+static uint32_t meta_end = 0; /* LBAs below this are filesystem metadata */
+static uint32_t meta_run_lba = 0, meta_run_count = 0; /* and these */
+
+/* flush scratch, only touched under flush_lock */
+static uint16_t flush_order[BCACHE_SECTORS];
+static uint32_t flush_lbas[BCACHE_FLUSH_BATCH];
+static uint8_t flush_buf[BCACHE_FLUSH_BATCH][SECTOR_SIZE];
+/* freed extents waiting for TRIM; seq orders them against flushes */
+typedef struct {
+  uint32_t lba;
+  uint32_t count;
+  uint32_t seq;
+} discard_t;
+
+static discard_t discards[BCACHE_DISCARD_MAX];
+static uint32_t discard_count = 0;
+static uint32_t discard_seq = 0;
+/* held across a TRIM, so a range can't be reallocated underneath it */
+static mutex_t discard_lock = MUTEX_INIT;
+
+/* ordered mode holds a metadata batch while the data goes out */
+static uint16_t meta_order[BCACHE_SECTORS];
+static uint32_t meta_lbas[BCACHE_FLUSH_BATCH];
+static uint8_t meta_buf[BCACHE_FLUSH_BATCH][SECTOR_SIZE];
+
+static inline uint32_t bucket_of(uint32_t lba) {
+  return ((lba * 2654435761u) >> 20) & (BCACHE_HASH_BUCKETS - 1);
+}
+
+static uint16_t lookup(uint32_t lba) {
+  for (uint16_t i = buckets[bucket_of(lba)]; i; i = slots[i - 1].hash_next) {
+    if (slots[i - 1].lba == lba)
+      return i - 1;
+  }
+  return NO_SLOT;
+}
+
+static void unhash(uint16_t slot) {
+  uint16_t *link = &buckets[bucket_of(slots[slot].lba)];
+  while (*link && *link - 1 != slot)
+    link = &slots[*link - 1].hash_next;
+  if (*link)
+    *link = slots[slot].hash_next;
+}
+
+/* CLOCK over clean sectors. Dirty ones are skipped: the dirty limit keeps
+ * at least half the cache clean, so a victim always turns up. So are ones
+ * being written back: until the write lands, the disk holds an older copy
+ * that a read would otherwise fetch. */
+static uint16_t evict(void) {
+  for (uint32_t scanned = 0; scanned < 2 * BCACHE_SECTORS; scanned++) {
+    uint16_t slot = (uint16_t)clock_hand;
+    bcache_slot_t *s = &slots[slot];
+    clock_hand = (clock_hand + 1) % BCACHE_SECTORS;
+    if (!s->valid)
+      return slot;
+    if (s->dirty || s->writing)
+      continue;
+    if (s->referenced) {
+      s->referenced = 0;
+      continue;
+    }
+    unhash(slot);
+    s->valid = 0;
+    return slot;
+  }
+  return NO_SLOT;
+}
+
+static void insert(uint16_t slot, uint32_t lba) {
+  bcache_slot_t *s = &slots[slot];
+  uint32_t b = bucket_of(lba);
+  s->lba = lba;
+  s->valid = 1;
+  s->dirty = 0;
+  s->writing = 0;
+  s->referenced = 1;
+  s->hash_next = buckets[b];
+  buckets[b] = slot + 1;
+}
+
+int bcache_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+  uint8_t *out = buf;
+  mutex_lock(&cache_lock);
+  for (uint32_t i = 0; i < count;) {
+    uint16_t slot = lookup(lba + i);
+    if (slot != NO_SLOT) {
+      stats.hits++;
+      slots[slot].referenced = 1;
+      memcpy(out + i * SECTOR_SIZE, data[slot], SECTOR_SIZE);
+      i++;
+      continue;
+    }
+
+    /* a run of misses is one transfer, straight into the caller's buffer,
+     * and then fills the cache as far as clean slots allow */
+    uint32_t run = 1;
+    while (i + run < count && lookup(lba + i + run) == NO_SLOT)
+      run++;
+    stats.misses += run;
+    if (disk_read_lbas(lba + i, run, out + i * SECTOR_SIZE) != 0) {
+      mutex_unlock(&cache_lock);
+      return -1;
+    }
+    for (uint32_t k = 0; k < run; k++) {
+      slot = evict();
+      if (slot == NO_SLOT)
+        break;
+      memcpy(data[slot], out + (i + k) * SECTOR_SIZE, SECTOR_SIZE);
+      insert(slot, lba + i + k);
+    }
+    i += run;
+  }
+  mutex_unlock(&cache_lock);
+  return 0;
+}
+
+int bcache_read(uint32_t lba, void *buf) {
+  return bcache_read_sectors(lba, 1, buf);
+}
+
+int bcache_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+  const uint8_t *in = buf;
+  if (dirty_count >= BCACHE_SECTORS * BCACHE_DIRTY_LIMIT / 100)
+    bcache_flush(); /* throttle: this writer pays for the backlog */
+
+  mutex_lock(&cache_lock);
+  if (mode == BCACHE_WRITETHROUGH) {
+    /* straight to disk; cached copies are kept current but never dirty */
+    int rc = disk_write_lbas(lba, count, buf);
+    for (uint32_t i = 0; rc == 0 && i < count; i++) {
+      uint16_t slot = lookup(lba + i);
+      if (slot != NO_SLOT) {
+        memcpy(data[slot], in + i * SECTOR_SIZE, SECTOR_SIZE);
+        slots[slot].referenced = 1;
+      }
+    }
+    mutex_unlock(&cache_lock);
+    return rc;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t slot = lookup(lba + i);
+    if (slot == NO_SLOT) {
+      slot = evict();
+      if (slot == NO_SLOT) {
+        if (disk_write_lbas(lba + i, 1, in + i * SECTOR_SIZE) != 0) {
+          mutex_unlock(&cache_lock);
+          return -1;
+        }
+        continue;
+      }
+      insert(slot, lba + i);
+    }
+
+    bcache_slot_t *s = &slots[slot];
+    memcpy(data[slot], in + i * SECTOR_SIZE, SECTOR_SIZE);
+    s->referenced = 1;
+    if (!s->dirty) {
+      s->dirty = 1;
+      s->dirty_tick = timer_ticks();
+      dirty_count++;
+    }
+  }
+  mutex_unlock(&cache_lock);
+  return 0;
+}
+
+int bcache_write(uint32_t lba, const void *buf) {
+  return bcache_write_sectors(lba, 1, buf);
+}
+
+/* ===== writeback ===== */
+
+enum { FLUSH_ALL, FLUSH_DATA, FLUSH_META };
+
+static inline int in_class(uint32_t lba, int which) {
+  if (which == FLUSH_ALL)
+    return 1;
+  int meta = lba < meta_end || lba - meta_run_lba < meta_run_count;
+  return meta == (which == FLUSH_META);
+}
+
+static void sort_by_lba(uint16_t *order, uint32_t n) {
+  /* shell sort, gaps 3x+1; n is at most BCACHE_SECTORS */
+  uint32_t gap = 1;
+  while (gap < n / 3)
+    gap = gap * 3 + 1;
+  for (; gap > 0; gap /= 3) {
+    for (uint32_t i = gap; i < n; i++) {
+      uint16_t v = order[i];
+      uint32_t j = i;
+      while (j >= gap && slots[order[j - gap]].lba > slots[v].lba) {
+        order[j] = order[j - gap];
+        j -= gap;
+      }
+      order[j] = v;
+    }
+  }
+}
+
+/* Dirty sectors of one class dirtied at or before cutoff, in LBA order.
+ * Caller holds cache_lock. */
+static uint32_t collect(uint16_t *order, uint64_t cutoff, int which) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < BCACHE_SECTORS; i++) {
+    if (slots[i].valid && slots[i].dirty && slots[i].dirty_tick <= cutoff &&
+        in_class(slots[i].lba, which))
+      order[n++] = (uint16_t)i;
+  }
+  sort_by_lba(order, n);
+  return n;
+}
+
+/* Copy the next batch of order[*next..n) out and mark it clean and being
+ * written; written_back ends that. Caller holds cache_lock. The slot may
+ * have been recycled since the sort; if it holds some other dirty sector
+ * now, writing that one is just as correct. */
+static uint32_t copy_out(const uint16_t *order, uint32_t *next, uint32_t n,
+                         uint32_t *lbas, uint8_t (*buf)[SECTOR_SIZE]) {
+  uint32_t batch = 0;
+  while (*next < n && batch < BCACHE_FLUSH_BATCH) {
+    bcache_slot_t *s = &slots[order[(*next)++]];
+    if (!s->valid || !s->dirty)
+      continue;
+    lbas[batch] = s->lba;
+    memcpy(buf[batch], data[s - slots], SECTOR_SIZE);
+    s->dirty = 0;
+    s->writing = 1;
+    dirty_count--;
+    batch++;
+  }
+  return batch;
+}
+
+/* The write of copied-out sectors is over: their slots may be evicted
+ * again, and if it failed they are dirty again, as a failed writeback must
+ * not lose the data. A slot that is gone was dropped by a discard. */
+static void written_back(const uint32_t *lbas, uint32_t count, int ok) {
+  mutex_lock(&cache_lock);
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t slot = lookup(lbas[i]);
+    if (slot == NO_SLOT)
+      continue;
+    bcache_slot_t *s = &slots[slot];
+    s->writing = 0;
+    if (!ok && !s->dirty) {
+      s->dirty = 1;
+      s->dirty_tick = timer_ticks();
+      dirty_count++;
+    }
+  }
+  mutex_unlock(&cache_lock);
+}
+
+/* The batch is LBA-sorted, so consecutive sectors go out as one write */
+static int write_out(const uint32_t *lbas, uint8_t (*buf)[SECTOR_SIZE],
+                     uint32_t batch) {
+  int written = 0;
+  for (uint32_t i = 0; i < batch;) {
+    uint32_t run = 1;
+    while (i + run < batch && lbas[i + run] == lbas[i] + run)
+      run++;
+    int ok = disk_write_lbas(lbas[i], run, buf[i]) == 0;
+    written_back(lbas + i, run, ok);
+    if (!ok) {
+      written = -1;
+    } else {
+      if (written >= 0)
+        written += run;
+      stats.writebacks += run;
+    }
+    i += run;
+  }
+  return written;
+}
+
+static int add_written(int total, int more) {
+  return (total < 0 || more < 0) ? -1 : total + more;
+}
+
+static int barrier(void) {
+  stats.barriers++;
+  return disk_flush();
+}
+
+/* Write back one class of sectors. Each batch is copied out and marked
+ * clean under the cache lock and written without it, so readers and
+ * writers only wait for a memcpy. A sector rewritten meanwhile is simply
+ * dirty again. */
+static int flush_class(uint64_t cutoff, int which) {
+  mutex_lock(&cache_lock);
+  uint32_t n = collect(flush_order, cutoff, which);
+  mutex_unlock(&cache_lock);
+
+  int written = 0;
+  for (uint32_t next = 0; next < n;) {
+    mutex_lock(&cache_lock);
+    uint32_t batch = copy_out(flush_order, &next, n, flush_lbas, flush_buf);
+    mutex_unlock(&cache_lock);
+    written = add_written(written, write_out(flush_lbas, flush_buf, batch));
+  }
+  return written;
+}
+
+/* Snapshot a batch of metadata, write every data sector dirtied before the
+ * snapshot, FLUSH CACHE, then write the snapshot. Whatever it references
+ * is on media by the time it lands. Data newer than the snapshot can't be
+ * referenced by it and waits for the next round. */
+static int flush_ordered(uint64_t cutoff) {
+  int written = 0;
+
+  mutex_lock(&cache_lock);
+  uint32_t n = collect(meta_order, cutoff, FLUSH_META);
+  mutex_unlock(&cache_lock);
+
+  for (uint32_t next = 0; next < n;) {
+    int first = next == 0;
+    mutex_lock(&cache_lock);
+    uint32_t batch = copy_out(meta_order, &next, n, meta_lbas, meta_buf);
+    mutex_unlock(&cache_lock);
+    if (batch == 0)
+      break;
+
+    /* after the first barrier only newly written data needs another */
+    int rc = flush_class(UINT64_MAX, FLUSH_DATA);
+    if (rc < 0 || ((first || rc > 0) && barrier() != 0)) {
+      written_back(meta_lbas, batch, 0);
+      return -1;
+    }
+    written = add_written(written, rc);
+    written = add_written(written, write_out(meta_lbas, meta_buf, batch));
+  }
+  return add_written(written, flush_class(cutoff, FLUSH_DATA));
+}
+
+/* Write back sectors dirtied at or before cutoff, the way the mode asks.
+ * Caller holds flush_lock, which also keeps the mode from changing. */
+static int flush_locked(uint64_t cutoff) {
+  return mode == BCACHE_ORDERED ? flush_ordered(cutoff)
+                                : flush_class(cutoff, FLUSH_ALL);
+}
+
+static int flush_older_than(uint64_t cutoff) {
+  TRACE_SCOPE(TP_BCACHE_FLUSH, dirty_count);
+  mutex_lock(&flush_lock);
+  int written = flush_locked(cutoff);
+  mutex_unlock(&flush_lock);
+  return written;
+}
+
+/* TRIM what was queued up to seq_limit; the flush that just finished
+ * carried the metadata that freed it */
+static void issue_discards(uint32_t seq_limit) {
+  mutex_lock(&discard_lock);
+  for (uint32_t i = 0; i < discard_count;) {
+    if (discards[i].seq > seq_limit) {
+      i++;
+      continue;
+    }
+    if (disk_trim(discards[i].lba, discards[i].count) == 0)
+      stats.discarded += discards[i].count;
+    discards[i] = discards[--discard_count];
+  }
+  mutex_unlock(&discard_lock);
+}
+
+int bcache_flush(void) {
+  uint32_t seq = discard_seq; /* their metadata is dirty or written by now */
+  int written = flush_older_than(UINT64_MAX);
+  if (barrier() != 0)
+    return -1;
+  if (written >= 0)
+    issue_discards(seq);
+  return written;
+}
+
+int bcache_barrier(void) {
+  if (mode != BCACHE_WRITETHROUGH)
+    return 0;
+  return barrier();
+}
+
+void bcache_invalidate(void) {
+  mutex_lock(&cache_lock);
+  memset(slots, 0, sizeof(slots));
+  memset(buckets, 0, sizeof(buckets));
+  clock_hand = 0;
+  dirty_count = 0;
+  mutex_unlock(&cache_lock);
+  mutex_lock(&discard_lock);
+  discard_count = 0; /* those extents belonged to the old contents */
+  mutex_unlock(&discard_lock);
+}
+
+/* ===== discard ===== */
+
+static void drop_range(uint32_t lba, uint32_t count) {
+  mutex_lock(&cache_lock);
+  for (uint32_t i = 0; i < BCACHE_SECTORS; i++) {
+    bcache_slot_t *s = &slots[i];
+    if (!s->valid || s->lba < lba || s->lba - lba >= count)
+      continue;
+    unhash((uint16_t)i);
+    if (s->dirty)
+      dirty_count--;
+    s->valid = 0;
+    s->dirty = 0;
+    s->writing = 0;
+  }
+  mutex_unlock(&cache_lock);
+}
+
+void bcache_discard(uint32_t lba, uint32_t count) {
+  if (count == 0)
+    return;
+  drop_range(lba, count);
+
+  mutex_lock(&discard_lock);
+  uint32_t seq = ++discard_seq;
+  for (uint32_t i = 0; i < discard_count; i++) {
+    discard_t *d = &discards[i];
+    if (d->lba + d->count == lba || lba + count == d->lba) {
+      if (lba < d->lba)
+        d->lba = lba;
+      d->count += count;
+      d->seq = seq;
+      mutex_unlock(&discard_lock);
+      return;
+    }
+  }
+  /* when full the extent just isn't trimmed; it is still free space and
+   * fstrim will pick it up */
+  if (discard_count < BCACHE_DISCARD_MAX)
+    discards[discard_count++] = (discard_t){lba, count, seq};
+  mutex_unlock(&discard_lock);
+}
+
+void bcache_discard_cancel(uint32_t lba, uint32_t count) {
+  uint32_t end = lba + count;
+  mutex_lock(&discard_lock);
+  for (uint32_t i = 0; i < discard_count;) {
+    discard_t *d = &discards[i];
+    uint32_t d_end = d->lba + d->count;
+    if (d_end <= lba || end <= d->lba) {
+      i++;
+      continue;
+    }
+    if (d->lba < lba && d_end > end) {
+      /* split around the reused part; with no room the tail goes
+       * untrimmed, which is harmless */
+      if (discard_count < BCACHE_DISCARD_MAX)
+        discards[discard_count++] = (discard_t){end, d_end - end, d->seq};
+      d->count = lba - d->lba;
+      i++;
+    } else if (d->lba < lba) {
+      d->count = lba - d->lba;
+      i++;
+    } else if (d_end > end) {
+      d->count = d_end - end;
+      d->lba = end;
+      i++;
+    } else {
+      discards[i] = discards[--discard_count];
+    }
+  }
+  mutex_unlock(&discard_lock);
+}
+
+int bcache_trim(uint32_t lba, uint32_t count) {
+  if (count == 0)
+    return 0;
+  drop_range(lba, count);
+  mutex_lock(&discard_lock);
+  int rc = disk_trim(lba, count);
+  if (rc == 0)
+    stats.discarded += count;
+  mutex_unlock(&discard_lock);
+  return rc == 0 ? (int)count : -1;
+}
+
+static void flusher_main(void *arg) {
+  (void)arg;
+  uint64_t age_ticks = (uint64_t)BCACHE_DIRTY_AGE_MS * TIMER_HZ / 1000;
+
+  while (1) {
+    sched_sleep_ms(BCACHE_FLUSH_INTERVAL_MS);
+    if (dirty_count == 0) {
+      if (discard_count)
+        bcache_flush(); /* just the barrier and the queued TRIMs */
+      continue;
+    }
+
+    if (dirty_count >= BCACHE_SECTORS * BCACHE_DIRTY_BACKGROUND / 100) {
+      bcache_flush();
+      continue;
+    }
+    uint64_t now = timer_ticks();
+    if (now >= age_ticks)
+      flush_older_than(now - age_ticks);
+  }
+}
+
+void bcache_start_flusher(void) {
+  thread_create("bflush", flusher_main, 0, PRIO_LOW);
+}
+
+/* ===== durability mode ===== */
+
+static const char *const mode_names[] = {
+    [BCACHE_WRITETHROUGH] = "writethrough",
+    [BCACHE_ORDERED] = "ordered",
+    [BCACHE_WRITEBACK] = "writeback",
+};
+
+/* Drain the cache under the old mode's ordering and switch only once it is
+ * clean. Holding flush_lock throughout means the flusher has no copy of a
+ * sector in flight that a writethrough write could then overtake; the
+ * cache_lock check catches writers that dirtied a sector meanwhile. */
+int bcache_set_mode(bcache_mode_t m) {
+  mutex_lock(&flush_lock);
+  for (;;) {
+    if (flush_locked(UINT64_MAX) < 0 || barrier() != 0) {
+      mutex_unlock(&flush_lock);
+      return -1; /* still dirty; stay in the mode that knows about it */
+    }
+    mutex_lock(&cache_lock);
+    int clean = dirty_count == 0;
+    if (clean)
+      mode = m;
+    mutex_unlock(&cache_lock);
+    if (clean)
+      break;
+  }
+  mutex_unlock(&flush_lock);
+  disk_set_write_cache(m != BCACHE_WRITETHROUGH);
+  return 0;
+}
+
+bcache_mode_t bcache_mode(void) { return mode; }
+
+const char *bcache_mode_name(bcache_mode_t m) {
+  return (uint32_t)m < sizeof(mode_names) / sizeof(mode_names[0])
+             ? mode_names[m]
+             : "unknown";
+}
+
+int bcache_mode_parse(const char *name) {
+  for (uint32_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+    if (strcmp(name, mode_names[i]) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+void bcache_set_meta_end(uint32_t lba) { meta_end = lba; }
+
+void bcache_set_meta_run(uint32_t lba, uint32_t count) {
+  meta_run_lba = lba;
+  meta_run_count = count;
+}
+
+bcache_stats_t bcache_stats(void) {
+  bcache_stats_t s = stats;
+  s.dirty = dirty_count;
+  return s;
+}
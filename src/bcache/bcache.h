@@ -0,0 +1,93 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+
+/* Write-behind sector cache between the filesystem and the disk driver.
+ * Writes land in memory and are marked dirty; a background flusher writes
+ * them back in LBA order once the oldest has been dirty for
+ * BCACHE_DIRTY_AGE_MS or the cache is BCACHE_DIRTY_BACKGROUND percent
+ * dirty. Past BCACHE_DIRTY_LIMIT percent the writer flushes inline, so a
+ * burst can't fill the cache with data that has nowhere to go. Reads are
+ * served from the cache and fill it, evicting clean sectors (CLOCK).
+ *
+ * The durability mode decides when data reaches the platter:
+ *   writethrough  every write goes straight to disk and bcache_barrier()
+ *                 issues FLUSH CACHE, so a completed fs call is on media
+ *   ordered       write-behind, but a flush writes data sectors, FLUSH
+ *                 CACHE, then metadata: the on-disk file table never
+ *                 points at blocks that didn't make it (the default)
+ *   writeback     write-behind in plain LBA order; FLUSH CACHE only on an
+ *                 explicit bcache_flush()
+ * Sectors below the metadata boundary (bcache_set_meta_end) are metadata,
+ * and so is one run above it (bcache_set_meta_run), for a file table that
+ * has grown out into the data area.
+ *
+ * Freed extents are queued with bcache_discard() and TRIMmed in batches by
+ * the next full flush, once the metadata that freed them is on media: a
+ * crash can't leave the old file table pointing at discarded blocks. */
+
+#define BCACHE_SECTORS 4096 /* 2 MiB of 512-byte sectors */
+#define BCACHE_HASH_BUCKETS 4096
+#define BCACHE_DIRTY_AGE_MS 5000
+#define BCACHE_DIRTY_BACKGROUND 25 /* percent */
+#define BCACHE_DIRTY_LIMIT 50      /* percent */
+#define BCACHE_FLUSH_INTERVAL_MS 100
+#define BCACHE_FLUSH_BATCH 32 /* sectors copied out per lock hold */
+#define BCACHE_DISCARD_MAX 64 /* queued extents; more are dropped */
+
+typedef enum {
+  BCACHE_WRITETHROUGH,
+  BCACHE_ORDERED,
+  BCACHE_WRITEBACK,
+} bcache_mode_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks; /* sectors written to disk */
+  uint64_t barriers;   /* FLUSH CACHE commands issued */
+  uint64_t discarded;  /* sectors TRIMmed */
+  uint32_t dirty;      /* sectors dirty right now */
+} bcache_stats_t;
+
+int bcache_read(uint32_t lba, void *buf);
+int bcache_write(uint32_t lba, const void *buf);
+/* count consecutive sectors; misses are read from disk in one transfer */
+int bcache_read_sectors(uint32_t lba, uint32_t count, void *buf);
+int bcache_write_sectors(uint32_t lba, uint32_t count, const void *buf);
+
+/* Write back every dirty sector and FLUSH CACHE; returns sectors written
+ * or -1. */
+int bcache_flush(void);
+/* In writethrough mode, FLUSH CACHE now so nothing written later can reach
+ * the media first. The write-behind modes order their own flushes, so it
+ * is a no-op there. */
+int bcache_barrier(void);
+/* Drop every cached sector, dirty ones included, e.g. after the disk has
+ * been rewritten underneath the cache. */
+void bcache_invalidate(void);
+
+/* Queue a freed extent for TRIM and drop its cached sectors, dirty ones
+ * included. Call after the metadata freeing it is in the cache. */
+void bcache_discard(uint32_t lba, uint32_t count);
+/* The extent is being allocated again: take it off the queue. */
+void bcache_discard_cancel(uint32_t lba, uint32_t count);
+/* TRIM now, for space whose freeing is already on disk (fstrim after a
+ * flush); returns sectors trimmed or -1 if the disk can't. */
+int bcache_trim(uint32_t lba, uint32_t count);
+
+/* Switch durability mode, flushing under the old one first and setting the
+ * drive's write cache to match: off for writethrough where the drive
+ * supports that. Returns -1, keeping the old mode, if the flush fails. */
+int bcache_set_mode(bcache_mode_t mode);
+bcache_mode_t bcache_mode(void);
+const char *bcache_mode_name(bcache_mode_t mode);
+int bcache_mode_parse(const char *name); /* mode, or -1 if unknown */
+void bcache_set_meta_end(uint32_t lba);
+void bcache_set_meta_run(uint32_t lba, uint32_t count); /* count 0: none */
+
+void bcache_start_flusher(void); /* needs the scheduler */
+bcache_stats_t bcache_stats(void);
+
+#endif
@@ -0,0 +1,336 @@
+#include "bench.h"
+#include "../clib/clib.h"
+#include "../disk/disk.h"
+#include "../fs/fs.h"
+#include "../kernel.h"
+#include "../sched/sched.h"
+#include "../timer/timer.h"
+#include "../vga/vga.h"
+
+#define BENCH_FS_IO_FILES 16
+#define BENCH_VGA_LINES 200
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static uint32_t num_results = 0;
+
+static uint8_t disk_buf[BENCH_DISK_SECTORS * 512];
+static uint8_t mem_src[BENCH_MEM_BYTES];
+static uint8_t mem_dst[BENCH_MEM_BYTES];
+
+static uint32_t lcg_state = 12345;
+
+static uint32_t bench_rand(void) {
+  lcg_state = lcg_state * 1103515245 + 12345;
+  return lcg_state >> 8;
+}
+
+static void bench_name(char *dst, const char *a, const char *b) {
+  uint32_t n = 0;
+  while (*a && n < BENCH_NAME_LEN - 1)
+    dst[n++] = *a++;
+  while (b && *b && n < BENCH_NAME_LEN - 1)
+    dst[n++] = *b++;
+  dst[n] = '\0';
+}
+
+static void bench_record(const char *name, const char *suffix, uint32_t ops,
+                         uint64_t bytes, uint64_t cycles) {
+  if (num_results >= BENCH_MAX_RESULTS)
+    return;
+  bench_result_t *r = &results[num_results++];
+  bench_name(r->name, name, suffix);
+  r->ops = ops;
+  r->bytes = bytes;
+  r->cycles = cycles;
+}
+
+static void put_kv(const char *key, uint64_t value) {
+  char num[21];
+  vga_putstr(" ", 0x0F);
+  vga_putstr(key, 0x0F);
+  vga_putstr("=", 0x0F);
+  vga_putstr(utoa(value, num, 10), 0x0F);
+}
+
+/* BENCH name=<suite.case> ops=N bytes=N cycles=N cpo=N mbps=I.FFF */
+static void bench_print(const bench_result_t *r) {
+  char num[21];
+  vga_putstr("BENCH name=", 0x0F);
+  vga_putstr(r->name, 0x0F);
+  put_kv("ops", r->ops);
+  put_kv("bytes", r->bytes);
+  put_kv("cycles", r->cycles);
+  put_kv("cpo", r->ops ? r->cycles / r->ops : 0);
+
+  /* bytes per ms == kB/s; print as MB/s with three decimals */
+  uint64_t kbps = 0;
+  if (r->cycles)
+    kbps = r->bytes * timer_tsc_khz() / r->cycles;
+  vga_putstr(" mbps=", 0x0F);
+  vga_putstr(utoa(kbps / 1000, num, 10), 0x0F);
+  vga_putchar('.', 0x0F);
+  uint32_t frac = (uint32_t)(kbps % 1000);
+  vga_putchar('0' + frac / 100, 0x0F);
+  vga_putchar('0' + (frac / 10) % 10, 0x0F);
+  vga_putchar('0' + frac % 10, 0x0F);
+  vga_putchar('\n', 0x0F);
+}
+
+/* ===== disk ===== */
+
+static void bench_disk(void) {
+  uint32_t n = BENCH_DISK_SECTORS;
+  uint64_t t0, t1;
+
+  /* these go around the block cache: get it clean first so the flusher
+   * can't land newer data between our read and write-back */
+  fs_flush();
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < n; i++)
+    disk_read_lba(i, disk_buf + i * 512);
+  t1 = rdtsc();
+  bench_record("disk.seq_read", NULL, n, (uint64_t)n * 512, t1 - t0);
+
+  /* write back exactly what was just read so the fs is left untouched */
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < n; i++)
+    disk_write_lba(i, disk_buf + i * 512);
+  t1 = rdtsc();
+  bench_record("disk.seq_write", NULL, n, (uint64_t)n * 512, t1 - t0);
+
+  /* the same span as single requests, the size an array splits over its
+   * members; again written back unchanged */
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_DISK_PASSES; i++)
+    disk_read_lbas(0, n, disk_buf);
+  t1 = rdtsc();
+  bench_record("disk.stream_read", NULL, BENCH_DISK_PASSES,
+               (uint64_t)BENCH_DISK_PASSES * n * 512, t1 - t0);
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_DISK_PASSES; i++)
+    disk_write_lbas(0, n, disk_buf);
+  t1 = rdtsc();
+  bench_record("disk.stream_write", NULL, BENCH_DISK_PASSES,
+               (uint64_t)BENCH_DISK_PASSES * n * 512, t1 - t0);
+
+  uint32_t lbas[BENCH_DISK_SECTORS];
+  for (uint32_t i = 0; i < n; i++)
+    lbas[i] = bench_rand() % BENCH_DISK_SPAN;
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < n; i++)
+    disk_read_lba(lbas[i], disk_buf + i * 512);
+  t1 = rdtsc();
+  bench_record("disk.rand_read", NULL, n, (uint64_t)n * 512, t1 - t0);
+
+  /* replay in reverse so a repeated LBA ends up with its original data */
+  t0 = rdtsc();
+  for (uint32_t i = n; i-- > 0;)
+    disk_write_lba(lbas[i], disk_buf + i * 512);
+  t1 = rdtsc();
+  bench_record("disk.rand_write", NULL, n, (uint64_t)n * 512, t1 - t0);
+}
+
+/* ===== fs ===== */
+
+static void bench_fs_name(char *dst, uint32_t i) {
+  char num[21];
+  bench_name(dst, ".bench_", utoa(i, num, 10));
+}
+
+static void bench_fs(void) {
+  static const uint32_t levels[] = {25, 50, 75};
+  static const char *const level_names[] = {"@25", "@50", "@75"};
+  char name[BENCH_NAME_LEN];
+  uint8_t payload[FS_SECTOR_SIZE];
+  uint8_t readback[FS_SECTOR_SIZE];
+  uint32_t created = 0;
+  uint64_t t0, t1;
+
+  for (uint32_t i = 0; i < FS_SECTOR_SIZE; i++)
+    payload[i] = (uint8_t)('a' + i % 26);
+
+  for (uint32_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+    uint32_t target = FS_MAX_FILES * levels[l] / 100;
+    uint32_t start = created;
+
+    t0 = rdtsc();
+    while (created < target) {
+      bench_fs_name(name, created);
+      if (fs_create_file(name) < 0)
+        break; /* table full of user files; measure what we have */
+      created++;
+    }
+    t1 = rdtsc();
+    if (created == 0)
+      break;
+    bench_record("fs.create", level_names[l], created - start, 0, t1 - t0);
+
+    uint32_t lookups = 0;
+    t0 = rdtsc();
+    for (uint32_t pass = 0; pass < 4; pass++) {
+      for (uint32_t i = 0; i < created; i++) {
+        bench_fs_name(name, i);
+        fs_is_directory(name);
+        lookups++;
+      }
+    }
+    t1 = rdtsc();
+    bench_record("fs.lookup", level_names[l], lookups, 0, t1 - t0);
+
+    uint32_t io = created < BENCH_FS_IO_FILES ? created : BENCH_FS_IO_FILES;
+    t0 = rdtsc();
+    for (uint32_t i = 0; i < io; i++) {
+      bench_fs_name(name, i);
+      fs_write_file(name, payload, FS_SECTOR_SIZE);
+    }
+    t1 = rdtsc();
+    bench_record("fs.write", level_names[l], io, (uint64_t)io * FS_SECTOR_SIZE,
+                 t1 - t0);
+
+    t0 = rdtsc();
+    for (uint32_t i = 0; i < io; i++) {
+      bench_fs_name(name, i);
+      fs_read_file(name, readback, sizeof(readback));
+    }
+    t1 = rdtsc();
+    bench_record("fs.read", level_names[l], io, (uint64_t)io * FS_SECTOR_SIZE,
+                 t1 - t0);
+  }
+
+  for (uint32_t i = 0; i < created; i++) {
+    bench_fs_name(name, i);
+    fs_delete_file(name);
+  }
+}
+
+/* ===== vga ===== */
+
+static void bench_vga(void) {
+  uint64_t t0, t1;
+  uint32_t cols = vga_columns(), rows = vga_rows();
+  uint32_t chars = cols * (rows - 5);
+  int mirror = vga_set_serial_mirror(0); /* time the console only */
+
+  vga_clear_screen();
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < chars; i++)
+    vga_putchar('x', 0x0F);
+  t1 = rdtsc();
+  bench_record("vga.putchar", NULL, chars, (uint64_t)chars * 2, t1 - t0);
+
+  /* every newline on the bottom row scrolls the whole console */
+  vga_set_cursor(rows - 1, 0);
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_VGA_LINES; i++)
+    vga_putchar('\n', 0x0F);
+  t1 = rdtsc();
+  bench_record("vga.scroll", NULL, BENCH_VGA_LINES,
+               (uint64_t)BENCH_VGA_LINES * cols * (rows - 1) * 2, t1 - t0);
+  vga_clear_screen();
+  vga_set_serial_mirror(mirror);
+}
+
+/* ===== memory ===== */
+
+static void bench_mem(void) {
+  uint64_t bytes = (uint64_t)BENCH_MEM_BYTES * BENCH_MEM_PASSES;
+  uint64_t t0, t1;
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_MEM_PASSES; i++)
+    memset(mem_dst, (int)i, BENCH_MEM_BYTES);
+  t1 = rdtsc();
+  bench_record("mem.memset", NULL, BENCH_MEM_PASSES, bytes, t1 - t0);
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_MEM_PASSES; i++)
+    memcpy(mem_dst, mem_src, BENCH_MEM_BYTES);
+  t1 = rdtsc();
+  bench_record("mem.memcpy", NULL, BENCH_MEM_PASSES, bytes, t1 - t0);
+}
+
+/* ===== smp ===== */
+
+#define BENCH_SMP_CHUNKS 64
+
+typedef struct {
+  const uint8_t *data;
+  uint32_t chunk;
+  uint32_t sums[BENCH_SMP_CHUNKS];
+} bench_sum_job_t;
+
+static void bench_sum_chunk(void *arg, uint32_t index) {
+  bench_sum_job_t *job = arg;
+  const uint8_t *p = job->data + index * job->chunk;
+  uint32_t a = 1, b = 0; /* Adler-style running sums */
+  for (uint32_t pass = 0; pass < BENCH_MEM_PASSES; pass++) {
+    for (uint32_t i = 0; i < job->chunk; i++) {
+      a += p[i];
+      b += a;
+    }
+  }
+  job->sums[index] = a ^ b;
+}
+
+/* the same checksum workload on one CPU, then fanned out over all of them */
+static void bench_smp(void) {
+  static bench_sum_job_t job;
+  uint64_t bytes = (uint64_t)BENCH_MEM_BYTES * BENCH_MEM_PASSES;
+  uint64_t t0, t1;
+
+  job.data = mem_src;
+  job.chunk = BENCH_MEM_BYTES / BENCH_SMP_CHUNKS;
+
+  t0 = rdtsc();
+  for (uint32_t i = 0; i < BENCH_SMP_CHUNKS; i++)
+    bench_sum_chunk(&job, i);
+  t1 = rdtsc();
+  bench_record("smp.checksum_serial", NULL, BENCH_SMP_CHUNKS, bytes, t1 - t0);
+
+  t0 = rdtsc();
+  sched_parallel(bench_sum_chunk, &job, BENCH_SMP_CHUNKS);
+  t1 = rdtsc();
+  bench_record("smp.checksum_parallel", NULL, BENCH_SMP_CHUNKS, bytes,
+               t1 - t0);
+}
+
+int bench_run(const char *suite) {
+  int all = (suite == NULL || strcmp(suite, "all") == 0);
+  int matched = 0;
+
+  num_results = 0;
+  if (all || strcmp(suite, "mem") == 0) {
+    bench_mem();
+    matched = 1;
+  }
+  if (all || strcmp(suite, "disk") == 0) {
+    bench_disk();
+    matched = 1;
+  }
+  if (all || strcmp(suite, "fs") == 0) {
+    bench_fs();
+    matched = 1;
+  }
+  if (all || strcmp(suite, "smp") == 0) {
+    bench_smp();
+    matched = 1;
+  }
+  if (all || strcmp(suite, "vga") == 0) {
+    bench_vga(); /* clears the screen, so results are printed afterwards */
+    matched = 1;
+  }
+  if (!matched)
+    return -1;
+
+  char num[21];
+  vga_putstr("BENCH_BEGIN tsc_khz=", 0x0F);
+  vga_putstr(utoa(timer_tsc_khz(), num, 10), 0x0F);
+  vga_putchar('\n', 0x0F);
+  for (uint32_t i = 0; i < num_results; i++)
+    bench_print(&results[i]);
+  vga_putstr("BENCH_END\n", 0x0F);
+  return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#define BENCH_MAX_RESULTS 32
+#define BENCH_DISK_SECTORS 256 /* sectors per sequential pass (128 KiB) */
+#define BENCH_DISK_PASSES 8    /* whole-span requests per stream case */
+#define BENCH_DISK_SPAN 32768  /* random LBAs stay inside the 16 MiB fs area */
+#define BENCH_MEM_BYTES 65536
+#define BENCH_MEM_PASSES 64
+
+#define BENCH_NAME_LEN 32
+
+typedef struct {
+  char name[BENCH_NAME_LEN];
+  uint32_t ops;
+  uint64_t bytes; /* 0 when the op has no meaningful byte count */
+  uint64_t cycles;
+} bench_result_t;
+
+/* Run one suite ("disk", "fs", "vga", "mem") or every suite ("all" / NULL)
+ * and print one "BENCH name=... " line per measurement. Returns -1 for an
+ * unknown suite name. */
+int bench_run(const char *suite);
+
+#endif
@@ -0,0 +1,101 @@
+#include "bootinfo.h"
+#include "../clib/clib.h"
+#include "../multiboot.h"
+
+#define LOW_MEMORY_END 0x100000ull
+
+static void parse_multiboot1(const multiboot_info_t *mbi, bootinfo_t *info) {
+  if (mbi->flags & MULTIBOOT_INFO_CMDLINE)
+    info->cmdline = (const char *)(uintptr_t)mbi->cmdline;
+  if ((mbi->flags & MULTIBOOT_INFO_MODS) && mbi->mods_count > 0) {
+    const multiboot_module_t *mod =
+        (const multiboot_module_t *)(uintptr_t)mbi->mods_addr;
+    info->module_start = mod->mod_start;
+    info->module_end = mod->mod_end;
+  }
+  if (mbi->flags & MULTIBOOT_INFO_MEMORY)
+    info->ram_top = LOW_MEMORY_END + (uint64_t)mbi->mem_upper * 1024;
+}
+
+/* the end of the available range that 1 MiB is in, if there is one */
+static uint64_t mmap_ram_top(const multiboot2_tag_mmap_t *tag) {
+  const uint8_t *p = (const uint8_t *)(tag + 1);
+  const uint8_t *end = (const uint8_t *)tag + tag->size;
+  uint64_t top = 0;
+  if (tag->entry_size < sizeof(multiboot2_mmap_entry_t))
+    return 0;
+  for (; p + tag->entry_size <= end; p += tag->entry_size) {
+    const multiboot2_mmap_entry_t *e = (const multiboot2_mmap_entry_t *)p;
+    if (e->type == MULTIBOOT2_MEMORY_AVAILABLE && e->addr <= LOW_MEMORY_END &&
+        e->addr + e->len > LOW_MEMORY_END)
+      top = e->addr + e->len;
+  }
+  return top;
+}
+
+static void parse_framebuffer(const multiboot2_tag_framebuffer_t *tag,
+                              bootinfo_t *info) {
+  /* a text-mode "framebuffer" is the VGA buffer we already use */
+  if (tag->fb_type != MULTIBOOT2_FRAMEBUFFER_RGB ||
+      tag->size < sizeof(*tag))
+    return;
+  info->fb.addr = tag->addr;
+  info->fb.pitch = tag->pitch;
+  info->fb.width = tag->width;
+  info->fb.height = tag->height;
+  info->fb.bpp = tag->bpp;
+  info->fb.red_pos = tag->red_pos;
+  info->fb.green_pos = tag->green_pos;
+  info->fb.blue_pos = tag->blue_pos;
+}
+
+static void parse_multiboot2(const multiboot2_info_t *mbi, bootinfo_t *info) {
+  const uint8_t *p = (const uint8_t *)(mbi + 1);
+  const uint8_t *end = (const uint8_t *)mbi + mbi->total_size;
+  uint64_t mem_upper_top = 0;
+
+  info->multiboot2 = 1;
+  while (p + sizeof(multiboot2_tag_t) <= end) {
+    const multiboot2_tag_t *tag = (const multiboot2_tag_t *)p;
+    if (tag->type == MULTIBOOT2_TAG_END || tag->size < sizeof(*tag))
+      break;
+    switch (tag->type) {
+    case MULTIBOOT2_TAG_CMDLINE:
+      info->cmdline = ((const multiboot2_tag_string_t *)tag)->string;
+      break;
+    case MULTIBOOT2_TAG_MODULE:
+      if (!info->module_end) {
+        const multiboot2_tag_module_t *mod =
+            (const multiboot2_tag_module_t *)tag;
+        info->module_start = mod->mod_start;
+        info->module_end = mod->mod_end;
+      }
+      break;
+    case MULTIBOOT2_TAG_BASIC_MEMINFO:
+      mem_upper_top =
+          LOW_MEMORY_END +
+          (uint64_t)((const multiboot2_tag_meminfo_t *)tag)->mem_upper * 1024;
+      break;
+    case MULTIBOOT2_TAG_MMAP:
+      info->ram_top = mmap_ram_top((const multiboot2_tag_mmap_t *)tag);
+      break;
+    case MULTIBOOT2_TAG_FRAMEBUFFER:
+      parse_framebuffer((const multiboot2_tag_framebuffer_t *)tag, info);
+      break;
+    }
+    p += (tag->size + 7) & ~7u; /* tags start 8-byte aligned */
+  }
+  if (!info->ram_top)
+    info->ram_top = mem_upper_top;
+}
+
+int bootinfo_parse(uint32_t magic, uintptr_t addr, bootinfo_t *info) {
+  memset(info, 0, sizeof(*info));
+  if (magic == MULTIBOOT_BOOTLOADER_MAGIC)
+    parse_multiboot1((const multiboot_info_t *)addr, info);
+  else if (magic == MULTIBOOT2_BOOTLOADER_MAGIC)
+    parse_multiboot2((const multiboot2_info_t *)addr, info);
+  else
+    return -1;
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+#include <stdint.h>
+
+/* What the bootloader told us, from either Multiboot1 (QEMU -kernel) or
+ * Multiboot2 (GRUB's multiboot2 command) info. Pointers and addresses are
+ * physical, which is where everything below 4 GiB is mapped. */
+
+typedef struct {
+  uint64_t addr; /* 0: none, or not a direct-colour framebuffer */
+  uint32_t pitch; /* bytes per line */
+  uint32_t width, height;
+  uint8_t bpp;
+  uint8_t red_pos, green_pos, blue_pos; /* bit offsets within a pixel */
+} bootinfo_fb_t;
+
+typedef struct {
+  int multiboot2;
+  const char *cmdline; /* NULL if none */
+  uint32_t module_start, module_end; /* the first module; both 0 if none */
+  /* End of the RAM that runs on from 1 MiB; 0 if the loader did not say.
+   * From the memory map when there is one, else from mem_upper. */
+  uint64_t ram_top;
+  bootinfo_fb_t fb;
+} bootinfo_t;
+
+/* Fill info from the magic and info address the loader left in EAX and
+ * EBX; -1, with info empty, if the magic is neither loader's. */
+int bootinfo_parse(uint32_t magic, uintptr_t addr, bootinfo_t *info);
+
+#endif
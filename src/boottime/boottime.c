@@ -0,0 +1,39 @@
+#include "boottime.h"
+#include "../clib/clib.h"
+#include "../timer/timer.h"
+#include "../vga/vga.h"
+
+extern uint64_t boot_tsc; /* entry.asm */
+
+static const char *phases[BOOTTIME_MAX_PHASES];
+static uint64_t stamps[BOOTTIME_MAX_PHASES];
+static uint32_t count;
+
+void boottime_mark(const char *phase) {
+  if (count == BOOTTIME_MAX_PHASES)
+    return;
+  stamps[count] = rdtsc();
+  phases[count++] = phase;
+}
+
+static void put_us(uint64_t us, uint32_t width) {
+  char num[21];
+  utoa(us, num, 10);
+  for (uint32_t n = strlen(num); n < width; n++)
+    vga_putchar(' ', 0x0F);
+  vga_putstr(num, 0x0F);
+  vga_putstr(" us", 0x0F);
+}
+
+void boottime_print(void) {
+  uint64_t prev = boot_tsc;
+  vga_putstr("    elapsed        took  phase\n", 0x0A);
+  for (uint32_t i = 0; i < count; i++) {
+    put_us(timer_cycles_to_us(stamps[i] - boot_tsc), 8);
+    put_us(timer_cycles_to_us(stamps[i] - prev), 9);
+    vga_putstr("  ", 0x0F);
+    vga_putstr(phases[i], 0x0F);
+    vga_putchar('\n', 0x0F);
+    prev = stamps[i];
+  }
+}
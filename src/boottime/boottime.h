@@ -0,0 +1,16 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include <stdint.h>
+
+/* Boot timeline: entry.asm stamps the TSC at the multiboot handoff, and
+ * kernel_main stamps the end of each boot phase after it. The stamps are
+ * raw cycles, so phases before timer_init calibrates the TSC are timed
+ * too; they are converted when printed. */
+
+#define BOOTTIME_MAX_PHASES 16
+
+void boottime_mark(const char *phase); /* phase has just finished */
+void boottime_print(void);             /* each phase since handoff, and its length */
+
+#endif
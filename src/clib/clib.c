@@ -29,6 +29,26 @@ void outb(unsigned short port, unsigned char val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+uint16_t inw(unsigned short port) {
+    uint16_t ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+void outw(unsigned short port, uint16_t val) {
+    __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+uint32_t inl(unsigned short port) {
+    uint32_t ret;
+    __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+void outl(unsigned short port, uint32_t val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
 
 int strncmp(const char *s1, const char *s2, unsigned int n) {
     for (unsigned int i = 0; i < n; i++) {
@@ -51,19 +71,130 @@ char *strncpy(char *dest, const char *src, unsigned int n) {
 }
 
 
+/* memcpy, memset and memcmp go a machine word at a time (4 bytes, or 8 in
+ * the x86_64 build) once the pointers allow it; the block cache and the fs
+ * move whole sectors through them. */
+typedef uintptr_t __attribute__((may_alias)) word_t;
+#define WORD_MASK (sizeof(word_t) - 1)
+
 void *memcpy(void *dest, const void *src, size_t n) {
     uint8_t *d = (uint8_t*)dest;
     const uint8_t *s = (const uint8_t*)src;
-    for (size_t i = 0; i < n; i++) {
-        d[i] = s[i];
+    if ((((uintptr_t)d ^ (uintptr_t)s) & WORD_MASK) == 0) {
+        for (; n && ((uintptr_t)d & WORD_MASK); n--)
+            *d++ = *s++;
+        for (; n >= sizeof(word_t); n -= sizeof(word_t)) {
+            *(word_t*)d = *(const word_t*)s;
+            d += sizeof(word_t);
+            s += sizeof(word_t);
+        }
     }
+    for (; n; n--)
+        *d++ = *s++;
     return dest;
 }
 
 void *memset(void *dest, int value, size_t n) {
     uint8_t *d = (uint8_t*)dest;
-    for (size_t i = 0; i < n; i++) {
-        d[i] = (uint8_t)value;
+    word_t pattern = ((word_t)-1 / 0xFF) * (uint8_t)value;
+    for (; n && ((uintptr_t)d & WORD_MASK); n--)
+        *d++ = (uint8_t)value;
+    for (; n >= sizeof(word_t); n -= sizeof(word_t)) {
+        *(word_t*)d = pattern;
+        d += sizeof(word_t);
     }
+    for (; n; n--)
+        *d++ = (uint8_t)value;
     return dest;
-}
\ No newline at end of file
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *x = (const uint8_t*)a;
+    const uint8_t *y = (const uint8_t*)b;
+    /* skip the equal words; the bytes of the first unequal one decide */
+    if (((uintptr_t)x & WORD_MASK) == 0 && ((uintptr_t)y & WORD_MASK) == 0) {
+        while (n >= sizeof(word_t) && *(const word_t*)x == *(const word_t*)y) {
+            x += sizeof(word_t);
+            y += sizeof(word_t);
+            n -= sizeof(word_t);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] != y[i])
+            return (int)x[i] - (int)y[i];
+    }
+    return 0;
+}
+
+/* Eight (or four) bytes per step: a word XORed with c repeated has a zero
+ * byte where c is, and (x - 0x01..01) & ~x & 0x80..80 is nonzero exactly
+ * when x has a zero byte. The word found is then searched a byte at a
+ * time. grep filters a whole buffer through this before comparing. */
+void *memchr(const void *src, int c, size_t n) {
+    const uint8_t *s = (const uint8_t*)src;
+    const word_t ones = (word_t)-1 / 0xFF;
+    word_t pattern = ones * (uint8_t)c;
+    for (; n && ((uintptr_t)s & WORD_MASK); n--, s++) {
+        if (*s == (uint8_t)c)
+            return (void*)s;
+    }
+    for (; n >= sizeof(word_t); n -= sizeof(word_t), s += sizeof(word_t)) {
+        word_t x = *(const word_t*)s ^ pattern;
+        if ((x - ones) & ~x & ones << 7)
+            break;
+    }
+    for (; n; n--, s++) {
+        if (*s == (uint8_t)c)
+            return (void*)s;
+    }
+    return NULL;
+}
+
+static uint64_t udivmod64(uint64_t n, uint64_t d, uint64_t *rem) {
+    uint64_t q = 0, r = 0;
+    if (d == 0) {
+        if (rem)
+            *rem = 0;
+        return 0;
+    }
+    for (int i = 63; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= (uint64_t)1 << i;
+        }
+    }
+    if (rem)
+        *rem = r;
+    return q;
+}
+
+uint64_t __udivdi3(uint64_t n, uint64_t d) {
+    if (d != 0 && (n >> 32) == 0 && (d >> 32) == 0)
+        return (uint32_t)n / (uint32_t)d;
+    return udivmod64(n, d, NULL);
+}
+
+uint64_t __umoddi3(uint64_t n, uint64_t d) {
+    uint64_t r;
+    if (d != 0 && (n >> 32) == 0 && (d >> 32) == 0)
+        return (uint32_t)n % (uint32_t)d;
+    udivmod64(n, d, &r);
+    return r;
+}
+
+char *utoa(uint64_t value, char *buf, unsigned int base) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[65];
+    int i = 0, j = 0;
+    if (base < 2 || base > 16)
+        base = 10;
+    do {
+        tmp[i++] = digits[value % base];
+        value /= base;
+    } while (value);
+    while (i > 0)
+        buf[j++] = tmp[--i];
+    buf[j] = '\0';
+    return buf;
+}
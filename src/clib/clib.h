@@ -8,7 +8,24 @@ void outb(unsigned short port, unsigned char val);
 int strcmp(const char *s1, const char *s2);
 size_t strlen(const char *s);
 unsigned char inb(unsigned short port);
+void outw(unsigned short port, uint16_t val);
+uint16_t inw(unsigned short port);
+void outl(unsigned short port, uint32_t val);
+uint32_t inl(unsigned short port);
 int strncmp(const char *s1, const char *s2, unsigned int n);
 char *strncpy(char *dest, const char *src, unsigned int n);
+void *memcpy(void *dest, const void *src, size_t n);
+void *memset(void *dest, int value, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+void *memchr(const void *s, int c, size_t n);
+
+/* unsigned to string in the given base (2..16); buf needs 65 bytes for
+ * base 2, 21 for base 10. Returns buf. */
+char *utoa(uint64_t value, char *buf, unsigned int base);
+
+/* 64-bit division helpers the compiler emits calls to on i386 (we don't
+ * link libgcc) */
+uint64_t __udivdi3(uint64_t n, uint64_t d);
+uint64_t __umoddi3(uint64_t n, uint64_t d);
 
 #endif
@@ -1,13 +1,40 @@
 #include "commands.h"
+#include "../bcache/bcache.h"
+#include "../bench/bench.h"
+#include "../boottime/boottime.h"
 #include "../clib/clib.h"
+#include "../disk/disk.h"
+#include "../exec/exec.h"
 #include "../fs/fs.h"
 #include "../kernel.h"
+#include "../prof/prof.h"
+#include "../sched/sched.h"
+#include "../search/search.h"
+#include "../serial/serial.h"
+#include "../shell/shell.h"
+#include "../trace/trace.h"
 #include "../vga/vga.h"
 
 void cmd_hello() { vga_putstr("Hello, user!\n", color_green_on_black()); }
 
 void cmd_clear() { vga_clear_screen(); }
 
+/* argv[first..] joined with single spaces; returns the length */
+static int join_args(int argc, char **argv, int first, char *out, int cap) {
+  int pos = 0;
+  for (int i = first; i < argc && pos < cap - 1; i++) {
+    int j = 0;
+    while (argv[i][j] && pos < cap - 1) {
+      out[pos++] = argv[i][j++];
+    }
+    if (i < argc - 1 && pos < cap - 1) {
+      out[pos++] = ' ';
+    }
+  }
+  out[pos] = '\0';
+  return pos;
+}
+
 void cmd_write(int argc, char **argv) {
   if (argc < 3) {
     vga_putstr("Usage: write <filename> <text>\n", 0x0E);
@@ -16,17 +43,7 @@ void cmd_write(int argc, char **argv) {
 
   // Concatenate all arguments after filename into content
   char content[512];
-  int pos = 0;
-  for (int i = 2; i < argc && pos < 511; i++) {
-    int j = 0;
-    while (argv[i][j] && pos < 511) {
-      content[pos++] = argv[i][j++];
-    }
-    if (i < argc - 1 && pos < 511) {
-      content[pos++] = ' ';
-    }
-  }
-  content[pos] = '\0';
+  int pos = join_args(argc, argv, 2, content, sizeof(content));
 
   int result = fs_write_file(argv[1], (uint8_t *)content, pos);
   if (result < 0) {
@@ -36,6 +53,103 @@ void cmd_write(int argc, char **argv) {
   }
 }
 
+void cmd_append(int argc, char **argv) {
+  if (argc < 3) {
+    vga_putstr("Usage: append <filename> <text>\n", 0x0E);
+    return;
+  }
+
+  // one line per call, like >> in a log
+  char content[512];
+  int pos = join_args(argc, argv, 2, content, sizeof(content) - 1);
+  content[pos++] = '\n';
+
+  if (fs_append_file(argv[1], (uint8_t *)content, pos) < 0)
+    vga_putstr("append: error writing file\n", 0x0C);
+}
+
+void cmd_fallocate(int argc, char **argv) {
+  uint32_t size = 0;
+  const char *p = argc == 3 ? argv[2] : "";
+  if (!*p) {
+    vga_putstr("Usage: fallocate <filename> <bytes>\n", 0x0E);
+    return;
+  }
+  for (; *p; p++) {
+    if (*p < '0' || *p > '9' || size > (0xFFFFFFFFu - 9) / 10) {
+      vga_putstr("fallocate: bad size\n", 0x0C);
+      return;
+    }
+    size = size * 10 + (uint32_t)(*p - '0');
+  }
+
+  int result = fs_fallocate(argv[1], size);
+  if (result == -2)
+    vga_putstr("fallocate: no contiguous space\n", 0x0C);
+  else if (result < 0)
+    vga_putstr("fallocate: error\n", 0x0C);
+}
+
+void cmd_compress(int argc, char **argv) {
+  int on = argc < 3 || strcmp(argv[2], "on") == 0;
+  if (argc < 2 || argc > 3 || (argc == 3 && !on && strcmp(argv[2], "off"))) {
+    vga_putstr("Usage: compress <file|dir> [on|off]\n", 0x0E);
+    return;
+  }
+
+  int result = fs_set_compress(argv[1], on);
+  if (result == -1)
+    vga_putstr("compress: no such file or directory\n", 0x0C);
+  else if (result == -3)
+    vga_putstr("compress: needs a version 2 filesystem (mkfs)\n", 0x0C);
+  else if (result < 0)
+    vga_putstr("compress: error\n", 0x0C);
+  else if (fs_is_directory(argv[1]) == 1)
+    vga_putstr(on ? "compress: new files in it will be compressed\n"
+                  : "compress: new files in it will not be compressed\n",
+               0x0A);
+  else
+    vga_putstr(on ? "compress: takes effect on the next write\n"
+                  : "compress: off from the next write\n",
+               0x0A);
+}
+
+void cmd_dedup(int argc, char **argv) {
+  char num[21];
+
+  if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+    fs_dedup_stats_t st = fs_dedup_stats();
+    /* logical over physical bytes, with two decimals */
+    uint64_t physical = st.bytes - st.deduped;
+    uint64_t ratio = physical ? st.bytes * 100 / physical : 100;
+    vga_putstr(fs_dedup_enabled() ? "dedup: on, ratio " : "dedup: off, ratio ",
+               0x0A);
+    vga_putstr(utoa(ratio / 100, num, 10), 0x0A);
+    vga_putchar('.', 0x0A);
+    vga_putchar('0' + (ratio / 10) % 10, 0x0A);
+    vga_putchar('0' + ratio % 10, 0x0A);
+    vga_putstr(", ", 0x0A);
+    vga_putstr(utoa(st.hits, num, 10), 0x0A);
+    vga_putstr(" hits, ", 0x0A);
+    vga_putstr(utoa(st.collisions, num, 10), 0x0A);
+    vga_putstr(" collisions, ", 0x0A);
+    vga_putstr(utoa(st.sectors_saved, num, 10), 0x0A);
+    vga_putstr(" sector writes saved\n", 0x0A);
+    return;
+  }
+  int on = argc == 2 && strcmp(argv[1], "on") == 0;
+  if (argc != 2 || (!on && strcmp(argv[1], "off"))) {
+    vga_putstr("Usage: dedup on|off|stats\n", 0x0E);
+    return;
+  }
+  if (fs_set_dedup(on) == -3)
+    vga_putstr("dedup: needs a version 2 filesystem (mkfs)\n", 0x0C);
+  else
+    vga_putstr(on ? "dedup: identical files will share blocks\n"
+                  : "dedup: off\n",
+               0x0A);
+}
+
 void cmd_echo(int argc, char *argv[]) {
   int newline = 1;
   int start = 1;
@@ -89,12 +203,19 @@ void cmd_touch(int argc, char *argv[]) {
 }
 
 void cmd_cat(int argc, char **argv) {
+  char buffer[FS_SECTOR_SIZE];
   if (argc < 2) {
-    vga_putstr("Usage: cat <filename>\n", 0x0E);
+    /* in a pipeline: copy what the command before printed */
+    int n;
+    while ((n = shell_read_input(buffer, sizeof(buffer))) > 0) {
+      for (int i = 0; i < n; i++)
+        vga_putchar(buffer[i], 0x0F);
+    }
+    if (n < 0)
+      vga_putstr("Usage: cat <filename>\n", 0x0E);
     return;
   }
 
-  char buffer[FS_BLOCK_SIZE];
   int read_bytes = fs_read_file(argv[1], (uint8_t *)buffer, sizeof(buffer));
 
   if (read_bytes < 0) {
@@ -110,10 +231,191 @@ void cmd_cat(int argc, char **argv) {
   vga_putchar('\n', 0x0F);
 }
 
+/* ===== grep and find ===== */
+
+#define GREP_BUF 8192
+
+static char grep_buf[GREP_BUF + 1]; /* +1: room to end the last line */
+
+/* up to len bytes of name from offset on, or of the pipeline's input when
+ * name is NULL (-1 if there is none) */
+static int grep_read(const char *name, uint32_t offset, char *buf,
+                     uint32_t len) {
+  if (!name)
+    return shell_read_input(buf, len);
+  return fs_read_at(name, offset, (uint8_t *)buf, len);
+}
+
+/* Print the lines of name that hold the pattern, after label if there is
+ * one. The file streams through grep_buf: each fill is searched up to its
+ * last whole line, and the part line after that is carried over to the
+ * front for the next. A line longer than the buffer is searched in
+ * buffer-sized pieces. Returns the lines printed, or -1 if name can't be
+ * read. */
+static int grep_file(const search_t *s, const char *name, const char *label) {
+  uint32_t offset = 0, keep = 0;
+  int matches = 0;
+  while (1) {
+    int n = grep_read(name, offset, grep_buf + keep, GREP_BUF - keep);
+    if (n < 0)
+      return -1;
+    offset += (uint32_t)n;
+    int eof = (uint32_t)n < GREP_BUF - keep;
+    char *end = grep_buf + keep + n;
+    char *stop = end;
+    if (!eof) {
+      while (stop > grep_buf && stop[-1] != '\n')
+        stop--;
+      if (stop == grep_buf)
+        stop = end;
+    }
+
+    /* p is always at the start of a line */
+    char *p = grep_buf;
+    const char *hit;
+    while ((hit = search_find(s, p, (uint32_t)(stop - p)))) {
+      char *line = (char *)hit;
+      while (line > p && line[-1] != '\n')
+        line--;
+      char *nl = memchr(hit, '\n', (size_t)(stop - hit));
+      char *line_end = nl ? nl : stop;
+      char saved = *line_end;
+      *line_end = '\0';
+      if (label) {
+        vga_putstr(label, 0x0B);
+        vga_putchar(':', 0x0F);
+      }
+      vga_putstr(line, 0x0F);
+      vga_putchar('\n', 0x0F);
+      *line_end = saved;
+      matches++;
+      p = nl ? nl + 1 : stop;
+    }
+
+    keep = (uint32_t)(end - stop);
+    for (uint32_t i = 0; i < keep; i++)
+      grep_buf[i] = stop[i];
+    if (eof)
+      return matches;
+  }
+}
+
+/* dir as a full path without a trailing /, "" for the root */
+static void resolve_dir(const char *dir, char full[FS_FILENAME_LEN * 2]) {
+  if (strcmp(dir, ".") == 0) {
+    dir = fs_get_current_dir();
+    strncpy(full, strcmp(dir, "/") == 0 ? "" : dir, FS_FILENAME_LEN * 2);
+  } else {
+    fs_resolve_path(dir, full);
+  }
+  size_t n = strlen(full);
+  while (n > 0 && full[n - 1] == '/')
+    full[--n] = '\0';
+}
+
+/* whether name, a full path, is somewhere below dir */
+static int in_tree(const char *name, const char *dir) {
+  size_t n = strlen(dir);
+  return n == 0 || (strncmp(name, dir, n) == 0 && name[n] == '/');
+}
+
+static int is_tree(const char *dir) {
+  char full[FS_FILENAME_LEN * 2 + 1];
+  full[0] = '/';
+  resolve_dir(dir, full + 1);
+  return full[1] == '\0' || fs_is_directory(full) == 1;
+}
+
+/* every file below dir, labelled with its path */
+static void grep_tree(const search_t *s, const char *dir) {
+  char full[FS_FILENAME_LEN * 2], path[FS_FILENAME_LEN + 2];
+  fs_dirent_t d;
+  uint32_t cursor = 0;
+  resolve_dir(dir, full);
+  while (fs_next_entry(&cursor, &d) == 0) {
+    if (d.is_directory || !in_tree(d.name, full))
+      continue;
+    path[0] = '/';
+    strncpy(path + 1, d.name, FS_FILENAME_LEN + 1);
+    grep_file(s, path, path);
+  }
+}
+
+void cmd_grep(int argc, char **argv) {
+  search_t s;
+  if (argc < 2 || search_init(&s, argv[1]) != 0) {
+    vga_putstr("Usage: grep <text> [file|dir ...]\n", 0x0E);
+    return;
+  }
+  /* no files: the input of a pipeline */
+  if (argc == 2) {
+    if (grep_file(&s, NULL, NULL) < 0)
+      vga_putstr("Usage: grep <text> [file|dir ...]\n", 0x0E);
+    return;
+  }
+  for (int i = 2; i < argc; i++) {
+    if (is_tree(argv[i])) {
+      grep_tree(&s, argv[i]);
+    } else if (grep_file(&s, argv[i], argc > 3 ? argv[i] : NULL) < 0) {
+      vga_putstr("grep: ", 0x0C);
+      vga_putstr(argv[i], 0x0C);
+      vga_putstr(": not found\n", 0x0C);
+    }
+  }
+}
+
+/* find [dir] [pattern]: each entry below dir (default here) whose last
+ * path component matches pattern (default all), directories with a
+ * trailing / */
+void cmd_find(int argc, char **argv) {
+  char full[FS_FILENAME_LEN * 2];
+  const char *dir = ".", *pattern = "*";
+  fs_dirent_t d;
+  uint32_t cursor = 0;
+
+  if (argc > 3) {
+    vga_putstr("Usage: find [dir] [pattern]\n", 0x0E);
+    return;
+  }
+  if (argc == 3) {
+    dir = argv[1];
+    pattern = argv[2];
+  } else if (argc == 2) {
+    if (is_tree(argv[1]))
+      dir = argv[1];
+    else
+      pattern = argv[1];
+  }
+  if (!is_tree(dir)) {
+    vga_putstr("find: not a directory\n", 0x0C);
+    return;
+  }
+
+  resolve_dir(dir, full);
+  while (fs_next_entry(&cursor, &d) == 0) {
+    if (!in_tree(d.name, full))
+      continue;
+    const char *base = d.name;
+    for (const char *p = d.name; *p; p++) {
+      if (*p == '/')
+        base = p + 1;
+    }
+    if (!search_glob(pattern, base))
+      continue;
+    vga_putchar('/', 0x0F);
+    vga_putstr(d.name, d.is_directory ? 0x0B : 0x0F);
+    if (d.is_directory)
+      vga_putchar('/', 0x0B);
+    vga_putchar('\n', 0x0F);
+  }
+}
+
 int cmd_bye(int argc, char *argv[]) {
   (void)argc;
   (void)argv;
   vga_putstr("Shutting down...\n", color_green_on_black());
+  if (fs_flush() != 0)
+    vga_putstr("bye: flushing the disk cache failed\n", 0x0C);
   while (1) {
     __asm__("hlt");
   }
@@ -174,6 +476,63 @@ void cmd_rm(int argc, char *argv[]) {
   }
 }
 
+/* cp and mv into a directory keep the source's last path component */
+static const char *target_path(const char *src, const char *dst, char *buf,
+                               uint32_t cap) {
+  if (fs_is_directory(dst) != 1)
+    return dst;
+  const char *base = src;
+  for (const char *p = src; *p; p++) {
+    if (*p == '/')
+      base = p + 1;
+  }
+  uint32_t n = 0;
+  for (const char *p = dst; *p && n < cap - 1; p++)
+    buf[n++] = *p;
+  if (n > 0 && buf[n - 1] != '/' && n < cap - 1)
+    buf[n++] = '/';
+  for (const char *p = base; *p && n < cap - 1; p++)
+    buf[n++] = *p;
+  buf[n] = '\0';
+  return buf;
+}
+
+void cmd_cp(int argc, char *argv[]) {
+  char path[FS_FILENAME_LEN * 2];
+  if (argc != 3) {
+    vga_putstr("Usage: cp <source> <dest>\n", 0x0E);
+    return;
+  }
+
+  int result = fs_copy_file(argv[1], target_path(argv[1], argv[2], path,
+                                                 sizeof(path)));
+  if (result == -1)
+    vga_putstr("cp: file not found\n", 0x0C);
+  else if (result == -3)
+    vga_putstr("cp: cannot copy a directory\n", 0x0C);
+  else if (result < 0)
+    vga_putstr("cp: error\n", 0x0C);
+}
+
+void cmd_mv(int argc, char *argv[]) {
+  char path[FS_FILENAME_LEN * 2];
+  if (argc != 3) {
+    vga_putstr("Usage: mv <source> <dest>\n", 0x0E);
+    return;
+  }
+
+  int result =
+      fs_rename(argv[1], target_path(argv[1], argv[2], path, sizeof(path)));
+  if (result == -1)
+    vga_putstr("mv: file not found\n", 0x0C);
+  else if (result == -2)
+    vga_putstr("mv: destination exists\n", 0x0C);
+  else if (result == -3)
+    vga_putstr("mv: bad destination name\n", 0x0C);
+  else if (result < 0)
+    vga_putstr("mv: error\n", 0x0C);
+}
+
 void cmd_cd(int argc, char *argv[]) {
   if (argc < 2) {
     // No argument - go to root
@@ -194,3 +553,246 @@ void cmd_pwd(void) {
   vga_putstr(fs_get_current_dir(), 0x0F);
   vga_putchar('\n', 0x0F);
 }
+
+void cmd_sync(void) {
+  bcache_stats_t before = bcache_stats();
+  char num[21];
+
+  if (fs_flush() != 0) {
+    vga_putstr("sync: write error\n", 0x0C);
+    return;
+  }
+  vga_putstr("sync: ", 0x0A);
+  vga_putstr(utoa(before.dirty, num, 10), 0x0A);
+  vga_putstr(" dirty sectors written\n", 0x0A);
+}
+
+void cmd_fstrim(void) {
+  char num[21];
+
+  if (!disk_info()->trim) {
+    vga_putstr("fstrim: disk does not support TRIM\n", 0x0E);
+    return;
+  }
+  int trimmed = fs_trim();
+  if (trimmed < 0) {
+    vga_putstr("fstrim: discard failed\n", 0x0C);
+    return;
+  }
+  vga_putstr("fstrim: ", 0x0A);
+  vga_putstr(utoa((uint32_t)trimmed, num, 10), 0x0A);
+  vga_putstr(" free blocks trimmed\n", 0x0A);
+}
+
+void cmd_disks(void) {
+  char num[21];
+  uint32_t members, chunk;
+  disk_layout_t layout = disk_layout(&members, &chunk);
+
+  for (int i = 0; i < disk_device_count(); i++) {
+    const disk_info_t *info = disk_device_info(i);
+    vga_putstr(i < (int)members ? "  * " : "    ", 0x0F);
+    vga_putstr(utoa((uint32_t)i, num, 10), 0x0F);
+    vga_putstr(": ", 0x0F);
+    vga_putstr(info->model, 0x0F);
+    vga_putstr(", ", 0x0F);
+    vga_putstr(utoa(info->sectors / 2048, num, 10), 0x0F);
+    vga_putstr(" MiB\n", 0x0F);
+  }
+  vga_putstr(disk_layout_name(layout), 0x0A);
+  if (layout == DISK_RAID0) {
+    vga_putstr(", ", 0x0A);
+    vga_putstr(utoa(chunk / 2, num, 10), 0x0A);
+    vga_putstr(" KiB chunks", 0x0A);
+  }
+  vga_putstr(": ", 0x0A);
+  vga_putstr(utoa(disk_info()->sectors / 2048, num, 10), 0x0A);
+  vga_putstr(" MiB usable (* = member)\n", 0x0A);
+}
+
+void cmd_boottime(void) { boottime_print(); }
+
+int cmd_exec(int argc, char *argv[]) {
+  char num[21];
+  int status;
+  int rc = exec_run(argc, argv, &status);
+
+  if (rc == EXEC_NOT_FOUND)
+    return -1;
+  if (rc == EXEC_BAD_FORMAT) {
+    vga_putstr(argv[0], 0x0C);
+    vga_putstr(": not an executable\n", 0x0C);
+  } else if (rc == EXEC_BUSY) {
+    vga_putstr("exec: a program is already running\n", 0x0C);
+  } else if (status != 0) {
+    vga_putstr(argv[0], 0x0E);
+    vga_putstr(": exit status ", 0x0E);
+    if (status < 0) {
+      vga_putstr("-", 0x0E);
+      status = -status;
+    }
+    vga_putstr(utoa((uint32_t)status, num, 10), 0x0E);
+    vga_putchar('\n', 0x0E);
+  }
+  return 0;
+}
+
+void cmd_mkfs(int argc, char *argv[]) {
+  uint32_t block_size = argc > 1 ? 0 : FS_DEFAULT_BLOCK_SIZE;
+  char num[21];
+
+  for (const char *p = argc > 1 ? argv[1] : ""; *p; p++) {
+    if (*p < '0' || *p > '9' || block_size > FS_MAX_BLOCK_SIZE) {
+      block_size = 0;
+      break;
+    }
+    block_size = block_size * 10 + (uint32_t)(*p - '0');
+  }
+  if (fs_format(block_size) != 0) {
+    vga_putstr("Usage: mkfs [block_size]  (power of two, 512 to 65536)\n",
+               0x0E);
+    return;
+  }
+  if (fs_flush() != 0) {
+    vga_putstr("mkfs: write error\n", 0x0C);
+    return;
+  }
+  vga_putstr("mkfs: formatted with ", 0x0A);
+  vga_putstr(utoa(fs_block_size(), num, 10), 0x0A);
+  vga_putstr("-byte blocks\n", 0x0A);
+}
+
+void cmd_bench(int argc, char *argv[]) {
+  if (bench_run(argc > 1 ? argv[1] : NULL) < 0) {
+    vga_putstr("Usage: bench [disk|fs|vga|mem|smp|all]\n", 0x0E);
+  }
+}
+
+/* trace and prof dumps go to COM1, or are staged here and written as one
+ * file */
+#define DUMP_BUF_SIZE (512 * 1024)
+
+static uint8_t dump_buf[DUMP_BUF_SIZE];
+
+typedef struct {
+  uint32_t len;
+  int truncated;
+} dump_ctx_t;
+
+typedef void (*dump_fn_t)(trace_emit_fn emit, void *ctx);
+
+static void dump_emit_serial(const char *text, uint32_t len, void *ctx) {
+  (void)ctx;
+  serial_write(text, len);
+}
+
+static void dump_emit_file(const char *text, uint32_t len, void *ctx) {
+  dump_ctx_t *f = (dump_ctx_t *)ctx;
+  if (f->len + len > DUMP_BUF_SIZE) {
+    f->truncated = 1;
+    return;
+  }
+  memcpy(dump_buf + f->len, text, len);
+  f->len += len;
+}
+
+static void dump_output(const char *tag, const char *file, dump_fn_t fn) {
+  if (file) {
+    dump_ctx_t f = {0, 0};
+    fn(dump_emit_file, &f);
+    vga_putstr(tag, 0x0F);
+    if (f.truncated) {
+      vga_putstr(": dump too large for file, use serial\n", 0x0C);
+    } else if (fs_write_file(file, dump_buf, f.len) < 0) {
+      vga_putstr(": error writing file\n", 0x0C);
+    } else {
+      vga_putstr(": written to file\n", 0x0A);
+    }
+  } else if (!serial_ready()) {
+    vga_putstr(tag, 0x0F);
+    vga_putstr(": no serial port\n", 0x0C);
+  } else {
+    fn(dump_emit_serial, NULL);
+    vga_putstr(tag, 0x0F);
+    vga_putstr(": dumped to serial\n", 0x0A);
+  }
+}
+
+void cmd_trace(int argc, char *argv[]) {
+  char num[21];
+
+  if (argc < 2) {
+    vga_putstr("Usage: trace on|off|clear|status|dump [file]\n", 0x0E);
+    return;
+  }
+
+  if (strcmp(argv[1], "on") == 0) {
+    trace_start();
+  } else if (strcmp(argv[1], "off") == 0) {
+    trace_stop();
+  } else if (strcmp(argv[1], "clear") == 0) {
+    trace_clear();
+  } else if (strcmp(argv[1], "status") == 0) {
+    vga_putstr(trace_enabled ? "trace: on, " : "trace: off, ", 0x0F);
+    vga_putstr(utoa(trace_count(), num, 10), 0x0F);
+    vga_putstr(" events\n", 0x0F);
+  } else if (strcmp(argv[1], "dump") == 0) {
+    int was_enabled = trace_enabled;
+    trace_stop(); /* keep the dump itself out of the buffer */
+    dump_output("trace", argc > 2 ? argv[2] : NULL, trace_dump_json);
+    if (was_enabled)
+      trace_start();
+  } else {
+    vga_putstr("Usage: trace on|off|clear|status|dump [file]\n", 0x0E);
+  }
+}
+
+void cmd_prof(int argc, char *argv[]) {
+  char num[21];
+
+  if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+    int backtrace = argc > 2 && strcmp(argv[2], "-g") == 0;
+    prof_start(backtrace);
+    vga_putstr("prof: sampling\n", 0x0A);
+  } else if (argc >= 2 && strcmp(argv[1], "stop") == 0) {
+    prof_stop();
+    vga_putstr("prof: stopped, ", 0x0F);
+    vga_putstr(utoa(prof_samples(), num, 10), 0x0F);
+    vga_putstr(" samples\n", 0x0F);
+  } else if (argc >= 2 && strcmp(argv[1], "dump") == 0) {
+    int was_running = prof_running();
+    prof_stop();
+    dump_output("prof", argc > 2 ? argv[2] : NULL, prof_dump);
+    if (was_running)
+      vga_putstr("prof: stopped for dump\n", 0x0E);
+  } else {
+    vga_putstr("Usage: prof start [-g] | stop | dump [file]\n", 0x0E);
+  }
+}
+
+static void put_padded(const char *s, uint32_t width) {
+  uint32_t len = strlen(s);
+  vga_putstr(s, 0x0F);
+  while (len++ < width)
+    vga_putchar(' ', 0x0F);
+}
+
+void cmd_ps(void) {
+  static const char *const states[] = {"unused",  "ready", "running",
+                                       "blocked", "sleep", "dead"};
+  static const char *const prios[] = {"idle", "low", "normal", "high"};
+  thread_t list[SCHED_MAX_THREADS];
+  char num[21];
+
+  uint32_t n = sched_list(list, SCHED_MAX_THREADS);
+  vga_putstr("TID  CPU  PRIO    STATE    TICKS   NAME\n", 0x0F);
+  for (uint32_t i = 0; i < n; i++) {
+    put_padded(utoa(list[i].id, num, 10), 5);
+    put_padded(utoa(list[i].cpu, num, 10), 5);
+    put_padded(prios[list[i].priority], 8);
+    put_padded(states[list[i].state], 9);
+    put_padded(utoa(list[i].run_ticks, num, 10), 8);
+    vga_putstr(list[i].name, 0x0F);
+    vga_putchar('\n', 0x0F);
+  }
+}
@@ -8,13 +8,35 @@ int cmd_bye(int argc, char *argv[]);
 void cmd_ls(void);
 void cmd_touch(int argc, char *argv[]);
 void cmd_cat(int argc, char *argv[]);
+/* grep <text> [file|dir ...]; with no files, the input of a pipeline */
+void cmd_grep(int argc, char *argv[]);
+void cmd_find(int argc, char *argv[]);
 
 /* FileSystem related commands */
 void cmd_mkdir(int argc, char *argv[]);
 void cmd_rmdir(int argc, char *argv[]);
 void cmd_rm(int argc, char *argv[]);
+void cmd_cp(int argc, char *argv[]);
+void cmd_mv(int argc, char *argv[]);
 void cmd_write(int argc, char **argv);
+void cmd_append(int argc, char **argv);
+void cmd_fallocate(int argc, char **argv);
+void cmd_compress(int argc, char **argv);
+void cmd_dedup(int argc, char **argv);
 void cmd_cd(int argc, char *argv[]);
 void cmd_pwd(void);
+void cmd_mkfs(int argc, char *argv[]);
+/* run argv[0] as a program from the fs; -1 if there is no such file */
+int cmd_exec(int argc, char *argv[]);
+
+/* Diagnostics */
+void cmd_bench(int argc, char *argv[]);
+void cmd_trace(int argc, char *argv[]);
+void cmd_prof(int argc, char *argv[]);
+void cmd_ps(void);
+void cmd_sync(void);
+void cmd_fstrim(void);
+void cmd_disks(void);
+void cmd_boottime(void);
 
 #endif
@@ -0,0 +1,149 @@
+#include "acpi.h"
+#include "../clib/clib.h"
+#include "paging.h"
+
+#define EBDA_SEGMENT_PTR 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_ISO 2
+#define MADT_LAPIC_ENABLED 0x1
+
+typedef struct __attribute__((packed)) {
+  char signature[8]; /* "RSD PTR " */
+  uint8_t checksum;
+  char oem_id[6];
+  uint8_t revision;
+  uint32_t rsdt_addr;
+} acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} acpi_sdt_header_t;
+
+typedef struct __attribute__((packed)) {
+  acpi_sdt_header_t header;
+  uint32_t lapic_addr;
+  uint32_t flags;
+} acpi_madt_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type;
+  uint8_t length;
+} madt_entry_t;
+
+static int checksum_ok(const void *p, uint32_t len) {
+  const uint8_t *b = p;
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < len; i++)
+    sum += b[i];
+  return sum == 0;
+}
+
+static const acpi_rsdp_t *scan_rsdp(uint32_t start, uint32_t end) {
+  for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)(uintptr_t)addr;
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+        checksum_ok(rsdp, sizeof(*rsdp)))
+      return rsdp;
+  }
+  return 0;
+}
+
+static const acpi_rsdp_t *find_rsdp(void) {
+  uint32_t ebda = (uint32_t)(*(volatile uint16_t *)EBDA_SEGMENT_PTR) << 4;
+  const acpi_rsdp_t *rsdp = 0;
+  if (ebda)
+    rsdp = scan_rsdp(ebda, ebda + 1024);
+  if (!rsdp)
+    rsdp = scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+  return rsdp;
+}
+
+/* the header, then the whole table once its length is known */
+static const acpi_sdt_header_t *map_table(uint32_t addr) {
+  const acpi_sdt_header_t *h =
+      paging_map(addr, sizeof(acpi_sdt_header_t), PAGING_WB);
+  if (h && !paging_map(addr, h->length, PAGING_WB))
+    return 0;
+  return h;
+}
+
+static const acpi_madt_t *find_madt(void) {
+  const acpi_rsdp_t *rsdp = find_rsdp();
+  if (!rsdp)
+    return 0;
+
+  const acpi_sdt_header_t *rsdt = map_table(rsdp->rsdt_addr);
+  if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0 ||
+      !checksum_ok(rsdt, rsdt->length))
+    return 0;
+
+  const uint32_t *tables = (const uint32_t *)(rsdt + 1);
+  uint32_t count = (rsdt->length - sizeof(*rsdt)) / 4;
+  for (uint32_t i = 0; i < count; i++) {
+    const acpi_sdt_header_t *h = map_table(tables[i]);
+    if (h && memcmp(h->signature, "APIC", 4) == 0 &&
+        checksum_ok(h, h->length))
+      return (const acpi_madt_t *)h;
+  }
+  return 0;
+}
+
+int acpi_read_madt(acpi_madt_info_t *info) {
+  const acpi_madt_t *madt = find_madt();
+  if (!madt)
+    return -1;
+
+  memset(info, 0, sizeof(*info));
+  info->lapic_addr = madt->lapic_addr;
+  for (uint32_t i = 0; i < ACPI_ISA_IRQS; i++)
+    info->isa_gsi[i] = i;
+
+  const uint8_t *p = (const uint8_t *)(madt + 1);
+  const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+  while (p + sizeof(madt_entry_t) <= end) {
+    const madt_entry_t *e = (const madt_entry_t *)p;
+    if (e->length < sizeof(madt_entry_t))
+      break;
+
+    switch (e->type) {
+    case MADT_LAPIC: {
+      /* acpi processor id, apic id, flags */
+      uint8_t apic_id = p[3];
+      uint32_t flags = *(const uint32_t *)(p + 4);
+      if ((flags & MADT_LAPIC_ENABLED) && info->num_cpus < ACPI_MAX_CPUS)
+        info->lapic_ids[info->num_cpus++] = apic_id;
+      break;
+    }
+    case MADT_IOAPIC:
+      /* id, reserved, address, gsi base */
+      if (!info->ioapic_addr) {
+        info->ioapic_addr = *(const uint32_t *)(p + 4);
+        info->ioapic_gsi_base = *(const uint32_t *)(p + 8);
+      }
+      break;
+    case MADT_ISO: {
+      /* bus, source irq, gsi, flags */
+      uint8_t irq = p[3];
+      if (irq < ACPI_ISA_IRQS) {
+        info->isa_gsi[irq] = *(const uint32_t *)(p + 4);
+        info->isa_flags[irq] = *(const uint16_t *)(p + 8);
+      }
+      break;
+    }
+    }
+    p += e->length;
+  }
+  return info->num_cpus ? 0 : -1;
+}
@@ -0,0 +1,28 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+/* Just enough ACPI to find the processors and interrupt controllers: the
+ * RSDP, the RSDT and the MADT ("APIC" table). Tables are read in place,
+ * mapped first since they may lie past the RAM the bootloader reported. */
+
+#define ACPI_MAX_CPUS 32
+#define ACPI_ISA_IRQS 16
+
+typedef struct {
+  uint32_t lapic_addr;
+  uint32_t num_cpus;
+  uint8_t lapic_ids[ACPI_MAX_CPUS]; /* enabled processors, MADT order */
+  uint32_t ioapic_addr;             /* first IOAPIC, 0 if none */
+  uint32_t ioapic_gsi_base;
+  /* ISA IRQ -> global system interrupt, with MPS INTI polarity/trigger
+   * flags from the interrupt source overrides (identity, 0 by default) */
+  uint32_t isa_gsi[ACPI_ISA_IRQS];
+  uint16_t isa_flags[ACPI_ISA_IRQS];
+} acpi_madt_info_t;
+
+/* Returns 0 and fills *info when an MADT was found, -1 otherwise. */
+int acpi_read_madt(acpi_madt_info_t *info);
+
+#endif
@@ -0,0 +1,198 @@
+#include "apic.h"
+#include "../clib/clib.h"
+#include "../cpu/paging.h"
+#include "../timer/timer.h"
+#include "idt.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_ENABLE 0x800
+
+/* local APIC registers, byte offsets */
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV16 0x3
+
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_LEVEL_ASSERT 0x4000
+#define ICR_PENDING 0x1000
+
+/* IOAPIC: index/data register pair, redirection table from 0x10 */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WIN 0x10
+#define IOAPIC_VER 0x01 /* bits 23:16 = redirection entries - 1 */
+#define IOAPIC_REDTBL(n) (0x10 + 2 * (n))
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+/* MPS INTI flags from the MADT interrupt source overrides */
+#define INTI_POLARITY_LOW 0x3
+#define INTI_TRIGGER_LEVEL 0xC
+
+static volatile uint32_t *lapic = 0;
+static volatile uint32_t *ioapic = 0;
+static acpi_madt_info_t madt;
+static uint8_t bsp_apic_id = 0;
+static uint32_t timer_counts_per_ms = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) { return lapic[reg / 4]; }
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+  lapic[reg / 4] = value;
+  (void)lapic[LAPIC_ID / 4]; /* read back to post the write */
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+  ioapic[IOAPIC_REGSEL / 4] = reg;
+  return ioapic[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+  ioapic[IOAPIC_REGSEL / 4] = reg;
+  ioapic[IOAPIC_WIN / 4] = value;
+}
+
+static uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static void wrmsr(uint32_t msr, uint64_t value) {
+  __asm__ volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+/* ===== IOAPIC as the irq_* controller ===== */
+
+static uint32_t ioapic_pin(uint8_t irq) {
+  return madt.isa_gsi[irq] - madt.ioapic_gsi_base;
+}
+
+static void ioapic_route(uint8_t irq, int masked) {
+  uint32_t low = IRQ_BASE + irq;
+  uint16_t flags = madt.isa_flags[irq];
+  if ((flags & INTI_POLARITY_LOW) == INTI_POLARITY_LOW)
+    low |= IOAPIC_ACTIVE_LOW;
+  if ((flags & INTI_TRIGGER_LEVEL) == INTI_TRIGGER_LEVEL)
+    low |= IOAPIC_LEVEL;
+  if (masked)
+    low |= IOAPIC_MASKED;
+
+  uint32_t pin = ioapic_pin(irq);
+  ioapic_write(IOAPIC_REDTBL(pin) + 1, (uint32_t)bsp_apic_id << 24);
+  ioapic_write(IOAPIC_REDTBL(pin), low); /* fixed delivery, physical dest */
+}
+
+static void apic_mask(uint8_t irq) { ioapic_route(irq, 1); }
+static void apic_unmask(uint8_t irq) { ioapic_route(irq, 0); }
+
+static void apic_eoi(uint32_t vector) {
+  if (vector != APIC_SPURIOUS_VECTOR) /* spurious interrupts take no EOI */
+    lapic_eoi();
+}
+
+static const irq_chip_t apic_chip = {apic_mask, apic_unmask, apic_eoi};
+
+/* ===== local APIC ===== */
+
+void lapic_init(void) {
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+uint8_t lapic_id(void) { return (uint8_t)(lapic_read(LAPIC_ID) >> 24); }
+
+void lapic_eoi(void) { lapic[LAPIC_EOI / 4] = 0; }
+
+static void lapic_send(uint8_t apic_id, uint32_t icr) {
+  while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+    ;
+  lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, icr);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+  lapic_send(apic_id, vector);
+}
+
+void lapic_send_init(uint8_t apic_id) {
+  lapic_send(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+}
+
+void lapic_send_startup(uint8_t apic_id, uint8_t page) {
+  lapic_send(apic_id, ICR_STARTUP | page);
+}
+
+/* Count the timer down for TIMER_CALIBRATE_MS against the (already
+ * calibrated) TSC. Every CPU's timer runs off the same bus clock, so the BSP
+ * does this once for all of them. */
+static uint32_t lapic_timer_calibrate(void) {
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  timer_delay_us(TIMER_CALIBRATE_MS * 1000);
+  uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  return elapsed / TIMER_CALIBRATE_MS;
+}
+
+void lapic_timer_start(uint32_t hz) {
+  uint32_t count = timer_counts_per_ms * 1000 / hz;
+  if (count == 0)
+    count = 1;
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | APIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+/* ===== bring-up ===== */
+
+int apic_init(const acpi_madt_info_t *info) {
+  if (!info->ioapic_addr)
+    return -1;
+  lapic = paging_map(info->lapic_addr, PAGE_SIZE, PAGING_UC);
+  ioapic = paging_map(info->ioapic_addr, PAGE_SIZE, PAGING_UC);
+  if (!lapic || !ioapic) {
+    lapic = 0;
+    return -1;
+  }
+  madt = *info;
+
+  wrmsr(IA32_APIC_BASE_MSR,
+        rdmsr(IA32_APIC_BASE_MSR) | IA32_APIC_BASE_ENABLE);
+  lapic_init();
+  bsp_apic_id = lapic_id();
+  timer_counts_per_ms = lapic_timer_calibrate();
+
+  uint32_t pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+  for (uint32_t pin = 0; pin < pins; pin++)
+    ioapic_write(IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+
+  irq_set_chip(&apic_chip);
+  return 0;
+}
+
+int apic_active(void) { return lapic != 0; }
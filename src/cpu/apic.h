@@ -0,0 +1,32 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "acpi.h"
+#include <stdint.h>
+
+/* Local APIC (one per CPU: timer, IPIs, EOI) and IOAPIC (routes the ISA
+ * IRQs). Registers are memory-mapped at the MADT addresses, which apic_init
+ * maps uncached. */
+
+#define APIC_TIMER_VECTOR 0x40
+#define APIC_RESCHED_VECTOR 0x41
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* Enable the BSP's local APIC, route ISA IRQs through the IOAPIC to the BSP
+ * and make the APIC the irq_* controller (the PIC is masked). Returns -1 and
+ * leaves the PIC in charge if there is no IOAPIC. */
+int apic_init(const acpi_madt_info_t *info);
+int apic_active(void);
+
+void lapic_init(void); /* per CPU: software-enable, LVTs masked */
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t page);
+
+/* periodic APIC_TIMER_VECTOR interrupts on the calling CPU */
+void lapic_timer_start(uint32_t hz);
+
+#endif
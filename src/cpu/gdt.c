@@ -0,0 +1,136 @@
+#include "gdt.h"
+#include "../clib/clib.h"
+#include "../smp/smp.h"
+
+typedef struct __attribute__((packed)) {
+  uint16_t limit_low;
+  uint16_t base_low;
+  uint8_t base_mid;
+  uint8_t access;
+  uint8_t granularity; /* flags in the high nibble, limit 19:16 low */
+  uint8_t base_high;
+} gdt_entry_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t limit;
+  uintptr_t base;
+} gdt_ptr_t;
+
+/* the fields the CPU reads on a privilege change; the rest is unused
+ * since tasks are never switched in hardware */
+#ifdef __x86_64__
+typedef struct __attribute__((packed)) {
+  uint32_t reserved;
+  uint64_t rsp0;
+  uint64_t unused[11]; /* rsp1-2, the interrupt stack table */
+  uint16_t trap;
+  uint16_t iomap_base;
+} tss_t;
+#else
+typedef struct __attribute__((packed)) {
+  uint32_t prev;
+  uint32_t esp0;
+  uint32_t ss0;
+  uint32_t unused[22];
+  uint16_t trap;
+  uint16_t iomap_base; /* past the limit: no I/O bitmap, no port access */
+} tss_t;
+#endif
+
+#define GDT_ENTRIES ((GDT_TSS + GDT_TSS_DESC * SMP_MAX_CPUS) / 8)
+
+static gdt_entry_t gdt[GDT_ENTRIES];
+static gdt_ptr_t gdt_ptr;
+static tss_t tss[SMP_MAX_CPUS];
+
+static void gdt_set(int i, uint32_t base, uint32_t limit, uint8_t access,
+                    uint8_t flags) {
+  gdt[i].limit_low = limit & 0xFFFF;
+  gdt[i].base_low = base & 0xFFFF;
+  gdt[i].base_mid = (base >> 16) & 0xFF;
+  gdt[i].access = access;
+  gdt[i].granularity = (uint8_t)((flags << 4) | ((limit >> 16) & 0x0F));
+  gdt[i].base_high = (base >> 24) & 0xFF;
+}
+
+#ifdef __x86_64__
+#define KERNEL_CODE_FLAGS 0xA /* 4 KiB granular, long mode */
+#else
+#define KERNEL_CODE_FLAGS 0xC /* 4 KiB granular, 32-bit */
+#endif
+
+void gdt_init(void) {
+  gdt_set(0, 0, 0, 0, 0);
+  gdt_set(1, 0, 0xFFFFF, 0x9A, KERNEL_CODE_FLAGS); /* ring 0 code */
+  gdt_set(2, 0, 0xFFFFF, 0x92, 0xC);               /* ring 0 data */
+  gdt_set(3, 0, 0xFFFFF, 0xFA, 0xC);               /* ring 3 code, 32-bit */
+  gdt_set(4, 0, 0xFFFFF, 0xF2, 0xC);               /* ring 3 data */
+  for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+    int slot = (GDT_TSS + GDT_TSS_DESC * i) / 8;
+    uintptr_t base = (uintptr_t)&tss[i];
+#ifndef __x86_64__
+    tss[i].ss0 = GDT_KERNEL_DATA;
+#endif
+    tss[i].iomap_base = sizeof(tss_t);
+    /* present, available TSS, byte granular */
+    gdt_set(slot, (uint32_t)base, sizeof(tss_t) - 1, 0x89, 0);
+#ifdef __x86_64__
+    /* the second half holds bits 63:32 of the base, then zeros */
+    uint64_t upper = (uint64_t)base >> 32;
+    memcpy(&gdt[slot + 1], &upper, sizeof(upper));
+#endif
+  }
+
+  gdt_ptr.limit = sizeof(gdt) - 1;
+  gdt_ptr.base = (uintptr_t)gdt;
+  gdt_load();
+  gdt_load_tss(0);
+}
+
+void gdt_load_tss(uint32_t cpu) {
+  __asm__ volatile("ltr %w0" : : "r"(GDT_TSS + GDT_TSS_DESC * cpu));
+}
+
+void gdt_set_kernel_stack(uint32_t cpu, uintptr_t stack_top) {
+#ifdef __x86_64__
+  tss[cpu].rsp0 = stack_top;
+#else
+  tss[cpu].esp0 = stack_top;
+#endif
+}
+
+#ifdef __x86_64__
+/* no far jump with an immediate in long mode: reload CS with a far return */
+void gdt_load(void) {
+  __asm__ volatile("lgdt %0\n\t"
+                   "pushq %1\n\t"
+                   "leaq 1f(%%rip), %%rax\n\t"
+                   "pushq %%rax\n\t"
+                   "lretq\n\t"
+                   "1:\n\t"
+                   "mov %2, %%ax\n\t"
+                   "mov %%ax, %%ds\n\t"
+                   "mov %%ax, %%es\n\t"
+                   "mov %%ax, %%fs\n\t"
+                   "mov %%ax, %%gs\n\t"
+                   "mov %%ax, %%ss\n\t"
+                   :
+                   : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA)
+                   : "rax", "memory");
+}
+#else
+void gdt_load(void) {
+  __asm__ volatile("lgdt %0\n\t"
+                   "ljmp %1, $1f\n\t"
+                   "1:\n\t"
+                   "mov %2, %%ax\n\t"
+                   "mov %%ax, %%ds\n\t"
+                   "mov %%ax, %%es\n\t"
+                   "mov %%ax, %%fs\n\t"
+                   "mov %%ax, %%gs\n\t"
+                   "mov %%ax, %%ss\n\t"
+                   :
+                   : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA)
+                   : "eax", "memory");
+}
+#endif
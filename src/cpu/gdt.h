@@ -0,0 +1,30 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE 0x1B /* ring 3, RPL included */
+#define GDT_USER_DATA 0x23
+#define GDT_TSS 0x28 /* CPU n's task state segment: GDT_TSS + TSS_DESC * n */
+#ifdef __x86_64__
+#define GDT_TSS_DESC 16 /* a long-mode TSS descriptor takes two entries */
+#else
+#define GDT_TSS_DESC 8
+#endif
+
+/* Multiboot leaves us with an unspecified GDT; install our own flat one so
+ * the selectors the IDT refers to are known. The kernel and user segments
+ * all span 4 GiB; paging is what keeps ring 3 out of the kernel. Each CPU
+ * has a TSS for the one thing it is used for: the stack an interrupt from
+ * ring 3 switches to. In the x86_64 build the kernel code segment is a
+ * 64-bit one, while the user segments stay 32-bit, so programs run in
+ * compatibility mode with the same ABI as on i386. */
+void gdt_init(void); /* and load CPU 0's TSS */
+void gdt_load(void); /* load it (and reload segments) on another CPU */
+void gdt_load_tss(uint32_t cpu);
+/* where CPU cpu's next entry from ring 3 puts the stack */
+void gdt_set_kernel_stack(uint32_t cpu, uintptr_t stack_top);
+
+#endif
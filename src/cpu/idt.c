@@ -0,0 +1,186 @@
+#include "idt.h"
+#include "../clib/clib.h"
+#include "../vga/vga.h"
+#include "gdt.h"
+
+#define PIC1_CMD 0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+
+#define ISR_STUBS IDT_ENTRIES /* see isr.asm */
+
+typedef struct __attribute__((packed)) {
+  uint16_t offset_low;
+  uint16_t selector;
+  uint8_t zero; /* long mode: the IST slot, 0 to stay on the usual stack */
+  uint8_t type_attr;
+  uint16_t offset_high;
+#ifdef __x86_64__
+  uint32_t offset_upper;
+  uint32_t reserved;
+#endif
+} idt_entry_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t limit;
+  uintptr_t base;
+} idt_ptr_t;
+
+extern uintptr_t isr_stub_table[ISR_STUBS];
+
+static idt_entry_t idt[IDT_ENTRIES];
+static idt_ptr_t idt_ptr;
+static isr_handler_t handlers[IDT_ENTRIES];
+static irq_exit_hook_t irq_exit_hook = 0;
+static isr_handler_t user_fault_handler = 0;
+
+static const char *const exception_names[32] = {
+    "divide error",   "debug",          "NMI",
+    "breakpoint",     "overflow",       "bound range",
+    "invalid opcode", "no FPU",         "double fault",
+    "coproc overrun", "invalid TSS",    "segment not present",
+    "stack fault",    "general protection", "page fault",
+    "reserved",       "x87 error",      "alignment check",
+    "machine check",  "SIMD error",     "virtualization",
+    "control protection",
+};
+
+static void idt_set_gate(uint8_t vector, uintptr_t offset, uint8_t dpl) {
+  idt[vector].offset_low = offset & 0xFFFF;
+  idt[vector].selector = GDT_KERNEL_CODE;
+  idt[vector].zero = 0;
+  /* present, callable from ring dpl and up, 32-bit (in long mode, 64-bit)
+   * interrupt gate */
+  idt[vector].type_attr = (uint8_t)(0x8E | dpl << 5);
+  idt[vector].offset_high = (offset >> 16) & 0xFFFF;
+#ifdef __x86_64__
+  idt[vector].offset_upper = (uint32_t)(offset >> 32);
+  idt[vector].reserved = 0;
+#endif
+}
+
+static void pic_remap(void) {
+  outb(PIC1_CMD, 0x11); /* ICW1: init, expect ICW4 */
+  outb(PIC2_CMD, 0x11);
+  outb(PIC1_DATA, IRQ_BASE); /* ICW2: vector offsets */
+  outb(PIC2_DATA, IRQ_BASE + 8);
+  outb(PIC1_DATA, 0x04); /* ICW3: slave on IRQ2 */
+  outb(PIC2_DATA, 0x02);
+  outb(PIC1_DATA, 0x01); /* ICW4: 8086 mode */
+  outb(PIC2_DATA, 0x01);
+  outb(PIC1_DATA, 0xFB); /* everything masked except the cascade */
+  outb(PIC2_DATA, 0xFF);
+}
+
+static void pic_mask(uint8_t irq) {
+  uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+  outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+static void pic_unmask(uint8_t irq) {
+  uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+  outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+static void pic_eoi(uint32_t vector) {
+  if (vector >= IRQ_BASE + 16)
+    return;
+  if (vector >= IRQ_BASE + 8)
+    outb(PIC2_CMD, PIC_EOI);
+  outb(PIC1_CMD, PIC_EOI);
+}
+
+static const irq_chip_t pic_chip = {pic_mask, pic_unmask, pic_eoi};
+static const irq_chip_t *chip = &pic_chip;
+
+void irq_mask(uint8_t irq) { chip->mask(irq); }
+void irq_unmask(uint8_t irq) { chip->unmask(irq); }
+
+void irq_set_chip(const irq_chip_t *new_chip) {
+  uint32_t flags = irq_save();
+  for (uint8_t irq = 0; irq < 16; irq++) {
+    chip->mask(irq);
+    if (handlers[IRQ_BASE + irq])
+      new_chip->unmask(irq);
+  }
+  chip = new_chip;
+  irq_restore(flags);
+}
+
+static void put_hex(uint32_t v) {
+  char num[21];
+  vga_putstr("0x", 0x0C);
+  vga_putstr(utoa(v, num, 16), 0x0C);
+}
+
+void idt_fatal(isr_frame_t *frame) {
+  vga_putstr("\nEXCEPTION: ", 0x0C);
+  vga_putstr(frame->int_no < 22 ? exception_names[frame->int_no] : "reserved",
+             0x0C);
+  vga_putstr(" err=", 0x0C);
+  put_hex(frame->err_code);
+  vga_putstr(" eip=", 0x0C);
+  put_hex(frame->eip);
+  vga_putstr("\nSystem halted.\n", 0x0C);
+  while (1) {
+    __asm__("cli; hlt");
+  }
+}
+
+/* called from isr_common with interrupts disabled */
+void isr_dispatch(isr_frame_t *frame) {
+  uint32_t vector = frame->int_no;
+  int irq = vector >= IRQ_BASE && vector != IDT_SYSCALL_VECTOR;
+
+  /* acknowledge first: a handler may switch away and not return soon */
+  if (irq)
+    chip->eoi(vector);
+
+  if (handlers[vector]) {
+    handlers[vector](frame);
+  } else if (vector < IRQ_BASE) {
+    if (isr_from_user(frame) && user_fault_handler)
+      user_fault_handler(frame);
+    else
+      idt_fatal(frame);
+  }
+
+  /* a system call is a point to preempt at like any IRQ */
+  if (vector >= IRQ_BASE && irq_exit_hook)
+    irq_exit_hook();
+}
+
+void irq_set_exit_hook(irq_exit_hook_t hook) { irq_exit_hook = hook; }
+
+void idt_set_handler(uint8_t vector, isr_handler_t handler) {
+  handlers[vector] = handler;
+}
+
+void idt_set_syscall_handler(isr_handler_t handler) {
+  handlers[IDT_SYSCALL_VECTOR] = handler;
+  idt_set_gate(IDT_SYSCALL_VECTOR, isr_stub_table[IDT_SYSCALL_VECTOR], 3);
+}
+
+void idt_set_user_fault_handler(isr_handler_t handler) {
+  user_fault_handler = handler;
+}
+
+void irq_set_handler(uint8_t irq, isr_handler_t handler) {
+  handlers[IRQ_BASE + irq] = handler;
+  irq_unmask(irq);
+}
+
+void idt_init(void) {
+  for (uint32_t i = 0; i < ISR_STUBS; i++)
+    idt_set_gate((uint8_t)i, isr_stub_table[i], 0);
+
+  pic_remap();
+
+  idt_ptr.limit = sizeof(idt) - 1;
+  idt_ptr.base = (uintptr_t)idt;
+  idt_load();
+}
+
+void idt_load(void) { __asm__ volatile("lidt %0" : : "m"(idt_ptr)); }
@@ -0,0 +1,113 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+
+#define IDT_ENTRIES 256
+#define IRQ_BASE 32 /* PIC IRQs 0-15 are remapped to vectors 32-47 */
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_ATA_PRIMARY 14
+#define IRQ_ATA_SECONDARY 15
+#define IDT_SYSCALL_VECTOR 0x80 /* int 0x80, the one gate ring 3 may use */
+#define EXC_PAGE_FAULT 14
+
+/* register state pushed by isr_common in isr.asm, lowest address first */
+#ifdef __x86_64__
+/* isr64.asm; each eXX name is the low half of its rXX register, which is
+ * all a program in 32-bit compatibility mode sees */
+#define ISR_REG64(x)                                                           \
+  union {                                                                      \
+    uint64_t r##x;                                                             \
+    uint32_t e##x;                                                             \
+  }
+typedef struct {
+  uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+  ISR_REG64(di);
+  ISR_REG64(si);
+  ISR_REG64(bp);
+  ISR_REG64(bx);
+  ISR_REG64(dx);
+  ISR_REG64(cx);
+  ISR_REG64(ax);
+  uint64_t int_no, err_code;
+  ISR_REG64(ip);
+  uint64_t cs;
+  union {
+    uint64_t rflags;
+    uint32_t eflags;
+  };
+  union {
+    uint64_t user_rsp; /* pushed on every entry in long mode */
+    uint32_t user_esp;
+  };
+  uint64_t user_ss;
+} isr_frame_t;
+#else
+typedef struct {
+  uint32_t gs, fs, es, ds;
+  uint32_t edi, esi, ebp, esp_unused, ebx, edx, ecx, eax;
+  uint32_t int_no, err_code;
+  uint32_t eip, cs, eflags;
+  uint32_t user_esp, user_ss; /* only pushed on entry from ring 3 */
+} isr_frame_t;
+#endif
+
+static inline int isr_from_user(const isr_frame_t *frame) {
+  return (frame->cs & 3) != 0;
+}
+
+/* the interrupted code's frame pointer, full width */
+static inline uintptr_t isr_frame_pointer(const isr_frame_t *frame) {
+#ifdef __x86_64__
+  return frame->rbp;
+#else
+  return frame->ebp;
+#endif
+}
+
+typedef void (*isr_handler_t)(isr_frame_t *frame);
+typedef void (*irq_exit_hook_t)(void);
+
+/* The interrupt controller behind the irq_* calls: the 8259 PIC from
+ * idt_init until smp_init hands delivery to the APIC. */
+typedef struct {
+  void (*mask)(uint8_t irq);
+  void (*unmask)(uint8_t irq);
+  void (*eoi)(uint32_t vector); /* called for every vector >= IRQ_BASE */
+} irq_chip_t;
+
+void idt_init(void); /* load the IDT and remap the PIC, IRQs masked */
+void idt_load(void); /* load the already built IDT on another CPU */
+void idt_set_handler(uint8_t vector, isr_handler_t handler);
+/* the IDT_SYSCALL_VECTOR handler; it is entered with interrupts off */
+void idt_set_syscall_handler(isr_handler_t handler);
+/* Exceptions that come from ring 3 and have no handler of their own go
+ * here instead of halting the machine. */
+void idt_set_user_fault_handler(isr_handler_t handler);
+/* report an exception and halt */
+void idt_fatal(isr_frame_t *frame);
+void irq_set_handler(uint8_t irq, isr_handler_t handler); /* and unmask */
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+/* called after every IRQ handler (the scheduler preempts from here) */
+void irq_set_exit_hook(irq_exit_hook_t hook);
+/* switch controllers; IRQs with a handler are unmasked on the new one */
+void irq_set_chip(const irq_chip_t *chip);
+
+static inline void interrupts_enable(void) { __asm__ volatile("sti"); }
+static inline void interrupts_disable(void) { __asm__ volatile("cli"); }
+
+/* disable interrupts, returning the previous EFLAGS for irq_restore */
+static inline uint32_t irq_save(void) {
+  uintptr_t flags; /* pop takes a full-width register */
+  __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+  return (uint32_t)flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+  if (flags & 0x200)
+    __asm__ volatile("sti" : : : "memory");
+}
+
+#endif
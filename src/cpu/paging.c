@@ -0,0 +1,255 @@
+#include "paging.h"
+#include "../clib/clib.h"
+#include "../smp/smp.h"
+#include "../smp/spinlock.h"
+#include "../vga/vga.h"
+
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITE 0x002
+#define PAGE_USER 0x004
+#define PAGE_PWT 0x008
+#define PAGE_PCD 0x010
+#define PAGE_LARGE 0x080 /* directory entry maps a large page */
+#define PAGE_GLOBAL 0x100
+#define PAGE_TYPE (PAGE_PWT | PAGE_PCD)
+
+#define CR0_WP 0x00010000
+#define CR0_PG 0x80000000
+#define CR4_PSE 0x010
+#define CR4_PGE 0x080
+
+#define CPUID_PSE (1u << 3)
+#define CPUID_PGE (1u << 13)
+#define CPUID_PAT (1u << 16)
+
+/* PAT entry 1 (PWT alone) is write-through after reset; it becomes
+ * write-combining. Entry 0 stays write-back and entry 3 (PCD | PWT)
+ * uncached, as they are without a PAT. */
+#define IA32_PAT_MSR 0x277
+#define PAT_VALUE 0x0007010600070106ull
+
+/* page_dir has an entry per large page of the 4 GiB identity space. In
+ * long mode it is four page directories side by side, under one PDPT and
+ * PML4, so it can be indexed the same way. */
+#ifdef __x86_64__
+typedef uint64_t pte_t;
+#define TABLE_ENTRIES 512
+#define DIR_ENTRIES 2048
+#define PDPT_ENTRIES 512
+#else
+typedef uint32_t pte_t;
+#define TABLE_ENTRIES 1024
+#define DIR_ENTRIES 1024
+#endif
+#define USER_FIRST (PAGING_USER_BASE / LARGE_PAGE_SIZE)
+#define USER_TABLES ((PAGING_USER_TOP - PAGING_USER_BASE) / LARGE_PAGE_SIZE)
+
+static pte_t page_dir[DIR_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static pte_t low_table[TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+#ifdef __x86_64__
+static pte_t pdpt[PDPT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static pte_t pml4[PDPT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+#define PAGE_ROOT pml4
+#else
+#define PAGE_ROOT page_dir
+#endif
+static uint16_t users[DIR_ENTRIES]; /* paging_map holders of a device page */
+static uint32_t ram_pages;          /* directory entries that map RAM */
+static int has_pat, has_pge, enabled;
+static ticket_lock_t lock = TICKET_LOCK_INIT;
+
+static pte_t user_tables[USER_TABLES][TABLE_ENTRIES]
+    __attribute__((aligned(PAGE_SIZE)));
+/* bumped by paging_clear_user; a CPU that saw an older one may still hold
+ * user translations from before it */
+static volatile uint32_t user_generation;
+static uint32_t cpu_generation[SMP_MAX_CPUS];
+
+static void cpuid(uint32_t leaf, uint32_t *ecx, uint32_t *edx) {
+  uint32_t eax, ebx;
+  __asm__ volatile("cpuid"
+                   : "=a"(eax), "=b"(ebx), "=c"(*ecx), "=d"(*edx)
+                   : "a"(leaf), "c"(0));
+}
+
+static void wrmsr(uint32_t msr, uint64_t value) {
+  __asm__ volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+static inline void invlpg(uintptr_t addr) {
+  __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static uint32_t type_bits(paging_type_t type) {
+  if (type == PAGING_WB)
+    return 0;
+  if (type == PAGING_WC && has_pat)
+    return PAGE_PWT;
+  return PAGE_PWT | PAGE_PCD;
+}
+
+void paging_init(uint32_t ram_top) {
+  uint32_t ecx, edx;
+  cpuid(1, &ecx, &edx);
+  if (!(edx & CPUID_PSE)) {
+    vga_putstr("paging: no 4 MiB pages, running unpaged\n", 0x0E);
+    return;
+  }
+  has_pat = (edx & CPUID_PAT) != 0;
+  has_pge = (edx & CPUID_PGE) != 0;
+
+  for (uint32_t i = 0; i < TABLE_ENTRIES; i++)
+    low_table[i] = i * PAGE_SIZE | PAGE_PRESENT | PAGE_WRITE | PAGE_GLOBAL;
+  page_dir[0] = (uintptr_t)low_table | PAGE_PRESENT | PAGE_WRITE;
+#ifdef __x86_64__
+  /* the upper levels let ring 3 through; the leaves decide */
+  for (uint32_t i = 0; i < DIR_ENTRIES / TABLE_ENTRIES; i++)
+    pdpt[i] = (uintptr_t)&page_dir[i * TABLE_ENTRIES] | PAGE_PRESENT |
+              PAGE_WRITE | PAGE_USER;
+  pml4[0] = (uintptr_t)pdpt | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+#endif
+
+  ram_pages = ram_top / LARGE_PAGE_SIZE + (ram_top % LARGE_PAGE_SIZE != 0);
+  if (ram_pages < 1)
+    ram_pages = 1;
+  if (ram_pages > USER_FIRST)
+    ram_pages = USER_FIRST; /* RAM past user space goes unused */
+  for (uint32_t i = 1; i < ram_pages; i++)
+    page_dir[i] = (pte_t)i * LARGE_PAGE_SIZE | PAGE_PRESENT | PAGE_WRITE |
+                  PAGE_LARGE | PAGE_GLOBAL;
+  paging_load();
+  enabled = 1;
+}
+
+/* Long mode is entered with paging on (entry64.asm), so this switches
+ * from the boot tables to these; setting PSE there is harmless. */
+void paging_load(void) {
+  uintptr_t cr0, cr4;
+  if (!page_dir[0])
+    return;
+  if (has_pat)
+    wrmsr(IA32_PAT_MSR, PAT_VALUE);
+  __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+  cr4 |= CR4_PSE | (has_pge ? CR4_PGE : 0);
+  __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+  __asm__ volatile("mov %0, %%cr3" : : "r"(PAGE_ROOT) : "memory");
+  __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+  cr0 |= CR0_PG | CR0_WP;
+  __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+int paging_enabled(void) { return enabled; }
+
+/* the low 4 MiB takes any type per 4 KiB page; other RAM stays write-back */
+static int can_map(uint32_t i, pte_t bits) {
+  if (i == 0)
+    return 1;
+  if (i < ram_pages)
+    return bits == 0;
+  if (i >= USER_FIRST && i < USER_FIRST + USER_TABLES)
+    return 0;
+  return users[i] == 0 || (page_dir[i] & PAGE_TYPE) == bits;
+}
+
+static void set_low_type(uint32_t start, uint32_t end, pte_t bits) {
+  if (end > LARGE_PAGE_SIZE)
+    end = LARGE_PAGE_SIZE;
+  for (uint32_t p = start / PAGE_SIZE; p * PAGE_SIZE < end; p++) {
+    low_table[p] = (low_table[p] & ~PAGE_TYPE) | bits;
+    invlpg(p * PAGE_SIZE);
+  }
+}
+
+void *paging_map(uint32_t phys, uint32_t size, paging_type_t type) {
+  uint32_t end = phys + size;
+  if (size == 0 || (end != 0 && end < phys))
+    return NULL;
+  if (!enabled)
+    return (void *)(uintptr_t)phys; /* reachable already, MTRRs' type */
+
+  uint32_t bits = type_bits(type);
+  uint32_t first = phys / LARGE_PAGE_SIZE;
+  uint32_t last = (end - 1) / LARGE_PAGE_SIZE;
+
+  ticket_lock(&lock);
+  for (uint32_t i = first; i <= last; i++) {
+    if (!can_map(i, bits)) {
+      ticket_unlock(&lock);
+      return NULL;
+    }
+  }
+  if (first == 0)
+    set_low_type(phys, last ? LARGE_PAGE_SIZE : end, bits);
+  for (uint32_t i = first > ram_pages ? first : ram_pages; i <= last; i++) {
+    if (users[i]++ == 0)
+      page_dir[i] = (pte_t)i * LARGE_PAGE_SIZE | PAGE_PRESENT | PAGE_WRITE |
+                    PAGE_LARGE | bits;
+  }
+  ticket_unlock(&lock);
+  return (void *)(uintptr_t)phys;
+}
+
+void paging_unmap(void *addr, uint32_t size) {
+  uint32_t phys = (uint32_t)(uintptr_t)addr;
+  if (!enabled || size == 0)
+    return;
+
+  uint32_t last = (phys + size - 1) / LARGE_PAGE_SIZE;
+  uint32_t first = phys / LARGE_PAGE_SIZE;
+
+  ticket_lock(&lock);
+  if (first == 0)
+    set_low_type(phys, last ? LARGE_PAGE_SIZE : phys + size, 0);
+  for (uint32_t i = first > ram_pages ? first : ram_pages; i <= last; i++) {
+    if (users[i] && --users[i] == 0) {
+      page_dir[i] = 0;
+      invlpg((uintptr_t)i * LARGE_PAGE_SIZE);
+    }
+  }
+  ticket_unlock(&lock);
+}
+
+static inline void reload_cr3(void) {
+  __asm__ volatile("mov %0, %%cr3" : : "r"(PAGE_ROOT) : "memory");
+}
+
+int paging_map_user(uint32_t vaddr, uint32_t phys, int writable) {
+  if (!enabled || vaddr < PAGING_USER_BASE || vaddr >= PAGING_USER_TOP)
+    return -1;
+  uint32_t i = vaddr / LARGE_PAGE_SIZE;
+  pte_t *table = user_tables[i - USER_FIRST];
+
+  ticket_lock(&lock);
+  if (!page_dir[i])
+    page_dir[i] = (uintptr_t)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+  table[vaddr / PAGE_SIZE % TABLE_ENTRIES] =
+      (phys & ~(PAGE_SIZE - 1)) | PAGE_PRESENT | PAGE_USER |
+      (writable ? PAGE_WRITE : 0);
+  ticket_unlock(&lock);
+  invlpg(vaddr);
+  return 0;
+}
+
+void paging_clear_user(void) {
+  ticket_lock(&lock);
+  for (uint32_t t = 0; t < USER_TABLES; t++) {
+    if (page_dir[USER_FIRST + t]) {
+      page_dir[USER_FIRST + t] = 0;
+      memset(user_tables[t], 0, sizeof(user_tables[t]));
+    }
+  }
+  user_generation++;
+  ticket_unlock(&lock);
+  reload_cr3(); /* user pages are never global */
+}
+
+void paging_sync(uint32_t cpu) {
+  uint32_t gen = user_generation;
+  if (!enabled || cpu_generation[cpu] == gen)
+    return;
+  cpu_generation[cpu] = gen;
+  reload_cr3();
+}
@@ -0,0 +1,58 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+/* Identity paging. RAM is mapped write-back in large pages, except the
+ * first one, which is in 4 KiB pages so the legacy video memory can take
+ * its own memory type. Everything else, device memory included, is absent
+ * until a driver maps it with paging_map. Memory types come from the PAT,
+ * reprogrammed so one entry is write-combining.
+ *
+ * Large pages are 4 MiB (PSE) on i386. The x86_64 build runs in long mode,
+ * where they are 2 MiB and four page directories cover the low 4 GiB; the
+ * interface is the same.
+ *
+ * Mappings are shared by every CPU. Removing one only flushes the calling
+ * CPU's TLB, so drivers unmap only what no other CPU still touches. */
+
+#define PAGE_SIZE 4096
+#ifdef __x86_64__
+#define LARGE_PAGE_SIZE 0x200000
+#else
+#define LARGE_PAGE_SIZE 0x400000
+#endif
+
+/* User space: 4 KiB pages ring 3 can reach. RAM is only identity-mapped
+ * below it. One program runs at a time, so there is one set of user pages,
+ * in the same tables as everything else. */
+#define PAGING_USER_BASE 0x40000000
+#define PAGING_USER_TOP 0x48000000
+
+typedef enum {
+  PAGING_WB, /* write-back: RAM */
+  PAGING_WC, /* write-combining: framebuffers (UC without a PAT) */
+  PAGING_UC, /* uncached: device registers */
+} paging_type_t;
+
+/* map [0, ram_top) and turn paging on; stays unpaged without PSE */
+void paging_init(uint32_t ram_top);
+void paging_load(void); /* the same tables on another CPU */
+int paging_enabled(void);
+
+/* Identity-map [phys, phys + size) with the given type and return it as a
+ * pointer, or NULL if part of it is already mapped with another type.
+ * Within RAM only the first 4 MiB can change type. Device mappings are
+ * counted, and paging_unmap removes them when the last user is gone. */
+void *paging_map(uint32_t phys, uint32_t size, paging_type_t type);
+void paging_unmap(void *addr, uint32_t size);
+
+/* map the user page at vaddr to the frame at phys; -1 outside user space */
+int paging_map_user(uint32_t vaddr, uint32_t phys, int writable);
+/* Remove every user page. Other CPUs drop what they cached of them in
+ * paging_sync, which the scheduler calls before running a thread that may
+ * enter user space. */
+void paging_clear_user(void);
+void paging_sync(uint32_t cpu);
+
+#endif
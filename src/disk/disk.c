@@ -1,9 +1,157 @@
 #include "disk.h"
 #include "../vga/vga.h"
 #include "../clib/clib.h"
+#include "../sched/sched.h"
+#include "../trace/trace.h"
 
-int disk_read_lba(uint32_t lba, void* buffer);
-int disk_write_lba(uint32_t lba, const void* buffer);
+/* A request at least this long that covers several members is split over
+ * worker threads, one per member; below it a thread costs more than the
+ * overlap wins. */
+#define PARALLEL_MIN_SECTORS 64
+
+static disk_layout_t layout = DISK_SINGLE;
+static uint32_t members = 1;
+static uint32_t chunk = DISK_CHUNK_DEFAULT;
+static uint32_t chunk_shift = 7;
+static disk_info_t array_info;
+
+/* RAID1 read balancing: requests in flight on each member, and the sector
+ * after the last one it read, as a stand-in for where its heads are */
+static volatile uint32_t pending[DISK_MAX_DEVICES];
+static uint32_t next_lba[DISK_MAX_DEVICES];
+
+typedef enum { OP_READ, OP_WRITE, OP_TRIM } array_op_t;
+
+typedef struct {
+    array_op_t op;
+    uint32_t lba;
+    uint32_t count;
+    uint8_t* buf;
+    int rc[DISK_MAX_DEVICES];
+} array_job_t;
+
+static int member_io(array_op_t op, uint32_t m, uint32_t lba, uint32_t count, uint8_t* p) {
+    if (op == OP_READ)
+        return disk_dev_read((int)m, lba, count, p);
+    if (op == OP_WRITE)
+        return disk_dev_write((int)m, lba, count, p);
+    return disk_dev_trim((int)m, lba, count);
+}
+
+/* Member m's chunks of the request, in order. They are adjacent on the
+ * member, so a TRIM goes out as one range. */
+static void stripe_member(void* arg, uint32_t m) {
+    array_job_t* job = arg;
+    uint32_t lba = job->lba, end = job->lba + job->count;
+    uint32_t trim_lba = 0, trim_count = 0;
+    int rc = 0;
+
+    while (lba < end) {
+        uint32_t c = lba >> chunk_shift;
+        uint32_t n = chunk - (lba & (chunk - 1));
+        if (n > end - lba)
+            n = end - lba;
+        if (c % members == m) {
+            uint32_t dev_lba = ((c / members) << chunk_shift) + (lba & (chunk - 1));
+            if (job->op != OP_TRIM)
+                rc |= member_io(job->op, m, dev_lba, n, job->buf + (lba - job->lba) * 512);
+            else {
+                if (trim_count == 0)
+                    trim_lba = dev_lba;
+                trim_count += n;
+            }
+        }
+        lba += n;
+    }
+    if (trim_count)
+        rc |= member_io(OP_TRIM, m, trim_lba, trim_count, NULL);
+    job->rc[m] = rc;
+}
+
+/* writes and trims go to every mirror whole */
+static void mirror_member(void* arg, uint32_t m) {
+    array_job_t* job = arg;
+    job->rc[m] = member_io(job->op, m, job->lba, job->count, job->buf);
+}
+
+/* a large read is cut into one piece per mirror */
+static void mirror_read_part(void* arg, uint32_t m) {
+    array_job_t* job = arg;
+    uint32_t share = (job->count + members - 1) / members;
+    uint32_t from = m * share;
+    uint32_t n = from >= job->count ? 0 : job->count - from;
+    if (n > share)
+        n = share;
+    job->rc[m] = n ? disk_dev_read((int)m, job->lba + from, n, job->buf + from * 512) : 0;
+}
+
+static int array_run(parallel_fn_t fn, array_job_t* job) {
+    int rc = 0;
+    if (job->count >= PARALLEL_MIN_SECTORS) {
+        sched_parallel(fn, job, members);
+    } else {
+        for (uint32_t m = 0; m < members; m++)
+            fn(job, m);
+    }
+    for (uint32_t m = 0; m < members; m++)
+        rc |= job->rc[m];
+    return rc ? -1 : 0;
+}
+
+/* the least busy mirror, the one already nearest lba on a tie */
+static uint32_t pick_mirror(uint32_t lba) {
+    uint32_t best = 0, best_dist = 0xFFFFFFFF;
+    for (uint32_t m = 0; m < members; m++) {
+        uint32_t dist = lba > next_lba[m] ? lba - next_lba[m] : next_lba[m] - lba;
+        if (pending[m] < pending[best] || (pending[m] == pending[best] && dist < best_dist)) {
+            best = m;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+static int array_io(array_op_t op, uint32_t lba, uint32_t count, uint8_t* buf) {
+    array_job_t job = {op, lba, count, buf, {0}};
+
+    if (disk_device_count() == 0)
+        return -1;
+    if (layout == DISK_SINGLE)
+        return member_io(op, 0, lba, count, buf);
+    if (lba + count > array_info.sectors)
+        return -1;
+    if (layout == DISK_RAID0)
+        return array_run(stripe_member, &job);
+    if (op != OP_READ)
+        return array_run(mirror_member, &job);
+    if (count >= PARALLEL_MIN_SECTORS)
+        return array_run(mirror_read_part, &job);
+
+    uint32_t m = pick_mirror(lba);
+    __atomic_fetch_add(&pending[m], 1, __ATOMIC_RELAXED);
+    int rc = disk_dev_read((int)m, lba, count, buf);
+    __atomic_fetch_sub(&pending[m], 1, __ATOMIC_RELAXED);
+    next_lba[m] = lba + count;
+    return rc;
+}
+
+int disk_read_lbas(uint32_t lba, uint32_t count, void* buffer) {
+    TRACE_SCOPE(TP_DISK_READ, lba);
+    return array_io(OP_READ, lba, count, buffer);
+}
+
+int disk_write_lbas(uint32_t lba, uint32_t count, const void* buffer) {
+    TRACE_SCOPE(TP_DISK_WRITE, lba);
+    return array_io(OP_WRITE, lba, count, (uint8_t*)buffer);
+}
+
+int disk_read_lba(uint32_t lba, void* buffer) {
+    return disk_read_lbas(lba, 1, buffer);
+}
+
+int disk_write_lba(uint32_t lba, const void* buffer) {
+    return disk_write_lbas(lba, 1, buffer);
+}
 
 /* Compatibility wrappers for legacy functions */
 int disk_read_sector(uint32_t lba, void* buffer) {
@@ -14,6 +162,111 @@ int disk_write_sector(uint32_t lba, const void* buffer) {
     return disk_write_lba(lba, buffer);
 }
 
+int disk_trim(uint32_t lba, uint32_t count) {
+    if (!array_info.trim)
+        return -1;
+    return array_io(OP_TRIM, lba, count, NULL);
+}
+
+int disk_flush(void) {
+    TRACE_SCOPE(TP_DISK_FLUSH, 0);
+    int rc = 0;
+    for (uint32_t m = 0; m < members; m++)
+        rc |= disk_dev_flush((int)m);
+    return rc;
+}
+
+int disk_set_write_cache(int enable) {
+    int rc = 0;
+    array_info.write_cache_enabled = 0;
+    for (uint32_t m = 0; m < members; m++) {
+        rc |= disk_dev_set_write_cache((int)m, enable);
+        array_info.write_cache_enabled |= disk_device_info((int)m)->write_cache_enabled;
+    }
+    return rc;
+}
+
+const disk_info_t* disk_info(void) {
+    return &array_info;
+}
+
+/* ===== layout ===== */
+
+int disk_set_layout(disk_layout_t new_layout, uint32_t new_members, uint32_t new_chunk) {
+    uint32_t found = (uint32_t)disk_device_count();
+    uint32_t shift = 0;
+
+    if (new_members == 0)
+        new_members = found;
+    if (new_layout == DISK_SINGLE)
+        new_members = 1;
+    if (found == 0 || new_members > found || (new_layout != DISK_SINGLE && new_members < 2))
+        return -1;
+    while ((1u << shift) < new_chunk)
+        shift++;
+    if (new_chunk == 0 || new_chunk > DISK_CHUNK_MAX || (1u << shift) != new_chunk)
+        return -1;
+
+    layout = new_layout;
+    members = new_members;
+    chunk = new_chunk;
+    chunk_shift = shift;
+
+    /* the smallest member bounds them all */
+    uint32_t smallest = 0xFFFFFFFF;
+    array_info = *disk_device_info(0);
+    for (uint32_t m = 0; m < members; m++) {
+        const disk_info_t* info = disk_device_info((int)m);
+        if (info->sectors < smallest)
+            smallest = info->sectors;
+        array_info.lba48 &= info->lba48;
+        array_info.trim &= info->trim;
+        array_info.write_cache |= info->write_cache;
+        array_info.write_cache_enabled |= info->write_cache_enabled;
+    }
+    if (layout == DISK_RAID0)
+        array_info.sectors = (smallest >> chunk_shift << chunk_shift) * members;
+    else
+        array_info.sectors = smallest;
+    for (uint32_t m = 0; m < DISK_MAX_DEVICES; m++) {
+        pending[m] = 0;
+        next_lba[m] = 0;
+    }
+    return 0;
+}
+
+disk_layout_t disk_layout(uint32_t* out_members, uint32_t* out_chunk) {
+    if (out_members)
+        *out_members = members;
+    if (out_chunk)
+        *out_chunk = chunk;
+    return layout;
+}
+
+const char* disk_layout_name(disk_layout_t l) {
+    static const char* const names[] = {"single", "raid0", "raid1"};
+    return names[l];
+}
+
 void disk_init(void) {
-    vga_putstr("disk: ATA driver ready\n", 0x0A);
+    int found = disk_probe();
+    if (found == 0) {
+        vga_putstr("disk: no ATA disk found\n", 0x0E);
+        return;
+    }
+    for (int i = 0; i < found; i++) {
+        const disk_info_t* info = disk_device_info(i);
+        char num[21];
+        vga_putstr("disk ", 0x0A);
+        vga_putstr(utoa((uint32_t)i, num, 10), 0x0A);
+        vga_putstr(": ", 0x0A);
+        vga_putstr(info->model, 0x0A);
+        if (!info->write_cache)
+            vga_putstr(", no write cache\n", 0x0A);
+        else if (info->write_cache_enabled)
+            vga_putstr(", write cache on\n", 0x0A);
+        else
+            vga_putstr(", write cache off\n", 0x0A);
+    }
+    disk_set_layout(DISK_SINGLE, 1, DISK_CHUNK_DEFAULT);
 }
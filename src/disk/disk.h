@@ -8,3 +8,67 @@ void disk_init(void);
 /* Modern ATA versions used by fs.c */
 int disk_read_lba(uint32_t lba, void* buffer);
 int disk_write_lba(uint32_t lba, const void* buffer);
+/* count consecutive sectors in as few commands as the drive allows */
+int disk_read_lbas(uint32_t lba, uint32_t count, void* buffer);
+int disk_write_lbas(uint32_t lba, uint32_t count, const void* buffer);
+
+/* What IDENTIFY DEVICE reported, plus the write cache state we left it in */
+typedef struct {
+    char model[41];
+    uint32_t sectors;             /* LBA28 addressable sectors */
+    uint8_t lba48;
+    uint8_t flush_ext;            /* FLUSH CACHE EXT supported */
+    uint8_t write_cache;          /* volatile write cache present */
+    uint8_t write_cache_enabled;
+    uint8_t trim;                 /* DATA SET MANAGEMENT TRIM, via bus-master DMA */
+} disk_info_t;
+
+/* The disk the calls above and below address: one drive, or an array
+ * built over several (see disk_set_layout). Its sectors are what the
+ * array exposes; trim is set only when every member can TRIM. */
+const disk_info_t* disk_info(void);
+
+/* Turn the drive's volatile write cache on or off (SET FEATURES 02h/82h) */
+int disk_set_write_cache(int enable);
+/* FLUSH CACHE (EXT): returns once everything written so far is on media.
+ * Nothing to do, and returns 0, while the write cache is off. */
+int disk_flush(void);
+/* TRIM count sectors from lba: the drive may drop their contents and
+ * reads return anything until they are written again. -1 if it can't. */
+int disk_trim(uint32_t lba, uint32_t count);
+
+/* ===== arrays =====
+ * RAID0 stripes the disk over its members in chunks, so one large request
+ * keeps every member busy; RAID1 writes each sector to every member and
+ * spreads reads over them. Members on different channels transfer in
+ * parallel; two on one channel take turns. */
+typedef enum {
+    DISK_SINGLE,                /* device 0 only */
+    DISK_RAID0,
+    DISK_RAID1,
+} disk_layout_t;
+
+#define DISK_CHUNK_DEFAULT 128  /* sectors, 64 KiB */
+#define DISK_CHUNK_MAX 2048     /* sectors, 1 MiB */
+
+/* Use the first `members` devices (0: all of them) as the disk. RAID0
+ * chunks are a power of two sectors up to DISK_CHUNK_MAX. -1 if there are
+ * too few devices or the chunk size is bad; the old layout stays. Only
+ * meaningful before the fs mounts: the data does not move. */
+int disk_set_layout(disk_layout_t layout, uint32_t members, uint32_t chunk);
+disk_layout_t disk_layout(uint32_t* members, uint32_t* chunk);
+const char* disk_layout_name(disk_layout_t layout);
+
+/* ===== devices =====
+ * Every ATA drive on the primary and secondary channels, master before
+ * slave, numbered in that order. */
+#define DISK_MAX_DEVICES 4
+
+int disk_probe(void);               /* IDENTIFY them all; returns the count */
+int disk_device_count(void);
+const disk_info_t* disk_device_info(int dev);
+int disk_dev_read(int dev, uint32_t lba, uint32_t count, void* buffer);
+int disk_dev_write(int dev, uint32_t lba, uint32_t count, const void* buffer);
+int disk_dev_set_write_cache(int dev, int enable);
+int disk_dev_flush(int dev);
+int disk_dev_trim(int dev, uint32_t lba, uint32_t count);
@@ -1,15 +1,91 @@
 #include "disk.h"
 #include "../vga/vga.h"
 #include "../clib/clib.h"
+#include "../trace/trace.h"
+#include "../sched/sched.h"
+#include "../pci/pci.h"
+#include "../cpu/idt.h"
+#include "../timer/timer.h"
 #include <stdint.h>
 #include <stddef.h>
 
-#define ATA_PRIMARY_IO   0x1F0
-#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_SECONDARY_IO   0x170
+#define ATA_SECONDARY_CTRL 0x376
 
 #define ATA_STATUS_BSY  0x80
 #define ATA_STATUS_RDY  0x40
+#define ATA_STATUS_DF   0x20
 #define ATA_STATUS_DRQ  0x08
+#define ATA_STATUS_ERR  0x01
+
+#define ATA_POLL_TICKS  (TIMER_HZ * 5) /* polling gives up on a hung drive */
+
+#define ATA_CMD_DSM             0x06
+#define ATA_CMD_FLUSH_CACHE     0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_SET_FEATURES    0xEF
+
+#define ATA_FEATURE_WCACHE_ON   0x02
+#define ATA_FEATURE_WCACHE_OFF  0x82
+#define ATA_DSM_TRIM            0x01
+
+/* PCI IDE bus master registers (offsets from BAR4, plus 8 for the
+ * secondary channel) */
+#define BM_COMMAND  0x00
+#define BM_STATUS   0x02
+#define BM_PRDT     0x04
+#define BM_CHANNEL  0x08
+#define BM_CMD_START 0x01
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define TRIM_RANGES 64          /* one 512-byte DSM block */
+#define TRIM_RANGE_MAX 0xFFFF   /* sectors per range entry */
+
+/* DATA SET MANAGEMENT is a DMA command, so TRIM needs the bus master even
+ * though everything else here is PIO. The kernel runs identity mapped, so
+ * these addresses are physical; the alignment keeps both inside one 64K
+ * window as the PRD rules require. */
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;
+    uint16_t flags;             /* bit 15: last entry */
+} __attribute__((packed)) ata_prd_t;
+
+/* Master and slave share a channel's registers, so a channel runs one
+ * command at a time; the two channels run independently of each other.
+ * Each channel has its own IRQ, shared by its two drives. */
+typedef struct {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bm;                /* bus master base, 0 without one */
+    int8_t selected;            /* drive the register file points at */
+    mutex_t lock;
+    uint8_t irq;
+    volatile int irq_seen;      /* the IRQ has arrived; until then, poll */
+    volatile int waiting;       /* a waiter wants the next IRQ posted */
+    semaphore_t irq_done;
+    uint64_t trim_ranges[TRIM_RANGES] __attribute__((aligned(512)));
+    ata_prd_t prd __attribute__((aligned(8)));
+} ata_channel_t;
+
+typedef struct {
+    ata_channel_t* ch;
+    uint8_t slave;
+    disk_info_t info;
+} ata_device_t;
+
+static ata_channel_t channels[2] = {
+    {ATA_PRIMARY_IO, ATA_PRIMARY_CTRL, 0, -1, MUTEX_INIT, IRQ_ATA_PRIMARY,
+     0, 0, SEMAPHORE_INIT(0), {0}, {0, 0, 0}},
+    {ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, 0, -1, MUTEX_INIT, IRQ_ATA_SECONDARY,
+     0, 0, SEMAPHORE_INIT(0), {0}, {0, 0, 0}},
+};
+static ata_device_t devices[DISK_MAX_DEVICES];
+static int num_devices = 0;
 
 static void io_wait(void) {
     for (volatile int i = 0; i < 1000; i++);
@@ -25,49 +101,342 @@ static void outsw(uint16_t port, const void* addr, uint32_t count) {
     __asm__ volatile ("rep outsw" : "+S"(addr), "+c"(count) : "d"(port));
 }
 
-static int ata_wait_bsy(void) {
-    while (inb(ATA_PRIMARY_IO + 7) & ATA_STATUS_BSY);
-    return 0;
+/* Reading the status register acknowledges the drive's interrupt; only
+ * a waiter that announced itself is woken, so no post goes stale. */
+static void ata_irq(ata_channel_t* ch) {
+    inb(ch->io + 7);
+    ch->irq_seen = 1;
+    if (__atomic_exchange_n(&ch->waiting, 0, __ATOMIC_SEQ_CST))
+        sem_post(&ch->irq_done);
 }
 
-static int ata_wait_drq(void) {
-    while (!(inb(ATA_PRIMARY_IO + 7) & ATA_STATUS_DRQ));
-    return 0;
+static void ata_primary_irq(isr_frame_t* frame) {
+    (void)frame;
+    ata_irq(&channels[0]);
 }
 
-int disk_read_lba(uint32_t lba, void* buffer) {
-    ata_wait_bsy();
+static void ata_secondary_irq(isr_frame_t* frame) {
+    (void)frame;
+    ata_irq(&channels[1]);
+}
 
-    outb(ATA_PRIMARY_IO + 6, 0xE0 | ((lba >> 24) & 0x0F)); // drive/head
-    outb(ATA_PRIMARY_IO + 2, 1);                           // sector count
-    outb(ATA_PRIMARY_IO + 3, (uint8_t)lba);
-    outb(ATA_PRIMARY_IO + 4, (uint8_t)(lba >> 8));
-    outb(ATA_PRIMARY_IO + 5, (uint8_t)(lba >> 16));
-    outb(ATA_PRIMARY_IO + 7, 0x20);                        // READ SECTORS
+/* 1 once BSY drops and the drive has set every bit in need, -1 if it
+ * flagged an error instead, 0 while it is still working. The alternate
+ * status port leaves the interrupt pending for ata_irq. */
+static int ata_ready(ata_channel_t* ch, uint8_t need) {
+    uint8_t status = inb(ch->ctrl);
+    if (status & ATA_STATUS_BSY)
+        return 0;
+    if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+        return -1;
+    return (status & need) == need;
+}
 
-    ata_wait_bsy();
-    ata_wait_drq();
+/* Wait for ata_ready. Where the drive will interrupt (irq set) and the
+ * channel's IRQ has been seen to work, the thread sleeps until it comes;
+ * otherwise it polls, yielding, and gives up after ATA_POLL_TICKS.
+ * Returns 0, or -1 on an error or timeout. */
+static int ata_wait(ata_channel_t* ch, uint8_t need, int irq) {
+    uint64_t deadline = timer_ticks() + ATA_POLL_TICKS;
+    int ready;
+    while ((ready = ata_ready(ch, need)) == 0) {
+        if (!irq || !ch->irq_seen || !sched_running()) {
+            if (timer_ticks() >= deadline)
+                return -1;
+            sched_yield();
+            continue;
+        }
+        __atomic_store_n(&ch->waiting, 1, __ATOMIC_SEQ_CST);
+        if ((ready = ata_ready(ch, need)) != 0) {
+            /* done before we slept: take back the request, or the post */
+            if (!__atomic_exchange_n(&ch->waiting, 0, __ATOMIC_SEQ_CST))
+                sem_wait(&ch->irq_done);
+            break;
+        }
+        sem_wait(&ch->irq_done);
+    }
+    return ready < 0 ? -1 : 0;
+}
 
-    insw(ATA_PRIMARY_IO, buffer, 256); // 512 bytes
-    io_wait();
+/* Before issuing a command: wait out the last one, whatever its status */
+static int ata_wait_idle(ata_channel_t* ch) {
+    uint64_t deadline = timer_ticks() + ATA_POLL_TICKS;
+    while (inb(ch->ctrl) & ATA_STATUS_BSY) {
+        if (timer_ticks() >= deadline)
+            return -1;
+        sched_yield();
+    }
     return 0;
 }
 
-int disk_write_lba(uint32_t lba, const void* buffer) {
-    ata_wait_bsy();
+/* the command or transfer just issued completes with an interrupt */
+static int ata_wait_bsy(ata_channel_t* ch) {
+    TRACE_SCOPE(TP_ATA_WAIT_BSY, 0);
+    return ata_wait(ch, 0, 1);
+}
+
+static int ata_wait_drq(ata_channel_t* ch) {
+    TRACE_SCOPE(TP_ATA_WAIT_DRQ, 0);
+    return ata_wait(ch, ATA_STATUS_DRQ, 1);
+}
+
+/* Point the channel at dev. Status reads reflect the newly selected drive
+ * only after ~400ns, so pay that only when the drive actually changes. */
+static void ata_drive(ata_device_t* dev, uint8_t bits) {
+    outb(dev->ch->io + 6, bits | (dev->slave << 4));
+    if (dev->ch->selected != dev->slave) {
+        dev->ch->selected = dev->slave;
+        io_wait();
+    }
+}
+
+#define ATA_MAX_SECTORS 256   /* per command; a count of 0 means 256 */
+
+static void ata_select(ata_device_t* dev, uint32_t lba, uint32_t count, uint8_t cmd) {
+    uint16_t io = dev->ch->io;
+    ata_drive(dev, 0xE0 | ((lba >> 24) & 0x0F));            // drive/head
+    outb(io + 2, (uint8_t)count);                           // sector count
+    outb(io + 3, (uint8_t)lba);
+    outb(io + 4, (uint8_t)(lba >> 8));
+    outb(io + 5, (uint8_t)(lba >> 16));
+    outb(io + 7, cmd);
+}
+
+int disk_device_count(void) {
+    return num_devices;
+}
+
+const disk_info_t* disk_device_info(int dev) {
+    return dev >= 0 && dev < num_devices ? &devices[dev].info : NULL;
+}
 
-    outb(ATA_PRIMARY_IO + 6, 0xE0 | ((lba >> 24) & 0x0F));
-    outb(ATA_PRIMARY_IO + 2, 1);
-    outb(ATA_PRIMARY_IO + 3, (uint8_t)lba);
-    outb(ATA_PRIMARY_IO + 4, (uint8_t)(lba >> 8));
-    outb(ATA_PRIMARY_IO + 5, (uint8_t)(lba >> 16));
-    outb(ATA_PRIMARY_IO + 7, 0x30);                        // WRITE SECTORS
+/* One READ/WRITE SECTORS per ATA_MAX_SECTORS run; the drive raises DRQ
+ * once per sector within it. */
+int disk_dev_read(int index, uint32_t lba, uint32_t count, void* buffer) {
+    ata_device_t* dev = &devices[index];
+    ata_channel_t* ch = dev->ch;
+    uint8_t* p = buffer;
+    int rc = 0;
+    mutex_lock(&ch->lock);
+    while (count > 0 && rc == 0) {
+        uint32_t n = count < ATA_MAX_SECTORS ? count : ATA_MAX_SECTORS;
+        rc = ata_wait_idle(ch);
+        if (rc != 0)
+            break;
+        ata_select(dev, lba, n, 0x20);                      // READ SECTORS
+        for (uint32_t i = 0; i < n && rc == 0; i++) {
+            rc = ata_wait_drq(ch);                          // IRQ per sector
+            if (rc == 0)
+                insw(ch->io, p, 256);                       // 512 bytes
+            p += 512;
+        }
+        io_wait();
+        lba += n;
+        count -= n;
+    }
+    mutex_unlock(&ch->lock);
+    return rc;
+}
 
-    ata_wait_bsy();
-    ata_wait_drq();
+int disk_dev_write(int index, uint32_t lba, uint32_t count, const void* buffer) {
+    ata_device_t* dev = &devices[index];
+    ata_channel_t* ch = dev->ch;
+    const uint8_t* p = buffer;
+    int rc = 0;
+    mutex_lock(&ch->lock);
+    while (count > 0 && rc == 0) {
+        uint32_t n = count < ATA_MAX_SECTORS ? count : ATA_MAX_SECTORS;
+        rc = ata_wait_idle(ch);
+        if (rc != 0)
+            break;
+        ata_select(dev, lba, n, 0x30);                      // WRITE SECTORS
+        // no interrupt for the first sector, one after each sector sent
+        rc = ata_wait(ch, ATA_STATUS_DRQ, 0);
+        for (uint32_t i = 0; i < n && rc == 0; i++) {
+            outsw(ch->io, p, 256);
+            p += 512;
+            rc = i + 1 < n ? ata_wait_drq(ch) : ata_wait_bsy(ch);
+        }
+        io_wait();
+        lba += n;
+        count -= n;
+    }
+    mutex_unlock(&ch->lock);
+    return rc;
+}
+
+/* ===== IDENTIFY / write cache ===== */
+
+/* Status after a non-data command: 0, or -1 if the drive flagged an error */
+static int ata_command_status(ata_channel_t* ch) {
+    return ata_wait_bsy(ch);
+}
 
-    outsw(ATA_PRIMARY_IO, buffer, 256);
+static int ata_identify(ata_device_t* dev, uint16_t* id) {
+    ata_channel_t* ch = dev->ch;
+
+    mutex_lock(&ch->lock);
+    ata_drive(dev, 0xA0);
+    outb(ch->io + 2, 0);
+    outb(ch->io + 3, 0);
+    outb(ch->io + 4, 0);
+    outb(ch->io + 5, 0);
+    outb(ch->io + 7, ATA_CMD_IDENTIFY);
     io_wait();
 
+    uint8_t status = inb(ch->io + 7);
+    if (status == 0 || status == 0xFF) { // nothing there
+        mutex_unlock(&ch->lock);
+        return -1;
+    }
+    // ATAPI and SATA bridges in PATAPI mode abort and set the signature
+    if (ata_wait_bsy(ch) != 0 || inb(ch->io + 4) || inb(ch->io + 5) ||
+        ata_wait_drq(ch) != 0) {
+        mutex_unlock(&ch->lock);
+        return -1;
+    }
+    insw(ch->io, id, 256);
+    mutex_unlock(&ch->lock);
     return 0;
 }
+
+/* IDENTIFY every drive on both channels, master before slave; returns how
+ * many answered. Device numbers follow that order. IDENTIFY itself
+ * interrupts, so a channel whose IRQ is routed sleeps from then on. */
+int disk_probe(void) {
+    uint16_t id[256];
+    pci_addr_t ide;
+    uint16_t bm = 0;
+
+    if (pci_find_class(0x01, 0x01, &ide) == 0)
+        bm = pci_bar_io(ide, 4);
+    num_devices = 0;
+    for (int c = 0; c < 2; c++) {
+        irq_set_handler(channels[c].irq, c ? ata_secondary_irq : ata_primary_irq);
+        outb(channels[c].ctrl, 0);                  // nIEN clear: interrupts on
+        for (uint8_t slave = 0; slave < 2; slave++) {
+            ata_device_t* dev = &devices[num_devices];
+            dev->ch = &channels[c];
+            dev->slave = slave;
+            if (ata_identify(dev, id) != 0)
+                continue;
+
+            disk_info_t* info = &dev->info;
+            memset(info, 0, sizeof(*info));
+            for (int i = 0; i < 20; i++) { // words 27-46, two chars each, swapped
+                info->model[i * 2] = (char)(id[27 + i] >> 8);
+                info->model[i * 2 + 1] = (char)id[27 + i];
+            }
+            for (int i = 39; i >= 0 && info->model[i] == ' '; i--)
+                info->model[i] = '\0';
+            info->sectors = id[60] | ((uint32_t)id[61] << 16);
+            info->lba48 = (id[83] >> 10) & 1;
+            info->flush_ext = (id[83] >> 13) & 1;
+            info->write_cache = (id[82] >> 5) & 1;
+            info->write_cache_enabled = (id[85] >> 5) & 1;
+
+            if (info->lba48 && (id[169] & 1) && bm) {
+                uint32_t cmd = pci_read32(ide, PCI_COMMAND);
+                pci_write32(ide, PCI_COMMAND, cmd | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+                channels[c].bm = bm + c * BM_CHANNEL;
+                info->trim = 1;
+            }
+            num_devices++;
+        }
+    }
+    return num_devices;
+}
+
+int disk_dev_set_write_cache(int index, int enable) {
+    ata_device_t* dev = &devices[index];
+    ata_channel_t* ch = dev->ch;
+    if (!dev->info.write_cache)
+        return enable ? -1 : 0; // no cache to turn off
+    mutex_lock(&ch->lock);
+    int rc = ata_wait_idle(ch);
+    if (rc == 0) {
+        ata_drive(dev, 0xE0);
+        outb(ch->io + 1, enable ? ATA_FEATURE_WCACHE_ON : ATA_FEATURE_WCACHE_OFF);
+        outb(ch->io + 7, ATA_CMD_SET_FEATURES);
+        rc = ata_command_status(ch);
+    }
+    mutex_unlock(&ch->lock);
+    if (rc == 0)
+        dev->info.write_cache_enabled = enable ? 1 : 0;
+    return rc;
+}
+
+int disk_dev_flush(int index) {
+    ata_device_t* dev = &devices[index];
+    ata_channel_t* ch = dev->ch;
+    if (!dev->info.write_cache_enabled)
+        return 0;
+    mutex_lock(&ch->lock);
+    int rc = ata_wait_idle(ch);
+    if (rc == 0) {
+        ata_drive(dev, 0xE0);
+        outb(ch->io + 7, dev->info.flush_ext ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+        rc = ata_command_status(ch);
+    }
+    mutex_unlock(&ch->lock);
+    return rc;
+}
+
+/* ===== TRIM ===== */
+
+/* one DSM command for up to TRIM_RANGES entries already in trim_ranges */
+static int ata_dsm_trim(ata_device_t* dev) {
+    ata_channel_t* ch = dev->ch;
+    uint16_t io = ch->io;
+    ch->prd.addr = (uint32_t)(uintptr_t)ch->trim_ranges;
+    ch->prd.bytes = sizeof(ch->trim_ranges);
+    ch->prd.flags = 0x8000;
+
+    if (ata_wait_idle(ch) != 0)
+        return -1;
+    outb(ch->bm + BM_COMMAND, 0);                   // stopped, memory -> drive
+    outl(ch->bm + BM_PRDT, (uint32_t)(uintptr_t)&ch->prd);
+    outb(ch->bm + BM_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ); // write 1 to clear
+
+    // 48-bit register file: each port takes the high byte, then the low
+    ata_drive(dev, 0x40);
+    outb(io + 1, 0);
+    outb(io + 1, ATA_DSM_TRIM);
+    outb(io + 2, 0);
+    outb(io + 2, 1);                                // one 512-byte block
+    for (int reg = 3; reg <= 5; reg++) {
+        outb(io + reg, 0);
+        outb(io + reg, 0);
+    }
+    outb(io + 7, ATA_CMD_DSM);
+    outb(ch->bm + BM_COMMAND, BM_CMD_START);
+
+    uint8_t bm;
+    while (!((bm = inb(ch->bm + BM_STATUS)) & (BM_STATUS_IRQ | BM_STATUS_ERR)))
+        sched_yield();
+    outb(ch->bm + BM_COMMAND, 0);
+    int rc = ata_command_status(ch);
+    outb(ch->bm + BM_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ);
+    return (bm & BM_STATUS_ERR) ? -1 : rc;
+}
+
+int disk_dev_trim(int index, uint32_t lba, uint32_t count) {
+    ata_device_t* dev = &devices[index];
+    ata_channel_t* ch = dev->ch;
+    int rc = 0;
+    if (!dev->info.trim)
+        return -1;
+    mutex_lock(&ch->lock); // the range buffer is the channel's
+    while (count > 0 && rc == 0) {
+        memset(ch->trim_ranges, 0, sizeof(ch->trim_ranges));
+        for (int i = 0; i < TRIM_RANGES && count > 0; i++) {
+            uint32_t n = count < TRIM_RANGE_MAX ? count : TRIM_RANGE_MAX;
+            ch->trim_ranges[i] = (uint64_t)lba | ((uint64_t)n << 48);
+            lba += n;
+            count -= n;
+        }
+        rc = ata_dsm_trim(dev);
+    }
+    mutex_unlock(&ch->lock);
+    return rc;
+}
@@ -8,14 +8,46 @@ dd MULTIBOOT_MAGIC
 dd MULTIBOOT_FLAGS
 dd MULTIBOOT_CHECKSUM
 
+; Multiboot2 header, for loaders that prefer it (GRUB's multiboot2 command).
+; It asks for nothing but the info tags: the console starts in text mode
+; and moves to a framebuffer itself once it has read the VGA font.
+align 8
+MULTIBOOT2_MAGIC equ 0xE85250D6
+MULTIBOOT2_ARCH  equ 0              ; i386 protected mode
+mb2_header:
+dd MULTIBOOT2_MAGIC
+dd MULTIBOOT2_ARCH
+dd mb2_header_end - mb2_header
+dd 0x100000000 - (MULTIBOOT2_MAGIC + MULTIBOOT2_ARCH + (mb2_header_end - mb2_header))
+dw 0, 0                             ; end tag
+dd 8
+mb2_header_end:
+
+section .bss
+align 16
+global stack_bottom
+global stack_top
+stack_bottom:
+    resb 16384              ; the bootloader's stack is unspecified
+stack_top:
+align 8
+global boot_tsc
+boot_tsc:
+    resq 1                  ; TSC at the multiboot handoff, for boottime
+
 section .text
 global _start
 extern kernel_main
 
 _start:
+    mov esp, stack_top
     ; Multiboot provides EAX=magic, EBX=info
+    mov ecx, eax            ; rdtsc overwrites EAX
+    rdtsc
+    mov [boot_tsc], eax
+    mov [boot_tsc + 4], edx
     push ebx
-    push eax
+    push ecx
     call kernel_main
 
 .hang:
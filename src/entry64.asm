@@ -0,0 +1,171 @@
+; entry.asm for the x86_64 build. Multiboot starts us in 32-bit protected
+; mode without paging; long mode needs PAE paging, so _start identity-maps
+; the low 4 GiB with 2 MiB pages, sets EFER.LME, turns paging on and jumps
+; to a 64-bit code segment. paging_init later replaces these tables, and
+; ap_boot64.asm reuses them to bring the other CPUs up the same way.
+
+BITS 32
+section .multiboot
+align 4
+MULTIBOOT_MAGIC  equ 0x1BADB002
+MULTIBOOT_FLAGS  equ 0x0
+MULTIBOOT_CHECKSUM equ -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
+dd MULTIBOOT_MAGIC
+dd MULTIBOOT_FLAGS
+dd MULTIBOOT_CHECKSUM
+
+; Multiboot2 header, for loaders that prefer it (GRUB's multiboot2 command).
+; It asks for nothing but the info tags: the console starts in text mode
+; and moves to a framebuffer itself once it has read the VGA font.
+align 8
+MULTIBOOT2_MAGIC equ 0xE85250D6
+MULTIBOOT2_ARCH  equ 0              ; i386 protected mode
+mb2_header:
+dd MULTIBOOT2_MAGIC
+dd MULTIBOOT2_ARCH
+dd mb2_header_end - mb2_header
+dd 0x100000000 - (MULTIBOOT2_MAGIC + MULTIBOOT2_ARCH + (mb2_header_end - mb2_header))
+dw 0, 0                             ; end tag
+dd 8
+mb2_header_end:
+
+PAGE_PRESENT_WRITE equ 0x003
+PAGE_LARGE         equ 0x080
+BOOT_PDS           equ 4            ; 4 x 512 x 2 MiB = 4 GiB
+CR4_PAE            equ 1 << 5
+CR0_PG             equ 1 << 31
+EFER_MSR           equ 0xC0000080
+EFER_LME           equ 1 << 8
+CPUID_LONG_MODE    equ 1 << 29      ; 0x80000001 EDX
+
+section .bss
+align 4096
+global boot_pml4
+boot_pml4:
+    resb 4096
+boot_pdpt:
+    resb 4096
+boot_pd:
+    resb 4096 * BOOT_PDS
+align 16
+global stack_bottom
+global stack_top
+stack_bottom:
+    resb 16384              ; the bootloader's stack is unspecified
+stack_top:
+align 8
+global boot_tsc
+boot_tsc:
+    resq 1                  ; TSC at the multiboot handoff, for boottime
+
+section .data
+align 8
+boot_gdt:
+    dq 0
+    dq 0x00AF9A000000FFFF   ; 0x08: ring 0 code, long mode
+    dq 0x00CF92000000FFFF   ; 0x10: ring 0 data
+boot_gdt_ptr:
+    dw boot_gdt_ptr - boot_gdt - 1
+    dd boot_gdt
+
+no_long_mode_msg:
+    db "BottleOS x86_64: this CPU has no long mode", 0
+
+section .text
+global _start
+extern kernel_main
+
+_start:
+    mov esp, stack_top
+    ; Multiboot provides EAX=magic, EBX=info; keep them in EDI/ESI, where
+    ; the 64-bit calling convention wants kernel_main's arguments
+    mov edi, eax
+    mov esi, ebx
+    rdtsc
+    mov [boot_tsc], eax
+    mov [boot_tsc + 4], edx
+
+    mov eax, 0x80000000
+    cpuid
+    cmp eax, 0x80000001
+    jb .no_long_mode
+    mov eax, 0x80000001
+    cpuid
+    test edx, CPUID_LONG_MODE
+    jz .no_long_mode
+
+    ; PD entries: 2 MiB pages over [0, 4 GiB)
+    xor ecx, ecx
+.fill_pd:
+    mov eax, ecx
+    shl eax, 21
+    or eax, PAGE_PRESENT_WRITE | PAGE_LARGE
+    mov [boot_pd + ecx * 8], eax
+    mov dword [boot_pd + ecx * 8 + 4], 0
+    inc ecx
+    cmp ecx, 512 * BOOT_PDS
+    jne .fill_pd
+
+    xor ecx, ecx
+.fill_pdpt:
+    mov eax, ecx
+    shl eax, 12
+    add eax, boot_pd
+    or eax, PAGE_PRESENT_WRITE
+    mov [boot_pdpt + ecx * 8], eax
+    inc ecx
+    cmp ecx, BOOT_PDS
+    jne .fill_pdpt
+
+    mov eax, boot_pdpt
+    or eax, PAGE_PRESENT_WRITE
+    mov [boot_pml4], eax
+
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, boot_pml4
+    mov cr3, eax
+    mov ecx, EFER_MSR
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+    lgdt [boot_gdt_ptr]
+    jmp 0x08:long_start
+
+; no way forward: say so on the VGA text console and stop
+.no_long_mode:
+    mov esi, no_long_mode_msg
+    mov edi, 0xB8000
+.print:
+    lodsb
+    test al, al
+    jz .hang32
+    mov ah, 0x0C
+    stosw
+    jmp .print
+.hang32:
+    cli
+    hlt
+    jmp .hang32
+
+BITS 64
+long_start:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov rsp, stack_top
+    mov edi, edi            ; upper halves are undefined after the switch
+    mov esi, esi
+    call kernel_main
+
+.hang:
+    cli
+    hlt
+    jmp .hang
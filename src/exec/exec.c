@@ -0,0 +1,335 @@
+#include "exec.h"
+#include "../clib/clib.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../fs/fs.h"
+#include "../sched/sched.h"
+#include "../vga/vga.h"
+
+#define ELF_MAGIC 0x464C457F /* "\x7FELF" */
+#define ELF_CLASS32 1
+#define ELF_DATA_LSB 1
+#define ELF_TYPE_EXEC 2
+#define ELF_MACHINE_386 3
+#define ELF_PT_LOAD 1
+#define ELF_PF_W 0x2
+#define ELF_MAX_PHDRS 16
+
+#define PF_PRESENT 0x1 /* page fault error code: protection, not absence */
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t class, data, version, abi;
+  uint8_t pad[8];
+  uint16_t type;
+  uint16_t machine;
+  uint32_t version2;
+  uint32_t entry;
+  uint32_t phoff;
+  uint32_t shoff;
+  uint32_t flags;
+  uint16_t ehsize;
+  uint16_t phentsize;
+  uint16_t phnum;
+  uint16_t shentsize;
+  uint16_t shnum;
+  uint16_t shstrndx;
+} elf_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t type;
+  uint32_t offset;
+  uint32_t vaddr;
+  uint32_t paddr;
+  uint32_t filesz;
+  uint32_t memsz;
+  uint32_t flags;
+  uint32_t align;
+} elf_phdr_t;
+
+typedef struct {
+  uint32_t vaddr, memsz;
+  uint32_t offset, filesz; /* the part of it read from the file */
+  int writable;
+} segment_t;
+
+/* the running program; one at a time */
+static struct {
+  char name[FS_FILENAME_LEN * 2];
+  segment_t seg[EXEC_MAX_SEGMENTS];
+  uint32_t nseg;
+  uint32_t entry;
+  int argc;
+  char args[EXEC_ARGS_SIZE];
+  int status;
+  uint32_t pages;
+  semaphore_t done;
+  volatile int running;
+} prog;
+
+static uint8_t frames[EXEC_MAX_FRAMES][PAGE_SIZE]
+    __attribute__((aligned(PAGE_SIZE)));
+static uint8_t frame_used[EXEC_MAX_FRAMES];
+
+int exec_user_range(uint32_t addr, uint32_t len) {
+  return addr >= PAGING_USER_BASE && addr <= EXEC_STACK_TOP &&
+         len <= EXEC_STACK_TOP - addr;
+}
+
+/* ===== loading ===== */
+
+static int load_headers(const char *name) {
+  elf_header_t eh;
+  elf_phdr_t ph[ELF_MAX_PHDRS];
+
+  int n = fs_read_at(name, 0, (uint8_t *)&eh, sizeof(eh));
+  if (n < 0)
+    return EXEC_NOT_FOUND;
+  if (n != sizeof(eh) || eh.magic != ELF_MAGIC || eh.class != ELF_CLASS32 ||
+      eh.data != ELF_DATA_LSB || eh.type != ELF_TYPE_EXEC ||
+      eh.machine != ELF_MACHINE_386 || eh.phentsize != sizeof(elf_phdr_t) ||
+      eh.phnum == 0 || eh.phnum > ELF_MAX_PHDRS)
+    return EXEC_BAD_FORMAT;
+  uint32_t bytes = eh.phnum * sizeof(elf_phdr_t);
+  if (fs_read_at(name, eh.phoff, (uint8_t *)ph, bytes) != (int)bytes)
+    return EXEC_BAD_FORMAT;
+
+  int entry_ok = 0;
+  prog.nseg = 0;
+  for (uint32_t i = 0; i < eh.phnum; i++) {
+    if (ph[i].type != ELF_PT_LOAD || ph[i].memsz == 0)
+      continue;
+    /* below the stack, and not overlapping it */
+    if (prog.nseg == EXEC_MAX_SEGMENTS || ph[i].filesz > ph[i].memsz ||
+        !exec_user_range(ph[i].vaddr, ph[i].memsz) ||
+        ph[i].vaddr + ph[i].memsz > EXEC_STACK_TOP - EXEC_STACK_SIZE)
+      return EXEC_BAD_FORMAT;
+    segment_t *s = &prog.seg[prog.nseg++];
+    s->vaddr = ph[i].vaddr;
+    s->memsz = ph[i].memsz;
+    s->offset = ph[i].offset;
+    s->filesz = ph[i].filesz;
+    s->writable = (ph[i].flags & ELF_PF_W) != 0;
+    entry_ok |= eh.entry >= s->vaddr && eh.entry - s->vaddr < s->memsz;
+  }
+  if (!entry_ok)
+    return EXEC_BAD_FORMAT;
+  prog.entry = eh.entry;
+  return 0;
+}
+
+static uint8_t *frame_alloc(void) {
+  for (uint32_t i = 0; i < EXEC_MAX_FRAMES; i++) {
+    if (!frame_used[i]) {
+      frame_used[i] = 1;
+      prog.pages++;
+      return frames[i];
+    }
+  }
+  return NULL;
+}
+
+/* Bring in the page at page: the file bytes of every segment on it, zeros
+ * for the rest. A page two segments share is writable if either is. */
+static int load_page(uint32_t page) {
+  int found = page >= EXEC_STACK_TOP - EXEC_STACK_SIZE;
+  int writable = found;
+  for (uint32_t i = 0; i < prog.nseg; i++) {
+    const segment_t *s = &prog.seg[i];
+    if (page < s->vaddr + s->memsz && page + PAGE_SIZE > s->vaddr) {
+      found = 1;
+      writable |= s->writable;
+    }
+  }
+  if (!found)
+    return -1;
+
+  uint8_t *frame = frame_alloc();
+  if (!frame)
+    return -1;
+  memset(frame, 0, PAGE_SIZE);
+  for (uint32_t i = 0; i < prog.nseg; i++) {
+    const segment_t *s = &prog.seg[i];
+    uint32_t from = page > s->vaddr ? page : s->vaddr;
+    uint32_t to = s->vaddr + s->filesz;
+    if (to > page + PAGE_SIZE)
+      to = page + PAGE_SIZE;
+    if (from >= to)
+      continue;
+    int n = fs_read_at(prog.name, s->offset + (from - s->vaddr),
+                       frame + (from - page), to - from);
+    if (n != (int)(to - from))
+      return -1;
+  }
+  return paging_map_user(page, (uint32_t)(uintptr_t)frame, writable);
+}
+
+/* ===== faults ===== */
+
+static void put_hex(uint32_t v) {
+  char num[21];
+  vga_putstr("0x", 0x0C);
+  vga_putstr(utoa(v, num, 16), 0x0C);
+}
+
+static void kill(const char *what, uint32_t addr) {
+  vga_putstr(prog.name, 0x0C);
+  vga_putstr(": ", 0x0C);
+  vga_putstr(what, 0x0C);
+  vga_putstr(" at ", 0x0C);
+  put_hex(addr);
+  vga_putstr(", killed\n", 0x0C);
+  exec_exit(EXEC_KILLED);
+}
+
+/* A fault on a user address, from the program or from the kernel copying
+ * to or from it in a system call, loads the page if the program has one
+ * there. Loading reads the fs, so it runs with interrupts on. */
+static void page_fault(isr_frame_t *frame) {
+  uintptr_t cr2;
+  __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+  uint32_t addr = (uint32_t)cr2; /* user space is below 4 GiB either way */
+
+  int user_addr = cr2 >= PAGING_USER_BASE && cr2 < EXEC_STACK_TOP;
+  if (!prog.running || (!isr_from_user(frame) && !user_addr))
+    idt_fatal(frame);
+  if (!user_addr || (frame->err_code & PF_PRESENT))
+    kill("bad access", addr);
+
+  interrupts_enable();
+  int rc = load_page(addr & ~(PAGE_SIZE - 1));
+  interrupts_disable();
+  if (rc != 0)
+    kill(prog.pages == EXEC_MAX_FRAMES ? "out of memory" : "bad access",
+         addr);
+}
+
+static void user_fault(isr_frame_t *frame) {
+  if (!prog.running)
+    idt_fatal(frame);
+  char what[24] = "exception ";
+  char num[21];
+  strncpy(what + 10, utoa(frame->int_no, num, 10), sizeof(what) - 11);
+  kill(what, frame->eip);
+}
+
+void exec_init(void) {
+  idt_set_handler(EXC_PAGE_FAULT, page_fault);
+  idt_set_user_fault_handler(user_fault);
+}
+
+/* ===== running ===== */
+
+#ifdef __x86_64__
+/* to 32-bit compatibility mode: GDT_USER_CODE is a 32-bit segment */
+static void enter_user(uint32_t eip, uint32_t esp) {
+  __asm__ volatile("mov %0, %%ds\n\t"
+                   "mov %0, %%es\n\t"
+                   "mov %0, %%fs\n\t"
+                   "mov %0, %%gs\n\t"
+                   "pushq %0\n\t"
+                   "pushq %1\n\t"
+                   "pushq $0x202\n\t" /* IF */
+                   "pushq %2\n\t"
+                   "pushq %3\n\t"
+                   "iretq"
+                   :
+                   : "r"((uintptr_t)GDT_USER_DATA), "r"((uintptr_t)esp),
+                     "i"(GDT_USER_CODE), "r"((uintptr_t)eip)
+                   : "memory");
+}
+#else
+static void enter_user(uint32_t eip, uint32_t esp) {
+  __asm__ volatile("mov %0, %%ds\n\t"
+                   "mov %0, %%es\n\t"
+                   "mov %0, %%fs\n\t"
+                   "mov %0, %%gs\n\t"
+                   "push %0\n\t"
+                   "push %1\n\t"
+                   "push $0x202\n\t" /* IF */
+                   "push %2\n\t"
+                   "push %3\n\t"
+                   "iret"
+                   :
+                   : "r"(GDT_USER_DATA), "r"(esp), "i"(GDT_USER_CODE),
+                     "r"(eip)
+                   : "memory");
+}
+#endif
+
+/* Lay out the arguments at the top of the stack, faulting its first page
+ * in, and drop to ring 3. */
+static void program_main(void *arg) {
+  (void)arg;
+  uint32_t argv[EXEC_MAX_ARGS + 1];
+  uint32_t sp = EXEC_STACK_TOP - EXEC_ARGS_SIZE;
+  memcpy((void *)(uintptr_t)sp, prog.args, EXEC_ARGS_SIZE);
+
+  const char *p = prog.args;
+  for (int i = 0; i < prog.argc; i++) {
+    argv[i] = sp + (uint32_t)(p - prog.args);
+    p += strlen(p) + 1;
+  }
+  argv[prog.argc] = 0;
+  sp -= sizeof(uint32_t) * (prog.argc + 1);
+  memcpy((void *)(uintptr_t)sp, argv, sizeof(uint32_t) * (prog.argc + 1));
+  uint32_t *frame = (uint32_t *)(uintptr_t)(sp - 3 * sizeof(uint32_t));
+  frame[0] = 0; /* return address */
+  frame[1] = (uint32_t)prog.argc;
+  frame[2] = sp;
+  enter_user(prog.entry, (uint32_t)(uintptr_t)frame);
+}
+
+void exec_exit(int status) {
+  interrupts_disable();
+  paging_clear_user();
+  memset(frame_used, 0, sizeof(frame_used));
+  prog.status = status;
+  prog.running = 0;
+  sem_post(&prog.done);
+  thread_exit();
+  while (1) {
+  }
+}
+
+static int copy_args(int argc, char *argv[]) {
+  uint32_t pos = 0;
+  if (argc > EXEC_MAX_ARGS)
+    return -1;
+  for (int i = 0; i < argc; i++) {
+    uint32_t len = strlen(argv[i]) + 1;
+    if (pos + len > EXEC_ARGS_SIZE)
+      return -1;
+    memcpy(prog.args + pos, argv[i], len);
+    pos += len;
+  }
+  prog.argc = argc;
+  return 0;
+}
+
+int exec_run(int argc, char *argv[], int *status) {
+  if (argc < 1 || strlen(argv[0]) >= sizeof(prog.name))
+    return EXEC_NOT_FOUND;
+  if (__atomic_exchange_n(&prog.running, 1, __ATOMIC_ACQUIRE))
+    return EXEC_BUSY;
+
+  strncpy(prog.name, argv[0], sizeof(prog.name) - 1);
+  prog.name[sizeof(prog.name) - 1] = '\0';
+  int rc = load_headers(prog.name);
+  if (rc == 0 && copy_args(argc, argv) != 0)
+    rc = EXEC_BAD_FORMAT;
+  prog.pages = 0;
+  sem_init(&prog.done, 0);
+  if (rc == 0 && !thread_create(argv[0], program_main, 0, PRIO_NORMAL))
+    rc = EXEC_BUSY;
+  if (rc != 0) {
+    prog.running = 0;
+    return rc;
+  }
+
+  sem_wait(&prog.done);
+  *status = prog.status;
+  return 0;
+}
+
+uint32_t exec_pages_used(void) { return prog.pages; }
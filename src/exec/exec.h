@@ -0,0 +1,40 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "../cpu/paging.h"
+#include <stdint.h>
+
+/* ELF32 programs from the filesystem, run in ring 3 one at a time on a
+ * thread of their own while the caller waits. Only the headers are read up
+ * front: a page of a segment is read from the file, or zeroed past its file
+ * bytes, the first time the program touches it, and the stack grows the
+ * same way. Programs call the kernel through int 0x80 (syscall.h).
+ *
+ * At the entry point the stack holds a null return address, argc and argv,
+ * as if _start(argc, argv) had been called. */
+
+#define EXEC_STACK_TOP PAGING_USER_TOP
+#define EXEC_STACK_SIZE 0x100000 /* at most; pages are added as touched */
+#define EXEC_MAX_FRAMES 1024     /* RAM for user pages, 4 MiB */
+#define EXEC_MAX_SEGMENTS 8
+#define EXEC_MAX_ARGS 16
+#define EXEC_ARGS_SIZE 512 /* argument strings, NULs included */
+
+#define EXEC_NOT_FOUND -1
+#define EXEC_BAD_FORMAT -2 /* not an i386 ELF32 executable for user space */
+#define EXEC_BUSY -3       /* a program is running, or no thread is free */
+#define EXEC_KILLED -1     /* the status of a program that faulted */
+
+void exec_init(void); /* take page faults and user exceptions */
+
+/* Run the program argv[0] and wait for it; 0 and its exit status, or one
+ * of the errors above. */
+int exec_run(int argc, char *argv[], int *status);
+/* pages the last program touched */
+uint32_t exec_pages_used(void);
+
+/* For the system calls, on the program's own thread: */
+int exec_user_range(uint32_t addr, uint32_t len); /* 1 if in user space */
+void exec_exit(int status) __attribute__((noreturn));
+
+#endif
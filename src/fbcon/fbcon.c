@@ -0,0 +1,262 @@
+#include "fbcon.h"
+#include "../clib/clib.h"
+#include "../cpu/paging.h"
+#include "../pci/pci.h"
+#include "../trace/trace.h"
+
+/* VGA registers for reading the font out of plane 2 */
+#define VGA_SEQ_INDEX 0x3C4
+#define VGA_SEQ_DATA 0x3C5
+#define VGA_GC_INDEX 0x3CE
+#define VGA_GC_DATA 0x3CF
+#define VGA_SEQ_MEMORY_MODE 0x04
+#define VGA_GC_READ_MAP 0x04
+#define VGA_GC_MODE 0x05
+#define VGA_GC_MISC 0x06
+#define VGA_PLANES 0xA0000
+#define VGA_PLANES_SIZE 0x10000
+#define VGA_FONT_STRIDE 32 /* bytes per character in plane 2 */
+
+/* Bochs VBE ("dispi") registers, on QEMU's std VGA and bochs-display */
+#define DISPI_INDEX 0x1CE
+#define DISPI_DATA 0x1CF
+#define DISPI_ID 0
+#define DISPI_XRES 1
+#define DISPI_YRES 2
+#define DISPI_BPP 3
+#define DISPI_ENABLE 4
+#define DISPI_ID_MIN 0xB0C0
+#define DISPI_ENABLED 0x01
+#define DISPI_LFB 0x40
+#define BOCHS_VGA_ID 0x11111234 /* device 1111, vendor 1234 */
+#define PCI_CLASS_DISPLAY 0x03
+#define PCI_SUBCLASS_VGA 0x00
+
+#define CACHE_SLOTS 512 /* direct-mapped, by character and attribute */
+
+typedef struct {
+  uint32_t key; /* the cell, or CACHE_EMPTY */
+  uint32_t run; /* last draw_run that used it */
+  uint32_t px[FBCON_GLYPH_HEIGHT][FBCON_GLYPH_WIDTH];
+} glyph_t;
+
+#define CACHE_EMPTY 0xFFFFFFFF
+
+static uint8_t font[256][FBCON_GLYPH_HEIGHT];
+static glyph_t cache[CACHE_SLOTS];
+static uint32_t palette[16];
+static uint16_t shown[FBCON_MAX_COLS * FBCON_MAX_ROWS];
+static uint8_t *fb_base;
+static uint32_t fb_pitch, cols, rows;
+
+static const uint8_t cga_rgb[16][3] = {
+    {0x00, 0x00, 0x00}, {0x00, 0x00, 0xAA}, {0x00, 0xAA, 0x00},
+    {0x00, 0xAA, 0xAA}, {0xAA, 0x00, 0x00}, {0xAA, 0x00, 0xAA},
+    {0xAA, 0x55, 0x00}, {0xAA, 0xAA, 0xAA}, {0x55, 0x55, 0x55},
+    {0x55, 0x55, 0xFF}, {0x55, 0xFF, 0x55}, {0x55, 0xFF, 0xFF},
+    {0xFF, 0x55, 0x55}, {0xFF, 0x55, 0xFF}, {0xFF, 0xFF, 0x55},
+    {0xFF, 0xFF, 0xFF},
+};
+
+static uint8_t vga_read(uint16_t index_port, uint8_t index) {
+  outb(index_port, index);
+  return inb(index_port + 1);
+}
+
+static void vga_write(uint16_t index_port, uint8_t index, uint8_t value) {
+  outb(index_port, index);
+  outb(index_port + 1, value);
+}
+
+/* The BIOS loaded its font into plane 2, which text mode interleaves with
+ * the others; switch to plain planar reads of it at 0xA0000 and back. */
+static int read_font(void) {
+  uint8_t seq_mode = vga_read(VGA_SEQ_INDEX, VGA_SEQ_MEMORY_MODE);
+  uint8_t gc_map = vga_read(VGA_GC_INDEX, VGA_GC_READ_MAP);
+  uint8_t gc_mode = vga_read(VGA_GC_INDEX, VGA_GC_MODE);
+  uint8_t gc_misc = vga_read(VGA_GC_INDEX, VGA_GC_MISC);
+  const volatile uint8_t *planes =
+      paging_map(VGA_PLANES, VGA_PLANES_SIZE, PAGING_UC);
+  if (!planes)
+    return -1;
+
+  vga_write(VGA_SEQ_INDEX, VGA_SEQ_MEMORY_MODE, 0x06); /* no odd/even */
+  vga_write(VGA_GC_INDEX, VGA_GC_READ_MAP, 2);
+  vga_write(VGA_GC_INDEX, VGA_GC_MODE, 0x00);
+  vga_write(VGA_GC_INDEX, VGA_GC_MISC, 0x04); /* 64 KiB at 0xA0000 */
+  for (uint32_t c = 0; c < 256; c++)
+    for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++)
+      font[c][y] = planes[c * VGA_FONT_STRIDE + y];
+  vga_write(VGA_SEQ_INDEX, VGA_SEQ_MEMORY_MODE, seq_mode);
+  vga_write(VGA_GC_INDEX, VGA_GC_READ_MAP, gc_map);
+  vga_write(VGA_GC_INDEX, VGA_GC_MODE, gc_mode);
+  vga_write(VGA_GC_INDEX, VGA_GC_MISC, gc_misc);
+  paging_unmap((void *)planes, VGA_PLANES_SIZE);
+
+  /* a card in graphics mode has no font there: want a blank space and
+   * an 'A' with something in it */
+  uint32_t space = 0, a = 0;
+  for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+    space |= font[' '][y];
+    a |= font['A'][y];
+  }
+  return space == 0 && a != 0 ? 0 : -1;
+}
+
+static uint16_t dispi_read(uint16_t index) {
+  outw(DISPI_INDEX, index);
+  return inw(DISPI_DATA);
+}
+
+static void dispi_write(uint16_t index, uint16_t value) {
+  outw(DISPI_INDEX, index);
+  outw(DISPI_DATA, value);
+}
+
+/* the std VGA's linear framebuffer is BAR 0; the mode is x8r8g8b8 */
+static int bochs_mode(bootinfo_fb_t *fb) {
+  pci_addr_t addr;
+  uint32_t size;
+  if (pci_find_class(PCI_CLASS_DISPLAY, PCI_SUBCLASS_VGA, &addr) != 0 ||
+      pci_read32(addr, PCI_VENDOR_ID) != BOCHS_VGA_ID ||
+      dispi_read(DISPI_ID) < DISPI_ID_MIN)
+    return -1;
+  fb->addr = pci_bar_mem(addr, 0, &size);
+  if (!fb->addr ||
+      size < (uint32_t)FBCON_MODE_WIDTH * FBCON_MODE_HEIGHT * 4)
+    return -1;
+  pci_write32(addr, PCI_COMMAND,
+              pci_read32(addr, PCI_COMMAND) | PCI_COMMAND_MEMORY);
+
+  dispi_write(DISPI_ENABLE, 0);
+  dispi_write(DISPI_XRES, FBCON_MODE_WIDTH);
+  dispi_write(DISPI_YRES, FBCON_MODE_HEIGHT);
+  dispi_write(DISPI_BPP, 32);
+  dispi_write(DISPI_ENABLE, DISPI_ENABLED | DISPI_LFB);
+  fb->width = FBCON_MODE_WIDTH;
+  fb->height = FBCON_MODE_HEIGHT;
+  fb->pitch = FBCON_MODE_WIDTH * 4;
+  fb->bpp = 32;
+  fb->red_pos = 16;
+  fb->green_pos = 8;
+  fb->blue_pos = 0;
+  return 0;
+}
+
+int fbcon_init(const bootinfo_fb_t *boot_fb, uint32_t *out_cols,
+               uint32_t *out_rows) {
+  bootinfo_fb_t fb = *boot_fb;
+  if (read_font() != 0)
+    return -1;
+  /* only 32-bit pixels, below 4 GiB, and room for the text screen */
+  if (fb.addr && (fb.bpp != 32 || fb.addr >> 32 ||
+                  fb.width < 80 * FBCON_GLYPH_WIDTH ||
+                  fb.height < 25 * FBCON_GLYPH_HEIGHT))
+    fb.addr = 0;
+  if (!fb.addr && bochs_mode(&fb) != 0)
+    return -1;
+
+  fb_base = paging_map((uint32_t)fb.addr, fb.pitch * fb.height, PAGING_WC);
+  if (!fb_base)
+    return -1;
+  fb_pitch = fb.pitch;
+  cols = fb.width / FBCON_GLYPH_WIDTH;
+  rows = fb.height / FBCON_GLYPH_HEIGHT;
+  if (cols > FBCON_MAX_COLS)
+    cols = FBCON_MAX_COLS;
+  if (rows > FBCON_MAX_ROWS)
+    rows = FBCON_MAX_ROWS;
+
+  for (uint32_t i = 0; i < 16; i++)
+    palette[i] = (uint32_t)cga_rgb[i][0] << fb.red_pos |
+                 (uint32_t)cga_rgb[i][1] << fb.green_pos |
+                 (uint32_t)cga_rgb[i][2] << fb.blue_pos;
+  for (uint32_t i = 0; i < CACHE_SLOTS; i++)
+    cache[i].key = CACHE_EMPTY;
+  /* whatever is on screen now matches no cell, so all of it is drawn */
+  memset(shown, 0xFF, sizeof(shown));
+  *out_cols = cols;
+  *out_rows = rows;
+  return 0;
+}
+
+static glyph_t *glyph_slot(uint16_t cell) {
+  return &cache[((cell & 0xFF) ^ (cell >> 8) * 0x9D) & (CACHE_SLOTS - 1)];
+}
+
+/* the cell's slot, its pixels rendered into it on a miss */
+static glyph_t *glyph(uint16_t cell) {
+  uint32_t ch = cell & 0xFF, attr = cell >> 8;
+  glyph_t *g = glyph_slot(cell);
+  if (g->key == cell)
+    return g;
+
+  uint32_t fg = palette[attr & 0x0F], bg = palette[attr >> 4];
+  for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+    uint8_t bits = font[ch][y];
+    for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+      g->px[y][x] = bits & (0x80 >> x) ? fg : bg;
+  }
+  g->key = cell;
+  return g;
+}
+
+/* cells [c0, c1] of row r, one full pixel line of the run at a time */
+static void blit(const glyph_t *const *g, uint32_t r, uint32_t c0,
+                 uint32_t c1) {
+  uint8_t *line = fb_base + r * FBCON_GLYPH_HEIGHT * fb_pitch +
+                  c0 * FBCON_GLYPH_WIDTH * 4;
+  for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++, line += fb_pitch) {
+    uint32_t *dst = (uint32_t *)line;
+    for (uint32_t c = c0; c <= c1; c++) {
+      const uint32_t *src = g[c]->px[y];
+      for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+        *dst++ = src[x];
+    }
+  }
+}
+
+/* Glyphs are looked up for a whole run before any is copied, so a run
+ * is cut short where a cell would evict a slot an earlier cell of the
+ * same run still needs. */
+static void draw_run(const uint16_t *cells, uint32_t r, uint32_t c0,
+                     uint32_t c1) {
+  static uint32_t run;
+  const glyph_t *g[FBCON_MAX_COLS];
+  const uint16_t *row = cells + r * cols;
+  uint32_t start = c0;
+
+  while (start <= c1) {
+    uint32_t c = start;
+    run++;
+    for (; c <= c1; c++) {
+      glyph_t *slot = glyph_slot(row[c]);
+      if (slot->run == run && slot->key != row[c])
+        break;
+      g[c] = glyph(row[c]);
+      slot->run = run;
+    }
+    blit(g, r, start, c - 1);
+    start = c;
+  }
+  for (uint32_t c = c0; c <= c1; c++)
+    shown[r * cols + c] = row[c];
+}
+
+void fbcon_draw(const uint16_t *cells, uint32_t first, uint32_t last) {
+  TRACE_SCOPE(TP_VGA_FLUSH, last - first + 1);
+  if (last >= rows)
+    last = rows - 1;
+  for (uint32_t r = first; r <= last; r++) {
+    /* from the first changed cell to the last: the ones in between are
+     * cheaper to redraw than to skip, and keep the stores sequential */
+    uint32_t c0 = 0, c1 = cols;
+    while (c0 < cols && cells[r * cols + c0] == shown[r * cols + c0])
+      c0++;
+    if (c0 == cols)
+      continue;
+    while (c1 - 1 > c0 && cells[r * cols + c1 - 1] == shown[r * cols + c1 - 1])
+      c1--;
+    draw_run(cells, r, c0, c1 - 1);
+  }
+}
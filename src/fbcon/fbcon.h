@@ -0,0 +1,33 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "../bootinfo/bootinfo.h"
+#include <stdint.h>
+
+/* Text console drawn on a linear 32-bpp framebuffer: the one the loader
+ * set up, or else a mode set on QEMU's Bochs/std VGA. Cells are the same
+ * character + attribute words as VGA text mode, in the CGA palette, drawn
+ * with the 8x16 font read out of the VGA card while it is still in text
+ * mode. Each character/attribute pair is rendered once into a glyph cache
+ * of ready pixels; drawing copies those a pixel line at a time across a
+ * run of cells, so the write-combined framebuffer sees long sequential
+ * runs of 32-bit stores. */
+
+#define FBCON_GLYPH_WIDTH 8
+#define FBCON_GLYPH_HEIGHT 16
+#define FBCON_MODE_WIDTH 1024 /* what the Bochs VGA is set to */
+#define FBCON_MODE_HEIGHT 768
+#define FBCON_MAX_COLS 160 /* bigger framebuffers use part of the screen */
+#define FBCON_MAX_ROWS 64
+
+/* Take over a framebuffer and report the console size in cells, at least
+ * 80x25; -1, with the screen left alone, if there is none or no font.
+ * Call in text mode. */
+int fbcon_init(const bootinfo_fb_t *fb, uint32_t *cols, uint32_t *rows);
+
+/* Draw rows [first, last] of cells (cols per row), skipping the cells that
+ * are on screen already: after a scroll, only the cells that differ from
+ * the ones above them are redrawn. */
+void fbcon_draw(const uint16_t *cells, uint32_t first, uint32_t last);
+
+#endif
@@ -1,6 +1,8 @@
 #include "fs.h"
-#include "../disk/disk.h"
+#include "../bcache/bcache.h"
 #include "../kernel.h"
+#include "../lz4/lz4.h"
+#include "../trace/trace.h"
 #include "../vga/vga.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -8,9 +10,9 @@
 
 /* In-memory state */
 static fs_superblock_t superblock;
-static fs_file_entry_t file_table[FS_MAX_FILES];
 static uint32_t blocks_available = 0;
 static char current_directory[FS_FILENAME_LEN] = "/";
+static uint32_t batch_depth = 0; /* fs_batch_begin calls not yet ended */
 
 /* minimal kernel string helpers */
 static void k_strncpy(char *dst, const char *src, size_t n) {
@@ -34,9 +36,920 @@ static int k_strncmp(const char *a, const char *b, size_t n) {
 
 /* ===== Disk-backed filesystem implementation ===== */
 
+/* Block numbers in the superblock and the file table are in block_size
+ * units; the disk and the block cache work in FS_SECTOR_SIZE sectors. */
+static uint32_t sectors_per_block = 1;
+
+static inline uint32_t data_lba(uint32_t block) {
+  return (superblock.data_block + block) * sectors_per_block;
+}
+
+static inline uint32_t table_lba(void) {
+  return superblock.file_table_block * sectors_per_block;
+}
+
+/* a version 1 table holds only the fields before is_inline */
+#define FS_V1_ENTRY_SIZE offsetof(fs_file_entry_t, is_inline)
+
+static inline uint32_t entry_size(void) {
+  return superblock.version < 2 ? FS_V1_ENTRY_SIZE : sizeof(fs_file_entry_t);
+}
+
+static inline uint32_t inline_max(void) {
+  return superblock.version < 2 ? 0 : FS_INLINE_MAX;
+}
+
+static inline int hashed(void) { return superblock.version >= 3; }
+
+static inline uint32_t extent_blocks(uint32_t size) {
+  return (size + superblock.block_size - 1) / superblock.block_size;
+}
+
+static int valid_block_size(uint32_t size) {
+  if (size < FS_MIN_BLOCK_SIZE || size > FS_MAX_BLOCK_SIZE)
+    return 0;
+  return (size & (size - 1)) == 0;
+}
+
+static inline uint32_t inode_map_lba(void) {
+  return superblock.inode_map_block * sectors_per_block;
+}
+
+static inline uint32_t ref_map_lba(void) {
+  return superblock.ref_map_block * sectors_per_block;
+}
+
+/* Mount reads neither the bitmap of used slots nor the block reference
+ * counts of a version 3 filesystem: sector s of a map is read the first
+ * time anything looks at it. A sector that can't be read stays unloaded,
+ * and whatever needed it fails rather than take it for zeros. */
+static int fault_in(uint32_t lba, void *map, uint32_t bytes, uint8_t *loaded,
+                    uint32_t s) {
+  uint8_t sector[FS_SECTOR_SIZE];
+  uint32_t n = bytes - s * FS_SECTOR_SIZE;
+  if (bcache_read(lba + s, sector) != 0) {
+    vga_putstr("fs: metadata read failed\n", 0x0C);
+    return -1;
+  }
+  memcpy((uint8_t *)map + s * FS_SECTOR_SIZE, sector,
+         n < FS_SECTOR_SIZE ? n : FS_SECTOR_SIZE);
+  loaded[s] = 1;
+  return 0;
+}
+
+/* ===== block ownership =====
+ * Each data block carries a count of the entries whose extent covers it
+ * (reflink copies and dedup share extents), plus one for a file table that
+ * has grown into the data area. A block is free when its count is 0.
+ * Version 3 keeps the counts on disk after the superblock; older versions
+ * count them off the table at mount. */
+
+static uint16_t block_refs[FS_DISK_SECTORS];
+static uint8_t refs_dirty[FS_DISK_SECTORS * 2 / FS_SECTOR_SIZE];
+static uint8_t refs_loaded[FS_DISK_SECTORS * 2 / FS_SECTOR_SIZE];
+
+/* block's count, or NULL when its sector of the map can't be read */
+static inline uint16_t *ref(uint32_t block) {
+  uint32_t s = block * 2 / FS_SECTOR_SIZE;
+  if (!refs_loaded[s] &&
+      fault_in(ref_map_lba(), block_refs, blocks_available * 2, refs_loaded,
+               s) != 0)
+    return NULL;
+  return &block_refs[block];
+}
+
+/* a block whose count can't be read is taken as owned */
+static inline int owned(uint32_t block) {
+  uint16_t *r = ref(block);
+  return !r || *r;
+}
+
+/* the counts of [start, start + count) are all in memory */
+static int refs_readable(uint32_t start, uint32_t count) {
+  if (start == 0xFFFFFFFF)
+    return 1;
+  for (uint32_t b = start; b < start + count && b < blocks_available; b++) {
+    if (!ref(b))
+      return 0;
+  }
+  return 1;
+}
+
+/* -1, changing nothing, if some count can't be read */
+static int add_refs(uint32_t start, uint32_t count, int delta) {
+  if (!refs_readable(start, count))
+    return -1;
+  if (start == 0xFFFFFFFF)
+    return 0;
+  for (uint32_t b = start; b < start + count && b < blocks_available; b++) {
+    uint16_t *r = ref(b);
+    *r = (uint16_t)(*r + delta);
+    refs_dirty[b * 2 / FS_SECTOR_SIZE] = 1;
+  }
+  return 0;
+}
+
+/* nothing owns any of [start, start + count) */
+static int range_free(uint32_t start, uint32_t count) {
+  if (start + count > blocks_available)
+    return 0;
+  for (uint32_t b = start; b < start + count; b++) {
+    if (owned(b))
+      return 0;
+  }
+  return 1;
+}
+
+/* room for one more owner on every block of the range */
+static int can_share(uint32_t start, uint32_t count) {
+  for (uint32_t b = start; b < start + count && b < blocks_available; b++) {
+    uint16_t *r = ref(b);
+    if (!r || *r == 0xFFFF)
+      return 0;
+  }
+  return 1;
+}
+
+/* First-fit allocation; the caller takes the blocks with add_refs, which
+ * can't fail on them: the scan read every count up to the run's end. */
+static int allocate_blocks(uint32_t blocks_needed) {
+  TRACE_SCOPE(TP_FS_ALLOC, blocks_needed);
+  if (blocks_needed == 0)
+    return -1;
+
+  uint32_t run = 0;
+  for (uint32_t b = 0; b < blocks_available; b++) {
+    uint16_t *r = ref(b);
+    if (!r)
+      return -1;
+    run = *r ? 0 : run + 1;
+    if (run == blocks_needed)
+      return (int)(b + 1 - run);
+  }
+  return -1;
+}
+
+/* First run of free blocks in [pos, end): returns its start and sets
+ * *run_end, or returns end when there is none. */
+static uint32_t next_free_run(uint32_t pos, uint32_t end, uint32_t *run_end) {
+  while (pos < end && owned(pos))
+    pos++;
+  uint32_t e = pos;
+  while (e < end && !owned(e))
+    e++;
+  *run_end = e;
+  return pos;
+}
+
+/* Hand the blocks of [start, start + count) that nothing owns any more
+ * to the block cache for TRIM: ones a new extent or a reflink copy still
+ * covers stay. Called after fs_sync, so the table that frees them goes out
+ * first; in a batch the table is still held back, so they are left for
+ * fstrim. */
+static void discard_blocks(uint32_t start, uint32_t count) {
+  if (start == 0xFFFFFFFF || batch_depth)
+    return;
+  uint32_t end = start + count, run_end;
+  for (uint32_t pos = next_free_run(start, end, &run_end); pos < end;
+       pos = next_free_run(run_end, end, &run_end))
+    bcache_discard(data_lba(pos), (run_end - pos) * sectors_per_block);
+}
+
+/* bytes of e's extent its data takes up */
+static inline uint32_t stored_bytes(const fs_file_entry_t *e) {
+  return e->is_compressed ? e->ext.stored : e->size;
+}
+
+/* blocks an entry owns: its data plus any preallocated tail */
+static uint32_t entry_blocks(const fs_file_entry_t *e) {
+  if (e->start_block == 0xFFFFFFFF)
+    return 0;
+  return extent_blocks(stored_bytes(e)) + e->prealloc;
+}
+
+/* take (+1) or give up (-1) e's blocks */
+static inline int hold_extent(const fs_file_entry_t *e, int delta) {
+  return add_refs(e->start_block, entry_blocks(e), delta);
+}
+
+/* another entry shares e's extent, or may: it must not be written in
+ * place */
+static int extent_shared(const fs_file_entry_t *e) {
+  uint32_t blocks = entry_blocks(e);
+  for (uint32_t b = e->start_block; b < e->start_block + blocks; b++) {
+    uint16_t *r = ref(b);
+    if (!r || *r > 1)
+      return 1;
+  }
+  return 0;
+}
+
+/* ===== file table =====
+ * The table stays on disk and is read through the block cache an entry at
+ * a time; the entries in use are held in icache, a small LRU cache that
+ * fs_sync writes back, each entry only if it changed. A version 3 table
+ * is an open-addressed hash table on the full path with linear probing,
+ * so a lookup reads the slot or two its probe touches, and a bitmap of
+ * used slots finds a free slot without reading any. Once it is 3/4 full
+ * it doubles into a new extent in the data area. Versions 1 and 2 keep
+ * their fixed table, searched in order. */
+
+#define FS_ICACHE 64
+#define NO_SLOT 0xFFFFFFFF
+
+typedef struct {
+  fs_file_entry_t e;    /* first: an entry pointer is its icache_t */
+  fs_file_entry_t disk; /* e as the table on disk has it */
+  uint32_t slot;        /* NO_SLOT when free */
+  uint32_t used_at;     /* LRU stamp */
+} icache_t;
+
+static icache_t icache[FS_ICACHE];
+static uint32_t icache_clock = 0;
+static uint32_t inode_map[FS_MAX_INODES / 32];  /* used slots */
+static uint32_t cached_map[FS_MAX_INODES / 32]; /* slots in icache */
+static uint8_t inode_map_dirty[FS_MAX_INODES / 8 / FS_SECTOR_SIZE];
+static uint8_t inode_map_loaded[FS_MAX_INODES / 8 / FS_SECTOR_SIZE];
+static const fs_file_entry_t no_entry;
+
+static inline int test_bit(const uint32_t *map, uint32_t i) {
+  return map[i / 32] >> (i % 32) & 1;
+}
+
+static inline void put_bit(uint32_t *map, uint32_t i, int on) {
+  if (on)
+    map[i / 32] |= 1u << (i % 32);
+  else
+    map[i / 32] &= ~(1u << (i % 32));
+}
+
+/* word w of the bitmap, or NULL when its sector can't be read */
+static inline uint32_t *map_word(uint32_t w) {
+  uint32_t s = w * 4 / FS_SECTOR_SIZE;
+  if (!inode_map_loaded[s] &&
+      fault_in(inode_map_lba(), inode_map, superblock.max_files / 8,
+               inode_map_loaded, s) != 0)
+    return NULL;
+  return &inode_map[w];
+}
+
+/* 1 or 0, or -1 when the bitmap can't be read there */
+static inline int slot_used(uint32_t slot) {
+  uint32_t *w = map_word(slot / 32);
+  return w ? (int)(*w >> (slot % 32) & 1) : -1;
+}
+
+static int set_used(uint32_t slot, int on) {
+  uint32_t *w = map_word(slot / 32);
+  if (!w)
+    return -1;
+  if (on)
+    *w |= 1u << (slot % 32);
+  else
+    *w &= ~(1u << (slot % 32));
+  inode_map_dirty[slot / 8 / FS_SECTOR_SIZE] = 1;
+  return 0;
+}
+
+/* first used slot at or after slot, max_files when there is none, or
+ * NO_SLOT when the bitmap can't be read on the way */
+static uint32_t next_used(uint32_t slot) {
+  while (slot < superblock.max_files) {
+    uint32_t *w = map_word(slot / 32);
+    if (!w)
+      return NO_SLOT;
+    uint32_t word = *w >> (slot % 32);
+    if (word)
+      return slot + (uint32_t)__builtin_ctz(word);
+    slot = (slot | 31) + 1;
+  }
+  return superblock.max_files;
+}
+
+static uint32_t name_hash(const char *name) {
+  uint32_t h = 2166136261u; /* FNV-1a */
+  for (uint32_t i = 0; i < FS_FILENAME_LEN && name[i]; i++)
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  return h ^ h >> 16;
+}
+
+static inline uint32_t home_slot(const char *name) {
+  return name_hash(name) & (superblock.max_files - 1);
+}
+
+/* The fingerprint index: the slots whose entries on disk carry a dedup
+ * fingerprint, chained by it into buckets so a write looks at the few
+ * files that may hold the same bytes rather than the whole table. Built
+ * by the first lookup after a mount or a table growth, then kept up by
+ * store_entry. */
+
+#define TWIN_BUCKETS 16384
+
+static uint8_t twin_built = 0;
+static uint32_t twin_head[TWIN_BUCKETS]; /* first slot + 1, 0 if none */
+static uint32_t twin_next[FS_MAX_INODES];
+static uint16_t twin_bucket[FS_MAX_INODES]; /* bucket + 1, 0 if unlinked */
+
+/* e has an extent a write of the same bytes could share */
+static int twin_candidate(const fs_file_entry_t *e) {
+  return inline_max() && e->used && !e->is_directory && !e->is_inline &&
+         e->start_block != 0xFFFFFFFF && e->ext.hash != 0;
+}
+
+/* slot holds e on disk now */
+static void twin_index(uint32_t slot, const fs_file_entry_t *e) {
+  if (!twin_built)
+    return;
+  if (twin_bucket[slot]) {
+    uint32_t *p = &twin_head[twin_bucket[slot] - 1];
+    while (*p != slot + 1)
+      p = &twin_next[*p - 1];
+    *p = twin_next[slot];
+    twin_bucket[slot] = 0;
+  }
+  if (!twin_candidate(e))
+    return;
+  uint32_t b = (uint32_t)e->ext.hash & (TWIN_BUCKETS - 1);
+  twin_next[slot] = twin_head[b];
+  twin_head[b] = slot + 1;
+  twin_bucket[slot] = (uint16_t)(b + 1);
+}
+
+/* Copy entry slot of the table at lba between the disk, through the block
+ * cache, and *e. A version 1 entry may straddle two sectors. A store skips
+ * sectors it wouldn't change, so writing back clean entries is cheap. */
+static int load_entry(uint32_t lba, uint32_t slot, fs_file_entry_t *e) {
+  uint8_t sector[FS_SECTOR_SIZE];
+  uint32_t esize = entry_size(), offset = slot * esize;
+  memset(e, 0, sizeof(*e));
+  for (uint32_t n = 0; n < esize;) {
+    uint32_t in = (offset + n) % FS_SECTOR_SIZE;
+    uint32_t chunk = esize - n;
+    if (chunk > FS_SECTOR_SIZE - in)
+      chunk = FS_SECTOR_SIZE - in;
+    if (bcache_read(lba + (offset + n) / FS_SECTOR_SIZE, sector) != 0)
+      return -1;
+    memcpy((uint8_t *)e + n, sector + in, chunk);
+    n += chunk;
+  }
+  return 0;
+}
+
+static int store_entry(uint32_t lba, uint32_t slot, const fs_file_entry_t *e) {
+  uint8_t sector[FS_SECTOR_SIZE];
+  uint32_t esize = entry_size(), offset = slot * esize;
+  for (uint32_t n = 0; n < esize;) {
+    uint32_t at = lba + (offset + n) / FS_SECTOR_SIZE;
+    uint32_t in = (offset + n) % FS_SECTOR_SIZE;
+    uint32_t chunk = esize - n;
+    if (chunk > FS_SECTOR_SIZE - in)
+      chunk = FS_SECTOR_SIZE - in;
+    if (bcache_read(at, sector) != 0)
+      return -1;
+    if (memcmp(sector + in, (const uint8_t *)e + n, chunk) != 0) {
+      memcpy(sector + in, (const uint8_t *)e + n, chunk);
+      if (bcache_write(at, sector) != 0)
+        return -1;
+    }
+    n += chunk;
+  }
+  if (lba == table_lba())
+    twin_index(slot, e);
+  return 0;
+}
+
+/* In a batch the table is left alone: entry writes wait here, and reads
+ * look here first, until write_metadata commits them. The batch commits
+ * early, between operations, once this is more than half full; writes
+ * one operation makes past the end go straight to the table. */
+
+#define FS_DEFERRED 1024
+
+typedef struct {
+  uint32_t slot;
+  fs_file_entry_t e;
+} deferred_t;
+
+static deferred_t deferred[FS_DEFERRED];
+static uint32_t deferred_count = 0;
+static uint32_t deferred_map[FS_MAX_INODES / 32]; /* slots in deferred */
+static uint32_t deferred_spills = 0; /* writes let through since a commit */
+static int batch_split = 0;          /* the open batch committed early */
+
+static deferred_t *deferred_find(uint32_t slot) {
+  if (!test_bit(deferred_map, slot))
+    return NULL;
+  for (uint32_t i = 0; i < deferred_count; i++) {
+    if (deferred[i].slot == slot)
+      return &deferred[i];
+  }
+  return NULL;
+}
+
+static void deferred_drop(void) {
+  for (uint32_t i = 0; i < deferred_count; i++)
+    put_bit(deferred_map, deferred[i].slot, 0);
+  deferred_count = 0;
+}
+
+/* slot's entry as the table has it, deferred writes included */
+static int get_entry(uint32_t slot, fs_file_entry_t *e) {
+  deferred_t *d = deferred_find(slot);
+  if (d) {
+    *e = d->e;
+    return 0;
+  }
+  return load_entry(table_lba(), slot, e);
+}
+
+/* A write to a slot with one deferred already replaces it, so that the
+ * older one doesn't land on top when they are committed. */
+static int put_entry(uint32_t slot, const fs_file_entry_t *e) {
+  deferred_t *d = deferred_find(slot);
+  if (!d && batch_depth && deferred_count == FS_DEFERRED)
+    deferred_spills++;
+  else if (!d && batch_depth) {
+    d = &deferred[deferred_count++];
+    d->slot = slot;
+    put_bit(deferred_map, slot, 1);
+  }
+  if (d) {
+    d->e = *e;
+    return 0;
+  }
+  return store_entry(table_lba(), slot, e);
+}
+
+/* the deferred writes to the table; they stay deferred if one fails */
+static int write_deferred(void) {
+  for (uint32_t i = 0; i < deferred_count; i++) {
+    if (store_entry(table_lba(), deferred[i].slot, &deferred[i].e) != 0)
+      return -1;
+  }
+  deferred_drop();
+  return 0;
+}
+
+static int write_back(icache_t *c) {
+  if (memcmp(&c->e, &c->disk, sizeof(c->e)) == 0)
+    return 0;
+  c->disk = c->e;
+  return put_entry(c->slot, &c->e);
+}
+
+static icache_t *icache_find(uint32_t slot) {
+  if (!test_bit(cached_map, slot))
+    return NULL;
+  for (uint32_t i = 0; i < FS_ICACHE; i++) {
+    if (icache[i].slot == slot)
+      return &icache[i];
+  }
+  return NULL;
+}
+
+static void icache_drop(icache_t *c) {
+  put_bit(cached_map, c->slot, 0);
+  c->slot = NO_SLOT;
+}
+
+static void icache_reset(void) {
+  for (uint32_t i = 0; i < FS_ICACHE; i++)
+    icache[i].slot = NO_SLOT;
+  memset(cached_map, 0, sizeof(cached_map));
+}
+
+/* A cache slot for slot's entry, which is empty on disk: a free one or the
+ * least recently used, written back first. An operation holds at most a
+ * few entries, all used more recently than the one this evicts. */
+static icache_t *icache_claim(uint32_t slot) {
+  icache_t *c = &icache[0];
+  for (uint32_t i = 0; i < FS_ICACHE; i++) {
+    if (icache[i].slot == NO_SLOT) {
+      c = &icache[i];
+      break;
+    }
+    if (icache[i].used_at < c->used_at)
+      c = &icache[i];
+  }
+  if (c->slot != NO_SLOT) {
+    write_back(c);
+    icache_drop(c);
+  }
+  c->disk = no_entry;
+  c->slot = slot;
+  c->used_at = ++icache_clock;
+  put_bit(cached_map, slot, 1);
+  return c;
+}
+
+/* slot's entry, held in icache for the caller to read and change */
+static fs_file_entry_t *entry_at(uint32_t slot) {
+  icache_t *c = icache_find(slot);
+  if (c) {
+    c->used_at = ++icache_clock;
+    return &c->e;
+  }
+  c = icache_claim(slot);
+  get_entry(slot, &c->e);
+  c->disk = c->e;
+  return &c->e;
+}
+
+static inline uint32_t slot_of(const fs_file_entry_t *e) {
+  return ((const icache_t *)e)->slot;
+}
+
+/* slot's entry for a scan, without caching it: in *tmp unless it is
+ * cached already, and good until the next call with the same tmp */
+static const fs_file_entry_t *peek(uint32_t slot, fs_file_entry_t *tmp) {
+  icache_t *c = icache_find(slot);
+  if (c)
+    return &c->e;
+  get_entry(slot, tmp);
+  return tmp;
+}
+
+/* the slot holding path, or NO_SLOT; also when the bitmap can't be read
+ * along its probe */
+static uint32_t find_slot(const char *path) {
+  fs_file_entry_t tmp;
+  uint32_t cap = superblock.max_files;
+  if (!hashed()) {
+    for (uint32_t i = next_used(0); i < cap; i = next_used(i + 1)) {
+      if (k_strncmp(peek(i, &tmp)->name, path, FS_FILENAME_LEN) == 0)
+        return i;
+    }
+    return NO_SLOT;
+  }
+  uint32_t i = home_slot(path);
+  for (uint32_t n = 0; n < cap && slot_used(i) == 1; n++) {
+    if (k_strncmp(peek(i, &tmp)->name, path, FS_FILENAME_LEN) == 0)
+      return i;
+    i = (i + 1) & (cap - 1);
+  }
+  return NO_SLOT;
+}
+
+/* the first free slot of path's probe sequence, or NO_SLOT if it is full
+ * or the bitmap can't be read before one turns up */
+static uint32_t probe_free(const char *path) {
+  uint32_t cap = superblock.max_files;
+  if (!hashed()) {
+    for (uint32_t w = 0; w < cap / 32; w++) {
+      uint32_t *word = map_word(w);
+      if (!word)
+        return NO_SLOT;
+      if (*word != 0xFFFFFFFF)
+        return w * 32 + (uint32_t)__builtin_ctz(~*word);
+    }
+    return NO_SLOT;
+  }
+  uint32_t i = home_slot(path);
+  for (uint32_t n = 0; n < cap; n++) {
+    int used = slot_used(i);
+    if (used < 0)
+      return NO_SLOT;
+    if (!used)
+      return i;
+    i = (i + 1) & (cap - 1);
+  }
+  return NO_SLOT;
+}
+
+/* Move the entry in slot from to the free slot to. A cached entry keeps
+ * its cache slot, so a pointer to it follows it. */
+static void move_slot(uint32_t from, uint32_t to) {
+  icache_t *c = icache_find(from);
+  if (c) {
+    put_bit(cached_map, from, 0);
+    put_bit(cached_map, to, 1);
+    c->slot = to;
+    c->disk = no_entry;
+  } else {
+    fs_file_entry_t tmp;
+    get_entry(from, &tmp);
+    put_entry(to, &tmp);
+  }
+  put_entry(from, &no_entry);
+  set_used(to, 1);
+  set_used(from, 0);
+}
+
+/* the bitmap from slot up to the next free slot can be read */
+static int run_readable(uint32_t slot) {
+  uint32_t mask = superblock.max_files - 1;
+  int used = 1;
+  for (uint32_t n = 0; used > 0 && n <= mask; n++, slot = (slot + 1) & mask)
+    used = slot_used(slot);
+  return used >= 0;
+}
+
+/* Empty slot. In a hash table the entries after it in its probe run are
+ * shifted back over the hole, so no lookup stops short of them: one stays
+ * put if its home lies between the hole and it. The run's bitmap is read
+ * first, so a failure to read it leaves the table as it was. */
+static int remove_slot(uint32_t slot) {
+  if (hashed() && !run_readable(slot))
+    return -1;
+  icache_t *c = icache_find(slot);
+  if (c)
+    icache_drop(c);
+  put_entry(slot, &no_entry);
+  set_used(slot, 0);
+  if (!hashed())
+    return 0;
+
+  fs_file_entry_t tmp;
+  uint32_t mask = superblock.max_files - 1, hole = slot;
+  for (uint32_t i = (slot + 1) & mask; slot_used(i) == 1;
+       i = (i + 1) & mask) {
+    uint32_t home = home_slot(peek(i, &tmp)->name);
+    if (((i - home) & mask) < ((i - hole) & mask))
+      continue;
+    move_slot(i, hole);
+    hole = i;
+  }
+  return 0;
+}
+
+/* Give the entry in slot a new name, and in a hash table its new slot.
+ * Removing the entry only frees slots, so once the bitmap along the new
+ * name's probe has been read, finding it a slot can't fail: the one just
+ * emptied, at worst. */
+static int rename_slot(uint32_t slot, const char *name) {
+  fs_file_entry_t moved;
+  if (!hashed()) {
+    k_strncpy(entry_at(slot)->name, name, FS_FILENAME_LEN);
+    return 0;
+  }
+  get_entry(slot, &moved);
+  icache_t *c = icache_find(slot);
+  if (c)
+    moved = c->e;
+  k_strncpy(moved.name, name, FS_FILENAME_LEN);
+  if (!run_readable(home_slot(moved.name)) || remove_slot(slot) != 0)
+    return -1;
+  slot = probe_free(moved.name);
+  set_used(slot, 1);
+  icache_claim(slot)->e = moved;
+  return 0;
+}
+
+static int write_back_entries(void) {
+  for (uint32_t i = 0; i < FS_ICACHE; i++) {
+    if (icache[i].slot != NO_SLOT && write_back(&icache[i]) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* write count bytes of map from lba on, the sectors marked in dirty */
+static int write_map(uint32_t lba, const void *map, uint32_t bytes,
+                     uint8_t *dirty) {
+  uint8_t sector[FS_SECTOR_SIZE];
+  for (uint32_t s = 0; s * FS_SECTOR_SIZE < bytes; s++) {
+    if (!dirty[s])
+      continue;
+    uint32_t n = bytes - s * FS_SECTOR_SIZE;
+    memset(sector, 0, FS_SECTOR_SIZE);
+    memcpy(sector, (const uint8_t *)map + s * FS_SECTOR_SIZE,
+           n < FS_SECTOR_SIZE ? n : FS_SECTOR_SIZE);
+    if (bcache_write(lba + s, sector) != 0)
+      return -1;
+    dirty[s] = 0;
+  }
+  return 0;
+}
+
+/* The table extent the superblock on disk points at is kept when the table
+ * grows out of it, until the superblock that replaces it is written: a
+ * batch may go on for a while before it is. */
+static uint32_t committed_table;      /* inode_map_block on disk */
+static uint32_t retired_start = 0;    /* that extent once replaced, */
+static uint32_t retired_blocks = 0;   /* blocks from the data area */
+
+static void mounted(void) {
+  sectors_per_block = superblock.block_size / FS_SECTOR_SIZE;
+  blocks_available = superblock.total_blocks - superblock.data_block;
+  bcache_set_meta_end(superblock.data_block * sectors_per_block);
+  /* a table that has grown into the data area is metadata all the same */
+  if (hashed() && superblock.inode_map_block >= superblock.data_block)
+    bcache_set_meta_run(inode_map_lba(),
+                        superblock.table_blocks * sectors_per_block);
+  else
+    bcache_set_meta_run(0, 0);
+  icache_reset();
+  memset(inode_map, 0, sizeof(inode_map));
+  memset(inode_map_dirty, 0, sizeof(inode_map_dirty));
+  memset(block_refs, 0, sizeof(block_refs));
+  memset(refs_dirty, 0, sizeof(refs_dirty));
+  deferred_drop();
+  deferred_spills = 0;
+  batch_split = 0;
+  twin_built = 0;
+  committed_table = superblock.inode_map_block;
+  retired_blocks = 0;
+  /* only version 3 has maps on disk to fault in */
+  memset(inode_map_loaded, !hashed(), sizeof(inode_map_loaded));
+  memset(refs_loaded, !hashed(), sizeof(refs_loaded));
+}
+
+/* superblock, table and maps into the block cache: what fs_sync does
+ * outside a batch */
+static int write_metadata(void) {
+  TRACE_SCOPE(TP_FS_SYNC, 0);
+  uint8_t sector[FS_SECTOR_SIZE];
+  /* data first: the table must not reach the disk ahead of the blocks it
+   * points at */
+  if (bcache_barrier() != 0)
+    return -1;
+  memset(sector, 0, FS_SECTOR_SIZE);
+  memcpy(sector, &superblock, sizeof(fs_superblock_t));
+  if (bcache_write(0, sector) != 0)
+    return -1;
+
+  if (write_back_entries() != 0 || write_deferred() != 0)
+    return -1;
+  uint32_t freed_start = retired_start, freed_blocks = retired_blocks;
+  retired_blocks = 0;
+  add_refs(freed_start, freed_blocks, -1); /* read in when it was retired */
+  if (hashed() &&
+      (write_map(inode_map_lba(), inode_map, superblock.max_files / 8,
+                 inode_map_dirty) != 0 ||
+       write_map(ref_map_lba(), block_refs, blocks_available * 2,
+                 refs_dirty) != 0))
+    return -1;
+  if (bcache_barrier() != 0)
+    return -1;
+  committed_table = superblock.inode_map_block;
+  deferred_spills = 0;
+  discard_blocks(freed_start, freed_blocks);
+  return 0;
+}
+
+/* the new table's bitmap, built aside until it is safely on disk */
+static uint32_t grown_map[FS_MAX_INODES / 32];
+static uint8_t grown_dirty[FS_MAX_INODES / 8 / FS_SECTOR_SIZE];
+
+/* Double the table into a new extent, rehashing every entry. Cached
+ * entries follow theirs, so pointers held across a create stay good. The
+ * new table is flushed before the superblock points at it, which in a
+ * batch waits for its end like any other change. -1, with the old table
+ * still in use, when there is no room for it or it can't be written. */
+static int grow_table(void) {
+  uint32_t old_cap = superblock.max_files, cap = old_cap * 2;
+  if (cap > FS_MAX_INODES)
+    return -1;
+  uint32_t map_blocks = extent_blocks(cap / 8);
+  uint32_t blocks =
+      map_blocks + extent_blocks(cap * (uint32_t)sizeof(fs_file_entry_t));
+  /* the old extent is given up at the end, when it is too late to fail */
+  if (superblock.inode_map_block >= superblock.data_block &&
+      !refs_readable(superblock.inode_map_block - superblock.data_block,
+                     superblock.table_blocks))
+    return -1;
+  int start = allocate_blocks(blocks);
+  /* every entry goes across from the old table as it stands now */
+  if (start < 0 || write_back_entries() != 0)
+    return -1;
+  add_refs((uint32_t)start, blocks, 1);
+  bcache_discard_cancel(data_lba((uint32_t)start), blocks * sectors_per_block);
+
+  uint32_t new_lba = data_lba((uint32_t)start + map_blocks);
+  uint8_t zero[FS_SECTOR_SIZE];
+  memset(zero, 0, FS_SECTOR_SIZE);
+  int rc = 0;
+  for (uint32_t s = 0;
+       rc == 0 && s < cap * sizeof(fs_file_entry_t) / FS_SECTOR_SIZE; s++)
+    rc = bcache_write(new_lba + s, zero);
+  memset(grown_map, 0, cap / 8);
+  fs_file_entry_t tmp;
+  for (uint32_t i = 0; rc == 0 && i < old_cap; i++) {
+    rc = get_entry(i, &tmp);
+    if (rc != 0 || !tmp.used)
+      continue;
+    uint32_t j = name_hash(tmp.name) & (cap - 1);
+    while (test_bit(grown_map, j))
+      j = (j + 1) & (cap - 1);
+    put_bit(grown_map, j, 1);
+    rc = store_entry(new_lba, j, &tmp);
+  }
+  memset(grown_dirty, 1, (cap / 8 + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE);
+  if (rc != 0 ||
+      write_map(data_lba((uint32_t)start), grown_map, cap / 8,
+                grown_dirty) != 0 ||
+      bcache_flush() < 0) {
+    add_refs((uint32_t)start, blocks, -1);
+    return -1;
+  }
+
+  /* the new table is on disk: switch over to it */
+  memcpy(inode_map, grown_map, cap / 8);
+  memset(inode_map_dirty, 0, sizeof(inode_map_dirty));
+  memset(inode_map_loaded, 1, sizeof(inode_map_loaded));
+  twin_built = 0; /* every entry changes slot */
+  uint32_t old_block = superblock.inode_map_block;
+  uint32_t old_blocks = superblock.table_blocks;
+  superblock.max_files = cap;
+  superblock.inode_map_block = superblock.data_block + (uint32_t)start;
+  superblock.file_table_block = superblock.inode_map_block + map_blocks;
+  superblock.table_blocks = blocks;
+  bcache_set_meta_run(inode_map_lba(), blocks * sectors_per_block);
+  deferred_drop(); /* what was deferred is in the new table */
+  memset(cached_map, 0, sizeof(cached_map));
+  for (uint32_t i = 0; i < FS_ICACHE; i++) {
+    if (icache[i].slot != NO_SLOT) {
+      icache[i].slot = find_slot(icache[i].e.name);
+      put_bit(cached_map, icache[i].slot, 1);
+    }
+  }
+
+  /* The first table sits before the data area and is simply left behind.
+   * One grown inside a batch was never on disk, so it is free right away. */
+  if (old_block >= superblock.data_block) {
+    uint32_t old_start = old_block - superblock.data_block;
+    if (old_block == committed_table) {
+      retired_start = old_start;
+      retired_blocks = old_blocks;
+    } else {
+      add_refs(old_start, old_blocks, -1);
+    }
+  }
+  return batch_depth ? 0 : write_metadata();
+}
+
+/* A fresh entry for path, in a free slot after growing the table if it is
+ * getting full; NULL when there is no slot. */
+static fs_file_entry_t *new_entry(const char *path) {
+  if (hashed() && (superblock.num_files + 1) * 4 > superblock.max_files * 3)
+    grow_table(); /* else fill up what is left */
+  uint32_t slot = probe_free(path);
+  if (slot == NO_SLOT)
+    return NULL;
+  set_used(slot, 1);
+  fs_file_entry_t *e = &icache_claim(slot)->e;
+  memset(e, 0, sizeof(*e));
+  k_strncpy(e->name, path, FS_FILENAME_LEN);
+  e->start_block = 0xFFFFFFFF;
+  e->used = 1;
+  superblock.num_files++;
+  return e;
+}
+
+int fs_format(uint32_t block_size) {
+  if (!valid_block_size(block_size))
+    return -1;
+
+  memset(&superblock, 0, sizeof(superblock));
+  superblock.magic = FS_MAGIC;
+  superblock.version = FS_VERSION;
+  superblock.num_files = 0;
+  superblock.max_files = FS_MAX_FILES;
+  superblock.block_size = block_size;
+
+  /* assume disk image large enough; use a safe fixed limit (16MB) */
+  superblock.total_blocks = FS_DISK_SECTORS / (block_size / FS_SECTOR_SIZE);
+
+  /* superblock, block reference counts, then the first table: its bitmap
+   * and its entries */
+  superblock.ref_map_block = 1;
+  superblock.inode_map_block = 1 + extent_blocks(superblock.total_blocks * 2);
+  superblock.file_table_block =
+      superblock.inode_map_block + extent_blocks(FS_MAX_FILES / 8);
+  superblock.data_block =
+      superblock.file_table_block +
+      extent_blocks(FS_MAX_FILES * (uint32_t)sizeof(fs_file_entry_t));
+  superblock.table_blocks =
+      superblock.data_block - superblock.inode_map_block;
+  mounted();
+  /* the maps are all zero, as the sectors written below */
+  memset(inode_map_loaded, 1, sizeof(inode_map_loaded));
+  memset(refs_loaded, 1, sizeof(refs_loaded));
+
+  /* write fresh superblock */
+  uint8_t sector[FS_SECTOR_SIZE];
+  memset(sector, 0, FS_SECTOR_SIZE);
+  memcpy(sector, &superblock, sizeof(fs_superblock_t));
+  if (bcache_write(0, sector) != 0)
+    return -1;
+
+  /* zero reference counts, bitmap and table */
+  memset(sector, 0, FS_SECTOR_SIZE);
+  for (uint32_t lba = sectors_per_block; lba < data_lba(0); lba++) {
+    if (bcache_write(lba, sector) != 0)
+      return -1;
+  }
+  k_strncpy(current_directory, "/", FS_FILENAME_LEN);
+
+  /* nothing in the data area is live any more */
+  bcache_discard(data_lba(0), blocks_available * sectors_per_block);
+  return 0;
+}
+
 int fs_init(void) {
-  uint8_t sector[FS_BLOCK_SIZE];
-  if (disk_read_lba(0, sector) != 0) {
+  TRACE_SCOPE(TP_FS_INIT, 0);
+  uint8_t sector[FS_SECTOR_SIZE];
+  if (bcache_read(0, sector) != 0) {
     vga_putstr("fs_init: disk read failed\n", 0x0C);
     return -1;
   }
@@ -45,63 +958,51 @@ int fs_init(void) {
 
   if (superblock.magic != FS_MAGIC) {
     vga_putstr("fs: initializing fresh filesystem on disk\n", 0x0E);
-
-    superblock.magic = FS_MAGIC;
-    superblock.version = FS_VERSION;
-    superblock.num_files = 0;
-    superblock.max_files = FS_MAX_FILES;
-    superblock.block_size = FS_BLOCK_SIZE;
-
-    /* assume disk image large enough; use a safe fixed limit (e.g., 32768
-     * blocks = 16MB) */
-    superblock.total_blocks = 32768;
-
-    uint32_t file_table_bytes = FS_MAX_FILES * sizeof(fs_file_entry_t);
-    uint32_t file_table_blocks =
-        (file_table_bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
-    superblock.file_table_block = 1;
-    superblock.data_block = 1 + file_table_blocks;
-
-    /* write fresh superblock */
-    memset(sector, 0, FS_BLOCK_SIZE);
-    memcpy(sector, &superblock, sizeof(fs_superblock_t));
-    disk_write_lba(0, sector);
-
-    /* zero file table and data */
-    memset(file_table, 0, sizeof(file_table));
-    uint8_t zero[FS_BLOCK_SIZE];
-    memset(zero, 0, FS_BLOCK_SIZE);
-    for (uint32_t b = 0; b < file_table_blocks; b++) {
-      disk_write_lba(superblock.file_table_block + b, zero);
+    if (fs_format(FS_DEFAULT_BLOCK_SIZE) != 0) {
+      vga_putstr("fs_init: format failed\n", 0x0C);
+      return -1;
     }
-    /* (optional) zero data area if you want clean disk */
     vga_putstr("fs: filesystem created successfully\n", 0x0A);
-  } else {
-    vga_putstr("fs: found existing filesystem on disk\n", 0x0A);
-    /* load file table into memory */
-    uint32_t file_table_bytes = superblock.max_files * sizeof(fs_file_entry_t);
-    uint32_t file_table_blocks =
-        (file_table_bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
-    uint8_t buf[FS_BLOCK_SIZE];
-    for (uint32_t b = 0; b < file_table_blocks; b++) {
-      disk_read_lba(superblock.file_table_block + b, buf);
-      uint32_t offset = b * FS_BLOCK_SIZE;
-      uint32_t copy_bytes = FS_BLOCK_SIZE;
-      uint32_t remaining = file_table_bytes - offset;
-      if (remaining < copy_bytes)
-        copy_bytes = remaining;
-      memcpy(((uint8_t *)file_table) + offset, buf, copy_bytes);
-    }
+    return 0;
   }
 
-  blocks_available = superblock.total_blocks - superblock.data_block;
+  if (superblock.version == 0 || superblock.version > FS_VERSION) {
+    vga_putstr("fs_init: unsupported filesystem version\n", 0x0C);
+    return -1;
+  }
+  if (!valid_block_size(superblock.block_size)) {
+    vga_putstr("fs_init: bad block size in superblock\n", 0x0C);
+    return -1;
+  }
+  if (superblock.max_files > FS_MAX_INODES ||
+      (superblock.max_files & (superblock.max_files - 1)) != 0) {
+    vga_putstr("fs_init: bad file table size in superblock\n", 0x0C);
+    return -1;
+  }
+  vga_putstr("fs: found existing filesystem on disk\n", 0x0A);
+  mounted();
+
+  /* Version 3 is mounted: its maps and entries are read as they are
+   * used. Older tables are small and have no maps, so those are worked out
+   * from the entries here. */
+  if (hashed())
+    return 0;
+  fs_file_entry_t e;
+  for (uint32_t i = 0; i < superblock.max_files; i++) {
+    load_entry(table_lba(), i, &e);
+    if (!e.used)
+      continue;
+    put_bit(inode_map, i, 1);
+    hold_extent(&e, 1);
+  }
   return 0;
 }
 
-/* find file entry by name, considering current directory */
-static fs_file_entry_t *find_entry(const char *name) {
-  char full_path[FS_FILENAME_LEN * 2];
+uint32_t fs_block_size(void) { return superblock.block_size; }
 
+/* the name as stored in the table: relative to the current directory
+ * unless it starts with / */
+static void build_path(const char *name, char full_path[FS_FILENAME_LEN * 2]) {
   // If name starts with /, it's absolute
   if (name[0] == '/') {
     k_strncpy(full_path, name + 1, FS_FILENAME_LEN); // skip the /
@@ -128,126 +1029,305 @@ static fs_file_entry_t *find_entry(const char *name) {
     }
     full_path[j] = '\0';
   }
+}
+
+/* find file entry by name, considering current directory */
+static fs_file_entry_t *find_entry(const char *name) {
+  char full_path[FS_FILENAME_LEN * 2];
+  build_path(name, full_path);
+
+  uint32_t slot = find_slot(full_path);
+  return slot == NO_SLOT ? NULL : entry_at(slot);
+}
+
+/* Data moves as whole sectors straight from/to the caller's buffer, with
+ * only a partial last sector bounced; a file's blocks are contiguous, so
+ * its bytes are contiguous sectors from the first block's LBA. */
+static void write_bytes(uint32_t lba, const uint8_t *data, uint32_t len) {
+  uint32_t full = len / FS_SECTOR_SIZE;
+  uint32_t rest = len % FS_SECTOR_SIZE;
+  if (full)
+    bcache_write_sectors(lba, full, data);
+  if (rest) {
+    uint8_t sector[FS_SECTOR_SIZE];
+    memset(sector, 0, FS_SECTOR_SIZE);
+    memcpy(sector, data + full * FS_SECTOR_SIZE, rest);
+    bcache_write(lba + full, sector);
+  }
+}
+
+/* staging for block-to-block copies and compares */
+static uint8_t bounce[8 * FS_SECTOR_SIZE];
+
+static void read_bytes(uint32_t lba, uint8_t *buf, uint32_t len) {
+  uint32_t full = len / FS_SECTOR_SIZE;
+  uint32_t rest = len % FS_SECTOR_SIZE;
+  if (full)
+    bcache_read_sectors(lba, full, buf);
+  if (rest) {
+    uint8_t sector[FS_SECTOR_SIZE];
+    bcache_read(lba + full, sector);
+    memcpy(buf + full * FS_SECTOR_SIZE, sector, rest);
+  }
+}
+
+/* ===== compressed files =====
+ * The extent of a compressed file is a run of chunks, each holding the
+ * next FS_CHUNK_SIZE bytes of the file (the last may hold fewer) and
+ * starting on a sector: a chunk_hdr_t, then len bytes of LZ4, or of the
+ * raw data when len == raw because it didn't compress. Every chunk decodes
+ * on its own, so an append only re-encodes the last one. */
+
+typedef struct {
+  uint16_t len; /* bytes after the header */
+  uint16_t raw; /* bytes of file data they decode to */
+} chunk_hdr_t;
+
+static uint8_t chunk_buf[FS_CHUNK_SIZE];                /* raw chunk */
+static uint8_t zbuf[FS_CHUNK_SIZE + FS_SECTOR_SIZE]; /* header + payload */
+
+static inline uint32_t sector_round(uint32_t bytes) {
+  return (bytes + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE * FS_SECTOR_SIZE;
+}
+
+/* Encode the head bytes already in chunk_buf followed by data as chunks
+ * written from lba on; lba 0 (the superblock, never data) only measures.
+ * Returns the bytes they take and sets *last to the last one's offset. */
+static uint32_t put_chunks(uint32_t lba, uint32_t head, const uint8_t *data,
+                           uint32_t len, uint32_t *last) {
+  uint32_t stored = 0;
+  *last = 0;
+  while (head + len > 0) {
+    const uint8_t *raw = data;
+    uint32_t n = len < FS_CHUNK_SIZE - head ? len : FS_CHUNK_SIZE - head;
+    if (head) {
+      memcpy(chunk_buf + head, data, n);
+      raw = chunk_buf;
+    }
+    data += n;
+    len -= n;
+    n += head;
+    head = 0;
+
+    chunk_hdr_t hdr = {(uint16_t)lz4_compress(raw, n, zbuf + sizeof(hdr),
+                                              n - 1),
+                       (uint16_t)n};
+    if (hdr.len == 0) {
+      memcpy(zbuf + sizeof(hdr), raw, n);
+      hdr.len = (uint16_t)n;
+    }
+    memcpy(zbuf, &hdr, sizeof(hdr));
+    uint32_t bytes = sector_round(sizeof(hdr) + hdr.len);
+    if (lba) {
+      write_bytes(lba, zbuf, sizeof(hdr) + hdr.len);
+      lba += bytes / FS_SECTOR_SIZE;
+    }
+    *last = stored;
+    stored += bytes;
+  }
+  return stored;
+}
+
+/* Decode the chunk at lba into dst, which has room for cap bytes. Returns
+ * the bytes decoded and sets *sectors to the chunk's length on disk, or -1
+ * if it doesn't decode. */
+static int get_chunk(uint32_t lba, uint8_t *dst, uint32_t cap,
+                     uint32_t *sectors) {
+  chunk_hdr_t hdr;
+  if (bcache_read(lba, zbuf) != 0)
+    return -1;
+  memcpy(&hdr, zbuf, sizeof(hdr));
+  if (hdr.raw == 0 || hdr.raw > FS_CHUNK_SIZE || hdr.raw > cap ||
+      hdr.len > hdr.raw)
+    return -1;
+  *sectors = sector_round(sizeof(hdr) + hdr.len) / FS_SECTOR_SIZE;
+  if (*sectors > 1 &&
+      bcache_read_sectors(lba + 1, *sectors - 1, zbuf + FS_SECTOR_SIZE) != 0)
+    return -1;
 
-  // Now search for the full path
-  for (uint32_t i = 0; i < superblock.max_files; i++) {
-    if (file_table[i].used &&
-        k_strncmp(file_table[i].name, full_path, FS_FILENAME_LEN) == 0)
-      return &file_table[i];
+  if (hdr.len == hdr.raw) {
+    memcpy(dst, zbuf + sizeof(hdr), hdr.raw);
+    return hdr.raw;
   }
-  return NULL;
+  if (lz4_decompress(zbuf + sizeof(hdr), hdr.len, dst, hdr.raw) != hdr.raw)
+    return -1;
+  return hdr.raw;
 }
 
-/* first-fit allocation */
-static int allocate_blocks(uint32_t blocks_needed) {
-  if (blocks_needed == 0)
-    return -1;
+/* ===== dedup =====
+ * Files written with dedup on carry a fingerprint of their contents in
+ * their entry, where it survives a remount; the fingerprint index finds
+ * the entries with a given one. A write whose fingerprint and size match
+ * another file's, and whose bytes compare equal, shares that file's extent
+ * the way a reflink copy does. Extents are whole files, so that is the
+ * unit. */
 
-  uint32_t total_data_blocks = superblock.total_blocks - superblock.data_block;
-  for (uint32_t start = 0; start + blocks_needed <= total_data_blocks;
-       start++) {
-    uint8_t ok = 1;
-    for (uint32_t j = 0; j < superblock.max_files; j++) {
-      if (!file_table[j].used)
-        continue;
-      if (file_table[j].start_block == 0xFFFFFFFF)
-        continue;
+static int dedup_on = 0;
+static fs_dedup_stats_t dedup;
 
-      uint32_t a = file_table[j].start_block;
-      uint32_t b =
-          a + ((file_table[j].size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
-      uint32_t s1 = start, e1 = start + blocks_needed;
-      uint32_t s2 = a, e2 = b;
-      if (!(e1 <= s2 || e2 <= s1)) {
-        ok = 0;
-        break;
-      }
+static uint64_t fingerprint(const uint8_t *p, uint32_t len) {
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    h = (h ^ v) * 0xFF51AFD7ED558CCDull;
+    h ^= h >> 32;
+  }
+  for (; len; p++, len--)
+    h = (h ^ *p) * 0x100000001B3ull;
+  h ^= h >> 29;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 32;
+  return h ? h : 1; /* 0 means no fingerprint */
+}
+
+/* byte for byte, so a fingerprint collision can't share the wrong data */
+static int same_data(const fs_file_entry_t *e, const uint8_t *data,
+                     uint32_t size) {
+  uint32_t lba = data_lba(e->start_block);
+  if (e->is_compressed) {
+    uint32_t done = 0, sectors;
+    while (done < size) {
+      int n = get_chunk(lba, chunk_buf, size - done, &sectors);
+      if (n < 0 || memcmp(chunk_buf, data + done, (uint32_t)n) != 0)
+        return 0;
+      done += (uint32_t)n;
+      lba += sectors;
     }
-    if (ok)
-      return (int)start;
+    return 1;
   }
-  return -1;
+  for (uint32_t off = 0; off < size; off += sizeof(bounce)) {
+    uint32_t n = size - off < sizeof(bounce) ? size - off : sizeof(bounce);
+    read_bytes(lba + off / FS_SECTOR_SIZE, bounce, n);
+    if (memcmp(bounce, data + off, n) != 0)
+      return 0;
+  }
+  return 1;
 }
 
-int fs_create_file(const char *name) {
-  char full_path[FS_FILENAME_LEN * 2];
+/* index every fingerprinted entry on disk; 0 if the table can't be read */
+static int build_twins(void) {
+  fs_file_entry_t tmp;
+  memset(twin_head, 0, sizeof(twin_head));
+  memset(twin_bucket, 0, superblock.max_files * sizeof(twin_bucket[0]));
+  twin_built = 1;
+  uint32_t i;
+  for (i = next_used(0); i < superblock.max_files; i = next_used(i + 1)) {
+    if (load_entry(table_lba(), i, &tmp) != 0)
+      break;
+    twin_index(i, &tmp);
+  }
+  if (i != superblock.max_files)
+    twin_built = 0;
+  return twin_built;
+}
 
-  // Build full path
-  if (name[0] == '/') {
-    k_strncpy(full_path, name + 1, FS_FILENAME_LEN);
-  } else if (strcmp(current_directory, "/") == 0) {
-    k_strncpy(full_path, name, FS_FILENAME_LEN);
-  } else {
-    int i = 0, j = 0;
-    while (current_directory[i] && i < FS_FILENAME_LEN - 1) {
-      full_path[j++] = current_directory[i++];
+/* f holds these bytes; a fingerprint match that doesn't is a collision */
+static int is_twin(const fs_file_entry_t *f, uint64_t hash,
+                   const uint8_t *data, uint32_t size) {
+  if (!twin_candidate(f) || f->size != size || f->ext.hash != hash ||
+      !can_share(f->start_block, entry_blocks(f)))
+    return 0;
+  if (same_data(f, data, size))
+    return 1;
+  dedup.collisions++;
+  return 0;
+}
+
+/* A file holding these bytes, copied to *twin; 0 if there is none. The
+ * index has the entries as the disk does, so the cached and deferred ones,
+ * which may be newer, are looked at instead of their slots. */
+static int find_twin(uint64_t hash, const uint8_t *data, uint32_t size,
+                     fs_file_entry_t *twin) {
+  if (!twin_built && !build_twins())
+    return 0;
+  for (uint32_t i = 0; i < FS_ICACHE; i++) {
+    if (icache[i].slot != NO_SLOT && is_twin(&icache[i].e, hash, data, size)) {
+      *twin = icache[i].e;
+      return 1;
     }
-    if (j > 0 && full_path[j - 1] != '/') {
-      full_path[j++] = '/';
+  }
+  for (uint32_t i = 0; i < deferred_count; i++) {
+    if (!test_bit(cached_map, deferred[i].slot) &&
+        is_twin(&deferred[i].e, hash, data, size)) {
+      *twin = deferred[i].e;
+      return 1;
     }
-    i = 0;
-    while (name[i] && j < FS_FILENAME_LEN * 2 - 1) {
-      full_path[j++] = name[i++];
+  }
+  fs_file_entry_t tmp;
+  uint32_t b = (uint32_t)hash & (TWIN_BUCKETS - 1);
+  for (uint32_t s = twin_head[b]; s; s = twin_next[s - 1]) {
+    if (test_bit(cached_map, s - 1) || test_bit(deferred_map, s - 1) ||
+        load_entry(table_lba(), s - 1, &tmp) != 0)
+      continue;
+    if (is_twin(&tmp, hash, data, size)) {
+      *twin = tmp;
+      return 1;
     }
-    full_path[j] = '\0';
   }
+  return 0;
+}
+
+int fs_set_dedup(int on) {
+  if (inline_max() == 0)
+    return -3; /* no room for fingerprints in a version 1 entry */
+  dedup_on = on ? 1 : 0;
+  return 0;
+}
+
+int fs_dedup_enabled(void) { return dedup_on; }
+
+fs_dedup_stats_t fs_dedup_stats(void) { return dedup; }
+
+/* new files take their directory's compression flag */
+static uint8_t inherit_compress(const char *path) {
+  char dir[FS_FILENAME_LEN];
+  uint32_t slash = 0;
+  for (uint32_t i = 0; i < FS_FILENAME_LEN && path[i]; i++) {
+    if (path[i] == '/')
+      slash = i;
+  }
+  if (slash == 0)
+    return 0;
+  k_strncpy(dir, path, slash);
+  dir[slash] = '\0';
+  uint32_t slot = find_slot(dir);
+  if (slot == NO_SLOT)
+    return 0;
+  fs_file_entry_t tmp;
+  const fs_file_entry_t *d = peek(slot, &tmp);
+  return d->is_directory ? d->compress : 0;
+}
+
+int fs_create_file(const char *name) {
+  TRACE_SCOPE(TP_FS_CREATE, 0);
+  char full_path[FS_FILENAME_LEN * 2];
+  build_path(name, full_path);
 
   if (find_entry(name))
     return -2; /* exists */
-  for (uint32_t i = 0; i < superblock.max_files; i++) {
-    if (!file_table[i].used) {
-      k_strncpy(file_table[i].name, full_path, FS_FILENAME_LEN);
-      file_table[i].size = 0;
-      file_table[i].start_block = 0xFFFFFFFF;
-      file_table[i].used = 1;
-      file_table[i].is_directory = 0;
-      superblock.num_files++;
-      return fs_sync();
-    }
-  }
-  return -1;
+  fs_file_entry_t *e = new_entry(full_path);
+  if (!e)
+    return -1;
+  e->compress = inherit_compress(full_path);
+  return fs_sync();
 }
 
 int fs_create_directory(const char *name) {
   char full_path[FS_FILENAME_LEN * 2];
-
-  // Build full path (same logic as create_file)
-  if (name[0] == '/') {
-    k_strncpy(full_path, name + 1, FS_FILENAME_LEN);
-  } else if (strcmp(current_directory, "/") == 0) {
-    k_strncpy(full_path, name, FS_FILENAME_LEN);
-  } else {
-    int i = 0, j = 0;
-    while (current_directory[i] && i < FS_FILENAME_LEN - 1) {
-      full_path[j++] = current_directory[i++];
-    }
-    if (j > 0 && full_path[j - 1] != '/') {
-      full_path[j++] = '/';
-    }
-    i = 0;
-    while (name[i] && j < FS_FILENAME_LEN * 2 - 1) {
-      full_path[j++] = name[i++];
-    }
-    full_path[j] = '\0';
-  }
+  build_path(name, full_path);
 
   if (find_entry(name))
     return -2; /* exists */
-  for (uint32_t i = 0; i < superblock.max_files; i++) {
-    if (!file_table[i].used) {
-      k_strncpy(file_table[i].name, full_path, FS_FILENAME_LEN);
-      file_table[i].size = 0;
-      file_table[i].start_block = 0xFFFFFFFF;
-      file_table[i].used = 1;
-      file_table[i].is_directory = 1; // Mark as directory
-      superblock.num_files++;
-      return fs_sync();
-    }
-  }
-  return -1;
+  fs_file_entry_t *e = new_entry(full_path);
+  if (!e)
+    return -1;
+  e->is_directory = 1; // Mark as directory
+  return fs_sync();
 }
 
 int fs_write_file(const char *name, const uint8_t *data, uint32_t size) {
+  TRACE_SCOPE(TP_FS_WRITE, size);
   fs_file_entry_t *e = find_entry(name);
   if (!e) {
     if (fs_create_file(name) < 0)
@@ -257,78 +1337,538 @@ int fs_write_file(const char *name, const uint8_t *data, uint32_t size) {
       return -1;
   }
 
-  if (e->start_block != 0xFFFFFFFF && e->size > 0) {
-    e->start_block = 0xFFFFFFFF;
-    e->size = 0;
+  /* the same bytes are on disk already, maybe in this very file */
+  uint64_t hash = 0;
+  fs_file_entry_t twin;
+  int found = 0;
+  if (dedup_on && inline_max() && size > inline_max()) {
+    hash = fingerprint(data, size);
+    found = find_twin(hash, data, size, &twin);
+    dedup.bytes += size;
   }
 
-  if (size == 0) {
-    e->size = 0;
-    e->start_block = 0xFFFFFFFF;
-    return fs_sync();
+  /* release the old extent so it can be reused, but remember it: a write
+   * that finds no space must leave the file as it was */
+  uint32_t old_start = e->start_block;
+  uint32_t old_size = e->size;
+  uint16_t old_prealloc = e->prealloc;
+  uint8_t old_inline = e->is_inline;
+  uint8_t old_compressed = e->is_compressed;
+  uint32_t old_blocks = entry_blocks(e);
+  if (hold_extent(e, -1) != 0)
+    return -1;
+  e->start_block = 0xFFFFFFFF;
+  e->size = 0;
+  e->prealloc = 0;
+  e->is_inline = 0;
+  e->is_compressed = 0;
+
+  if (found) {
+    memset(e->data, 0, FS_INLINE_MAX);
+    e->start_block = twin.start_block;
+    e->size = size;
+    e->is_compressed = twin.is_compressed;
+    e->ext.stored = twin.ext.stored;
+    e->ext.tail = twin.ext.tail;
+    e->ext.hash = hash;
+    hold_extent(e, 1);
+    dedup.hits++;
+    dedup.deduped += size;
+    dedup.sectors_saved += sector_round(stored_bytes(e)) / FS_SECTOR_SIZE;
+    if (fs_sync() != 0)
+      return -1;
+    discard_blocks(old_start, old_blocks);
+    return 0;
+  }
+
+  /* small enough to keep in the entry: only the table is written */
+  if (size <= inline_max()) {
+    memset(e->data, 0, FS_INLINE_MAX);
+    if (size)
+      memcpy(e->data, data, size);
+    e->size = size;
+    e->is_inline = size > 0;
+    if (fs_sync() != 0)
+      return -1;
+    discard_blocks(old_start, old_blocks);
+    return 0;
   }
 
-  uint32_t blocks_needed = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+  uint32_t stored = size, last = 0;
+  if (e->compress)
+    stored = put_chunks(0, 0, data, size, &last);
+  uint32_t blocks_needed = extent_blocks(stored);
   int start = allocate_blocks(blocks_needed);
   if (start < 0) {
+    e->start_block = old_start;
+    e->size = old_size;
+    e->prealloc = old_prealloc;
+    e->is_inline = old_inline;
+    e->is_compressed = old_compressed;
+    hold_extent(e, 1);
     vga_putstr("fs: no contiguous space\n", 0x0C);
     return -2;
   }
+  add_refs((uint32_t)start, blocks_needed, 1);
+  memset(e->data, 0, FS_INLINE_MAX);
+  /* a TRIM still queued for these blocks must not land on the new data */
+  bcache_discard_cancel(data_lba(start), blocks_needed * sectors_per_block);
 
   uint32_t block_idx = (uint32_t)start;
-  uint32_t bytes_written = 0;
-  uint8_t sector[FS_BLOCK_SIZE];
-  for (uint32_t bi = 0; bi < blocks_needed; bi++) {
-    uint32_t to_copy = size - bytes_written;
-    if (to_copy > FS_BLOCK_SIZE)
-      to_copy = FS_BLOCK_SIZE;
-    memset(sector, 0, FS_BLOCK_SIZE);
-    memcpy(sector, data + bytes_written, to_copy);
-    disk_write_lba(superblock.data_block + block_idx + bi, sector);
-    bytes_written += to_copy;
+  if (e->compress) {
+    put_chunks(data_lba(block_idx), 0, data, size, &last);
+    e->is_compressed = 1;
+    e->ext.stored = stored;
+    e->ext.tail = last;
+  } else {
+    write_bytes(data_lba(block_idx), data, size);
   }
+  e->ext.hash = hash;
 
   e->start_block = block_idx;
   e->size = size;
-  return fs_sync();
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(old_start, old_blocks);
+  return 0;
+}
+
+/* Make e own at least `blocks` blocks, keeping its data: extend in place
+ * into the free blocks right after it, or else move it to a new run with
+ * `slack` extra blocks of headroom when that fits; inline data moves out
+ * of the entry into the new run. An extent shared with a reflink copy is
+ * never written to, so e always moves off it. A run given up by a move is
+ * returned in *freed for the caller to discard after fs_sync. Leaves e
+ * untouched and returns -2 when there is no room. */
+static int reserve_blocks(fs_file_entry_t *e, uint32_t blocks, uint32_t slack,
+                          uint32_t *freed_start, uint32_t *freed_count) {
+  uint32_t have = entry_blocks(e);
+  uint32_t used = extent_blocks(stored_bytes(e));
+  int shared = extent_shared(e);
+  *freed_start = 0xFFFFFFFF;
+  *freed_count = 0;
+  if (blocks <= have && !shared)
+    return 0;
+  if (blocks < used)
+    blocks = used;
+
+  if (have > 0 && !shared &&
+      range_free(e->start_block + have, blocks - have)) {
+    add_refs(e->start_block + have, blocks - have, 1);
+    bcache_discard_cancel(data_lba(e->start_block + have),
+                          (blocks - have) * sectors_per_block);
+    e->prealloc = (uint16_t)(blocks - used);
+    return 0;
+  }
+
+  uint32_t want = blocks + slack;
+  int start = allocate_blocks(want);
+  if (start < 0 && slack) {
+    want = blocks;
+    start = allocate_blocks(want);
+  }
+  if (start < 0)
+    return -2;
+  add_refs((uint32_t)start, want, 1);
+  bcache_discard_cancel(data_lba(start), want * sectors_per_block);
+
+  uint32_t sectors = sector_round(stored_bytes(e)) / FS_SECTOR_SIZE;
+  if (e->is_inline) {
+    write_bytes(data_lba(start), e->data, e->size);
+    memset(e->data, 0, FS_INLINE_MAX);
+    e->is_inline = 0;
+    sectors = 0;
+  }
+  for (uint32_t i = 0; i < sectors; i += 8) {
+    uint32_t n = sectors - i < 8 ? sectors - i : 8;
+    bcache_read_sectors(data_lba(e->start_block) + i, n, bounce);
+    bcache_write_sectors(data_lba(start) + i, n, bounce);
+  }
+  add_refs(e->start_block, have, -1);
+  *freed_start = e->start_block;
+  *freed_count = have;
+  e->start_block = (uint32_t)start;
+  e->prealloc = (uint16_t)(want - used);
+  return 0;
+}
+
+static fs_file_entry_t *find_or_create(const char *name) {
+  fs_file_entry_t *e = find_entry(name);
+  if (!e && fs_create_file(name) >= 0)
+    e = find_entry(name);
+  return e;
+}
+
+/* Append to a compressed file, or start one: the last chunk, when it has
+ * room, is decoded and written again with the new data after it. */
+static int append_compressed(fs_file_entry_t *e, const uint8_t *data,
+                             uint32_t len) {
+  uint32_t from = 0, head = 0, sectors, last;
+  uint8_t was_inline = e->is_inline;
+  if (e->is_inline) {
+    memcpy(chunk_buf, e->data, e->size);
+    head = e->size;
+  } else if (e->is_compressed) {
+    from = e->ext.stored;
+    int n = get_chunk(data_lba(e->start_block) + e->ext.tail / FS_SECTOR_SIZE,
+                      chunk_buf, FS_CHUNK_SIZE, &sectors);
+    if (n < 0)
+      return -1;
+    if (n < FS_CHUNK_SIZE) {
+      head = (uint32_t)n;
+      from = e->ext.tail;
+    }
+  }
+  uint32_t needed = extent_blocks(from + put_chunks(0, head, data, len, &last));
+
+  if (!e->is_compressed) {
+    memset(e->data, 0, FS_INLINE_MAX);
+    e->is_inline = 0;
+    e->is_compressed = 1;
+  }
+  uint32_t freed_start, freed_count;
+  if (reserve_blocks(e, needed, needed / 4, &freed_start, &freed_count) != 0) {
+    if (was_inline) {
+      memcpy(e->data, chunk_buf, e->size);
+      e->is_inline = 1;
+      e->is_compressed = 0;
+    } else if (e->size == 0) {
+      e->is_compressed = 0;
+    }
+    vga_putstr("fs: no contiguous space\n", 0x0C);
+    return -2;
+  }
+  uint32_t owned = entry_blocks(e);
+
+  uint32_t stored = put_chunks(data_lba(e->start_block) + from / FS_SECTOR_SIZE,
+                               head, data, len, &last);
+  e->ext.stored = from + stored;
+  e->ext.tail = from + last;
+  e->ext.hash = 0;
+  e->size += len;
+  e->prealloc = (uint16_t)(owned - needed);
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(freed_start, freed_count);
+  return 0;
+}
+
+int fs_append_file(const char *name, const uint8_t *data, uint32_t len) {
+  TRACE_SCOPE(TP_FS_WRITE, len);
+  fs_file_entry_t *e = find_or_create(name);
+  if (!e)
+    return -1;
+  if (len == 0)
+    return 0;
+  if (e->size + len < e->size)
+    return -2;
+
+  /* a file with no blocks stays in its entry for as long as it fits */
+  if (e->start_block == 0xFFFFFFFF && e->size + len <= inline_max()) {
+    memcpy(e->data + e->size, data, len);
+    e->size += len;
+    e->is_inline = 1;
+    return fs_sync();
+  }
+  if (e->is_compressed || (e->compress && (e->is_inline || e->size == 0)))
+    return append_compressed(e, data, len);
+
+  /* headroom on a move, so a growing log doesn't move on every append */
+  uint32_t needed = extent_blocks(e->size + len);
+  uint32_t freed_start, freed_count;
+  if (reserve_blocks(e, needed, needed / 4, &freed_start, &freed_count) != 0) {
+    vga_putstr("fs: no contiguous space\n", 0x0C);
+    return -2;
+  }
+  uint32_t owned = entry_blocks(e);
+
+  /* only the partial tail sector is read back; the rest is new */
+  uint32_t lba = data_lba(e->start_block) + e->size / FS_SECTOR_SIZE;
+  uint32_t in_sector = e->size % FS_SECTOR_SIZE;
+  uint32_t done = 0;
+  if (in_sector) {
+    uint8_t sector[FS_SECTOR_SIZE];
+    done = FS_SECTOR_SIZE - in_sector;
+    if (done > len)
+      done = len;
+    bcache_read(lba, sector);
+    memcpy(sector + in_sector, data, done);
+    bcache_write(lba, sector);
+    lba++;
+  }
+  write_bytes(lba, data + done, len - done);
+
+  e->ext.hash = 0; /* stale now; the next full write sets it again */
+  e->size += len;
+  e->prealloc = (uint16_t)(owned - needed);
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(freed_start, freed_count);
+  return 0;
+}
+
+int fs_fallocate(const char *name, uint32_t size) {
+  fs_file_entry_t *e = find_or_create(name);
+  if (!e)
+    return -1;
+  uint32_t freed_start, freed_count;
+  if (reserve_blocks(e, extent_blocks(size), 0, &freed_start, &freed_count) !=
+      0) {
+    vga_putstr("fs: no contiguous space\n", 0x0C);
+    return -2;
+  }
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(freed_start, freed_count);
+  return 0;
 }
 
 int fs_read_file(const char *name, uint8_t *buf, uint32_t bufsize) {
+  TRACE_SCOPE(TP_FS_READ, bufsize);
   fs_file_entry_t *e = find_entry(name);
   if (!e)
     return -1;
   if (bufsize < e->size)
     return -2;
+  if (e->is_inline) {
+    memcpy(buf, e->data, e->size);
+    return e->size;
+  }
   if (e->start_block == 0xFFFFFFFF)
     return 0;
+  if (e->is_compressed) {
+    uint32_t lba = data_lba(e->start_block);
+    uint32_t done = 0, sectors;
+    while (done < e->size) {
+      int n = get_chunk(lba, buf + done, e->size - done, &sectors);
+      if (n < 0)
+        return -1;
+      done += (uint32_t)n;
+      lba += sectors;
+    }
+    return e->size;
+  }
+
+  read_bytes(data_lba(e->start_block), buf, e->size);
+  return e->size;
+}
+
+/* sectors the chunk at lba takes, 0 if its header is bad */
+static uint32_t chunk_sectors(uint32_t lba) {
+  uint8_t sector[FS_SECTOR_SIZE];
+  chunk_hdr_t hdr;
+  if (bcache_read(lba, sector) != 0)
+    return 0;
+  memcpy(&hdr, sector, sizeof(hdr));
+  if (hdr.raw != FS_CHUNK_SIZE || hdr.len > hdr.raw)
+    return 0;
+  return sector_round(sizeof(hdr) + hdr.len) / FS_SECTOR_SIZE;
+}
+
+int fs_read_at(const char *name, uint32_t offset, uint8_t *buf, uint32_t len) {
+  TRACE_SCOPE(TP_FS_READ, len);
+  fs_file_entry_t *e = find_entry(name);
+  if (!e)
+    return -1;
+  if (offset >= e->size)
+    return 0;
+  if (len > e->size - offset)
+    len = e->size - offset;
+  if (e->is_inline) {
+    memcpy(buf, e->data + offset, len);
+    return len;
+  }
+
+  uint32_t lba = data_lba(e->start_block);
+  uint32_t done = 0;
+  if (e->is_compressed) {
+    /* every chunk but the last holds FS_CHUNK_SIZE bytes, so the ones
+     * before the range are skipped by their headers alone */
+    uint32_t pos = offset / FS_CHUNK_SIZE * FS_CHUNK_SIZE;
+    for (uint32_t c = 0; c < offset / FS_CHUNK_SIZE; c++) {
+      uint32_t sectors = chunk_sectors(lba);
+      if (sectors == 0)
+        return -1;
+      lba += sectors;
+    }
+    while (done < len) {
+      uint32_t sectors;
+      int n = get_chunk(lba, chunk_buf, FS_CHUNK_SIZE, &sectors);
+      uint32_t skip = offset + done - pos;
+      if (n < 0 || (uint32_t)n <= skip)
+        return -1;
+      uint32_t take = (uint32_t)n - skip < len - done ? (uint32_t)n - skip
+                                                      : len - done;
+      memcpy(buf + done, chunk_buf + skip, take);
+      done += take;
+      pos += (uint32_t)n;
+      lba += sectors;
+    }
+    return len;
+  }
+
+  lba += offset / FS_SECTOR_SIZE;
+  uint32_t skip = offset % FS_SECTOR_SIZE;
+  if (skip) {
+    uint8_t sector[FS_SECTOR_SIZE];
+    done = FS_SECTOR_SIZE - skip < len ? FS_SECTOR_SIZE - skip : len;
+    bcache_read(lba++, sector);
+    memcpy(buf, sector + skip, done);
+  }
+  read_bytes(lba, buf + done, len - done);
+  return len;
+}
+
+int fs_copy_file(const char *src_name, const char *dst_name) {
+  fs_file_entry_t *src = find_entry(src_name);
+  if (!src)
+    return -1;
+  fs_file_entry_t *dst = find_entry(dst_name);
+  if (src->is_directory || (dst && dst->is_directory))
+    return -3;
+  if (dst == src)
+    return 0;
+  if (!can_share(src->start_block, extent_blocks(stored_bytes(src))))
+    return -2;
+  if (!dst && (dst = find_or_create(dst_name)) == NULL)
+    return -1;
+
+  /* the copy points at the same blocks; whichever is written first moves */
+  uint32_t old_start = dst->start_block;
+  uint32_t old_blocks = entry_blocks(dst);
+  if (hold_extent(dst, -1) != 0)
+    return -1;
+  dst->size = src->size;
+  dst->start_block =
+      extent_blocks(stored_bytes(src)) ? src->start_block : 0xFFFFFFFF;
+  dst->prealloc = 0;
+  dst->is_inline = src->is_inline;
+  dst->is_compressed = src->is_compressed;
+  memcpy(dst->data, src->data, FS_INLINE_MAX);
+  hold_extent(dst, 1);
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(old_start, old_blocks);
+  return 0;
+}
+
+static uint32_t name_len(const char *name) {
+  uint32_t n = 0;
+  while (n < FS_FILENAME_LEN && name[n])
+    n++;
+  return n;
+}
 
-  uint8_t sector[FS_BLOCK_SIZE];
-  uint32_t block_idx = e->start_block;
-  uint32_t bytes_read = 0;
-  uint32_t remaining = e->size;
-  uint32_t total_blocks = (e->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+int fs_rename(const char *old_name, const char *new_name) {
+  char from[FS_FILENAME_LEN * 2], to[FS_FILENAME_LEN * 2];
+  build_path(old_name, from);
+  uint32_t slot = find_slot(from);
+  if (slot == NO_SLOT)
+    return -1;
+  if (find_entry(new_name))
+    return -2;
 
-  for (uint32_t bi = 0; bi < total_blocks; bi++) {
-    disk_read_lba(superblock.data_block + block_idx + bi, sector);
-    uint32_t to_copy = remaining > FS_BLOCK_SIZE ? FS_BLOCK_SIZE : remaining;
-    memcpy(buf + bytes_read, sector, to_copy);
-    bytes_read += to_copy;
-    remaining -= to_copy;
+  /* entries move between slots below, so none is held across it */
+  fs_file_entry_t tmp;
+  const fs_file_entry_t *e = peek(slot, &tmp);
+  uint8_t is_directory = e->is_directory;
+  k_strncpy(from, e->name, FS_FILENAME_LEN);
+  from[FS_FILENAME_LEN] = '\0';
+  build_path(new_name, to);
+  uint32_t from_len = name_len(from), to_len = name_len(to);
+  if (to_len == 0 || to_len >= FS_FILENAME_LEN)
+    return -3;
+
+  /* a directory takes what is under it along; check that every new name
+   * fits, and that it isn't moving into itself, before renaming any */
+  for (uint32_t pass = 0; is_directory && pass < 2; pass++) {
+    if (k_strncmp(to, from, from_len) == 0 && to[from_len] == '/')
+      return -3;
+    /* A renamed entry may land in a slot still ahead, and the entries
+     * behind the one it left shift back into it, so the slot is looked at
+     * again; neither can bring an unvisited entry in behind the scan. */
+    uint32_t i;
+    for (i = next_used(0); i < superblock.max_files;) {
+      const fs_file_entry_t *f = peek(i, &tmp);
+      if (k_strncmp(f->name, from, from_len) != 0 ||
+          f->name[from_len] != '/') {
+        i = next_used(i + 1);
+        continue;
+      }
+      uint32_t rest = name_len(f->name) - from_len;
+      if (to_len + rest >= FS_FILENAME_LEN)
+        return -3;
+      if (pass == 0) {
+        i = next_used(i + 1);
+        continue;
+      }
+      char moved[FS_FILENAME_LEN];
+      memcpy(moved, to, to_len);
+      memcpy(moved + to_len, f->name + from_len, rest);
+      moved[to_len + rest] = '\0';
+      if (rename_slot(i, moved) != 0)
+        return -1;
+      i = next_used(i);
+    }
+    /* the first pass reads the whole bitmap, so the second can't fail */
+    if (i == NO_SLOT)
+      return -1;
   }
+  if (rename_slot(find_slot(from), to) != 0)
+    return -1;
+  if (is_directory && strcmp(current_directory, from) == 0)
+    k_strncpy(current_directory, to, FS_FILENAME_LEN);
+  return fs_sync();
+}
 
-  return bytes_read;
+int fs_set_compress(const char *name, int on) {
+  fs_file_entry_t *e = find_entry(name);
+  if (!e)
+    return -1;
+  if (inline_max() == 0)
+    return -3; /* no room for the flags in a version 1 entry */
+  e->compress = on ? 1 : 0;
+  return fs_sync();
 }
 
 int fs_delete_file(const char *name) {
+  TRACE_SCOPE(TP_FS_DELETE, 0);
   fs_file_entry_t *e = find_entry(name);
   if (!e)
     return -1;
-  e->used = 0;
-  e->size = 0;
-  e->start_block = 0xFFFFFFFF;
+  uint32_t old_start = e->start_block;
+  uint32_t old_blocks = entry_blocks(e);
+  if (hold_extent(e, -1) != 0)
+    return -1;
+  if (remove_slot(slot_of(e)) != 0) {
+    hold_extent(e, 1);
+    return -1;
+  }
   if (superblock.num_files > 0)
     superblock.num_files--;
-  return fs_sync();
+  if (fs_sync() != 0)
+    return -1;
+  discard_blocks(old_start, old_blocks);
+  return 0;
+}
+
+static void put_dec(uint32_t s) {
+  char dec[12];
+  int pos = 0;
+  if (s == 0)
+    dec[pos++] = '0';
+  else {
+    char rev[12];
+    int r = 0;
+    while (s) {
+      rev[r++] = '0' + (s % 10);
+      s /= 10;
+    }
+    while (r--)
+      dec[pos++] = rev[r];
+  }
+  dec[pos] = '\0';
+  vga_putstr(dec, 0x0F);
 }
 
 void fs_list_files(void) {
@@ -347,84 +1887,90 @@ void fs_list_files(void) {
     }
   }
 
-  for (uint32_t i = 0; i < superblock.max_files; i++) {
-    if (file_table[i].used) {
-      char *display_name = file_table[i].name;
+  fs_file_entry_t tmp;
+  for (uint32_t i = next_used(0); i < superblock.max_files;
+       i = next_used(i + 1)) {
+    const fs_file_entry_t *e = peek(i, &tmp);
+    const char *display_name = e->name;
 
-      // If we're in a subdirectory, only show files that start with our prefix
-      if (prefix_len > 0) {
-        if (k_strncmp(file_table[i].name, prefix, prefix_len) != 0) {
-          continue; // Skip files not in this directory
-        }
-        display_name =
-            file_table[i].name + prefix_len; // Show name without prefix
-      } else {
-        // In root, skip files with / in the name (they're in subdirs)
-        int has_slash = 0;
-        for (int j = 0; file_table[i].name[j]; j++) {
-          if (file_table[i].name[j] == '/') {
-            has_slash = 1;
-            break;
-          }
+    // If we're in a subdirectory, only show files that start with our prefix
+    if (prefix_len > 0) {
+      if (k_strncmp(e->name, prefix, prefix_len) != 0) {
+        continue; // Skip files not in this directory
+      }
+      display_name = e->name + prefix_len; // Show name without prefix
+    } else {
+      // In root, skip files with / in the name (they're in subdirs)
+      int has_slash = 0;
+      for (int j = 0; j < FS_FILENAME_LEN && e->name[j]; j++) {
+        if (e->name[j] == '/') {
+          has_slash = 1;
+          break;
         }
-        if (has_slash)
-          continue;
       }
+      if (has_slash)
+        continue;
+    }
 
-      if (file_table[i].is_directory) {
-        vga_putstr("[DIR] ", 0x0B);
-      } else {
-        vga_putstr("      ", 0x0F);
-      }
-      vga_putstr(display_name, 0x0F);
-      if (!file_table[i].is_directory) {
-        vga_putstr(" (", 0x0F);
-        char dec[12];
-        uint32_t s = file_table[i].size;
-        int pos = 0;
-        if (s == 0)
-          dec[pos++] = '0';
-        else {
-          char rev[12];
-          int r = 0;
-          while (s) {
-            rev[r++] = '0' + (s % 10);
-            s /= 10;
-          }
-          while (r--)
-            dec[pos++] = rev[r];
-        }
-        dec[pos] = '\0';
-        vga_putstr(dec, 0x0F);
-        vga_putstr(" bytes)", 0x0F);
+    if (e->is_directory) {
+      vga_putstr("[DIR] ", 0x0B);
+    } else {
+      vga_putstr("      ", 0x0F);
+    }
+    vga_putstr(display_name, 0x0F);
+    if (!e->is_directory) {
+      vga_putstr(" (", 0x0F);
+      put_dec(e->size);
+      vga_putstr(" bytes", 0x0F);
+      if (e->is_compressed) {
+        vga_putstr(", ", 0x0F);
+        put_dec(e->ext.stored);
+        vga_putstr(" on disk", 0x0F);
       }
-      vga_putchar('\n', 0x0F);
+      vga_putstr(")", 0x0F);
     }
+    vga_putchar('\n', 0x0F);
   }
 }
 
-int fs_sync(void) {
-  uint8_t sector[FS_BLOCK_SIZE];
-  memset(sector, 0, FS_BLOCK_SIZE);
-  memcpy(sector, &superblock, sizeof(fs_superblock_t));
-  if (disk_write_lba(0, sector) != 0)
+int fs_next_entry(uint32_t *cursor, fs_dirent_t *out) {
+  fs_file_entry_t tmp;
+  uint32_t slot = next_used(*cursor);
+  if (slot >= superblock.max_files)
     return -1;
+  const fs_file_entry_t *e = peek(slot, &tmp);
+  k_strncpy(out->name, e->name, FS_FILENAME_LEN);
+  out->name[FS_FILENAME_LEN] = '\0';
+  out->size = e->size;
+  out->is_directory = e->is_directory;
+  *cursor = slot + 1;
+  return 0;
+}
 
-  uint32_t file_table_bytes = superblock.max_files * sizeof(fs_file_entry_t);
-  uint32_t file_table_blocks =
-      (file_table_bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+void fs_resolve_path(const char *name, char full_path[FS_FILENAME_LEN * 2]) {
+  build_path(name, full_path);
+}
 
-  for (uint32_t b = 0; b < file_table_blocks; b++) {
-    uint32_t offset = b * FS_BLOCK_SIZE;
-    uint32_t to_copy = FS_BLOCK_SIZE;
-    if (offset + to_copy > file_table_bytes)
-      to_copy = file_table_bytes - offset;
-    memset(sector, 0, FS_BLOCK_SIZE);
-    memcpy(sector, ((uint8_t *)file_table) + offset, to_copy);
-    if (disk_write_lba(superblock.file_table_block + b, sector) != 0)
-      return -1;
-  }
-  return 0;
+int fs_sync(void) {
+  if (!batch_depth)
+    return write_metadata();
+  /* fs_batch_end writes it all at once, unless it has outgrown deferred */
+  if (deferred_count <= FS_DEFERRED / 2 && !deferred_spills)
+    return 0;
+  batch_split = 1;
+  return write_metadata();
+}
+
+void fs_batch_begin(void) { batch_depth++; }
+
+int fs_batch_end(void) {
+  if (batch_depth == 0 || --batch_depth)
+    return 0;
+  int split = batch_split;
+  batch_split = 0;
+  if (write_metadata() != 0)
+    return -1;
+  return split;
 }
 
 int fs_delete_directory(const char *name) {
@@ -434,10 +1980,8 @@ int fs_delete_directory(const char *name) {
   if (!e->is_directory)
     return -2; // Not a directory
 
-  e->used = 0;
-  e->size = 0;
-  e->start_block = 0xFFFFFFFF;
-  e->is_directory = 0;
+  if (remove_slot(slot_of(e)) != 0)
+    return -1;
   if (superblock.num_files > 0)
     superblock.num_files--;
   return fs_sync();
@@ -483,3 +2027,27 @@ int fs_change_directory(const char *name) {
   k_strncpy(current_directory, name, FS_FILENAME_LEN);
   return 0;
 }
+
+int fs_flush(void) {
+  /* a flush in the middle of a batch commits what it has so far */
+  if (batch_depth && write_metadata() != 0)
+    return -1;
+  return bcache_flush() < 0 ? -1 : 0;
+}
+
+int fs_trim(void) {
+  /* every free extent's freeing has to be on disk before it is trimmed */
+  if (fs_flush() != 0)
+    return -1;
+
+  uint32_t total = blocks_available;
+  uint32_t run_end;
+  int trimmed = 0;
+  for (uint32_t pos = next_free_run(0, total, &run_end); pos < total;
+       pos = next_free_run(run_end, total, &run_end)) {
+    if (bcache_trim(data_lba(pos), (run_end - pos) * sectors_per_block) < 0)
+      return -1;
+    trimmed += run_end - pos;
+  }
+  return trimmed;
+}
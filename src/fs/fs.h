@@ -5,12 +5,19 @@
 #include <stdint.h>
 
 #define FS_MAGIC 0x426F746C /* "Botl" short magic */
-#define FS_VERSION 1
+#define FS_VERSION 3 /* 1: 44-byte entries, no inline data; 2: fixed table */
 
-#define FS_MAX_FILES 128
+#define FS_MAX_FILES 128     /* table slots a new filesystem starts with */
+#define FS_MAX_INODES 131072 /* slots the table can grow to (version 3) */
 #define FS_FILENAME_LEN 32
-#define FS_BLOCK_SIZE 512   /* bytes per block */
+#define FS_SECTOR_SIZE 512 /* disk sector, the unit of device I/O */
+#define FS_MIN_BLOCK_SIZE 512
+#define FS_MAX_BLOCK_SIZE 65536
+#define FS_DEFAULT_BLOCK_SIZE 4096 /* what fs_init formats a blank disk with */
+#define FS_DISK_SECTORS 32768      /* 16 MiB, the disk size the fs assumes */
 #define FS_MAX_BLOCKS 16384 /* safety limit */
+#define FS_INLINE_MAX 80     /* files up to this size live in their entry */
+#define FS_CHUNK_SIZE 8192   /* compressed files are encoded in chunks of this */
 
 typedef struct {
   char name[FS_FILENAME_LEN];
@@ -18,30 +25,108 @@ typedef struct {
   uint32_t start_block;
   uint8_t used; /* 0 = free, 1 = used */
   uint8_t is_directory;
-  uint8_t reserved[2];
-} fs_file_entry_t;
+  uint16_t prealloc; /* blocks reserved past the end of the data */
+  uint8_t is_inline;     /* contents are in data[], no blocks */
+  uint8_t compress;      /* LZ4 new data; on a directory, for new files in it */
+  uint8_t is_compressed; /* blocks hold LZ4 chunks */
+  uint8_t reserved;
+  union {
+    uint8_t data[FS_INLINE_MAX]; /* is_inline */
+    struct {
+      uint32_t stored; /* compressed: bytes of chunks, whole sectors */
+      uint32_t tail;   /* compressed: offset of the last chunk */
+      uint64_t hash;   /* dedup fingerprint of the contents, 0 if none */
+    } ext;
+  };
+} fs_file_entry_t; /* 128 bytes, four to a sector */
 
 typedef struct {
   uint32_t magic;
   uint32_t version;
   uint32_t num_files;
   uint32_t max_files;
-  uint32_t block_size;
-  uint32_t total_blocks;
+  uint32_t block_size;       /* power of two, FS_MIN..FS_MAX_BLOCK_SIZE */
+  uint32_t total_blocks;     /* block numbers count block_size units */
   uint32_t file_table_block; /* block index where file table begins */
   uint32_t data_block;       /* block index where file data begins */
-  uint8_t reserved[452]; /* pad to 512 bytes (superblock fits in one block) */
+  /* version 3: the table is a hash table of max_files slots in an extent
+   * that starts with its bitmap of used slots, and grows by doubling */
+  uint32_t inode_map_block; /* the table's extent, bitmap first */
+  uint32_t table_blocks;    /* the extent's length */
+  uint32_t ref_map_block;   /* uint16 per data block: entries that own it */
+  uint8_t reserved[440]; /* pad to 512 bytes (superblock fits in one block) */
 } fs_superblock_t;
 
 /* public API */
 int fs_init(void);
+/* fresh, empty filesystem with the given block size; -1 if it is invalid */
+int fs_format(uint32_t block_size);
+uint32_t fs_block_size(void);
 int fs_create_file(const char *name);
+/* replace the contents; any preallocation is dropped */
 int fs_write_file(const char *name, const uint8_t *data, uint32_t size);
+/* add to the end, growing in place into adjacent free blocks when it can */
+int fs_append_file(const char *name, const uint8_t *data, uint32_t len);
+/* reserve contiguous space for size bytes without changing the size */
+int fs_fallocate(const char *name, uint32_t size);
 int fs_read_file(const char *name, uint8_t *buf, uint32_t bufsize);
+/* up to len bytes from offset on; the bytes read, 0 at or past the end.
+ * Only the sectors, or compressed chunks, the range covers are decoded. */
+int fs_read_at(const char *name, uint32_t offset, uint8_t *buf, uint32_t len);
+/* Dedup: with it on, fs_write_file fingerprints the data and, when another
+ * file already holds the same bytes, shares its blocks as a reflink copy
+ * would instead of writing them. Counters are since boot. */
+typedef struct {
+  uint64_t bytes;      /* written by fs_write_file with dedup on */
+  uint64_t deduped;    /* of those, found on disk already */
+  uint32_t hits;       /* writes that shared another file's blocks */
+  uint32_t collisions; /* fingerprint matches whose data differed */
+  uint32_t sectors_saved;
+} fs_dedup_stats_t;
+
+int fs_set_dedup(int on); /* -3 on a version 1 filesystem */
+int fs_dedup_enabled(void);
+fs_dedup_stats_t fs_dedup_stats(void);
+
+/* compress what is written to the file from now on, or on a directory,
+ * to files created in it; -3 on a version 1 filesystem */
+int fs_set_compress(const char *name, int on);
 int fs_delete_file(const char *name);
+/* reflink copy: dst shares src's blocks until either is written, so it
+ * costs a file table update whatever the size; an existing dst is
+ * replaced. -3 if either is a directory. */
+int fs_copy_file(const char *src, const char *dst);
+/* metadata-only rename; a directory takes its files along. -2 if new
+ * exists, -3 if a resulting name is too long. */
+int fs_rename(const char *old_name, const char *new_name);
 void fs_list_files(void);
-int fs_sync(void); /* write metadata+table+data back to module memory
-                      (non-durable on host) */
+/* Walking the namespace: *cursor starts at 0, and each call returns 0
+ * with the next entry in table order (which is no order of names), or -1
+ * after the last. Names are full paths, without the leading /. */
+typedef struct {
+  char name[FS_FILENAME_LEN + 1]; /* NUL-terminated, unlike the entry's */
+  uint32_t size;
+  uint8_t is_directory;
+} fs_dirent_t;
+
+int fs_next_entry(uint32_t *cursor, fs_dirent_t *out);
+/* name as a full path like fs_dirent_t's, relative ones from the current
+ * directory; "" for / */
+void fs_resolve_path(const char *name, char full_path[FS_FILENAME_LEN * 2]);
+int fs_sync(void);  /* write superblock + file table to the block cache */
+int fs_flush(void); /* write every dirty cached sector to disk */
+/* Batch: between these, fs_sync leaves the superblock, table and maps in
+ * memory and fs_batch_end writes them once, so a run of small operations
+ * costs one metadata update rather than one each. Batches nest; only the
+ * outermost end writes. The table changes are held in a fixed set: once
+ * an operation leaves it more than half full, the batch so far is written
+ * as fs_sync would outside one, and fs_batch_end returns 1 instead of 0
+ * to say the batch went out in parts (-1 if writing failed). Writes are
+ * only grouped, never made atomic: there is no journal, and a crash
+ * before the end can leave any part of the batch on disk. */
+void fs_batch_begin(void);
+int fs_batch_end(void);
+int fs_trim(void);  /* TRIM all free space; blocks trimmed, or -1 */
 
 /* directories stuff */
 
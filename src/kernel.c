@@ -1,8 +1,24 @@
 #include "kernel.h"
+#include "bcache/bcache.h"
+#include "bench/bench.h"
+#include "bootinfo/bootinfo.h"
+#include "boottime/boottime.h"
 #include "clib/clib.h"
+#include "cpu/gdt.h"
+#include "cpu/idt.h"
+#include "cpu/paging.h"
+#include "disk/disk.h"
+#include "exec/exec.h"
 #include "fs/fs.h"
-#include "multiboot.h"
+#include "keyboard/keyboard.h"
+#include "prof/prof.h"
+#include "sched/sched.h"
+#include "selftest/selftest.h"
+#include "serial/serial.h"
 #include "shell/shell.h"
+#include "smp/smp.h"
+#include "syscall/syscall.h"
+#include "timer/timer.h"
 #include "vga/vga.h"
 
 int light_mode = 1;
@@ -11,7 +27,7 @@ uint8_t *disk_module_addr = 0;
 uint32_t disk_module_size = 0;
 
 void set_disk_module(uint32_t start, uint32_t end) {
-  disk_module_addr = (uint8_t *)start;
+  disk_module_addr = (uint8_t *)(uintptr_t)start;
   disk_module_size = end - start;
 }
 
@@ -30,6 +46,75 @@ void kprint_num(uint32_t n) {
   vga_putstr(&buf[i + 1], color_green_on_black());
 }
 
+static char kernel_cmdline[CMDLINE_MAX];
+
+void cmdline_init(const char *cmdline) {
+  strncpy(kernel_cmdline, cmdline ? cmdline : "", CMDLINE_MAX - 1);
+  kernel_cmdline[CMDLINE_MAX - 1] = '\0';
+}
+
+/* walk space-separated tokens; returns the token length, 0 at the end */
+static uint32_t cmdline_token(const char **p) {
+  while (**p == ' ')
+    (*p)++;
+  uint32_t len = 0;
+  while ((*p)[len] && (*p)[len] != ' ')
+    len++;
+  return len;
+}
+
+int cmdline_has(const char *word) {
+  uint32_t wlen = strlen(word);
+  const char *p = kernel_cmdline;
+  uint32_t len;
+  while ((len = cmdline_token(&p)) != 0) {
+    if (len == wlen && strncmp(p, word, len) == 0)
+      return 1;
+    p += len;
+  }
+  return 0;
+}
+
+const char *cmdline_get(const char *key, char *buf, uint32_t size) {
+  uint32_t klen = strlen(key);
+  const char *p = kernel_cmdline;
+  uint32_t len;
+  while ((len = cmdline_token(&p)) != 0) {
+    if (len > klen && p[klen] == '=' && strncmp(p, key, klen) == 0) {
+      uint32_t vlen = len - klen - 1;
+      if (vlen >= size)
+        vlen = size - 1;
+      strncpy(buf, p + klen + 1, vlen);
+      buf[vlen] = '\0';
+      return buf;
+    }
+    p += len;
+  }
+  return NULL;
+}
+
+void qemu_exit(uint32_t code) {
+  /* a no-op unless QEMU was started with -device isa-debug-exit */
+  __asm__ volatile("outl %0, %1" : : "a"(code), "Nd"((uint16_t)QEMU_EXIT_PORT));
+}
+
+/* Headless runs (make test / make bench): run the workload named by
+ * autorun=, report over serial and leave QEMU with a status code. */
+static void kernel_autorun(const char *mode) {
+  int failed;
+
+  if (strcmp(mode, "bench") == 0) {
+    failed = bench_run("all") != 0;
+  } else if (strcmp(mode, "test") == 0) {
+    failed = selftest_run() != 0;
+  } else {
+    vga_putstr("autorun: unknown mode\n", 0x0C);
+    failed = 1;
+  }
+  vga_putstr(failed ? "AUTORUN FAIL\n" : "AUTORUN PASS\n", 0x0F);
+  qemu_exit(failed ? QEMU_EXIT_FAILURE : QEMU_EXIT_SUCCESS);
+}
+
 int k_create_file(const char *name) { return fs_create_file(name); }
 
 int k_write_file(const char *name, const char *content) {
@@ -41,14 +126,81 @@ int k_read_file(const char *name, char *buffer, uint32_t size) {
   return fs_read_file(name, (uint8_t *)buffer, size);
 }
 
+/* fsmode=writethrough|ordered|writeback picks the durability mode */
+static void mount_mode(void) {
+  char name[16];
+  bcache_mode_t mode = BCACHE_ORDERED;
+  if (cmdline_get("fsmode", name, sizeof(name))) {
+    int parsed = bcache_mode_parse(name);
+    if (parsed < 0)
+      vga_putstr("fsmode: unknown mode, using ordered\n", 0x0E);
+    else
+      mode = (bcache_mode_t)parsed;
+  }
+  if (bcache_set_mode(mode) != 0) {
+    vga_putstr("fsmode: flush failed, mode unchanged\n", 0x0C);
+    mode = bcache_mode();
+  }
+  vga_putstr("fs: ", color_green_on_black());
+  vga_putstr(bcache_mode_name(mode), color_green_on_black());
+  vga_putstr(" mode\n", color_green_on_black());
+}
+
+/* raid=0|1 builds an array over every disk found; raid_chunk=<KiB> sets
+ * the RAID0 stripe unit. The same options must be given on every boot. */
+static void disk_array(void) {
+  char arg[16];
+  if (!cmdline_get("raid", arg, sizeof(arg)))
+    return;
+  disk_layout_t layout = strcmp(arg, "0") == 0   ? DISK_RAID0
+                         : strcmp(arg, "1") == 0 ? DISK_RAID1
+                                                 : DISK_SINGLE;
+  uint32_t chunk = DISK_CHUNK_DEFAULT;
+  if (cmdline_get("raid_chunk", arg, sizeof(arg))) {
+    chunk = 0;
+    for (const char *p = arg; *p >= '0' && *p <= '9'; p++)
+      chunk = chunk * 10 + (uint32_t)(*p - '0');
+    chunk *= 2; /* KiB to sectors */
+  }
+  uint32_t members;
+  if (layout == DISK_SINGLE || disk_set_layout(layout, 0, chunk) != 0) {
+    vga_putstr("raid: bad options or too few disks, using disk 0\n", 0x0E);
+    return;
+  }
+  disk_layout(&members, &chunk);
+  vga_putstr("disk: ", color_green_on_black());
+  vga_putstr(disk_layout_name(layout), color_green_on_black());
+  vga_putstr(" over ", color_green_on_black());
+  kprint_num(members);
+  vga_putstr(" disks\n", color_green_on_black());
+}
+
+/* End of the RAM the bootloader reported above 1 MiB, and at least the end
+ * of the disk module; without a report, enough for the kernel and a
+ * module. Paging maps up to here. */
+#define DEFAULT_RAM_TOP (64u << 20)
+
+static uint32_t ram_top(const bootinfo_t *boot) {
+  uint64_t top = boot->ram_top ? boot->ram_top : DEFAULT_RAM_TOP;
+  uint32_t module_end =
+      (uint32_t)(uintptr_t)disk_module_addr + disk_module_size;
+  if (module_end > top)
+    top = module_end;
+  return top > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)top;
+}
+
 void kernel_main(uint32_t magic, uint32_t addr) {
-  (void)magic;
-  multiboot_info_t *mbi = (multiboot_info_t *)addr;
+  bootinfo_t boot;
+  char autorun[16];
+
+  bootinfo_parse(magic, addr, &boot);
+  if (boot.cmdline)
+    cmdline_init(boot.cmdline);
 
-  if (mbi->mods_count > 0) {
-    multiboot_module_t *mod = (multiboot_module_t *)mbi->mods_addr;
-    disk_module_addr = (uint8_t *)mod->mod_start;
-    disk_module_size = mod->mod_end - mod->mod_start;
+  vga_clear_screen();
+  if (boot.module_end) {
+    disk_module_addr = (uint8_t *)(uintptr_t)boot.module_start;
+    disk_module_size = boot.module_end - boot.module_start;
 
     vga_putstr("Found disk module, size = ", color_green_on_black());
     kprint_num(disk_module_size);
@@ -56,9 +208,40 @@ void kernel_main(uint32_t magic, uint32_t addr) {
   } else {
     vga_putstr("No modules loaded.\n", color_green_on_black());
   }
-  vga_clear_screen();
   vga_putstr("Welcome to BottleOS Shell [light, testing branch] \n",
              color_green_on_black());
+  gdt_init();
+  idt_init();
+  paging_init(ram_top(&boot));
+  paging_map((uint32_t)(uintptr_t)VIDEO_MEMORY,
+             VGA_MEM_WIDTH * VGA_MEM_HEIGHT * 2, PAGING_WC);
+  /* fbcon=off stays in 80x25 text mode */
+  if (!cmdline_has("fbcon=off"))
+    vga_use_framebuffer(&boot.fb);
+  boottime_mark("cpu");
+  serial_init();
+  if (cmdline_has("console=serial") ||
+      cmdline_get("autorun", autorun, sizeof(autorun)))
+    vga_set_serial_mirror(1);
+  timer_init();
+  timer_start();
+  boottime_mark("timer");
+  prof_init();
+  keyboard_init();
+  exec_init();
+  syscall_init();
+  sched_init("shell");
+  smp_init();
+  interrupts_enable();
+  boottime_mark("drivers");
+  disk_init();
+  disk_array();
+  boottime_mark("disk");
+  mount_mode();
   fs_init();
+  boottime_mark("fs mount");
+  bcache_start_flusher();
+  if (cmdline_get("autorun", autorun, sizeof(autorun)))
+    kernel_autorun(autorun);
   shell_start();
 }
@@ -28,6 +28,21 @@ static inline uint8_t color_green_on_black() {
   return light_mode ? LIGHT_GREEN_ON_BLACK : DARK_GREEN_ON_BLACK;
 }
 
+/* kernel command line (multiboot cmdline / QEMU -append) */
+#define CMDLINE_MAX 256
+
+void cmdline_init(const char *cmdline);
+int cmdline_has(const char *word);
+/* value of "key=value" copied into buf; NULL when the key is absent */
+const char *cmdline_get(const char *key, char *buf, uint32_t size);
+
+/* QEMU isa-debug-exit (iobase 0xf4): QEMU exits with (code << 1) | 1 */
+#define QEMU_EXIT_PORT 0xF4
+#define QEMU_EXIT_SUCCESS 0x10 /* -> exit status 33 */
+#define QEMU_EXIT_FAILURE 0x11 /* -> exit status 35 */
+
+void qemu_exit(uint32_t code);
+
 int k_create_file(const char *name);
 int k_write_file(const char *name, const char *content);
 int k_read_file(const char *name, char *buffer, uint32_t size);
@@ -1,10 +1,20 @@
 #include "keyboard.h"
 #include "../clib/clib.h"
+#include "../cpu/idt.h"
+#include "../sched/sched.h"
+
+#define KEYBOARD_BUFFER_SIZE 64 /* power of two */
 
 static int shift_pressed = 0;
 static int ctrl_pressed = 0;
 static int caps_lock_on = 0;
 
+/* filled by IRQ1, drained by keyboard_get_scancode */
+static unsigned char scancode_buf[KEYBOARD_BUFFER_SIZE];
+static volatile uint32_t buf_head = 0;
+static volatile uint32_t buf_tail = 0;
+static semaphore_t keys_ready = SEMAPHORE_INIT(0); /* one post per scancode */
+
 void keyboard_handle_modifier(unsigned char scancode) {
   switch (scancode) {
   case 0x2A:
@@ -61,10 +71,36 @@ char keyboard_scancode_to_ascii(unsigned char scancode) {
   return c;
 }
 
+static void keyboard_irq(isr_frame_t *frame) {
+  (void)frame;
+  unsigned char scancode = inb(KEYBOARD_DATA_PORT);
+  if (buf_head - buf_tail < KEYBOARD_BUFFER_SIZE) {
+    scancode_buf[buf_head & (KEYBOARD_BUFFER_SIZE - 1)] = scancode;
+    buf_head++;
+    sem_post(&keys_ready);
+  }
+}
+
+void keyboard_init(void) {
+  /* drop anything the controller latched before we took over */
+  while (inb(KEYBOARD_STATUS_PORT) & 1)
+    inb(KEYBOARD_DATA_PORT);
+  irq_set_handler(IRQ_KEYBOARD, keyboard_irq);
+}
+
+/* Blocks until a key arrives: the calling thread sleeps on the semaphore,
+ * or the CPU halts until the next interrupt before the scheduler is up.
+ * IRQ1 is delivered to the BSP, so the reader may be on another CPU. */
 unsigned char keyboard_get_scancode() {
-  while (!(inb(KEYBOARD_STATUS_PORT) & 1)) {
+  while (buf_head == buf_tail) {
+    if (sched_running())
+      sem_wait(&keys_ready);
+    else
+      __asm__ volatile("sti\n\thlt");
   }
-  return inb(KEYBOARD_DATA_PORT);
+  unsigned char scancode = scancode_buf[buf_tail & (KEYBOARD_BUFFER_SIZE - 1)];
+  __atomic_store_n(&buf_tail, buf_tail + 1, __ATOMIC_RELEASE);
+  return scancode;
 }
 
 int keyboard_is_shift_pressed(void) { return shift_pressed; }
@@ -0,0 +1,159 @@
+#include "lz4.h"
+#include "../clib/clib.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5 /* a block ends with at least this many literals */
+#define MF_LIMIT 12     /* and no match starts closer than this to the end */
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+#define SKIP_SHIFT 6 /* probe faster through data that isn't matching */
+
+/* input offsets by hash of the 4 bytes there. Cleared per block so the
+ * output depends only on the input: the fs sizes a block before writing. */
+static uint32_t hash_table[1 << HASH_BITS];
+
+static inline uint32_t read32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* the 255, 255, ..., rest tail of a length that overflowed its nibble */
+static uint8_t *put_length(uint8_t *op, uint32_t n) {
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = (uint8_t)n;
+  return op;
+}
+
+static uint8_t *put_literals(uint8_t *op, const uint8_t *lit, uint32_t n,
+                             uint32_t match_nibble) {
+  uint8_t *token = op++;
+  if (n >= 15) {
+    *token = (uint8_t)(0xF0 | match_nibble);
+    op = put_length(op, n - 15);
+  } else {
+    *token = (uint8_t)(n << 4 | match_nibble);
+  }
+  memcpy(op, lit, n);
+  return op + n;
+}
+
+uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst,
+                      uint32_t cap) {
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *end = src + len;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + cap;
+
+  if (len > MF_LIMIT) {
+    const uint8_t *mf_limit = end - MF_LIMIT;
+    const uint8_t *match_limit = end - LAST_LITERALS;
+    uint32_t misses = 0;
+    memset(hash_table, 0, sizeof(hash_table));
+
+    while (ip < mf_limit) {
+      uint32_t pos = (uint32_t)(ip - src);
+      uint32_t h = hash4(read32(ip));
+      uint32_t cand = hash_table[h];
+      hash_table[h] = pos;
+      if (cand >= pos || pos - cand > MAX_OFFSET ||
+          read32(src + cand) != read32(ip)) {
+        ip += 1 + (misses++ >> SKIP_SHIFT);
+        continue;
+      }
+      misses = 0;
+
+      const uint8_t *match = src + cand;
+      while (ip > anchor && match > src && ip[-1] == match[-1]) {
+        ip--;
+        match--;
+      }
+      uint32_t offset = (uint32_t)(ip - match);
+      const uint8_t *mend = ip + MIN_MATCH;
+      while (mend < match_limit && *mend == mend[-(int32_t)offset])
+        mend++;
+
+      uint32_t lit = (uint32_t)(ip - anchor);
+      uint32_t mlen = (uint32_t)(mend - ip) - MIN_MATCH;
+      /* token, literals and their length, offset, match length */
+      if ((uint32_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1)
+        return 0;
+      op = put_literals(op, anchor, lit, mlen >= 15 ? 15 : mlen);
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8);
+      if (mlen >= 15)
+        op = put_length(op, mlen - 15);
+      anchor = ip = mend;
+    }
+  }
+
+  uint32_t lit = (uint32_t)(end - anchor);
+  if ((uint32_t)(oend - op) < 1 + lit + lit / 255 + 1)
+    return 0;
+  op = put_literals(op, anchor, lit, 0);
+  return (uint32_t)(op - dst);
+}
+
+int lz4_decompress(const uint8_t *src, uint32_t len, uint8_t *dst,
+                   uint32_t cap) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = src + len;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + cap;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    uint32_t lit = token >> 4;
+    if (lit == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > (uint32_t)(iend - ip) || lit > (uint32_t)(oend - op))
+      return -1;
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend)
+      break; /* the last sequence is literals only */
+
+    if (iend - ip < 2)
+      return -1;
+    uint32_t offset = (uint32_t)ip[0] | (uint32_t)ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > (uint32_t)(op - dst))
+      return -1;
+    uint32_t mlen = token & 15;
+    if (mlen == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        mlen += b;
+      } while (b == 255);
+    }
+    mlen += MIN_MATCH;
+    if (mlen > (uint32_t)(oend - op))
+      return -1;
+
+    const uint8_t *match = op - offset;
+    if (offset >= mlen) {
+      memcpy(op, match, mlen);
+      op += mlen;
+    } else {
+      while (mlen--) /* overlapping: a run repeating the last offset bytes */
+        *op++ = *match++;
+    }
+  }
+  return (int)(op - dst);
+}
@@ -0,0 +1,19 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+/* LZ4 block format (no frame header or checksum): greedy single-probe
+ * matching, fast enough to sit in the fs write path. Inputs are expected
+ * to be at most a few tens of KiB; matches reach back up to 64 KiB. */
+
+/* Compress len bytes into at most cap bytes; 0 if it doesn't fit, so a
+ * cap of len - 1 asks for output smaller than the input or nothing. */
+uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst,
+                      uint32_t cap);
+/* Decode a block into at most cap bytes; decoded length, or -1 if the
+ * input is malformed or would overrun dst. */
+int lz4_decompress(const uint8_t *src, uint32_t len, uint8_t *dst,
+                   uint32_t cap);
+
+#endif
@@ -9,6 +9,11 @@ typedef struct {
     uint32_t reserved;
 } multiboot_module_t;
 
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY 0x00000001
+#define MULTIBOOT_INFO_CMDLINE 0x00000004
+#define MULTIBOOT_INFO_MODS 0x00000008
+
 typedef struct {
     uint32_t flags;
     uint32_t mem_lower;
@@ -19,3 +24,80 @@ typedef struct {
     uint32_t mods_addr;
     // (we don't need anything else for now)
 } multiboot_info_t;
+
+// Multiboot2: the info is a list of tags, each 8-byte aligned, ending
+// with a tag of type MULTIBOOT2_TAG_END. Only the ones we use are here.
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+
+#define MULTIBOOT2_TAG_END 0
+#define MULTIBOOT2_TAG_CMDLINE 1
+#define MULTIBOOT2_TAG_MODULE 3
+#define MULTIBOOT2_TAG_BASIC_MEMINFO 4
+#define MULTIBOOT2_TAG_MMAP 6
+#define MULTIBOOT2_TAG_FRAMEBUFFER 8
+
+#define MULTIBOOT2_MEMORY_AVAILABLE 1
+
+#define MULTIBOOT2_FRAMEBUFFER_RGB 1
+#define MULTIBOOT2_FRAMEBUFFER_TEXT 2
+
+typedef struct {
+    uint32_t total_size;
+    uint32_t reserved;
+} multiboot2_info_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size; // header included, padding to 8 bytes not
+} multiboot2_tag_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    char string[];
+} multiboot2_tag_string_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;
+    uint32_t mod_end;
+    char string[];
+} multiboot2_tag_module_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mem_lower; // KiB
+    uint32_t mem_upper; // KiB above 1 MiB
+} multiboot2_tag_meminfo_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+    uint32_t reserved;
+} multiboot2_mmap_entry_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size; // may grow; step by this, not sizeof
+    uint32_t entry_version;
+} multiboot2_tag_mmap_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t size;
+    uint64_t addr;
+    uint32_t pitch; // bytes per line
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t fb_type;
+    uint16_t reserved;
+    // MULTIBOOT2_FRAMEBUFFER_RGB: where each channel sits in a pixel
+    uint8_t red_pos, red_size;
+    uint8_t green_pos, green_size;
+    uint8_t blue_pos, blue_size;
+} multiboot2_tag_framebuffer_t;
@@ -0,0 +1,83 @@
+#include "pci.h"
+#include "../clib/clib.h"
+
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static uint32_t config_addr(pci_addr_t addr, uint8_t offset) {
+  return 0x80000000u | ((uint32_t)addr.bus << 16) |
+         ((uint32_t)addr.dev << 11) | ((uint32_t)addr.fn << 8) |
+         (offset & 0xFC);
+}
+
+uint32_t pci_read32(pci_addr_t addr, uint8_t offset) {
+  outl(PCI_CONFIG_ADDR, config_addr(addr, offset));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(pci_addr_t addr, uint8_t offset, uint32_t value) {
+  outl(PCI_CONFIG_ADDR, config_addr(addr, offset));
+  outl(PCI_CONFIG_DATA, value);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_addr_t *out) {
+  for (uint32_t bus = 0; bus < 256; bus++) {
+    for (uint8_t dev = 0; dev < 32; dev++) {
+      pci_addr_t a = {(uint8_t)bus, dev, 0};
+      if ((pci_read32(a, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+        continue;
+      /* only look past function 0 on multi-function devices */
+      uint8_t fns = (pci_read32(a, PCI_HEADER_TYPE) >> 16) & 0x80 ? 8 : 1;
+      for (a.fn = 0; a.fn < fns; a.fn++) {
+        if ((pci_read32(a, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+          continue;
+        uint32_t cls = pci_read32(a, PCI_CLASS_REV);
+        if ((cls >> 24) == class_code && ((cls >> 16) & 0xFF) == subclass) {
+          *out = a;
+          return 0;
+        }
+      }
+    }
+  }
+  return -1;
+}
+
+uint16_t pci_bar_io(pci_addr_t addr, uint32_t bar) {
+  uint32_t v = pci_read32(addr, (uint8_t)(PCI_BAR0 + bar * 4));
+  if (!(v & 1))
+    return 0;
+  return (uint16_t)(v & 0xFFFC);
+}
+
+#define BAR_MEM_TYPE 0x6 /* bits 2:1, 2 = 64-bit */
+#define BAR_MEM_64 0x4
+
+/* The size is what the BAR reads back as after writing all ones, with
+ * memory decoding off meanwhile so the half-written BAR decodes nothing. */
+uint32_t pci_bar_mem(pci_addr_t addr, uint32_t bar, uint32_t *size) {
+  uint8_t off = (uint8_t)(PCI_BAR0 + bar * 4);
+  uint32_t v = pci_read32(addr, off);
+  if ((v & 1) || (v & ~0xFu) == 0)
+    return 0;
+  if ((v & BAR_MEM_TYPE) == BAR_MEM_64 && pci_read32(addr, off + 4) != 0)
+    return 0;
+
+  uint32_t cmd = pci_read32(addr, PCI_COMMAND);
+  pci_write32(addr, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+  pci_write32(addr, off, 0xFFFFFFFF);
+  uint32_t mask = pci_read32(addr, off) & ~0xFu;
+  pci_write32(addr, off, v);
+  pci_write32(addr, PCI_COMMAND, cmd);
+
+  if (size)
+    *size = ~mask + 1;
+  return v & ~0xFu;
+}
+
+void *pci_map_bar(pci_addr_t addr, uint32_t bar, paging_type_t type) {
+  uint32_t size;
+  uint32_t base = pci_bar_mem(addr, bar, &size);
+  if (!base)
+    return NULL;
+  return paging_map(base, size, type);
+}
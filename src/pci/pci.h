@@ -0,0 +1,39 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "../cpu/paging.h"
+#include <stdint.h>
+
+/* PCI configuration space through the legacy 0xCF8/0xCFC mechanism, enough
+ * to find a controller by class, turn on bus mastering and map its BARs. */
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS_REV 0x08
+#define PCI_HEADER_TYPE 0x0C
+#define PCI_BAR0 0x10
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+
+typedef struct {
+  uint8_t bus;
+  uint8_t dev;
+  uint8_t fn;
+} pci_addr_t;
+
+uint32_t pci_read32(pci_addr_t addr, uint8_t offset);
+void pci_write32(pci_addr_t addr, uint8_t offset, uint32_t value);
+
+/* First function with this class/subclass; returns 0, or -1 if none. */
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_addr_t *out);
+/* I/O port base of BAR n, 0 if it is a memory BAR or unset */
+uint16_t pci_bar_io(pci_addr_t addr, uint32_t bar);
+/* base and size of memory BAR n, 0 if it is an I/O BAR, unset or above
+ * 4 GiB */
+uint32_t pci_bar_mem(pci_addr_t addr, uint32_t bar, uint32_t *size);
+/* memory BAR n mapped with the given type (paging_unmap to undo), or NULL */
+void *pci_map_bar(pci_addr_t addr, uint32_t bar, paging_type_t type);
+
+#endif
@@ -0,0 +1,38 @@
+#include "pipe.h"
+#include "../clib/clib.h"
+
+void pipe_reset(pipe_t *p) {
+  p->head = 0;
+  p->tail = 0;
+  p->dropped = 0;
+}
+
+uint32_t pipe_used(const pipe_t *p) { return p->tail - p->head; }
+
+/* The ring is copied in at most two pieces: up to the end of buf, then
+ * from its start. */
+uint32_t pipe_write(pipe_t *p, const char *data, uint32_t len) {
+  uint32_t room = PIPE_SIZE - pipe_used(p);
+  if (len > room) {
+    p->dropped += len - room;
+    len = room;
+  }
+  uint32_t at = p->tail & (PIPE_SIZE - 1);
+  uint32_t first = len < PIPE_SIZE - at ? len : PIPE_SIZE - at;
+  memcpy(p->buf + at, data, first);
+  memcpy(p->buf, data + first, len - first);
+  p->tail += len;
+  return len;
+}
+
+uint32_t pipe_read(pipe_t *p, char *buf, uint32_t len) {
+  uint32_t used = pipe_used(p);
+  if (len > used)
+    len = used;
+  uint32_t at = p->head & (PIPE_SIZE - 1);
+  uint32_t first = len < PIPE_SIZE - at ? len : PIPE_SIZE - at;
+  memcpy(buf, p->buf + at, first);
+  memcpy(buf + first, p->buf, len - first);
+  p->head += len;
+  return len;
+}
@@ -0,0 +1,28 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdint.h>
+
+/* In-memory byte pipe: a ring buffer the shell connects one command's
+ * output to the next command's input through. Writes past its capacity
+ * are dropped and counted rather than blocking, as the shell runs the
+ * commands of a pipeline one after another. */
+
+#define PIPE_SIZE 32768 /* power of two */
+
+typedef struct {
+  char buf[PIPE_SIZE];
+  uint32_t head;    /* next byte to read; free-running */
+  uint32_t tail;    /* next byte to write; free-running */
+  uint32_t dropped; /* bytes lost to a full pipe since the reset */
+} pipe_t;
+
+void pipe_reset(pipe_t *p);
+/* bytes waiting to be read */
+uint32_t pipe_used(const pipe_t *p);
+/* append up to len bytes; returns how many fit */
+uint32_t pipe_write(pipe_t *p, const char *data, uint32_t len);
+/* take up to len bytes; 0 once it is empty */
+uint32_t pipe_read(pipe_t *p, char *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,127 @@
+#include "prof.h"
+#include "../clib/clib.h"
+#include "../timer/timer.h"
+
+static prof_stack_t slots[PROF_SLOTS];
+static volatile int running = 0;
+static int want_backtrace = 0;
+static uint32_t total_samples = 0;
+static uint32_t dropped_samples = 0; /* histogram full */
+
+static uint32_t hash_stack(const uint32_t *pcs, uint32_t depth) {
+  uint32_t h = 2166136261u; /* FNV-1a over the PCs */
+  for (uint32_t i = 0; i < depth; i++) {
+    h ^= pcs[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int same_stack(const prof_stack_t *s, const uint32_t *pcs,
+                      uint32_t depth) {
+  if (s->depth != depth)
+    return 0;
+  for (uint32_t i = 0; i < depth; i++)
+    if (s->pcs[i] != pcs[i])
+      return 0;
+  return 1;
+}
+
+/* Walk saved EBPs: [ebp] is the caller's EBP, the word above it the return
+ * address (words are 8 bytes in the x86_64 build, whose kernel still sits
+ * below 4 GiB, so PCs fit in 32 bits). Frames must move up the stack and
+ * stay close together, which stops the walk at the bottom of any kernel or
+ * thread stack. */
+static uint32_t unwind(uintptr_t ebp, uint32_t *pcs, uint32_t depth) {
+  while (depth < PROF_MAX_DEPTH && ebp != 0 &&
+         (ebp & (sizeof(uintptr_t) - 1)) == 0) {
+    uintptr_t *frame = (uintptr_t *)ebp;
+    uintptr_t next = frame[0];
+    uintptr_t ret = frame[1];
+    if (ret == 0)
+      break;
+    pcs[depth++] = (uint32_t)ret;
+    if (next <= ebp || next - ebp > 65536)
+      break;
+    ebp = next;
+  }
+  return depth;
+}
+
+static void prof_tick(isr_frame_t *frame) {
+  uint32_t pcs[PROF_MAX_DEPTH];
+  uint32_t depth = 1;
+
+  if (!running)
+    return;
+
+  pcs[0] = frame->eip;
+  if (want_backtrace)
+    depth = unwind(isr_frame_pointer(frame), pcs, 1);
+
+  total_samples++;
+  uint32_t h = hash_stack(pcs, depth);
+  for (uint32_t probe = 0; probe < PROF_SLOTS; probe++) {
+    prof_stack_t *s = &slots[(h + probe) & (PROF_SLOTS - 1)];
+    if (s->count == 0) {
+      s->depth = depth;
+      memcpy(s->pcs, pcs, depth * sizeof(uint32_t));
+      s->count = 1;
+      return;
+    }
+    if (same_stack(s, pcs, depth)) {
+      s->count++;
+      return;
+    }
+  }
+  dropped_samples++;
+}
+
+void prof_init(void) { timer_add_hook(prof_tick); }
+
+void prof_start(int backtrace) {
+  running = 0;
+  memset(slots, 0, sizeof(slots));
+  total_samples = 0;
+  dropped_samples = 0;
+  want_backtrace = backtrace;
+  running = 1;
+}
+
+void prof_stop(void) { running = 0; }
+int prof_running(void) { return running; }
+uint32_t prof_samples(void) { return total_samples; }
+
+static void emit_str(prof_emit_fn emit, void *ctx, const char *s) {
+  emit(s, strlen(s), ctx);
+}
+
+static void emit_num(prof_emit_fn emit, void *ctx, uint32_t v,
+                     unsigned int base) {
+  char num[21];
+  emit_str(emit, ctx, utoa(v, num, base));
+}
+
+/* # bottleos-prof v1 hz=<n> samples=<n> dropped=<n> backtrace=<0|1>
+ * <count> <pc> [<pc> ...]    hex PCs, leaf first
+ * # end */
+void prof_dump(prof_emit_fn emit, void *ctx) {
+  emit_str(emit, ctx, "# bottleos-prof v1 hz=");
+  emit_num(emit, ctx, TIMER_HZ, 10);
+  emit_str(emit, ctx, " samples=");
+  emit_num(emit, ctx, total_samples, 10);
+  emit_str(emit, ctx, " dropped=");
+  emit_num(emit, ctx, dropped_samples, 10);
+  emit_str(emit, ctx, want_backtrace ? " backtrace=1\n" : " backtrace=0\n");
+  for (uint32_t i = 0; i < PROF_SLOTS; i++) {
+    if (slots[i].count == 0)
+      continue;
+    emit_num(emit, ctx, slots[i].count, 10);
+    for (uint32_t d = 0; d < slots[i].depth; d++) {
+      emit_str(emit, ctx, " ");
+      emit_num(emit, ctx, slots[i].pcs[d], 16);
+    }
+    emit_str(emit, ctx, "\n");
+  }
+  emit_str(emit, ctx, "# end\n");
+}
@@ -0,0 +1,29 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+/* Sampling profiler: every timer tick records the interrupted EIP, and with
+ * backtraces on also the frame-pointer chain, into a histogram of distinct
+ * stacks. Dumps are symbolized on the host by tools/prof_symbolize.py. */
+
+#define PROF_MAX_DEPTH 16
+#define PROF_SLOTS 2048 /* distinct stacks kept, power of two */
+
+typedef struct {
+  uint32_t count;
+  uint32_t depth;
+  uint32_t pcs[PROF_MAX_DEPTH]; /* leaf first */
+} prof_stack_t;
+
+/* dump sink, same shape as the trace one */
+typedef void (*prof_emit_fn)(const char *text, uint32_t len, void *ctx);
+
+void prof_init(void); /* hook the timer; sampling starts stopped */
+void prof_start(int backtrace);
+void prof_stop(void);
+int prof_running(void);
+uint32_t prof_samples(void);
+void prof_dump(prof_emit_fn emit, void *ctx);
+
+#endif
@@ -0,0 +1,627 @@
+#include "sched.h"
+#include "../clib/clib.h"
+#include "../cpu/apic.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../cpu/paging.h"
+#include "../smp/smp.h"
+#include "../timer/timer.h"
+
+/* switch.asm: save callee-saved registers on the current stack, store the
+ * stack pointer in *old_sp, load new_sp and pop the next thread's registers */
+extern void context_switch(uintptr_t *old_sp, uintptr_t new_sp);
+
+/* registers context_switch pops before its ret: edi, esi, ebx, ebp, or in
+ * switch64.asm r15-r12, rbx, rbp */
+#ifdef __x86_64__
+#define SWITCH_SAVED_REGS 6
+#else
+#define SWITCH_SAVED_REGS 4
+#endif
+
+typedef struct {
+  ticket_lock_t lock; /* run_queue and nr_ready */
+  thread_list_t run_queue[SCHED_PRIORITIES];
+  volatile uint32_t nr_ready;
+  thread_t *volatile current;
+  thread_t *idle;
+  thread_t *prev;  /* switched away from; finish_switch releases it */
+  int prev_requeue; /* prev was preempted and goes back on a run queue */
+  volatile int need_resched;
+  volatile int online;
+} sched_cpu_t;
+
+static thread_t threads[SCHED_MAX_THREADS];
+static uint8_t stacks[SCHED_MAX_THREADS][SCHED_STACK_SIZE]
+    __attribute__((aligned(16)));
+static ticket_lock_t threads_lock = TICKET_LOCK_INIT;
+static uint32_t next_thread_id = 0;
+
+static sched_cpu_t cpus[SMP_MAX_CPUS];
+static volatile int started = 0;
+
+/* sleepers are woken from the BSP's PIT tick; every CPU adds to the list */
+static thread_t *sleep_list = 0;
+static mcs_lock_t sleep_lock = MCS_LOCK_INIT;
+
+/* the calling CPU; only meaningful with interrupts disabled */
+static inline sched_cpu_t *this_cpu(void) { return &cpus[smp_cpu_index()]; }
+
+/* ===== queues (interrupts disabled, owning lock held) ===== */
+
+static void queue_push(thread_list_t *q, thread_t *t) {
+  t->next = 0;
+  if (q->tail)
+    q->tail->next = t;
+  else
+    q->head = t;
+  q->tail = t;
+}
+
+static thread_t *queue_pop(thread_list_t *q) {
+  thread_t *t = q->head;
+  if (t) {
+    q->head = t->next;
+    if (!q->head)
+      q->tail = 0;
+    t->next = 0;
+  }
+  return t;
+}
+
+/* Take the first thread of priority >= min_prio from cpu's queue whose
+ * stack is free. A thread woken while still switching away keeps on_cpu set
+ * for a moment; skip it unless it is what self, the calling CPU, is running
+ * now. When stealing, the victim's current thread is not free: its stack is
+ * still in use over there. */
+static thread_t *dequeue(sched_cpu_t *cpu, sched_cpu_t *self,
+                         uint32_t min_prio) {
+  for (int p = SCHED_PRIORITIES - 1; p >= (int)min_prio; p--) {
+    thread_t **link = &cpu->run_queue[p].head;
+    thread_t *prev = 0;
+    for (thread_t *t = *link; t; prev = t, link = &t->next, t = t->next) {
+      if (t->on_cpu && t != self->current)
+        continue;
+      *link = t->next;
+      if (cpu->run_queue[p].tail == t)
+        cpu->run_queue[p].tail = prev;
+      t->next = 0;
+      cpu->nr_ready--;
+      return t;
+    }
+  }
+  return 0;
+}
+
+static void enqueue(uint32_t c, thread_t *t) {
+  sched_cpu_t *cpu = &cpus[c];
+  ticket_lock(&cpu->lock);
+  t->state = THREAD_READY;
+  t->cpu = c;
+  queue_push(&cpu->run_queue[t->priority], t);
+  cpu->nr_ready++;
+  thread_t *running = cpu->current;
+  int preempt = running && t->priority > running->priority;
+  ticket_unlock(&cpu->lock);
+
+  if (preempt) {
+    cpu->need_resched = 1;
+    smp_send_resched(c);
+  }
+}
+
+static int cpu_is_idle(uint32_t c) {
+  return cpus[c].online && cpus[c].current == cpus[c].idle &&
+         cpus[c].nr_ready == 0;
+}
+
+/* last CPU for cache warmth, unless it is busy and another one is idle */
+static uint32_t pick_cpu(thread_t *t) {
+  uint32_t home = t->cpu < SMP_MAX_CPUS && cpus[t->cpu].online ? t->cpu : 0;
+  if (cpu_is_idle(home))
+    return home;
+  for (uint32_t c = 0; c < SMP_MAX_CPUS; c++)
+    if (cpu_is_idle(c))
+      return c;
+  return home;
+}
+
+static void make_ready(thread_t *t) { enqueue(pick_cpu(t), t); }
+
+/* Work stealing: pull from the CPU with the longest queue. Only one run
+ * queue lock is ever held, so CPUs stealing from each other can't deadlock. */
+static thread_t *steal(sched_cpu_t *self, uint32_t min_prio) {
+  sched_cpu_t *victim = 0;
+  uint32_t most = 0;
+  for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+    if (&cpus[c] != self && cpus[c].nr_ready > most) {
+      most = cpus[c].nr_ready;
+      victim = &cpus[c];
+    }
+  }
+  if (!victim)
+    return 0;
+  ticket_lock(&victim->lock);
+  thread_t *t = dequeue(victim, self, min_prio);
+  ticket_unlock(&victim->lock);
+  return t;
+}
+
+static int work_elsewhere(sched_cpu_t *self) {
+  for (uint32_t c = 0; c < SMP_MAX_CPUS; c++)
+    if (&cpus[c] != self && cpus[c].nr_ready > 0)
+      return 1;
+  return 0;
+}
+
+/* Runs on the thread just switched to, still on the switching CPU: put the
+ * thread we left back on a run queue if it was preempted, then let other
+ * CPUs run it. */
+static void finish_switch(void) {
+  sched_cpu_t *cpu = this_cpu();
+  thread_t *prev = cpu->prev;
+  cpu->prev = 0;
+  if (cpu->prev_requeue)
+    enqueue(cpu - cpus, prev);
+  __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+}
+
+/* Pick the next thread and switch to it. Interrupts must be disabled. A
+ * running caller keeps the CPU unless something of at least its priority is
+ * ready; a blocked or sleeping caller must already be on its wait list. */
+static void schedule(void) {
+  sched_cpu_t *cpu = this_cpu();
+  thread_t *prev = cpu->current;
+  int running = prev->state == THREAD_RUNNING && prev != cpu->idle;
+  uint32_t min_prio = running ? prev->priority : PRIO_IDLE;
+
+  cpu->need_resched = 0;
+  ticket_lock(&cpu->lock);
+  thread_t *next = dequeue(cpu, cpu, min_prio);
+  ticket_unlock(&cpu->lock);
+  if (!next)
+    next = steal(cpu, min_prio);
+  if (!next) {
+    if (prev->state == THREAD_RUNNING)
+      return; /* nothing better; includes the idle thread */
+    next = cpu->idle;
+  }
+  if (next == prev) { /* woken again before it got switched out */
+    prev->state = THREAD_RUNNING;
+    return;
+  }
+
+  if (prev == cpu->idle)
+    prev->state = THREAD_READY; /* the idle thread is never queued */
+  cpu->prev = prev;
+  cpu->prev_requeue = running;
+
+  next->state = THREAD_RUNNING;
+  next->slice = SCHED_TIMESLICE_TICKS;
+  next->cpu = cpu - cpus;
+  next->on_cpu = 1;
+  cpu->current = next;
+  if (next->kstack_top) {
+    gdt_set_kernel_stack(cpu - cpus, next->kstack_top);
+    paging_sync(cpu - cpus);
+  }
+  context_switch(&prev->sp, next->sp);
+  finish_switch();
+}
+
+/* ===== timer ===== */
+
+static void sched_account(sched_cpu_t *cpu) {
+  thread_t *t = cpu->current;
+  t->run_ticks++;
+  if (t == cpu->idle) {
+    if (cpu->nr_ready || work_elsewhere(cpu))
+      cpu->need_resched = 1;
+    return;
+  }
+  if (t->slice > 0)
+    t->slice--;
+  if (t->slice == 0)
+    cpu->need_resched = 1;
+}
+
+/* PIT tick, BSP only: wake sleepers, then account like any CPU */
+static void sched_tick(isr_frame_t *frame) {
+  (void)frame;
+  if (!started)
+    return;
+
+  uint64_t now = timer_ticks();
+  mcs_node_t node;
+  mcs_lock(&sleep_lock, &node);
+  thread_t **link = &sleep_list;
+  while (*link) {
+    thread_t *t = *link;
+    if (t->wake_tick <= now) {
+      *link = t->next;
+      make_ready(t);
+    } else {
+      link = &t->next;
+    }
+  }
+  mcs_unlock(&sleep_lock, &node);
+
+  sched_account(this_cpu());
+}
+
+/* local APIC timer on the APs */
+static void sched_ap_tick(isr_frame_t *frame) {
+  (void)frame;
+  sched_account(this_cpu());
+}
+
+/* Runs on the way out of every IRQ, interrupts still off. Switching here is
+ * how preemption happens: the interrupted thread's iret runs when it is
+ * scheduled again. */
+static void sched_irq_exit(void) {
+  if (!started)
+    return;
+  sched_cpu_t *cpu = this_cpu();
+  if (cpu->need_resched && cpu->current->preempt_count == 0)
+    schedule();
+}
+
+/* ===== threads ===== */
+
+static void idle_loop(void) {
+  while (1) {
+    interrupts_disable();
+    sched_cpu_t *cpu = this_cpu();
+    if (cpu->need_resched || cpu->nr_ready || work_elsewhere(cpu))
+      schedule();
+    __asm__ volatile("sti\n\thlt"); /* sti holds off IRQs until the hlt */
+  }
+}
+
+static void idle_main(void *arg) {
+  (void)arg;
+  idle_loop();
+}
+
+/* first code a new thread runs, reached through context_switch's ret */
+static void thread_trampoline(void) {
+  finish_switch();
+  interrupts_enable();
+  thread_t *self = thread_current();
+  self->entry(self->arg);
+  thread_exit();
+}
+
+static void thread_setup(thread_t *t, const char *name, uint8_t priority) {
+  strncpy(t->name, name, SCHED_NAME_LEN - 1);
+  t->name[SCHED_NAME_LEN - 1] = '\0';
+  t->id = next_thread_id++;
+  t->priority = priority < SCHED_PRIORITIES ? priority : PRIO_NORMAL;
+  t->slice = SCHED_TIMESLICE_TICKS;
+  t->run_ticks = 0;
+  t->preempt_count = 0;
+  t->kstack_top = 0;
+  t->next = 0;
+}
+
+/* claim a free slot and build its first stack frame; not yet runnable */
+static thread_t *thread_alloc(const char *name, thread_entry_t entry,
+                              void *arg, uint8_t priority) {
+  thread_t *t = 0;
+  uint32_t slot;
+  ticket_lock(&threads_lock);
+  for (slot = 1; slot < SCHED_MAX_THREADS; slot++) {
+    if ((threads[slot].state == THREAD_UNUSED ||
+         threads[slot].state == THREAD_DEAD) &&
+        !threads[slot].on_cpu) {
+      t = &threads[slot];
+      thread_setup(t, name, priority);
+      t->state = THREAD_BLOCKED; /* reserved */
+      break;
+    }
+  }
+  ticket_unlock(&threads_lock);
+  if (!t)
+    return 0;
+
+  t->entry = entry;
+  t->arg = arg;
+  t->kstack_top = (uintptr_t)(stacks[slot] + SCHED_STACK_SIZE);
+
+  /* frame context_switch pops: the saved registers, all zero (a zero ebp
+   * ends frame-pointer walks), then ret */
+  uintptr_t *sp = (uintptr_t *)(stacks[slot] + SCHED_STACK_SIZE);
+  *--sp = 0;                              /* fake return for the trampoline */
+  *--sp = (uintptr_t)thread_trampoline;   /* ret target */
+  for (int i = 0; i < SWITCH_SAVED_REGS; i++)
+    *--sp = 0;
+  t->sp = (uintptr_t)sp;
+  return t;
+}
+
+thread_t *thread_create(const char *name, thread_entry_t entry, void *arg,
+                        uint8_t priority) {
+  uint32_t flags = irq_save();
+  thread_t *t = thread_alloc(name, entry, arg, priority);
+  if (t) {
+    t->cpu = smp_cpu_index();
+    make_ready(t);
+  }
+  irq_restore(flags);
+  return t;
+}
+
+void thread_exit(void) {
+  interrupts_disable();
+  this_cpu()->current->state = THREAD_DEAD;
+  schedule();
+  while (1) {
+  }
+}
+
+thread_t *thread_current(void) {
+  uint32_t flags = irq_save();
+  thread_t *t = cpus[smp_cpu_index()].current;
+  irq_restore(flags);
+  return t;
+}
+
+/* the calling context becomes a running thread on CPU c */
+static thread_t *adopt_boot_context(uint32_t c, thread_t *t, const char *name,
+                                    uint8_t priority) {
+  thread_setup(t, name, priority);
+  t->state = THREAD_RUNNING;
+  t->cpu = c;
+  t->on_cpu = 1;
+  cpus[c].current = t;
+  return t;
+}
+
+void sched_init(const char *boot_thread_name) {
+  uint32_t flags = irq_save();
+  ticket_lock(&threads_lock);
+  adopt_boot_context(0, &threads[0], boot_thread_name, PRIO_NORMAL);
+  ticket_unlock(&threads_lock);
+
+  cpus[0].idle = thread_alloc("idle0", idle_main, 0, PRIO_IDLE);
+  cpus[0].idle->state = THREAD_READY; /* the idle thread is never queued */
+  cpus[0].idle->cpu = 0;
+  cpus[0].online = 1;
+
+  timer_add_hook(sched_tick);
+  idt_set_handler(APIC_TIMER_VECTOR, sched_ap_tick);
+  /* APIC_RESCHED_VECTOR needs no handler: the IRQ exit hook does the work */
+  irq_set_exit_hook(sched_irq_exit);
+  started = 1;
+  irq_restore(flags);
+}
+
+void sched_ap_start(uint32_t c) {
+  char name[SCHED_NAME_LEN] = "idle";
+  char num[21];
+
+  interrupts_disable();
+  strncpy(name + 4, utoa(c, num, 10), SCHED_NAME_LEN - 5);
+  ticket_lock(&threads_lock);
+  thread_t *t = 0;
+  for (uint32_t slot = 1; slot < SCHED_MAX_THREADS && !t; slot++)
+    if (threads[slot].state == THREAD_UNUSED)
+      t = &threads[slot];
+  if (t)
+    adopt_boot_context(c, t, name, PRIO_IDLE);
+  ticket_unlock(&threads_lock);
+  if (!t) {
+    while (1) /* no slot left to represent this CPU; park it */
+      __asm__ volatile("cli\n\thlt");
+  }
+
+  cpus[c].idle = t;
+  lapic_timer_start(TIMER_HZ);
+  cpus[c].online = 1;
+  idle_loop();
+}
+
+int sched_running(void) { return started; }
+
+void sched_yield(void) {
+  if (!started)
+    return;
+  uint32_t flags = irq_save();
+  schedule();
+  irq_restore(flags);
+}
+
+void sched_sleep_ms(uint32_t ms) {
+  if (!started)
+    return;
+  uint64_t ticks = (uint64_t)ms * TIMER_HZ / 1000;
+  if (ticks == 0)
+    ticks = 1;
+
+  uint32_t flags = irq_save();
+  thread_t *self = this_cpu()->current;
+  mcs_node_t node;
+  mcs_lock(&sleep_lock, &node);
+  self->wake_tick = timer_ticks() + ticks;
+  self->state = THREAD_SLEEPING;
+  self->next = sleep_list;
+  sleep_list = self;
+  mcs_unlock(&sleep_lock, &node);
+  schedule();
+  irq_restore(flags);
+}
+
+void sched_preempt_disable(void) {
+  uint32_t flags = irq_save();
+  if (started)
+    this_cpu()->current->preempt_count++;
+  irq_restore(flags);
+}
+
+void sched_preempt_enable(void) {
+  uint32_t flags = irq_save();
+  if (started) {
+    sched_cpu_t *cpu = this_cpu();
+    if (cpu->current->preempt_count > 0)
+      cpu->current->preempt_count--;
+    if (cpu->current->preempt_count == 0 && cpu->need_resched)
+      schedule();
+  }
+  irq_restore(flags);
+}
+
+/* ===== wait queues ===== */
+
+/* Caller holds wq->lock with interrupts disabled; returns with it dropped. */
+static void wait_queue_sleep_locked(wait_queue_t *wq) {
+  thread_t *self = this_cpu()->current;
+  self->state = THREAD_BLOCKED;
+  queue_push(&wq->list, self);
+  ticket_unlock(&wq->lock);
+  schedule();
+}
+
+void wait_queue_sleep(wait_queue_t *wq) {
+  if (!started)
+    return;
+  uint32_t flags = ticket_lock_irqsave(&wq->lock);
+  wait_queue_sleep_locked(wq);
+  irq_restore(flags);
+}
+
+int wait_queue_wake_one(wait_queue_t *wq) {
+  uint32_t flags = ticket_lock_irqsave(&wq->lock);
+  thread_t *t = queue_pop(&wq->list);
+  ticket_unlock(&wq->lock);
+  if (t)
+    make_ready(t);
+  irq_restore(flags);
+  return t != 0;
+}
+
+int wait_queue_wake_all(wait_queue_t *wq) {
+  int woken = 0;
+  while (wait_queue_wake_one(wq))
+    woken++;
+  return woken;
+}
+
+/* ===== mutexes and semaphores ===== */
+
+void mutex_init(mutex_t *m) {
+  m->locked = 0;
+  m->owner = 0;
+  m->waiters = (wait_queue_t)WAIT_QUEUE_INIT;
+}
+
+void mutex_lock(mutex_t *m) {
+  uint32_t flags = ticket_lock_irqsave(&m->waiters.lock);
+  while (m->locked && started) {
+    wait_queue_sleep_locked(&m->waiters);
+    ticket_lock(&m->waiters.lock);
+  }
+  m->locked = 1;
+  m->owner = started ? this_cpu()->current : 0;
+  ticket_unlock_irqrestore(&m->waiters.lock, flags);
+}
+
+int mutex_trylock(mutex_t *m) {
+  uint32_t flags = ticket_lock_irqsave(&m->waiters.lock);
+  int ok = !m->locked;
+  if (ok) {
+    m->locked = 1;
+    m->owner = started ? this_cpu()->current : 0;
+  }
+  ticket_unlock_irqrestore(&m->waiters.lock, flags);
+  return ok;
+}
+
+void mutex_unlock(mutex_t *m) {
+  uint32_t flags = ticket_lock_irqsave(&m->waiters.lock);
+  m->locked = 0;
+  m->owner = 0;
+  thread_t *t = queue_pop(&m->waiters.list);
+  ticket_unlock(&m->waiters.lock);
+  if (t)
+    make_ready(t);
+  irq_restore(flags);
+}
+
+void sem_init(semaphore_t *s, int count) {
+  s->count = count;
+  s->waiters = (wait_queue_t)WAIT_QUEUE_INIT;
+}
+
+void sem_wait(semaphore_t *s) {
+  uint32_t flags = ticket_lock_irqsave(&s->waiters.lock);
+  while (s->count <= 0 && started) {
+    wait_queue_sleep_locked(&s->waiters);
+    ticket_lock(&s->waiters.lock);
+  }
+  s->count--;
+  ticket_unlock_irqrestore(&s->waiters.lock, flags);
+}
+
+void sem_post(semaphore_t *s) {
+  uint32_t flags = ticket_lock_irqsave(&s->waiters.lock);
+  s->count++;
+  thread_t *t = queue_pop(&s->waiters.list);
+  ticket_unlock(&s->waiters.lock);
+  if (t)
+    make_ready(t);
+  irq_restore(flags);
+}
+
+uint32_t sched_list(thread_t *out, uint32_t max) {
+  uint32_t n = 0;
+  uint32_t flags = ticket_lock_irqsave(&threads_lock);
+  for (uint32_t i = 0; i < SCHED_MAX_THREADS && n < max; i++) {
+    if (threads[i].state != THREAD_UNUSED && threads[i].state != THREAD_DEAD)
+      out[n++] = threads[i];
+  }
+  ticket_unlock_irqrestore(&threads_lock, flags);
+  return n;
+}
+
+/* ===== parallel helper ===== */
+
+typedef struct {
+  parallel_fn_t fn;
+  void *arg;
+  uint32_t count;
+  volatile uint32_t next;
+  semaphore_t done;
+} parallel_job_t;
+
+static void parallel_drain(parallel_job_t *job) {
+  uint32_t i;
+  while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+         job->count)
+    job->fn(job->arg, i);
+}
+
+static void parallel_worker(void *arg) {
+  parallel_job_t *job = arg;
+  parallel_drain(job);
+  sem_post(&job->done);
+}
+
+uint32_t sched_parallel(parallel_fn_t fn, void *arg, uint32_t count) {
+  parallel_job_t job = {fn, arg, count, 0, SEMAPHORE_INIT(0)};
+  uint32_t workers = smp_cpu_count() - 1;
+  uint32_t spawned = 0;
+
+  if (workers > count)
+    workers = count;
+  if (started) {
+    uint8_t prio = thread_current()->priority;
+    for (uint32_t i = 0; i < workers; i++)
+      if (thread_create("worker", parallel_worker, &job, prio))
+        spawned++;
+  }
+
+  parallel_drain(&job);
+  for (uint32_t i = 0; i < spawned; i++)
+    sem_wait(&job.done);
+  return spawned + 1;
+}
@@ -0,0 +1,126 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "../smp/spinlock.h"
+#include <stdint.h>
+
+/* Kernel threads with a preemptive priority scheduler. Higher priorities
+ * always run first; threads of equal priority round-robin on a timer-driven
+ * time slice. All threads share the kernel address space; stacks come from
+ * a fixed pool.
+ *
+ * Each CPU has its own run queues. Woken threads go back to the CPU they
+ * last ran on unless another CPU is idle, and a CPU that runs out of work
+ * steals from the busiest queue, so there is no global run-queue lock. */
+
+#define SCHED_MAX_THREADS 32
+#define SCHED_STACK_SIZE 16384
+#define SCHED_TIMESLICE_TICKS 10
+#define SCHED_NAME_LEN 16
+
+typedef enum {
+  PRIO_IDLE,
+  PRIO_LOW,
+  PRIO_NORMAL,
+  PRIO_HIGH,
+  SCHED_PRIORITIES
+} thread_priority_t;
+
+typedef enum {
+  THREAD_UNUSED,
+  THREAD_READY,
+  THREAD_RUNNING,
+  THREAD_BLOCKED,
+  THREAD_SLEEPING,
+  THREAD_DEAD
+} thread_state_t;
+
+typedef void (*thread_entry_t)(void *arg);
+
+typedef struct thread {
+  uintptr_t sp; /* saved by context_switch */
+  uint32_t id;
+  char name[SCHED_NAME_LEN];
+  thread_state_t state;
+  uint8_t priority;
+  uint32_t slice;      /* ticks left in the current time slice */
+  uint64_t wake_tick;  /* THREAD_SLEEPING: timer tick to wake at */
+  uint64_t run_ticks;  /* ticks spent running, for ps */
+  uint32_t cpu;        /* CPU it runs on, or last ran on */
+  volatile int on_cpu; /* its stack is live until the switch away finishes */
+  uint32_t preempt_count;
+  uintptr_t kstack_top; /* pool threads: where an entry from ring 3 lands */
+  thread_entry_t entry;
+  void *arg;
+  struct thread *next; /* run queue, wait queue or sleep list link */
+} thread_t;
+
+typedef struct {
+  thread_t *head;
+  thread_t *tail;
+} thread_list_t;
+
+typedef struct {
+  ticket_lock_t lock;
+  thread_list_t list;
+} wait_queue_t;
+
+typedef struct {
+  volatile int locked;
+  thread_t *owner;
+  wait_queue_t waiters;
+} mutex_t;
+
+typedef struct {
+  volatile int count;
+  wait_queue_t waiters;
+} semaphore_t;
+
+#define WAIT_QUEUE_INIT {TICKET_LOCK_INIT, {0, 0}}
+#define MUTEX_INIT {0, 0, WAIT_QUEUE_INIT}
+#define SEMAPHORE_INIT(n) {(n), WAIT_QUEUE_INIT}
+
+/* Turn the boot context into thread 0 and start preempting. */
+void sched_init(const char *boot_thread_name);
+/* Called by each AP once it is up: the AP's boot context becomes its idle
+ * thread and the CPU starts taking work. Does not return. */
+void sched_ap_start(uint32_t cpu);
+int sched_running(void);
+
+thread_t *thread_create(const char *name, thread_entry_t entry, void *arg,
+                        uint8_t priority);
+void thread_exit(void);
+thread_t *thread_current(void);
+
+void sched_yield(void);
+void sched_sleep_ms(uint32_t ms);
+void sched_preempt_disable(void);
+void sched_preempt_enable(void);
+
+/* Block on / wake a wait queue. The caller re-checks its wake-up condition
+ * after every return; for a condition another CPU can change, use a
+ * semaphore or mutex, which test it under the queue's lock. */
+void wait_queue_sleep(wait_queue_t *wq);
+int wait_queue_wake_one(wait_queue_t *wq);
+int wait_queue_wake_all(wait_queue_t *wq);
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+void sem_init(semaphore_t *s, int count);
+void sem_wait(semaphore_t *s);
+void sem_post(semaphore_t *s);
+
+/* snapshot for ps; returns threads copied */
+uint32_t sched_list(thread_t *out, uint32_t max);
+
+/* Run fn(arg, i) for every i in [0, count) on worker threads spread over
+ * the online CPUs, the caller taking a share, and return when all are done.
+ * Indices are handed out one at a time, so make each a sizeable chunk.
+ * Returns the number of threads that took part. */
+typedef void (*parallel_fn_t)(void *arg, uint32_t index);
+uint32_t sched_parallel(parallel_fn_t fn, void *arg, uint32_t count);
+
+#endif
@@ -0,0 +1,21 @@
+BITS 32
+section .text
+global context_switch
+
+; void context_switch(uintptr_t *old_sp, uintptr_t new_sp)
+; Saves the callee-saved registers on the current stack, parks esp in
+; *old_sp and resumes whatever new_sp was saved (or built) with.
+context_switch:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
@@ -0,0 +1,24 @@
+BITS 64
+section .text
+global context_switch
+
+; void context_switch(uintptr_t *old_sp, uintptr_t new_sp)
+; switch.asm for the x86_64 build: the System V callee-saved registers go
+; on the current stack, rsp in *old_sp (rdi), and the ones saved (or built,
+; see thread_alloc) with new_sp (rsi) come back off.
+context_switch:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
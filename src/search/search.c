@@ -0,0 +1,70 @@
+#include "search.h"
+#include "../clib/clib.h"
+
+int search_init(search_t *s, const char *pattern) {
+  uint32_t len = (uint32_t)strlen(pattern);
+  if (len == 0 || len > SEARCH_MAX)
+    return -1;
+  memcpy(s->pat, pattern, len);
+  s->len = len;
+  /* a byte the pattern doesn't hold (but for its last) moves it past */
+  memset(s->shift, (int)len, sizeof(s->shift));
+  for (uint32_t i = 0; i + 1 < len; i++)
+    s->shift[s->pat[i]] = (uint8_t)(len - 1 - i);
+  return 0;
+}
+
+static const char *find_short(const search_t *s, const char *text,
+                              uint32_t len) {
+  const char *end = text + len;
+  const char *p = text;
+  while ((uint32_t)(end - p) >= s->len) {
+    p = memchr(p, s->pat[0], (uint32_t)(end - p) - s->len + 1);
+    if (!p)
+      return NULL;
+    if (memcmp(p + 1, s->pat + 1, s->len - 1) == 0)
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+const char *search_find(const search_t *s, const char *text, uint32_t len) {
+  if (len < s->len)
+    return NULL;
+  if (s->len <= SEARCH_SHORT)
+    return find_short(s, text, len);
+
+  const uint8_t *t = (const uint8_t *)text;
+  uint8_t last = s->pat[s->len - 1];
+  for (uint32_t pos = 0; pos <= len - s->len;) {
+    uint8_t c = t[pos + s->len - 1];
+    if (c == last && memcmp(t + pos, s->pat, s->len - 1) == 0)
+      return text + pos;
+    pos += s->shift[c];
+  }
+  return NULL;
+}
+
+/* Backtracking is only ever to the last *: on a mismatch it takes one
+ * more character of name and tries again from there. */
+int search_glob(const char *pattern, const char *name) {
+  const char *star = 0, *resume = 0;
+  while (*name) {
+    if (*pattern == '*') {
+      star = pattern++;
+      resume = name;
+    } else if (*pattern == '?' || *pattern == *name) {
+      pattern++;
+      name++;
+    } else if (star) {
+      pattern = star + 1;
+      name = ++resume;
+    } else {
+      return 0;
+    }
+  }
+  while (*pattern == '*')
+    pattern++;
+  return *pattern == '\0';
+}
@@ -0,0 +1,32 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+/* Substring search for grep and name matching for find.
+ *
+ * A pattern of up to SEARCH_SHORT bytes is found by letting memchr, which
+ * goes a word at a time, skip to each place its first byte occurs and
+ * comparing the rest there. A longer one uses Boyer-Moore-Horspool: the
+ * byte under the end of the pattern says how far it can move, usually its
+ * whole length, so most bytes of the text are never looked at. */
+
+#define SEARCH_MAX 64   /* longest pattern */
+#define SEARCH_SHORT 3  /* longest one searched with memchr alone */
+
+typedef struct {
+  uint8_t pat[SEARCH_MAX];
+  uint32_t len;
+  uint8_t shift[256]; /* BMH: how far to move for the byte under the end */
+} search_t;
+
+/* -1 if pattern is empty or longer than SEARCH_MAX */
+int search_init(search_t *s, const char *pattern);
+/* the first occurrence in text[0..len), or NULL */
+const char *search_find(const search_t *s, const char *text, uint32_t len);
+
+/* shell-style match of the whole of name: * any run of characters, ? any
+ * one, anything else itself */
+int search_glob(const char *pattern, const char *name);
+
+#endif
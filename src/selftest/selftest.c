@@ -0,0 +1,300 @@
+#include "selftest.h"
+#include "../bcache/bcache.h"
+#include "../bootinfo/bootinfo.h"
+#include "../clib/clib.h"
+#include "../cpu/paging.h"
+#include "../disk/disk.h"
+#include "../exec/exec.h"
+#include "../fs/fs.h"
+#include "../multiboot.h"
+#include "../search/search.h"
+#include "../timer/timer.h"
+#include "../vga/vga.h"
+
+#define SELFTEST_SCRATCH_LBA 30000 /* near the end of the 16 MiB fs area */
+
+static int failures;
+static int current_failed;
+
+#define EXPECT(cond)                                                           \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      vga_putstr("  expect failed: " #cond "\n", 0x0C);                        \
+      current_failed = 1;                                                      \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)
+
+static uint8_t buf_a[4096];
+static uint8_t buf_b[4096];
+
+static void fill(uint8_t *buf, uint32_t len, uint32_t seed) {
+  for (uint32_t i = 0; i < len; i++)
+    buf[i] = (uint8_t)(seed + i * 7);
+}
+
+static void test_timer(void) {
+  EXPECT(timer_tsc_khz() > 0);
+  uint64_t start = timer_ticks();
+  uint64_t tsc = rdtsc();
+  /* ~20 ms of TSC time must see the PIT tick advance */
+  while (rdtsc() - tsc < (uint64_t)timer_tsc_khz() * 20)
+    ;
+  EXPECT(timer_ticks() > start);
+}
+
+/* device mappings are counted per 4 MiB page and must agree on type */
+#define SELFTEST_MMIO 0xE0000000 /* mapped by nothing else, never touched */
+
+static void test_paging(void) {
+  EXPECT(paging_enabled());
+  uint8_t *p = paging_map(SELFTEST_MMIO, PAGE_SIZE, PAGING_UC);
+  EXPECT(p == (uint8_t *)SELFTEST_MMIO);
+  EXPECT(paging_map(SELFTEST_MMIO + PAGE_SIZE, PAGE_SIZE, PAGING_WC) == NULL);
+  EXPECT(paging_map(SELFTEST_MMIO + PAGE_SIZE, PAGE_SIZE, PAGING_UC) != NULL);
+  paging_unmap(p, PAGE_SIZE);
+  paging_unmap(p + PAGE_SIZE, PAGE_SIZE);
+  EXPECT(paging_map(SELFTEST_MMIO, PAGE_SIZE, PAGING_WC) == p);
+  paging_unmap(p, PAGE_SIZE);
+  /* RAM past the first 4 MiB stays write-back */
+  EXPECT(paging_map(LARGE_PAGE_SIZE, PAGE_SIZE, PAGING_UC) == NULL);
+  EXPECT(paging_map(LARGE_PAGE_SIZE, PAGE_SIZE, PAGING_WB) != NULL);
+}
+
+static void test_disk_roundtrip(void) {
+  uint8_t saved[512];
+  EXPECT(disk_read_lba(SELFTEST_SCRATCH_LBA, saved) == 0);
+  fill(buf_a, 512, 3);
+  EXPECT(disk_write_lba(SELFTEST_SCRATCH_LBA, buf_a) == 0);
+  EXPECT(disk_read_lba(SELFTEST_SCRATCH_LBA, buf_b) == 0);
+  EXPECT(memcmp(buf_a, buf_b, 512) == 0);
+  EXPECT(disk_write_lba(SELFTEST_SCRATCH_LBA, saved) == 0);
+}
+
+/* several chunks in one request, so an array splits it over its members */
+#define SELFTEST_SPAN 272
+
+static void test_disk_span(void) {
+  static uint8_t saved[SELFTEST_SPAN * 512];
+  static uint8_t out[SELFTEST_SPAN * 512], in[SELFTEST_SPAN * 512];
+  EXPECT(disk_read_lbas(SELFTEST_SCRATCH_LBA, SELFTEST_SPAN, saved) == 0);
+  fill(out, sizeof(out), 11);
+  EXPECT(disk_write_lbas(SELFTEST_SCRATCH_LBA, SELFTEST_SPAN, out) == 0);
+  EXPECT(disk_read_lbas(SELFTEST_SCRATCH_LBA, SELFTEST_SPAN, in) == 0);
+  EXPECT(memcmp(out, in, sizeof(in)) == 0);
+  /* and sector by sector, which takes the short path */
+  for (uint32_t i = 0; i < SELFTEST_SPAN; i += 37) {
+    EXPECT(disk_read_lba(SELFTEST_SCRATCH_LBA + i, buf_b) == 0);
+    EXPECT(memcmp(buf_b, out + i * 512, 512) == 0);
+  }
+  EXPECT(disk_write_lbas(SELFTEST_SCRATCH_LBA, SELFTEST_SPAN, saved) == 0);
+}
+
+static void test_fs_roundtrip(void) {
+  static const uint32_t sizes[] = {0, 1, 511, 512, 513, 4096};
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    fill(buf_a, sizes[i], i);
+    EXPECT(fs_write_file(".selftest", buf_a, sizes[i]) == 0);
+    EXPECT(fs_read_file(".selftest", buf_b, sizeof(buf_b)) == (int)sizes[i]);
+    EXPECT(memcmp(buf_a, buf_b, sizes[i]) == 0);
+  }
+  EXPECT(fs_delete_file(".selftest") == 0);
+  EXPECT(fs_read_file(".selftest", buf_b, sizeof(buf_b)) == -1);
+}
+
+static void test_fs_create_delete(void) {
+  EXPECT(fs_create_file(".selftest_c") == 0);
+  EXPECT(fs_create_file(".selftest_c") == -2);
+  EXPECT(fs_delete_file(".selftest_c") == 0);
+  EXPECT(fs_delete_file(".selftest_c") == -1);
+}
+
+static void test_fs_directories(void) {
+  EXPECT(fs_create_directory(".selftest_d") == 0);
+  EXPECT(fs_is_directory(".selftest_d") == 1);
+  EXPECT(fs_change_directory(".selftest_d") == 0);
+  fill(buf_a, 100, 9);
+  EXPECT(fs_write_file("f", buf_a, 100) == 0);
+  EXPECT(fs_change_directory("/") == 0);
+  EXPECT(fs_read_file(".selftest_d/f", buf_b, sizeof(buf_b)) == 100);
+  EXPECT(fs_delete_file(".selftest_d/f") == 0);
+  EXPECT(fs_delete_directory(".selftest_d") == 0);
+}
+
+static void test_fs_remount(void) {
+  fill(buf_a, 1500, 5);
+  EXPECT(fs_write_file(".selftest_r", buf_a, 1500) == 0);
+  EXPECT(fs_flush() == 0);
+  bcache_invalidate();
+  EXPECT(fs_init() == 0); /* reload metadata from disk */
+  EXPECT(fs_read_file(".selftest_r", buf_b, sizeof(buf_b)) == 1500);
+  EXPECT(memcmp(buf_a, buf_b, 1500) == 0);
+  EXPECT(fs_delete_file(".selftest_r") == 0);
+}
+
+/* A two-segment program, laid out by hand: code at the user base that
+ * exits with the word at the start of its data page, which the fs holds. */
+#define SELFTEST_ELF_SIZE 0x2004
+
+static void build_elf(uint8_t *elf, const uint8_t code[12]) {
+  static const uint32_t phdrs[2][8] = {
+      /* type, offset, vaddr, paddr, filesz, memsz, flags (r-x, rw-), align */
+      {1, 0x1000, PAGING_USER_BASE, 0, 12, 12, 5, PAGE_SIZE},
+      {1, 0x2000, PAGING_USER_BASE + PAGE_SIZE, 0, 4, PAGE_SIZE, 6, PAGE_SIZE},
+  };
+  uint32_t entry = PAGING_USER_BASE, phoff = 52, data = 42;
+  uint16_t half[] = {2, 3}; /* executable, i386 */
+  uint16_t sizes[] = {52, 32, 2}; /* header, phdr, phdrs */
+
+  memset(elf, 0, SELFTEST_ELF_SIZE);
+  memcpy(elf, "\x7F" "ELF\x01\x01\x01", 7);
+  memcpy(elf + 16, half, sizeof(half));
+  elf[20] = 1;
+  memcpy(elf + 24, &entry, 4);
+  memcpy(elf + 28, &phoff, 4);
+  memcpy(elf + 40, sizes, sizeof(sizes));
+  memcpy(elf + phoff, phdrs, sizeof(phdrs));
+  memcpy(elf + 0x1000, code, 12);
+  memcpy(elf + 0x2000, &data, 4);
+}
+
+static void test_exec(void) {
+  static uint8_t elf[SELFTEST_ELF_SIZE];
+  /* mov eax, [data]; mov ebx, eax; xor eax, eax (SYS_EXIT); int 0x80 */
+  static const uint8_t exits[12] = {0xA1, 0x00, 0x10, 0x00, 0x40, 0x89,
+                                    0xC3, 0x31, 0xC0, 0xCD, 0x80, 0x90};
+  /* the same, reading address 0, which is the kernel's */
+  static const uint8_t faults[12] = {0xA1, 0x00, 0x00, 0x00, 0x00, 0x89,
+                                     0xC3, 0x31, 0xC0, 0xCD, 0x80, 0x90};
+  char *argv[] = {".selftest_x", "arg"};
+  int status = 0;
+
+  build_elf(elf, exits);
+  EXPECT(fs_write_file(".selftest_x", elf, sizeof(elf)) == 0);
+  EXPECT(exec_run(2, argv, &status) == 0);
+  EXPECT(status == 42);
+  EXPECT(exec_pages_used() == 3); /* code, data and stack, nothing else */
+
+  build_elf(elf, faults);
+  EXPECT(fs_write_file(".selftest_x", elf, sizeof(elf)) == 0);
+  EXPECT(exec_run(1, argv, &status) == 0);
+  EXPECT(status == EXEC_KILLED);
+
+  EXPECT(fs_write_file(".selftest_x", (const uint8_t *)"#!", 2) == 0);
+  EXPECT(exec_run(1, argv, &status) == EXEC_BAD_FORMAT);
+  EXPECT(fs_delete_file(".selftest_x") == 0);
+  EXPECT(exec_run(1, argv, &status) == EXEC_NOT_FOUND);
+}
+
+static void test_search(void) {
+  static const char text[] = "error: disk 0 timeout\nwarn: retry\nerror: disk";
+  search_t s;
+  EXPECT(memchr(text, 'w', sizeof(text)) == text + 22);
+  EXPECT(memchr(text, 'Q', sizeof(text)) == NULL);
+  EXPECT(search_init(&s, "") == -1);
+  EXPECT(search_init(&s, "disk") == 0); /* Horspool */
+  EXPECT(search_find(&s, text, sizeof(text) - 1) == text + 7);
+  EXPECT(search_find(&s, text + 8, sizeof(text) - 9) == text + 41);
+  EXPECT(search_init(&s, "ry") == 0); /* memchr */
+  EXPECT(search_find(&s, text, sizeof(text) - 1) == text + 31);
+  EXPECT(search_init(&s, "disks") == 0);
+  EXPECT(search_find(&s, text, sizeof(text) - 1) == NULL);
+  EXPECT(search_glob("*.log", "boot.log") && !search_glob("*.log", "boot.lo"));
+  EXPECT(search_glob("a?c*", "abc") && !search_glob("a?c", "ac"));
+}
+
+/* a Multiboot2 info block the way GRUB lays it out: tags padded to 8 */
+static uint32_t add_tag(uint8_t *info, uint32_t off, const void *tag,
+                        uint32_t size) {
+  memcpy(info + off, tag, size);
+  return off + ((size + 7) & ~7u);
+}
+
+static void test_bootinfo(void) {
+  static uint64_t block[32];
+  uint8_t *info = (uint8_t *)block;
+  struct {
+    multiboot2_tag_string_t tag;
+    char s[4];
+  } cmdline = {{MULTIBOOT2_TAG_CMDLINE, sizeof(cmdline)}, "a=b"};
+  multiboot2_tag_meminfo_t mem = {MULTIBOOT2_TAG_BASIC_MEMINFO, sizeof(mem),
+                                  640, 1024};
+  struct {
+    multiboot2_tag_mmap_t tag;
+    multiboot2_mmap_entry_t e[2];
+  } mmap = {{MULTIBOOT2_TAG_MMAP, sizeof(mmap),
+             sizeof(multiboot2_mmap_entry_t), 0},
+            {{0, 0x9F000, MULTIBOOT2_MEMORY_AVAILABLE, 0},
+             {0x100000, 0x7F00000, MULTIBOOT2_MEMORY_AVAILABLE, 0}}};
+  multiboot2_tag_framebuffer_t fb = {MULTIBOOT2_TAG_FRAMEBUFFER,
+                                     sizeof(fb),
+                                     0xFD000000,
+                                     4096,
+                                     1024,
+                                     768,
+                                     32,
+                                     MULTIBOOT2_FRAMEBUFFER_RGB,
+                                     0,
+                                     16, 8, 8, 8, 0, 8};
+  multiboot2_tag_t end = {MULTIBOOT2_TAG_END, sizeof(end)};
+  uint32_t off = sizeof(multiboot2_info_t);
+  bootinfo_t boot;
+
+  off = add_tag(info, off, &cmdline, sizeof(cmdline));
+  off = add_tag(info, off, &mem, sizeof(mem));
+  off = add_tag(info, off, &mmap, sizeof(mmap));
+  off = add_tag(info, off, &fb, sizeof(fb));
+  off = add_tag(info, off, &end, sizeof(end));
+  ((multiboot2_info_t *)info)->total_size = off;
+
+  EXPECT(bootinfo_parse(MULTIBOOT2_BOOTLOADER_MAGIC, (uintptr_t)info,
+                        &boot) == 0);
+  EXPECT(boot.multiboot2 && strcmp(boot.cmdline, "a=b") == 0);
+  EXPECT(boot.module_end == 0);
+  EXPECT(boot.ram_top == 0x8000000); /* the map wins over mem_upper */
+  EXPECT(boot.fb.addr == 0xFD000000 && boot.fb.bpp == 32);
+  EXPECT(boot.fb.width == 1024 && boot.fb.red_pos == 16);
+  EXPECT(bootinfo_parse(0, (uintptr_t)info, &boot) == -1);
+}
+
+typedef struct {
+  const char *name;
+  void (*fn)(void);
+} selftest_case_t;
+
+static const selftest_case_t cases[] = {
+    {"timer", test_timer},
+    {"paging", test_paging},
+    {"bootinfo", test_bootinfo},
+    {"search", test_search},
+    {"disk_roundtrip", test_disk_roundtrip},
+    {"disk_span", test_disk_span},
+    {"fs_roundtrip", test_fs_roundtrip},
+    {"fs_create_delete", test_fs_create_delete},
+    {"fs_directories", test_fs_directories},
+    {"fs_remount", test_fs_remount},
+    {"exec", test_exec},
+};
+
+int selftest_run(void) {
+  char num[21];
+  uint32_t n = sizeof(cases) / sizeof(cases[0]);
+
+  failures = 0;
+  fs_change_directory("/");
+  for (uint32_t i = 0; i < n; i++) {
+    current_failed = 0;
+    cases[i].fn();
+    failures += current_failed;
+    vga_putstr("TEST ", 0x0F);
+    vga_putstr(cases[i].name, 0x0F);
+    vga_putstr(current_failed ? " FAIL\n" : " PASS\n",
+               current_failed ? 0x0C : 0x0A);
+  }
+  vga_putstr("TEST_SUMMARY passed=", 0x0F);
+  vga_putstr(utoa(n - failures, num, 10), 0x0F);
+  vga_putstr(" failed=", 0x0F);
+  vga_putstr(utoa(failures, num, 10), 0x0F);
+  vga_putchar('\n', 0x0F);
+  return failures;
+}
@@ -0,0 +1,8 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+/* In-kernel smoke tests for headless runs (autorun=test). Prints one
+ * "TEST <name> PASS|FAIL" line per case and returns the failure count. */
+int selftest_run(void);
+
+#endif
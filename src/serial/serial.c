@@ -0,0 +1,43 @@
+#include "serial.h"
+#include "../clib/clib.h"
+
+static int serial_present = 0;
+
+void serial_init(void) {
+  outb(SERIAL_COM1 + 1, 0x00); /* no interrupts */
+  outb(SERIAL_COM1 + 3, 0x80); /* DLAB on */
+  outb(SERIAL_COM1 + 0, 0x01); /* divisor 1 = 115200 baud */
+  outb(SERIAL_COM1 + 1, 0x00);
+  outb(SERIAL_COM1 + 3, 0x03); /* 8N1, DLAB off */
+  outb(SERIAL_COM1 + 2, 0xC7); /* FIFO on, cleared, 14-byte threshold */
+  outb(SERIAL_COM1 + 4, 0x1E); /* loopback to probe the UART */
+  outb(SERIAL_COM1 + 0, 0xAE);
+  if (inb(SERIAL_COM1 + 0) != 0xAE) {
+    serial_present = 0;
+    return;
+  }
+  outb(SERIAL_COM1 + 4, 0x0F); /* normal operation, OUT1/OUT2, RTS/DTR */
+  serial_present = 1;
+}
+
+int serial_ready(void) { return serial_present; }
+
+void serial_putchar(char c) {
+  if (!serial_present)
+    return;
+  if (c == '\n')
+    serial_putchar('\r');
+  while (!(inb(SERIAL_COM1 + 5) & 0x20))
+    ;
+  outb(SERIAL_COM1, (unsigned char)c);
+}
+
+void serial_putstr(const char *str) {
+  while (*str)
+    serial_putchar(*str++);
+}
+
+void serial_write(const char *buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++)
+    serial_putchar(buf[i]);
+}
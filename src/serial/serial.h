@@ -0,0 +1,14 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+
+void serial_init(void);
+int serial_ready(void); /* 1 once serial_init found a working UART */
+void serial_putchar(char c);
+void serial_putstr(const char *str);
+void serial_write(const char *buf, uint32_t len);
+
+#endif
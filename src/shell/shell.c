@@ -1,14 +1,39 @@
 #include "shell.h"
+#include "../boottime/boottime.h"
 #include "../clib/clib.h"
 #include "../commands/commands.h"
 #include "../fs/fs.h"
 #include "../kernel.h"
 #include "../keyboard/keyboard.h"
+#include "../pipe/pipe.h"
+#include "../trace/trace.h"
 #include "../vga/vga.h"
 
 static char input_buffer[INPUT_BUFFER_SIZE];
 static unsigned int input_pos = 0;
 
+/* A line is up to SHELL_MAX_STAGES commands joined by |, the last of them
+ * optionally redirected with > or >>. The commands run one after another,
+ * each with its console output caught in a pipe that the next one reads as
+ * its input; two pipes are enough, used in turn. A redirect writes the
+ * last pipe to the file once its command has finished, so a command that
+ * reads the fs never sees the file change under it. */
+static pipe_t pipes[2];
+static pipe_t *stage_in;  /* NULL: the keyboard */
+static pipe_t *stage_out; /* NULL: the screen */
+static uint8_t redirect_buf[4096];
+static int source_depth = 0;
+
+static void shell_run_line(char *line);
+
+static void shell_sink(char c) { pipe_write(stage_out, &c, 1); }
+
+int shell_read_input(char *buf, uint32_t len) {
+  if (!stage_in)
+    return -1;
+  return (int)pipe_read(stage_in, buf, len);
+}
+
 static void shell_parse_input(char *input, char *argv[], int *argc) {
   *argc = 0;
   char *p = input;
@@ -26,7 +51,63 @@ static void shell_parse_input(char *input, char *argv[], int *argc) {
   }
 }
 
+/* Run a script a line at a time inside one fs batch, so the file table
+ * is written once at the end instead of after every command. Its path is
+ * made absolute first, so a cd in the script doesn't lose it. */
+static void cmd_source(int argc, char *argv[]) {
+  char line[INPUT_BUFFER_SIZE];
+  char path[FS_FILENAME_LEN * 2 + 1];
+  uint32_t offset = 0;
+
+  if (argc != 2) {
+    vga_putstr("Usage: source <file>\n", 0x0E);
+    return;
+  }
+  /* the lines reuse the pipes */
+  if (stage_in || stage_out) {
+    vga_putstr("source: can't be piped or redirected\n", 0x0C);
+    return;
+  }
+  if (source_depth == SHELL_SOURCE_DEPTH) {
+    vga_putstr("source: nested too deep\n", 0x0C);
+    return;
+  }
+  path[0] = '/';
+  fs_resolve_path(argv[1], path + 1);
+  source_depth++;
+  fs_batch_begin();
+  while (1) {
+    int n = fs_read_at(path, offset, (uint8_t *)line, sizeof(line) - 1);
+    if (n < 0)
+      vga_putstr("source: file not found\n", 0x0C);
+    if (n <= 0)
+      break;
+
+    int len = 0;
+    while (len < n && line[len] != '\n')
+      len++;
+    if (len == (int)sizeof(line) - 1) {
+      vga_putstr("source: line too long\n", 0x0C);
+      break;
+    }
+    offset += (uint32_t)len + (len < n);
+    if (len > 0 && line[len - 1] == '\r')
+      len--;
+    line[len] = '\0';
+
+    char *p = line;
+    while (*p == ' ')
+      p++;
+    if (*p != '\0' && *p != '#')
+      shell_run_line(p);
+  }
+  if (fs_batch_end() < 0)
+    vga_putstr("source: writing the file table failed\n", 0x0C);
+  source_depth--;
+}
+
 static void shell_execute_command(int argc, char *argv[]) {
+  TRACE_SCOPE(TP_SHELL_CMD, argc);
   if (argc > 0) {
     if (strcmp(argv[0], "hello") == 0) {
       cmd_hello();
@@ -47,33 +128,154 @@ static void shell_execute_command(int argc, char *argv[]) {
       cmd_touch(argc, argv);
     } else if (strcmp(argv[0], "cat") == 0) {
       cmd_cat(argc, argv);
+    } else if (strcmp(argv[0], "grep") == 0) {
+      cmd_grep(argc, argv);
+    } else if (strcmp(argv[0], "find") == 0) {
+      cmd_find(argc, argv);
     } else if (strcmp(argv[0], "write") == 0) {
       cmd_write(argc, argv);
-    } else if (strcmp(argv[0], "mkdir") == 0) { // ADD THIS
+    } else if (strcmp(argv[0], "append") == 0) {
+      cmd_append(argc, argv);
+    } else if (strcmp(argv[0], "fallocate") == 0) {
+      cmd_fallocate(argc, argv);
+    } else if (strcmp(argv[0], "compress") == 0) {
+      cmd_compress(argc, argv);
+    } else if (strcmp(argv[0], "dedup") == 0) {
+      cmd_dedup(argc, argv);
+    } else if (strcmp(argv[0], "mkdir") == 0) {
       cmd_mkdir(argc, argv);
-    } else if (strcmp(argv[0], "rmdir") == 0) { // ADD THIS
+    } else if (strcmp(argv[0], "rmdir") == 0) {
       cmd_rmdir(argc, argv);
     } else if (strcmp(argv[0], "rm") == 0) {
       cmd_rm(argc, argv);
-    } else if (strcmp(argv[0], "cd") == 0) { // ADD THIS
+    } else if (strcmp(argv[0], "cp") == 0) {
+      cmd_cp(argc, argv);
+    } else if (strcmp(argv[0], "mv") == 0) {
+      cmd_mv(argc, argv);
+    } else if (strcmp(argv[0], "cd") == 0) {
       cmd_cd(argc, argv);
-    } else if (strcmp(argv[0], "pwd") == 0) { // ADD THIS
+    } else if (strcmp(argv[0], "pwd") == 0) {
       cmd_pwd();
-    } else {
+    } else if (strcmp(argv[0], "bench") == 0) {
+      cmd_bench(argc, argv);
+    } else if (strcmp(argv[0], "trace") == 0) {
+      cmd_trace(argc, argv);
+    } else if (strcmp(argv[0], "prof") == 0) {
+      cmd_prof(argc, argv);
+    } else if (strcmp(argv[0], "ps") == 0) {
+      cmd_ps();
+    } else if (strcmp(argv[0], "sync") == 0) {
+      cmd_sync();
+    } else if (strcmp(argv[0], "fstrim") == 0) {
+      cmd_fstrim();
+    } else if (strcmp(argv[0], "disks") == 0) {
+      cmd_disks();
+    } else if (strcmp(argv[0], "boottime") == 0) {
+      cmd_boottime();
+    } else if (strcmp(argv[0], "mkfs") == 0) {
+      cmd_mkfs(argc, argv);
+    } else if (strcmp(argv[0], "source") == 0) {
+      cmd_source(argc, argv);
+    } else if (cmd_exec(argc, argv) != 0) {
       vga_putstr("Unknown command\n", color_white_on_black());
     }
   }
 }
 
+/* Cut "> file" or ">> file" off the end of cmd: the file, "" if the name
+ * is missing, or NULL if there is no redirect. */
+static char *shell_parse_redirect(char *cmd, int *append) {
+  char *p = cmd;
+  while (*p && *p != '>')
+    p++;
+  if (*p == '\0')
+    return NULL;
+  *p++ = '\0';
+  *append = *p == '>';
+  if (*append)
+    p++;
+  while (*p == ' ')
+    p++;
+  char *name = p;
+  while (*p && *p != ' ')
+    p++;
+  *p = '\0';
+  return name;
+}
+
+/* out's contents into the file: replacing it, or after what it holds */
+static void shell_write_redirect(pipe_t *out, const char *name, int append) {
+  int first = !append;
+  do {
+    uint32_t n = pipe_read(out, (char *)redirect_buf, sizeof(redirect_buf));
+    if (n == 0 && !first)
+      break;
+    int rc = first ? fs_write_file(name, redirect_buf, n)
+                   : fs_append_file(name, redirect_buf, n);
+    if (rc < 0) {
+      vga_putstr("shell: can't write ", 0x0C);
+      vga_putstr(name, 0x0C);
+      vga_putchar('\n', 0x0C);
+      return;
+    }
+    first = 0;
+  } while (pipe_used(out));
+}
+
+static void shell_run_line(char *line) {
+  char *stages[SHELL_MAX_STAGES];
+  int n = 1;
+  stages[0] = line;
+  for (char *p = line; *p; p++) {
+    if (*p != '|')
+      continue;
+    if (n == SHELL_MAX_STAGES) {
+      vga_putstr("shell: too many |\n", 0x0C);
+      return;
+    }
+    *p = '\0';
+    stages[n++] = p + 1;
+  }
+
+  pipe_t *in = NULL;
+  for (int i = 0; i < n; i++) {
+    int append = 0;
+    char *file = shell_parse_redirect(stages[i], &append);
+    if (file && (*file == '\0' || i < n - 1)) {
+      vga_putstr("shell: > needs a file, after the last command\n", 0x0C);
+      return;
+    }
+    pipe_t *out = NULL;
+    if (file || i < n - 1) {
+      out = &pipes[i % 2];
+      pipe_reset(out);
+    }
+
+    char *argv[MAX_ARGS];
+    int argc;
+    shell_parse_input(stages[i], argv, &argc);
+    stage_in = in;
+    stage_out = out;
+    vga_set_sink(out ? shell_sink : NULL);
+    shell_execute_command(argc, argv);
+    vga_set_sink(NULL);
+    stage_in = NULL;
+    stage_out = NULL;
+
+    if (out && out->dropped)
+      vga_putstr("shell: pipe full, output cut short\n", 0x0E);
+    if (file)
+      shell_write_redirect(out, file, append);
+    in = out;
+  }
+}
+
 static void shell_handle_input(char c) {
   if (c == '\n') {
     input_buffer[input_pos] = '\0';
     vga_putchar('\n', color_white_on_black());
 
-    char *argv[MAX_ARGS];
-    int argc;
-    shell_parse_input(input_buffer, argv, &argc);
-    shell_execute_command(argc, argv);
+    shell_run_line(input_buffer);
 
     input_pos = 0;
     vga_putstr(fs_get_current_dir(), color_green_on_black());
@@ -86,13 +288,13 @@ static void shell_handle_input(char c) {
       if (col > 0) {
         vga_set_cursor(row, col - 1);
       } else if (row > 0) {
-        vga_set_cursor(row - 1, VGA_MEM_WIDTH - 1);
+        vga_set_cursor(row - 1, vga_columns() - 1);
       }
       vga_putchar(' ', color_white_on_black());
       if (col > 0) {
         vga_set_cursor(row, col - 1);
       } else if (row > 0) {
-        vga_set_cursor(row - 1, VGA_MEM_WIDTH - 1);
+        vga_set_cursor(row - 1, vga_columns() - 1);
       }
     }
   } else {
@@ -105,6 +307,7 @@ static void shell_handle_input(char c) {
 
 void shell_start(void) {
 
+  boottime_mark("prompt");
   vga_putstr("> ", color_white_on_black());
 
   while (1) {
@@ -1,10 +1,17 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <stdint.h>
+
 #define INPUT_BUFFER_SIZE 128
 #define MAX_ARGS 16
+#define SHELL_MAX_STAGES 4   /* commands in a pipeline */
+#define SHELL_SOURCE_DEPTH 4 /* scripts sourcing scripts */
 
 void shell_start(void);
+/* For commands that read input: up to len bytes of what the command before
+ * it in a pipeline printed, 0 at the end, or -1 if it is not in one. */
+int shell_read_input(char *buf, uint32_t len);
 void cmd_theme(int argc, char *argv[]);
 void cmd_ls(void);
 void cmd_touch(int argc, char *argv[]);
@@ -0,0 +1,57 @@
+; Application processor entry. smp_init copies everything between
+; ap_trampoline_start and ap_trampoline_end to SMP_TRAMPOLINE_ADDR and
+; points the startup IPI there, so the code below runs at that address in
+; real mode, not where it is linked; REL() converts a label accordingly.
+; smp_init fills ap_trampoline_args with the stack and C entry point.
+
+%define TRAMPOLINE_ADDR 0x8000          ; SMP_TRAMPOLINE_ADDR in smp.h
+%define REL(label) (TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+section .text
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_args
+
+BITS 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(ap_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                       ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(ap_protected)
+
+BITS 32
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [REL(ap_trampoline_args)]
+    mov eax, [REL(ap_trampoline_args) + 4]
+    call eax                        ; does not return
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; same flat selectors as gdt.c, until the AP loads the kernel's GDT
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF           ; 0x08: ring 0 code
+    dq 0x00CF92000000FFFF           ; 0x10: ring 0 data
+ap_gdt_ptr:
+    dw ap_gdt_ptr - ap_gdt - 1
+    dd REL(ap_gdt)
+
+align 4
+ap_trampoline_args:
+    dd 0                            ; stack top
+    dd 0                            ; void (*entry)(void)
+ap_trampoline_end:
@@ -0,0 +1,85 @@
+; ap_boot.asm for the x86_64 build: the same trampoline, copied to
+; SMP_TRAMPOLINE_ADDR and entered in real mode, but it goes on from
+; protected mode into long mode on the boot page tables (entry64.asm),
+; which identity-map the low 4 GiB. ap_main then loads the kernel's own
+; GDT, IDT and page tables. ap_trampoline_args is laid out as on i386.
+
+%define TRAMPOLINE_ADDR 0x8000          ; SMP_TRAMPOLINE_ADDR in smp.h
+%define REL(label) (TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+CR4_PAE  equ 1 << 5
+CR0_PG   equ 1 << 31
+EFER_MSR equ 0xC0000080
+EFER_LME equ 1 << 8
+
+section .text
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_args
+extern boot_pml4
+
+BITS 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(ap_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                       ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(ap_protected)
+
+BITS 32
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, boot_pml4
+    mov cr3, eax
+    mov ecx, EFER_MSR
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+    jmp 0x18:REL(ap_long)
+
+BITS 64
+ap_long:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [REL(ap_trampoline_args)]
+    mov eax, [REL(ap_trampoline_args) + 4]
+    call rax                        ; does not return
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; protected-mode selectors as in gdt.c, plus the long-mode code segment
+; that gets the AP there, until it loads the kernel's GDT
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF           ; 0x08: ring 0 code, 32-bit
+    dq 0x00CF92000000FFFF           ; 0x10: ring 0 data
+    dq 0x00AF9A000000FFFF           ; 0x18: ring 0 code, long mode
+ap_gdt_ptr:
+    dw ap_gdt_ptr - ap_gdt - 1
+    dd REL(ap_gdt)
+
+align 4
+ap_trampoline_args:
+    dd 0                            ; stack top
+    dd 0                            ; void (*entry)(void)
+ap_trampoline_end:
@@ -0,0 +1,113 @@
+#include "smp.h"
+#include "../clib/clib.h"
+#include "../cpu/acpi.h"
+#include "../cpu/apic.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../cpu/paging.h"
+#include "../sched/sched.h"
+#include "../timer/timer.h"
+#include "../vga/vga.h"
+#include "spinlock.h"
+
+#define AP_SIPI_WAIT_US 200
+#define AP_ONLINE_WAIT_US 100000
+
+/* ap_boot.asm */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_trampoline_args[];
+
+static uint8_t ap_stacks[SMP_MAX_CPUS][SMP_AP_STACK_SIZE]
+    __attribute__((aligned(16)));
+static uint8_t cpu_apic_id[SMP_MAX_CPUS];
+static uint8_t apic_id_to_cpu[256]; /* unknown ids map to the BSP */
+static volatile uint32_t cpus_online = 1;
+static volatile uint32_t ap_booting; /* index of the AP being started */
+
+/* C entry for an AP, on its own stack with the trampoline's GDT */
+static void ap_main(void) {
+  gdt_load();
+  idt_load();
+  paging_load();
+  lapic_init();
+  uint32_t cpu = ap_booting;
+  gdt_load_tss(cpu);
+  __atomic_store_n(&cpus_online, cpu + 1, __ATOMIC_RELEASE);
+  sched_ap_start(cpu); /* becomes this CPU's idle thread */
+}
+
+static int wait_online(uint32_t cpu, uint32_t us) {
+  uint64_t end = rdtsc() + (uint64_t)us * timer_tsc_khz() / 1000;
+  while (rdtsc() < end) {
+    if (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) > cpu)
+      return 0;
+    cpu_relax();
+  }
+  return -1;
+}
+
+/* INIT, 10 ms, then up to two STARTUPs (the second only if the first was
+ * missed), as in the MultiProcessor Specification. */
+static int start_ap(uint8_t apic_id, uint32_t cpu) {
+  uint32_t *args = (uint32_t *)(SMP_TRAMPOLINE_ADDR +
+                                (ap_trampoline_args - ap_trampoline_start));
+  args[0] = (uint32_t)(uintptr_t)(ap_stacks[cpu] + SMP_AP_STACK_SIZE);
+  args[1] = (uint32_t)(uintptr_t)ap_main; /* the kernel is below 4 GiB */
+  ap_booting = cpu;
+
+  lapic_send_init(apic_id);
+  timer_delay_us(10000);
+  lapic_send_startup(apic_id, SMP_TRAMPOLINE_ADDR >> 12);
+  if (wait_online(cpu, AP_SIPI_WAIT_US) == 0)
+    return 0;
+  lapic_send_startup(apic_id, SMP_TRAMPOLINE_ADDR >> 12);
+  return wait_online(cpu, AP_ONLINE_WAIT_US);
+}
+
+void smp_init(void) {
+  acpi_madt_info_t madt;
+  char num[21];
+
+  if (acpi_read_madt(&madt) < 0 || apic_init(&madt) < 0) {
+    vga_putstr("SMP: no MADT/IOAPIC, running on one CPU\n", 0x0E);
+    return;
+  }
+
+  uint8_t bsp = lapic_id();
+  cpu_apic_id[0] = bsp;
+  memcpy((void *)SMP_TRAMPOLINE_ADDR, ap_trampoline_start,
+         (uint32_t)(ap_trampoline_end - ap_trampoline_start));
+
+  for (uint32_t i = 0; i < madt.num_cpus && cpus_online < SMP_MAX_CPUS; i++) {
+    uint8_t id = madt.lapic_ids[i];
+    if (id == bsp)
+      continue;
+    uint32_t cpu = cpus_online;
+    cpu_apic_id[cpu] = id;
+    apic_id_to_cpu[id] = (uint8_t)cpu;
+    if (start_ap(id, cpu) < 0) {
+      apic_id_to_cpu[id] = 0;
+      vga_putstr("SMP: CPU with APIC id ", 0x0C);
+      vga_putstr(utoa(id, num, 10), 0x0C);
+      vga_putstr(" did not start\n", 0x0C);
+    }
+  }
+
+  vga_putstr("SMP: ", 0x0A);
+  vga_putstr(utoa(cpus_online, num, 10), 0x0A);
+  vga_putstr(" CPUs online\n", 0x0A);
+}
+
+uint32_t smp_cpu_count(void) { return cpus_online; }
+
+uint32_t smp_cpu_index(void) {
+  if (!apic_active())
+    return 0;
+  return apic_id_to_cpu[lapic_id()];
+}
+
+void smp_send_resched(uint32_t cpu) {
+  if (cpu < cpus_online && cpu != smp_cpu_index())
+    lapic_send_ipi(cpu_apic_id[cpu], APIC_RESCHED_VECTOR);
+}
@@ -0,0 +1,26 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+/* Multiprocessor bring-up. smp_init finds the CPUs in the ACPI MADT, moves
+ * interrupt delivery from the 8259 PIC to the local APIC + IOAPIC, and
+ * starts every application processor with INIT-SIPI-SIPI. Without an MADT
+ * (or with one CPU) the kernel keeps running uniprocessor on the PIC.
+ *
+ * Per-CPU data is kept by each subsystem in arrays indexed by
+ * smp_cpu_index(): 0 is the bootstrap processor, APs are numbered in MADT
+ * order as they come online. */
+
+#define SMP_MAX_CPUS 8
+#define SMP_AP_STACK_SIZE 16384
+#define SMP_TRAMPOLINE_ADDR 0x8000 /* SIPI vector 0x08, below 1 MiB */
+
+void smp_init(void);
+uint32_t smp_cpu_count(void); /* CPUs online */
+uint32_t smp_cpu_index(void); /* index of the calling CPU */
+
+/* Interrupt another CPU so it reschedules (no-op when uniprocessor). */
+void smp_send_resched(uint32_t cpu);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../cpu/idt.h"
+#include <stdint.h>
+
+/* Spinlocks for data shared between CPUs. Both kinds are FIFO-fair. A ticket
+ * lock is two counters in one cache line: cheap, fine for short sections
+ * with few contenders. An MCS lock makes each waiter spin on its own queue
+ * node, so heavily contended locks do not bounce a line between every CPU.
+ * Neither disables interrupts; use the _irqsave forms for anything an
+ * interrupt handler also takes. */
+
+static inline void cpu_relax(void) { __asm__ volatile("pause" : : : "memory"); }
+
+typedef struct {
+  volatile uint16_t next;  /* next ticket handed out */
+  volatile uint16_t owner; /* ticket currently holding the lock */
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT {0, 0}
+
+static inline void ticket_lock(ticket_lock_t *l) {
+  uint16_t me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != me)
+    cpu_relax();
+}
+
+static inline int ticket_trylock(ticket_lock_t *l) {
+  uint16_t owner = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+  uint16_t expected = owner;
+  return __atomic_compare_exchange_n(&l->next, &expected,
+                                     (uint16_t)(owner + 1), 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_unlock(ticket_lock_t *l) {
+  __atomic_store_n(&l->owner, (uint16_t)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline uint32_t ticket_lock_irqsave(ticket_lock_t *l) {
+  uint32_t flags = irq_save();
+  ticket_lock(l);
+  return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t *l, uint32_t flags) {
+  ticket_unlock(l);
+  irq_restore(flags);
+}
+
+/* The caller supplies the queue node (usually on its stack) and passes the
+ * same node to mcs_unlock. */
+typedef struct mcs_node {
+  struct mcs_node *volatile next;
+  volatile int locked;
+} mcs_node_t;
+
+typedef struct {
+  mcs_node_t *volatile tail;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT {0}
+
+static inline void mcs_lock(mcs_lock_t *l, mcs_node_t *node) {
+  node->next = 0;
+  node->locked = 1;
+  mcs_node_t *prev = __atomic_exchange_n(&l->tail, node, __ATOMIC_ACQ_REL);
+  if (prev) {
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+      cpu_relax();
+  }
+}
+
+static inline void mcs_unlock(mcs_lock_t *l, mcs_node_t *node) {
+  mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  if (!next) {
+    mcs_node_t *expected = node;
+    if (__atomic_compare_exchange_n(&l->tail, &expected, 0, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+    /* a successor swapped itself in but has not linked up yet */
+    while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+      cpu_relax();
+  }
+  __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "syscall.h"
+#include "../clib/clib.h"
+#include "../cpu/idt.h"
+#include "../exec/exec.h"
+#include "../fs/fs.h"
+#include "../kernel.h"
+#include "../vga/vga.h"
+
+/* User memory is copied through here rather than handed to the fs, so a
+ * fault on it (which may kill the program) never lands inside the fs. */
+#define SYSCALL_BOUNCE 4096
+
+static uint8_t bounce[SYSCALL_BOUNCE];
+static char path[FS_FILENAME_LEN * 2];
+
+/* the NUL-terminated name at addr into path; -1 if it is too long */
+static int get_name(uint32_t addr) {
+  for (uint32_t i = 0; i < sizeof(path); i++) {
+    if (!exec_user_range(addr + i, 1))
+      exec_exit(EXEC_KILLED);
+    path[i] = ((const char *)(uintptr_t)addr)[i];
+    if (path[i] == '\0')
+      return 0;
+  }
+  return -1;
+}
+
+static void check_range(uint32_t addr, uint32_t len) {
+  if (!exec_user_range(addr, len))
+    exec_exit(EXEC_KILLED);
+}
+
+static int sys_puts(uint32_t buf, uint32_t len) {
+  check_range(buf, len);
+  for (uint32_t i = 0; i < len; i++)
+    vga_putchar(((const char *)(uintptr_t)buf)[i], color_white_on_black());
+  return (int)len;
+}
+
+static int sys_read(uint32_t name, uint32_t offset, uint32_t buf,
+                    uint32_t len) {
+  check_range(buf, len);
+  if (get_name(name) != 0)
+    return -1;
+  uint32_t done = 0;
+  while (done < len) {
+    uint32_t want = len - done < SYSCALL_BOUNCE ? len - done : SYSCALL_BOUNCE;
+    int n = fs_read_at(path, offset + done, bounce, want);
+    if (n < 0)
+      return -1;
+    memcpy((uint8_t *)(uintptr_t)buf + done, bounce, (uint32_t)n);
+    done += (uint32_t)n;
+    if ((uint32_t)n < want)
+      break;
+  }
+  return (int)done;
+}
+
+/* the first piece replaces the file, the rest are appended */
+static int sys_write(uint32_t name, uint32_t buf, uint32_t len, int append) {
+  check_range(buf, len);
+  if (get_name(name) != 0)
+    return -1;
+  uint32_t done = 0;
+  do {
+    uint32_t n = len - done < SYSCALL_BOUNCE ? len - done : SYSCALL_BOUNCE;
+    memcpy(bounce, (const uint8_t *)(uintptr_t)buf + done, n);
+    int rc = append || done ? fs_append_file(path, bounce, n)
+                            : fs_write_file(path, bounce, n);
+    if (rc < 0)
+      return -1;
+    done += n;
+  } while (done < len);
+  return 0;
+}
+
+/* Entered through an interrupt gate; the work runs with interrupts on so
+ * the fs can wait on the disk, and off again for the return to ring 3. */
+static void syscall(isr_frame_t *frame) {
+  int rc;
+  interrupts_enable();
+  switch (frame->eax) {
+  case SYS_EXIT:
+    exec_exit((int)frame->ebx);
+  case SYS_PUTS:
+    rc = sys_puts(frame->ebx, frame->ecx);
+    break;
+  case SYS_READ:
+    rc = sys_read(frame->ebx, frame->ecx, frame->edx, frame->esi);
+    break;
+  case SYS_WRITE:
+    rc = sys_write(frame->ebx, frame->ecx, frame->edx, 0);
+    break;
+  case SYS_APPEND:
+    rc = sys_write(frame->ebx, frame->ecx, frame->edx, 1);
+    break;
+  default:
+    rc = -1;
+  }
+  interrupts_disable();
+  frame->eax = (uint32_t)rc;
+}
+
+void syscall_init(void) { idt_set_syscall_handler(syscall); }
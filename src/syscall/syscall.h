@@ -0,0 +1,20 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+/* System calls, int 0x80 from ring 3: the number in eax, arguments in ebx,
+ * ecx, edx and esi, the result back in eax. File names are NUL-terminated
+ * and resolved against the shell's current directory. Buffers and names
+ * must lie in user space; a program that passes anything else, or memory
+ * it cannot touch, is killed. Shared with user/ as the ABI. */
+
+#define SYS_EXIT 0   /* (status) */
+#define SYS_PUTS 1   /* (buf, len) to the console; returns len */
+#define SYS_READ 2   /* (name, offset, buf, len); bytes read, or -1 */
+#define SYS_WRITE 3  /* (name, buf, len) replaces the file; 0 or -1 */
+#define SYS_APPEND 4 /* (name, buf, len); 0 or -1 */
+
+#ifndef SYSCALL_USER
+void syscall_init(void);
+#endif
+
+#endif
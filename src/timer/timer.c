@@ -0,0 +1,82 @@
+#include "timer.h"
+#include "../clib/clib.h"
+
+#define PIT_CH0_DATA 0x40
+#define PIT_CH2_DATA 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CH2_GATE 0x61 /* bit0 = gate, bit1 = speaker, bit5 = OUT2 */
+
+static uint32_t tsc_khz = 0;
+static volatile uint64_t ticks = 0;
+static timer_hook_t hooks[TIMER_MAX_HOOKS];
+static uint32_t num_hooks = 0;
+
+/* Program channel 2 in mode 0 (interrupt on terminal count) and spin until
+ * OUT2 goes high; the TSC delta over that window gives the clock rate. */
+static uint32_t calibrate_tsc_khz(void) {
+  uint32_t latch = PIT_FREQUENCY / (1000 / TIMER_CALIBRATE_MS);
+
+  outb(PIT_CH2_GATE, (inb(PIT_CH2_GATE) & ~0x02) | 0x01);
+  outb(PIT_COMMAND, 0xB0); /* ch2, lobyte/hibyte, mode 0, binary */
+  outb(PIT_CH2_DATA, latch & 0xFF);
+  outb(PIT_CH2_DATA, (latch >> 8) & 0xFF);
+
+  uint64_t start = rdtsc();
+  while (!(inb(PIT_CH2_GATE) & 0x20))
+    ;
+  uint64_t end = rdtsc();
+
+  outb(PIT_CH2_GATE, inb(PIT_CH2_GATE) & ~0x01);
+  return (uint32_t)((end - start) / TIMER_CALIBRATE_MS);
+}
+
+void timer_init(void) {
+  tsc_khz = calibrate_tsc_khz();
+  if (tsc_khz == 0)
+    tsc_khz = 1000000; /* pretend 1 GHz rather than divide by zero later */
+}
+
+uint32_t timer_tsc_khz(void) { return tsc_khz; }
+
+uint64_t timer_cycles_to_us(uint64_t cycles) {
+  if (tsc_khz == 0)
+    return 0;
+  return cycles * 1000 / tsc_khz;
+}
+
+void timer_delay_us(uint32_t us) {
+  uint64_t end = rdtsc() + (uint64_t)us * tsc_khz / 1000;
+  while (rdtsc() < end)
+    __asm__ volatile("pause");
+}
+
+static void timer_irq(isr_frame_t *frame) {
+  ticks++;
+  for (uint32_t i = 0; i < num_hooks; i++)
+    hooks[i](frame);
+}
+
+void timer_start(void) {
+  uint32_t divisor = PIT_FREQUENCY / TIMER_HZ;
+  outb(PIT_COMMAND, 0x34); /* ch0, lobyte/hibyte, mode 2 rate generator */
+  outb(PIT_CH0_DATA, divisor & 0xFF);
+  outb(PIT_CH0_DATA, (divisor >> 8) & 0xFF);
+  irq_set_handler(IRQ_TIMER, timer_irq);
+}
+
+uint64_t timer_ticks(void) {
+  /* 64-bit read is two loads on i386 and the tick may land on another CPU
+   * in between; retry until two reads agree */
+  uint64_t t;
+  do {
+    t = ticks;
+  } while (t != ticks);
+  return t;
+}
+
+int timer_add_hook(timer_hook_t hook) {
+  if (num_hooks >= TIMER_MAX_HOOKS)
+    return -1;
+  hooks[num_hooks++] = hook;
+  return 0;
+}
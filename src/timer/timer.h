@@ -0,0 +1,32 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "../cpu/idt.h"
+#include <stdint.h>
+
+#define PIT_FREQUENCY 1193182 /* Hz, PIT input clock */
+#define TIMER_CALIBRATE_MS 10
+#define TIMER_HZ 1000 /* PIT channel 0 tick rate */
+#define TIMER_MAX_HOOKS 4
+
+/* read the CPU time-stamp counter */
+static inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+void timer_init(void); /* calibrate the TSC against PIT channel 2 */
+uint32_t timer_tsc_khz(void);
+uint64_t timer_cycles_to_us(uint64_t cycles);
+void timer_delay_us(uint32_t us); /* busy-wait on the TSC */
+
+/* Periodic PIT channel 0 interrupt. Hooks run in interrupt context on every
+ * tick with the interrupted register state. */
+typedef void (*timer_hook_t)(isr_frame_t *frame);
+
+void timer_start(void);
+uint64_t timer_ticks(void);
+int timer_add_hook(timer_hook_t hook);
+
+#endif
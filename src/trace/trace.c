@@ -0,0 +1,143 @@
+#include "trace.h"
+#include "../clib/clib.h"
+#include "../sched/sched.h"
+#include "../timer/timer.h"
+
+typedef struct {
+  const char *name;
+  const char *cat;
+} trace_point_info_t;
+
+static const trace_point_info_t point_info[TP_COUNT] = {
+    [TP_DISK_READ] = {"disk_read_lba", "disk"},
+    [TP_DISK_WRITE] = {"disk_write_lba", "disk"},
+    [TP_DISK_FLUSH] = {"disk_flush", "disk"},
+    [TP_ATA_WAIT_BSY] = {"ata_wait_bsy", "disk"},
+    [TP_ATA_WAIT_DRQ] = {"ata_wait_drq", "disk"},
+    [TP_FS_INIT] = {"fs_init", "fs"},
+    [TP_FS_CREATE] = {"fs_create_file", "fs"},
+    [TP_FS_WRITE] = {"fs_write_file", "fs"},
+    [TP_FS_READ] = {"fs_read_file", "fs"},
+    [TP_FS_DELETE] = {"fs_delete_file", "fs"},
+    [TP_FS_ALLOC] = {"allocate_blocks", "fs"},
+    [TP_FS_SYNC] = {"fs_sync", "fs"},
+    [TP_BCACHE_FLUSH] = {"bcache_flush", "fs"},
+    [TP_SHELL_CMD] = {"shell_command", "shell"},
+    [TP_VGA_PUTSTR] = {"vga_putstr", "console"},
+    [TP_VGA_SCROLL] = {"vga_scroll", "console"},
+    [TP_VGA_FLUSH] = {"fbcon_draw", "console"},
+};
+
+typedef struct {
+  volatile uint32_t head; /* total events ever claimed on this CPU */
+  trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+volatile int trace_enabled = 0;
+static trace_ring_t rings[TRACE_MAX_CPUS];
+static uint64_t trace_base_tsc = 0;
+
+static inline uint32_t trace_cpu(void) { return smp_cpu_index(); }
+
+void trace_record(uint16_t point, uint8_t phase, uint32_t arg) {
+  uint32_t cpu = trace_cpu();
+  trace_ring_t *ring = &rings[cpu];
+  /* claim a slot first so an interrupt landing mid-record gets its own */
+  uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  trace_event_t *ev = &ring->events[slot & (TRACE_RING_EVENTS - 1)];
+  ev->tsc = rdtsc();
+  ev->point = point;
+  ev->phase = phase;
+  ev->cpu = (uint8_t)cpu;
+  ev->arg = arg;
+  thread_t *t = thread_current();
+  ev->tid = t ? t->id : 0;
+}
+
+void trace_start(void) {
+  if (trace_base_tsc == 0)
+    trace_base_tsc = rdtsc();
+  trace_enabled = 1;
+}
+
+void trace_stop(void) { trace_enabled = 0; }
+
+void trace_clear(void) {
+  for (uint32_t c = 0; c < TRACE_MAX_CPUS; c++)
+    rings[c].head = 0;
+  trace_base_tsc = rdtsc();
+}
+
+uint32_t trace_count(void) {
+  uint32_t total = 0;
+  for (uint32_t c = 0; c < TRACE_MAX_CPUS; c++)
+    total += rings[c].head < TRACE_RING_EVENTS ? rings[c].head
+                                               : TRACE_RING_EVENTS;
+  return total;
+}
+
+/* ===== JSON export ===== */
+
+static void emit_str(trace_emit_fn emit, void *ctx, const char *s) {
+  emit(s, strlen(s), ctx);
+}
+
+static void emit_num(trace_emit_fn emit, void *ctx, uint64_t v) {
+  char num[21];
+  emit_str(emit, ctx, utoa(v, num, 10));
+}
+
+/* microseconds since trace_base_tsc with nanosecond decimals */
+static void emit_ts(trace_emit_fn emit, void *ctx, uint64_t tsc) {
+  uint32_t khz = timer_tsc_khz();
+  uint64_t delta = tsc > trace_base_tsc ? tsc - trace_base_tsc : 0;
+  uint64_t scaled = delta * 1000;
+  uint64_t us = khz ? scaled / khz : 0;
+  uint32_t ns = khz ? (uint32_t)((scaled % khz) * 1000 / khz) : 0;
+  char frac[4] = {'0' + ns / 100, '0' + (ns / 10) % 10, '0' + ns % 10, 0};
+  emit_num(emit, ctx, us);
+  emit_str(emit, ctx, ".");
+  emit_str(emit, ctx, frac);
+}
+
+static void emit_event(trace_emit_fn emit, void *ctx, const trace_event_t *ev,
+                       int first) {
+  static const char *const phases[] = {"B", "E", "i"};
+  const trace_point_info_t *info =
+      ev->point < TP_COUNT ? &point_info[ev->point] : NULL;
+
+  emit_str(emit, ctx, first ? "\n{\"name\":\"" : ",\n{\"name\":\"");
+  emit_str(emit, ctx, info ? info->name : "unknown");
+  emit_str(emit, ctx, "\",\"cat\":\"");
+  emit_str(emit, ctx, info ? info->cat : "unknown");
+  emit_str(emit, ctx, "\",\"ph\":\"");
+  emit_str(emit, ctx, phases[ev->phase <= TRACE_PHASE_INSTANT ? ev->phase : 2]);
+  emit_str(emit, ctx, "\",\"ts\":");
+  emit_ts(emit, ctx, ev->tsc);
+  /* a thread that migrates keeps its track, so its B/E pairs still match */
+  emit_str(emit, ctx, ",\"pid\":0,\"tid\":");
+  emit_num(emit, ctx, ev->tid);
+  if (ev->phase == TRACE_PHASE_INSTANT)
+    emit_str(emit, ctx, ",\"s\":\"t\"");
+  emit_str(emit, ctx, ",\"args\":{\"arg\":");
+  emit_num(emit, ctx, ev->arg);
+  emit_str(emit, ctx, ",\"cpu\":");
+  emit_num(emit, ctx, ev->cpu);
+  emit_str(emit, ctx, "}}");
+}
+
+void trace_dump_json(trace_emit_fn emit, void *ctx) {
+  int first = 1;
+  emit_str(emit, ctx, "{\"traceEvents\":[");
+  for (uint32_t c = 0; c < TRACE_MAX_CPUS; c++) {
+    trace_ring_t *ring = &rings[c];
+    uint32_t head = ring->head;
+    uint32_t start = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    for (uint32_t i = start; i < head; i++) {
+      const trace_event_t *ev = &ring->events[i & (TRACE_RING_EVENTS - 1)];
+      emit_event(emit, ctx, ev, first);
+      first = 0;
+    }
+  }
+  emit_str(emit, ctx, "\n],\"displayTimeUnit\":\"ns\"}\n");
+}
@@ -0,0 +1,113 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../smp/smp.h"
+#include <stdint.h>
+
+/* Lightweight tracepoints. Each event is a TSC timestamp plus a 32-bit
+ * payload, appended to a per-CPU flight-recorder ring that overwrites the
+ * oldest entries. With tracing off a tracepoint costs one predicted-not-taken
+ * branch; building with -DTRACE_DISABLED removes them entirely. */
+
+#define TRACE_RING_EVENTS 4096 /* per CPU, power of two */
+#define TRACE_MAX_CPUS SMP_MAX_CPUS
+
+typedef enum {
+  TP_DISK_READ,
+  TP_DISK_WRITE,
+  TP_DISK_FLUSH,
+  TP_ATA_WAIT_BSY,
+  TP_ATA_WAIT_DRQ,
+  TP_FS_INIT,
+  TP_FS_CREATE,
+  TP_FS_WRITE,
+  TP_FS_READ,
+  TP_FS_DELETE,
+  TP_FS_ALLOC,
+  TP_FS_SYNC,
+  TP_BCACHE_FLUSH,
+  TP_SHELL_CMD,
+  TP_VGA_PUTSTR,
+  TP_VGA_SCROLL,
+  TP_VGA_FLUSH,
+  TP_COUNT
+} trace_point_t;
+
+typedef enum {
+  TRACE_PHASE_BEGIN,
+  TRACE_PHASE_END,
+  TRACE_PHASE_INSTANT,
+} trace_phase_t;
+
+typedef struct {
+  uint64_t tsc;
+  uint16_t point;
+  uint8_t phase;
+  uint8_t cpu;
+  uint32_t arg;
+  uint32_t tid; /* thread it happened in: 0, the boot thread, until sched */
+} trace_event_t;
+
+/* dump sink: receives the JSON text in pieces */
+typedef void (*trace_emit_fn)(const char *text, uint32_t len, void *ctx);
+
+extern volatile int trace_enabled;
+
+void trace_record(uint16_t point, uint8_t phase, uint32_t arg);
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+uint32_t trace_count(void); /* events currently held, all CPUs */
+
+/* Chrome trace / Perfetto JSON ("traceEvents" array of B/E/i events).
+ * Tracing must be stopped while dumping. */
+void trace_dump_json(trace_emit_fn emit, void *ctx);
+
+#ifndef TRACE_DISABLED
+
+typedef struct {
+  uint16_t point;
+  uint8_t active;
+} trace_scope_t;
+
+static inline trace_scope_t trace_scope_begin(uint16_t point, uint32_t arg) {
+  trace_scope_t s = {point, 0};
+  if (__builtin_expect(trace_enabled, 0)) {
+    trace_record(point, TRACE_PHASE_BEGIN, arg);
+    s.active = 1;
+  }
+  return s;
+}
+
+static inline void trace_scope_end(trace_scope_t *s) {
+  if (__builtin_expect(s->active, 0))
+    trace_record(s->point, TRACE_PHASE_END, 0);
+}
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+
+/* begin event now, matching end event when the enclosing scope exits */
+#define TRACE_SCOPE(point, arg)                                                \
+  trace_scope_t TRACE_CAT(trace_scope_, __LINE__)                              \
+      __attribute__((cleanup(trace_scope_end))) =                              \
+          trace_scope_begin((point), (arg))
+
+#define TRACE_MARK(point, arg)                                                 \
+  do {                                                                         \
+    if (__builtin_expect(trace_enabled, 0))                                    \
+      trace_record((point), TRACE_PHASE_INSTANT, (arg));                       \
+  } while (0)
+
+#else
+
+#define TRACE_SCOPE(point, arg)                                                \
+  do {                                                                         \
+  } while (0)
+#define TRACE_MARK(point, arg)                                                 \
+  do {                                                                         \
+  } while (0)
+
+#endif
+
+#endif
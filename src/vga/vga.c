@@ -1,68 +1,115 @@
 #include "vga.h"
+#include "../fbcon/fbcon.h"
 #include "../kernel.h"
+#include "../serial/serial.h"
+#include "../trace/trace.h"
 
 static unsigned int cursor_row = 0;
 static unsigned int cursor_col = 0;
+static int serial_mirror = 0;
+static vga_sink_t sink = 0;
+
+/* The console is cols x rows cells, either in the text buffer or drawn
+ * by fbcon. The text buffer is mapped write-combining, which makes reading
+ * it back as slow as uncached memory, so a copy is kept in RAM for
+ * scrolling and the buffer itself is only ever written. On a framebuffer
+ * the copy is the console: rows written to are marked dirty, and fbcon
+ * draws them once per call rather than once per character. */
+static uint16_t shadow[FBCON_MAX_COLS * FBCON_MAX_ROWS];
+static unsigned int cols = VGA_MEM_WIDTH;
+static unsigned int rows = VGA_MEM_HEIGHT;
+static int framebuffer = 0;
+static unsigned int dirty_first = FBCON_MAX_ROWS, dirty_last = 0;
+
+static inline uint16_t vga_cell(char c, unsigned char color) {
+    return (uint16_t)((uint8_t)c | color << 8);
+}
+
+static inline void vga_dirty(unsigned int first, unsigned int last) {
+    if (first < dirty_first)
+        dirty_first = first;
+    if (last > dirty_last)
+        dirty_last = last;
+}
+
+static inline void vga_put_cell(unsigned int i, uint16_t cell) {
+    shadow[i] = cell;
+    if (framebuffer)
+        vga_dirty(i / cols, i / cols);
+    else
+        ((volatile uint16_t *)VIDEO_MEMORY)[i] = cell;
+}
+
+static void vga_flush(void) {
+    if (!framebuffer || dirty_first > dirty_last)
+        return;
+    fbcon_draw(shadow, dirty_first, dirty_last);
+    dirty_first = FBCON_MAX_ROWS;
+    dirty_last = 0;
+}
 
 void vga_clear_screen() {
-    char *video_memory = VIDEO_MEMORY;
-    for (unsigned int i = 0; i < VGA_MEM_WIDTH * VGA_MEM_HEIGHT; i++) {
-        video_memory[i * 2] = ' ';
-        video_memory[i * 2 + 1] = color_white_on_black();
-    }
+    uint16_t blank = vga_cell(' ', color_white_on_black());
+    for (unsigned int i = 0; i < cols * rows; i++)
+        vga_put_cell(i, blank);
     cursor_row = 0;
     cursor_col = 0;
+    vga_flush();
 }
 
 static void vga_scroll() {
-    char *video_memory = VIDEO_MEMORY;
-
-    for (unsigned int row = 1; row < VGA_MEM_HEIGHT; row++) {
-        for (unsigned int col = 0; col < VGA_MEM_WIDTH; col++) {
-            video_memory[((row - 1) * VGA_MEM_WIDTH + col) * 2] =
-                video_memory[(row * VGA_MEM_WIDTH + col) * 2];
-            video_memory[((row - 1) * VGA_MEM_WIDTH + col) * 2 + 1] =
-                video_memory[(row * VGA_MEM_WIDTH + col) * 2 + 1];
-        }
-    }
+    TRACE_SCOPE(TP_VGA_SCROLL, 0);
+    uint16_t blank = vga_cell(' ', color_white_on_black());
 
-    for (unsigned int col = 0; col < VGA_MEM_WIDTH; col++) {
-        video_memory[((VGA_MEM_HEIGHT - 1) * VGA_MEM_WIDTH + col) * 2] = ' ';
-        video_memory[((VGA_MEM_HEIGHT - 1) * VGA_MEM_WIDTH + col) * 2 + 1] =
-            color_white_on_black();
-    }
+    /* on a framebuffer this only marks every row dirty, and fbcon then
+     * redraws the cells that differ from the row that was above them */
+    for (unsigned int i = 0; i < cols * (rows - 1); i++)
+        vga_put_cell(i, shadow[i + cols]);
+    for (unsigned int col = 0; col < cols; col++)
+        vga_put_cell((rows - 1) * cols + col, blank);
 
     if (cursor_row > 0)
         cursor_row--;
 }
 
-void vga_putchar(char c, unsigned char color) {
-    char *video_memory = VIDEO_MEMORY;
+static void vga_put(char c, unsigned char color) {
+    if (sink) {
+        sink(c);
+        return;
+    }
+    if (serial_mirror)
+        serial_putchar(c);
 
     if (c == '\n') {
         cursor_col = 0;
         cursor_row++;
-        if (cursor_row >= VGA_MEM_HEIGHT)
+        if (cursor_row >= rows)
             vga_scroll();
         return;
     }
 
-    video_memory[(cursor_row * VGA_MEM_WIDTH + cursor_col) * 2] = c;
-    video_memory[(cursor_row * VGA_MEM_WIDTH + cursor_col) * 2 + 1] = color;
+    vga_put_cell(cursor_row * cols + cursor_col, vga_cell(c, color));
 
     cursor_col++;
-    if (cursor_col >= VGA_MEM_WIDTH) {
+    if (cursor_col >= cols) {
         cursor_col = 0;
         cursor_row++;
-        if (cursor_row >= VGA_MEM_HEIGHT)
+        if (cursor_row >= rows)
             vga_scroll();
     }
 }
 
+void vga_putchar(char c, unsigned char color) {
+    vga_put(c, color);
+    vga_flush();
+}
+
 void vga_putstr(const char *str, unsigned char color) {
+    TRACE_SCOPE(TP_VGA_PUTSTR, 0);
     for (unsigned int i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i], color);
+        vga_put(str[i], color);
     }
+    vga_flush();
 }
 
 unsigned int vga_get_cursor_row(void) { return cursor_row; }
@@ -71,3 +118,38 @@ void vga_set_cursor(unsigned int row, unsigned int col) {
     cursor_row = row;
     cursor_col = col;
 }
+
+int vga_set_serial_mirror(int enabled) {
+    int old = serial_mirror;
+    serial_mirror = enabled;
+    return old;
+}
+
+vga_sink_t vga_set_sink(vga_sink_t new_sink) {
+    vga_sink_t old = sink;
+    sink = new_sink;
+    return old;
+}
+
+int vga_use_framebuffer(const bootinfo_fb_t *fb) {
+    uint32_t new_cols, new_rows;
+    if (framebuffer || fbcon_init(fb, &new_cols, &new_rows) != 0)
+        return -1;
+
+    /* spread the 80x25 screen out to the wider rows, last cell first so
+     * nothing is overwritten before it is moved, and blank the rest */
+    uint16_t blank = vga_cell(' ', color_white_on_black());
+    for (unsigned int i = new_cols * new_rows; i-- > 0;) {
+        unsigned int row = i / new_cols, col = i % new_cols;
+        shadow[i] = row < rows && col < cols ? shadow[row * cols + col] : blank;
+    }
+    cols = new_cols;
+    rows = new_rows;
+    framebuffer = 1;
+    vga_dirty(0, rows - 1);
+    vga_flush();
+    return 0;
+}
+
+unsigned int vga_columns(void) { return cols; }
+unsigned int vga_rows(void) { return rows; }
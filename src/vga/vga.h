@@ -1,6 +1,7 @@
 #ifndef VGA_H
 #define VGA_H
 
+#include "../bootinfo/bootinfo.h"
 #include <stdint.h>
 
 #define VIDEO_MEMORY ((char *)0xb8000)
@@ -13,5 +14,19 @@ void vga_putstr(const char *str, unsigned char color);
 unsigned int vga_get_cursor_row(void);
 unsigned int vga_get_cursor_col(void);
 void vga_set_cursor(unsigned int row, unsigned int col);
+/* copy everything printed to COM1 as well (headless runs); returns the
+ * previous setting */
+int vga_set_serial_mirror(int enabled);
+/* hand everything printed to sink instead of the screen and COM1, as the
+ * shell does to redirect a command; NULL restores the screen. Returns the
+ * previous sink. */
+typedef void (*vga_sink_t)(char c);
+vga_sink_t vga_set_sink(vga_sink_t sink);
+/* move the console from text mode to a framebuffer (fbcon), keeping what
+ * is on screen; -1, still in text mode, if there is no usable one */
+int vga_use_framebuffer(const bootinfo_fb_t *fb);
+/* console size in characters: 80x25 in text mode */
+unsigned int vga_columns(void);
+unsigned int vga_rows(void);
 
 #endif
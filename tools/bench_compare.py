@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Compare BottleOS bench output against a stored baseline.
+
+Both files hold "BENCH name=<case> ops=.. cycles=.. cpo=.. mbps=.." lines
+(other lines are ignored). A case regresses when its cycles per op grow by
+more than --threshold percent. Exits 1 on any regression or missing case,
+when there is no baseline, or when the baseline's "# setup: .." line names
+a different --setup than the results were measured under.
+
+usage: bench_compare.py [--threshold 15] [--setup ..] baseline.txt results.txt
+"""
+
+import argparse
+import os
+import sys
+
+
+def parse(path):
+    results = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("# setup: "):
+                results[None] = line[len("# setup: "):]
+            if not line.startswith("BENCH "):
+                continue
+            fields = dict(kv.split("=", 1) for kv in line.split()[1:]
+                          if "=" in kv)
+            if "name" in fields and "cpo" in fields:
+                results[fields["name"]] = fields
+    return results
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("baseline")
+    ap.add_argument("results")
+    ap.add_argument("--threshold", type=float, default=15.0,
+                    help="allowed cycles/op growth in percent")
+    ap.add_argument("--setup", help="how the results were measured")
+    args = ap.parse_args()
+
+    current = parse(args.results)
+    if not current:
+        sys.exit("bench_compare: no BENCH lines in %s" % args.results)
+    if not os.path.exists(args.baseline):
+        print("bench_compare: no baseline at %s; run 'make bench-baseline' "
+              "to record one" % args.baseline)
+        return 1
+    baseline = parse(args.baseline)
+    setup = baseline.pop(None, None)
+    if args.setup and setup != args.setup:
+        print("bench_compare: FAIL, the baseline was measured under another "
+              "setup\n  baseline: %s\n  now:      %s" % (setup, args.setup))
+        return 1
+
+    failed = False
+    print("%-24s %14s %14s %8s" % ("case", "base cpo", "cpo", "change"))
+    for name in sorted(baseline):
+        base = int(baseline[name]["cpo"])
+        if name not in current:
+            print("%-24s %14d %14s %8s  MISSING" % (name, base, "-", "-"))
+            failed = True
+            continue
+        now = int(current[name]["cpo"])
+        change = (now - base) * 100.0 / base if base else 0.0
+        verdict = ""
+        if change > args.threshold:
+            verdict = "  REGRESSION"
+            failed = True
+        print("%-24s %14d %14d %+7.1f%%%s" % (name, base, now, change,
+                                              verdict))
+    for name in sorted(set(current) - set(baseline)):
+        print("%-24s %14s %14s %8s  new" % (name, "-", current[name]["cpo"],
+                                             "-"))
+
+    if failed:
+        print("bench_compare: FAIL (threshold %.1f%%)" % args.threshold)
+        return 1
+    print("bench_compare: OK")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+#include "host.h"
+#include "../../src/fs/fs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Same line format as the in-kernel bench command, with wall-clock time in
+ * place of TSC cycles and the device traffic each op caused. */
+static void report(const char *name, uint32_t ops, uint64_t bytes,
+                   uint64_t ns, host_disk_stats_t io) {
+  double secs = ns / 1e9;
+  printf("BENCH name=host.%s ops=%u bytes=%llu ns=%llu ns_per_op=%llu "
+         "ops_per_s=%.0f mbps=%.3f rd_per_op=%.2f wr_per_op=%.2f\n",
+         name, ops, (unsigned long long)bytes, (unsigned long long)ns,
+         (unsigned long long)(ops ? ns / ops : 0), secs > 0 ? ops / secs : 0,
+         secs > 0 ? bytes / secs / 1e6 : 0,
+         ops ? (double)io.reads / ops : 0, ops ? (double)io.writes / ops : 0);
+}
+
+static void bench_name(char *buf, uint32_t i) { sprintf(buf, "b%06u", i); }
+
+static void bench_pass(const char *label, uint32_t files, uint32_t size) {
+  static uint8_t data[1 << 16], out[1 << 16];
+  char name[32], tag[48];
+  uint64_t t0;
+
+  for (uint32_t i = 0; i < size; i++)
+    data[i] = (uint8_t)i;
+
+  host_disk_reset_stats();
+  t0 = host_now_ns();
+  for (uint32_t i = 0; i < files; i++) {
+    bench_name(name, i);
+    fs_write_file(name, data, size);
+  }
+  snprintf(tag, sizeof(tag), "fs.write.%s", label);
+  report(tag, files, (uint64_t)files * size, host_now_ns() - t0,
+         host_disk_stats());
+
+  host_disk_reset_stats();
+  t0 = host_now_ns();
+  for (uint32_t i = 0; i < files; i++) {
+    bench_name(name, i);
+    fs_read_file(name, out, sizeof(out));
+  }
+  snprintf(tag, sizeof(tag), "fs.read.%s", label);
+  report(tag, files, (uint64_t)files * size, host_now_ns() - t0,
+         host_disk_stats());
+}
+
+int run_bench(uint32_t files) {
+  char name[32];
+  uint64_t t0;
+
+  if (host_fs_format() != 0)
+    return 1;
+
+  uint32_t created = 0;
+  host_disk_reset_stats();
+  t0 = host_now_ns();
+  for (uint32_t i = 0; i < files; i++) {
+    bench_name(name, i);
+    if (fs_create_file(name) != 0)
+      break;
+    created++;
+  }
+  report("fs.create", created, 0, host_now_ns() - t0, host_disk_stats());
+  if (created < files)
+    printf("bench: file table full after %u of %u files\n", created, files);
+
+  host_disk_reset_stats();
+  t0 = host_now_ns();
+  for (uint32_t pass = 0; pass < 4; pass++) {
+    for (uint32_t i = 0; i < created; i++) {
+      bench_name(name, i);
+      fs_is_directory(name);
+    }
+  }
+  report("fs.lookup", created * 4, 0, host_now_ns() - t0, host_disk_stats());
+
+  bench_pass("512", created, 512);
+  bench_pass("4k", created, 4096);
+  bench_pass("64k", created < 64 ? created : 64, 65536);
+
+  host_disk_reset_stats();
+  t0 = host_now_ns();
+  for (uint32_t i = 0; i < created; i++) {
+    bench_name(name, i);
+    fs_delete_file(name);
+  }
+  report("fs.delete", created, 0, host_now_ns() - t0, host_disk_stats());
+  return 0;
+}
@@ -0,0 +1,408 @@
+#include "host.h"
+#include "../../src/fs/fs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Random create/write/append/fallocate/copy/rename/read/delete/remount
+ * sequences checked against a trivial in-memory model of what every file
+ * should contain, some of them inside a batch. Odd seeds run with dedup
+ * on. There are enough names for the file table to grow past its first
+ * FS_MAX_FILES slots. */
+
+#define FUZZ_NAMES 160
+#define FUZZ_MAX_SMALL 2048
+#define FUZZ_MAX_LARGE (3 * 1024 * 1024)
+#define FUZZ_MAX_TINY (2 * FS_INLINE_MAX) /* either side of the inline limit */
+
+typedef struct {
+  int exists;
+  uint8_t *data;
+  uint32_t size;
+} model_file_t;
+
+static model_file_t model[FUZZ_NAMES];
+static uint32_t model_count = 0;
+static uint32_t rng;
+static uint32_t op_index;
+static uint32_t nospace_count;
+static int in_batch;
+
+static uint32_t fuzz_rand(void) {
+  /* xorshift32 */
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void fuzz_name(char *buf, uint32_t i) { sprintf(buf, "n%u", i); }
+
+static int fail(const char *what, uint32_t idx, int got, int want) {
+  fprintf(stderr, "fuzz: op %u: %s on n%u returned %d, expected %d\n",
+          op_index, what, idx, got, want);
+  return -1;
+}
+
+static void model_set(uint32_t idx, const uint8_t *data, uint32_t size) {
+  free(model[idx].data);
+  model[idx].data = NULL;
+  if (size) {
+    model[idx].data = malloc(size);
+    memcpy(model[idx].data, data, size);
+  }
+  model[idx].size = size;
+}
+
+static int check_file(uint32_t idx) {
+  static uint8_t buf[FUZZ_MAX_LARGE];
+  char name[16];
+  fuzz_name(name, idx);
+
+  int rc = fs_read_file(name, buf, sizeof(buf));
+  if (!model[idx].exists)
+    return rc == -1 ? 0 : fail("read", idx, rc, -1);
+  if (rc != (int)model[idx].size)
+    return fail("read", idx, rc, (int)model[idx].size);
+  if (model[idx].size && memcmp(buf, model[idx].data, model[idx].size) != 0) {
+    fprintf(stderr, "fuzz: op %u: n%u content mismatch\n", op_index, idx);
+    return -1;
+  }
+  return 0;
+}
+
+/* After a flush the image agrees with itself: the inode bitmap with the
+ * used flags, num_files with both, and every block's reference count with
+ * the extents (and grown table) covering it. */
+static int check_image(void) {
+  static uint16_t refs[HOST_DISK_SECTORS];
+  const uint8_t *disk = host_disk_data();
+  const fs_superblock_t *sb = (const fs_superblock_t *)disk;
+  uint32_t bs = sb->block_size, blocks = sb->total_blocks - sb->data_block;
+  const fs_file_entry_t *table =
+      (const fs_file_entry_t *)(disk + (size_t)sb->file_table_block * bs);
+  const uint8_t *map = disk + (size_t)sb->inode_map_block * bs;
+  const uint16_t *disk_refs =
+      (const uint16_t *)(disk + (size_t)sb->ref_map_block * bs);
+  uint32_t used = 0;
+
+  memset(refs, 0, sizeof(refs));
+  if (sb->inode_map_block >= sb->data_block)
+    for (uint32_t b = 0; b < sb->table_blocks; b++)
+      refs[sb->inode_map_block - sb->data_block + b]++;
+  for (uint32_t i = 0; i < sb->max_files; i++) {
+    const fs_file_entry_t *e = &table[i];
+    if (e->used != (map[i / 8] >> (i % 8) & 1)) {
+      fprintf(stderr, "fuzz: op %u: slot %u used %u, bitmap disagrees\n",
+              op_index, i, e->used);
+      return -1;
+    }
+    if (!e->used)
+      continue;
+    used++;
+    if (e->start_block == 0xFFFFFFFF)
+      continue;
+    uint32_t stored = e->is_compressed ? e->ext.stored : e->size;
+    uint32_t n = (stored + bs - 1) / bs + e->prealloc;
+    for (uint32_t b = e->start_block; b < e->start_block + n; b++)
+      refs[b]++;
+  }
+  if (used != sb->num_files) {
+    fprintf(stderr, "fuzz: op %u: %u slots used, superblock says %u\n",
+            op_index, used, sb->num_files);
+    return -1;
+  }
+  for (uint32_t b = 0; b < blocks; b++) {
+    if (refs[b] != disk_refs[b]) {
+      fprintf(stderr, "fuzz: op %u: block %u has %u owners, count says %u\n",
+              op_index, b, refs[b], disk_refs[b]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int check_all(void) {
+  for (uint32_t i = 0; i < FUZZ_NAMES; i++)
+    if (check_file(i) != 0)
+      return -1;
+
+  /* the directory listing must agree with the model too */
+  char line[64], name[16];
+  host_console_clear();
+  fs_list_files();
+  for (uint32_t i = 0; i < FUZZ_NAMES; i++) {
+    fuzz_name(name, i);
+    /* compressed files go on with ", N on disk)" */
+    snprintf(line, sizeof(line), "      %s (%u bytes", name, model[i].size);
+    int listed = strstr(host_console_text(), line) != NULL;
+    if (listed != model[i].exists) {
+      fprintf(stderr, "fuzz: op %u: listing disagrees for %s\n", op_index,
+              name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int op_create(uint32_t idx) {
+  char name[16];
+  fuzz_name(name, idx);
+  int want = model[idx].exists ? -2 : 0;
+  int rc = fs_create_file(name);
+  if (rc == -1 && want == 0 && model_count >= FS_MAX_FILES) {
+    nospace_count++; /* table full and no room to grow it */
+    return 0;
+  }
+  if (rc != want)
+    return fail("create", idx, rc, want);
+  if (rc == 0) {
+    model[idx].exists = 1;
+    model_set(idx, NULL, 0);
+    model_count++;
+  }
+  return 0;
+}
+
+static int op_write(uint32_t idx) {
+  static uint8_t buf[FUZZ_MAX_LARGE];
+  char name[16];
+  fuzz_name(name, idx);
+
+  uint32_t kind = fuzz_rand() % 5;
+  uint32_t size = kind == 0   ? fuzz_rand() % FUZZ_MAX_LARGE
+                  : kind == 1 ? fuzz_rand() % FUZZ_MAX_TINY
+                              : fuzz_rand() % FUZZ_MAX_SMALL;
+  uint8_t seed = (uint8_t)fuzz_rand();
+  uint32_t noise = fuzz_rand() % 2 ? seed | 1 : 0; /* noise won't compress */
+  for (uint32_t i = 0; i < size; i++) {
+    noise = noise * 1103515245 + 12345 * (noise != 0);
+    buf[i] = (uint8_t)(seed + i * 13 + (noise >> 24));
+  }
+  if (kind == 4) { /* another file's contents, for dedup to find */
+    uint32_t src = fuzz_rand() % FUZZ_NAMES;
+    size = model[src].size;
+    if (size)
+      memcpy(buf, model[src].data, size);
+  }
+
+  int rc = fs_write_file(name, buf, size);
+  if (rc == -1 && !model[idx].exists && model_count >= FS_MAX_FILES) {
+    nospace_count++;
+    return 0;
+  }
+
+  if (!model[idx].exists) {
+    model[idx].exists = 1;
+    model_set(idx, NULL, 0);
+    model_count++;
+  }
+  if (rc == -2) {
+    nospace_count++; /* out of contiguous space: file keeps its old data */
+    return 0;
+  }
+  if (rc != 0)
+    return fail("write", idx, rc, 0);
+  model_set(idx, buf, size);
+  return 0;
+}
+
+static int op_append(uint32_t idx) {
+  static uint8_t buf[FUZZ_MAX_SMALL];
+  char name[16];
+  fuzz_name(name, idx);
+
+  uint32_t len = fuzz_rand() % 2 ? fuzz_rand() % FUZZ_MAX_TINY
+                                  : fuzz_rand() % FUZZ_MAX_SMALL;
+  if (model[idx].size + len > FUZZ_MAX_LARGE)
+    return 0;
+  uint8_t seed = (uint8_t)fuzz_rand();
+  for (uint32_t i = 0; i < len; i++)
+    buf[i] = (uint8_t)(seed + i * 7);
+
+  int rc = fs_append_file(name, buf, len);
+  if (rc == -1 && !model[idx].exists && model_count >= FS_MAX_FILES) {
+    nospace_count++;
+    return 0;
+  }
+
+  if (!model[idx].exists) {
+    model[idx].exists = 1;
+    model_set(idx, NULL, 0);
+    model_count++;
+  }
+  if (rc == -2) {
+    nospace_count++;
+    return 0;
+  }
+  if (rc != 0)
+    return fail("append", idx, rc, 0);
+  if (len) {
+    uint8_t *grown = malloc(model[idx].size + len);
+    memcpy(grown, model[idx].data, model[idx].size);
+    memcpy(grown + model[idx].size, buf, len);
+    free(model[idx].data);
+    model[idx].data = grown;
+    model[idx].size += len;
+  }
+  return 0;
+}
+
+static int op_fallocate(uint32_t idx) {
+  char name[16];
+  fuzz_name(name, idx);
+
+  int rc = fs_fallocate(name, fuzz_rand() % (4 * FUZZ_MAX_SMALL));
+  if (rc == -1 && !model[idx].exists && model_count >= FS_MAX_FILES) {
+    nospace_count++;
+    return 0;
+  }
+  if (!model[idx].exists) {
+    model[idx].exists = 1;
+    model_set(idx, NULL, 0);
+    model_count++;
+  }
+  if (rc == -2) {
+    nospace_count++;
+    return 0;
+  }
+  return rc == 0 ? 0 : fail("fallocate", idx, rc, 0);
+}
+
+/* compression only changes the encoding, never what reads back */
+static int op_compress(uint32_t idx) {
+  char name[16];
+  fuzz_name(name, idx);
+  int want = model[idx].exists ? 0 : -1;
+  int rc = fs_set_compress(name, fuzz_rand() % 4 != 0);
+  return rc == want ? 0 : fail("compress", idx, rc, want);
+}
+
+/* reflink copies share blocks with their source, so any write to one
+ * that leaked into the other shows up in the model check */
+static int op_copy(uint32_t idx) {
+  char name[16], dst_name[16];
+  uint32_t dst = fuzz_rand() % FUZZ_NAMES;
+  fuzz_name(name, idx);
+  fuzz_name(dst_name, dst);
+
+  int want = model[idx].exists ? 0 : -1;
+  int rc = fs_copy_file(name, dst_name);
+  if (rc == -1 && want == 0 && !model[dst].exists &&
+      model_count >= FS_MAX_FILES) {
+    nospace_count++;
+    return 0;
+  }
+  if (rc != want)
+    return fail("copy", idx, rc, want);
+  if (rc == 0 && dst != idx) {
+    if (!model[dst].exists) {
+      model[dst].exists = 1;
+      model_count++;
+    }
+    model_set(dst, model[idx].data, model[idx].size);
+  }
+  return 0;
+}
+
+static int op_rename(uint32_t idx) {
+  char name[16], dst_name[16];
+  uint32_t dst = fuzz_rand() % FUZZ_NAMES;
+  fuzz_name(name, idx);
+  fuzz_name(dst_name, dst);
+
+  int want = !model[idx].exists ? -1 : model[dst].exists ? -2 : 0;
+  int rc = fs_rename(name, dst_name);
+  if (rc != want)
+    return fail("rename", idx, rc, want);
+  if (rc == 0) {
+    model[dst] = model[idx];
+    model[idx].exists = 0;
+    model[idx].data = NULL;
+    model[idx].size = 0;
+  }
+  return 0;
+}
+
+static int op_delete(uint32_t idx) {
+  char name[16];
+  fuzz_name(name, idx);
+  int want = model[idx].exists ? 0 : -1;
+  int rc = fs_delete_file(name);
+  if (rc != want)
+    return fail("delete", idx, rc, want);
+  if (rc == 0) {
+    model[idx].exists = 0;
+    model_set(idx, NULL, 0);
+    model_count--;
+  }
+  return 0;
+}
+
+int run_fuzz(uint32_t seed, uint32_t ops) {
+  rng = seed ? seed : 1;
+  memset(model, 0, sizeof(model));
+  model_count = 0;
+  nospace_count = 0;
+  in_batch = 0;
+
+  if (host_fs_format() != 0)
+    return 1;
+  fs_set_dedup(seed & 1); /* odd seeds share identical files */
+
+  for (op_index = 0; op_index < ops; op_index++) {
+    uint32_t idx = fuzz_rand() % FUZZ_NAMES;
+    uint32_t dice = fuzz_rand() % 100;
+    int rc;
+
+    if (dice < 32)
+      rc = op_write(idx);
+    else if (dice < 42)
+      rc = op_append(idx);
+    else if (dice < 45)
+      rc = op_fallocate(idx);
+    else if (dice < 54)
+      rc = check_file(idx);
+    else if (dice < 60)
+      rc = op_compress(idx);
+    else if (dice < 72)
+      rc = op_create(idx);
+    else if (dice < 88)
+      rc = op_delete(idx);
+    else if (dice < 92)
+      rc = op_copy(idx);
+    else if (dice < 94)
+      rc = op_rename(idx);
+    else if (dice < 97) {
+      rc = in_batch && fs_batch_end() < 0 ? -1 : 0;
+      in_batch = 0;
+      if (rc == 0)
+        rc = host_fs_remount() == 0 && check_image() == 0 ? check_all() : -1;
+    } else if (dice < 98) {
+      rc = in_batch ? (fs_batch_end() < 0 ? -1 : 0) : (fs_batch_begin(), 0);
+      in_batch = !in_batch;
+    } else {
+      rc = check_all();
+    }
+
+    if (rc != 0) {
+      fprintf(stderr, "fuzz: FAILED (seed %u)\n", seed);
+      return 1;
+    }
+  }
+  if ((in_batch && fs_batch_end() < 0) || host_fs_remount() != 0 ||
+      check_image() != 0 || check_all() != 0) {
+    fprintf(stderr, "fuzz: FAILED final check (seed %u)\n", seed);
+    return 1;
+  }
+
+  printf("fuzz: seed %u, %u ops, %u-byte blocks OK (%u files live, "
+         "%u out-of-space writes, %u dedup hits, %u table slots)\n",
+         seed, ops, host_block_size, model_count, nospace_count,
+         fs_dedup_stats().hits,
+         ((const fs_superblock_t *)host_disk_data())->max_files);
+  for (uint32_t i = 0; i < FUZZ_NAMES; i++)
+    free(model[i].data);
+  return 0;
+}
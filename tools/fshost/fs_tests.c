@@ -0,0 +1,1274 @@
+#include "host.h"
+#include "../../src/bcache/bcache.h"
+#include "../../src/fs/fs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+static const char *current_test = "";
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "  %s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__,   \
+              current_test, #cond);                                            \
+      failures++;                                                              \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint32_t seed) {
+  for (uint32_t i = 0; i < len; i++)
+    buf[i] = (uint8_t)(seed * 31 + i * 7 + (i >> 9));
+}
+
+/* ===== tests ===== */
+
+static void test_format_and_remount(void) {
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_create_file("a") == 0);
+  /* mounting reads the superblock and nothing else */
+  host_disk_reset_stats();
+  CHECK(host_fs_remount() == 0);
+  CHECK(host_disk_stats().reads == 1);
+  CHECK(fs_is_directory("a") == 0);
+}
+
+static void test_create_duplicate(void) {
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_create_file("dup") == 0);
+  CHECK(fs_create_file("dup") == -2);
+  CHECK(fs_is_directory("missing") == -1);
+}
+
+static void test_roundtrip_sizes(void) {
+  static const uint32_t sizes[] = {0, 1, 511, 512, 513, 4096, 65537};
+  static uint8_t in[65537], out[65537];
+
+  CHECK(host_fs_format() == 0);
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    fill_pattern(in, sizes[i], i);
+    memset(out, 0xAA, sizeof(out));
+    CHECK(fs_write_file("f", in, sizes[i]) == 0);
+    CHECK(fs_read_file("f", out, sizeof(out)) == (int)sizes[i]);
+    CHECK(memcmp(in, out, sizes[i]) == 0);
+  }
+}
+
+static void test_read_buffer_too_small(void) {
+  uint8_t buf[600];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(buf, sizeof(buf), 1);
+  CHECK(fs_write_file("f", buf, sizeof(buf)) == 0);
+  CHECK(fs_read_file("f", buf, 100) == -2);
+  CHECK(fs_read_file("nope", buf, sizeof(buf)) == -1);
+}
+
+static void test_delete(void) {
+  uint8_t buf[16] = "hello";
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_write_file("f", buf, 5) == 0);
+  CHECK(fs_delete_file("f") == 0);
+  CHECK(fs_read_file("f", buf, sizeof(buf)) == -1);
+  CHECK(fs_delete_file("f") == -1);
+}
+
+static void test_persistence(void) {
+  uint8_t in[3000], out[3000];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(in, sizeof(in), 9);
+  CHECK(fs_write_file("keep", in, sizeof(in)) == 0);
+  CHECK(fs_create_directory("dir") == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("keep", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  CHECK(fs_is_directory("dir") == 1);
+}
+
+static void test_directories(void) {
+  uint8_t buf[8] = "x";
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_create_directory("docs") == 0);
+  CHECK(fs_create_directory("docs") == -2);
+  CHECK(fs_change_directory("docs") == 0);
+  CHECK(strcmp(fs_get_current_dir(), "docs") == 0);
+  CHECK(fs_write_file("note", buf, 1) == 0);
+  CHECK(fs_change_directory("/") == 0);
+  CHECK(fs_read_file("docs/note", buf, sizeof(buf)) == 1);
+  CHECK(fs_read_file("note", buf, sizeof(buf)) == -1);
+  CHECK(fs_change_directory("missing") == -1);
+  CHECK(fs_change_directory("docs/note") == -2);
+
+  host_console_clear();
+  fs_list_files();
+  CHECK(strstr(host_console_text(), "[DIR] docs") != NULL);
+  CHECK(strstr(host_console_text(), "note") == NULL);
+
+  CHECK(fs_delete_directory("docs/note") == -2);
+  CHECK(fs_delete_directory("docs") == 0);
+  CHECK(fs_is_directory("docs") == -1);
+}
+
+static void test_table_grows(void) {
+  enum { FILES = 3000 };
+  char name[16];
+  uint8_t buf[8], out[8];
+  CHECK(host_fs_format() == 0);
+  for (int i = 0; i < FILES; i++) {
+    snprintf(name, sizeof(name), "f%d", i);
+    memcpy(buf, &i, sizeof(i));
+    CHECK(fs_write_file(name, buf, sizeof(i)) == 0);
+  }
+  /* deletes shift the rest of a probe run back; renames move slots */
+  for (int i = 0; i < FILES; i += 3) {
+    snprintf(name, sizeof(name), "f%d", i);
+    CHECK(fs_delete_file(name) == 0);
+  }
+  for (int i = 1; i < FILES; i += 30) {
+    char to[16];
+    snprintf(name, sizeof(name), "f%d", i);
+    snprintf(to, sizeof(to), "r%d", i);
+    CHECK(fs_rename(name, to) == 0);
+  }
+  CHECK(fs_create_directory("d") == 0);
+  for (int i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "d/g%d", i);
+    CHECK(fs_create_file(name) == 0);
+  }
+  CHECK(fs_rename("d", "e") == 0);
+
+  CHECK(host_fs_remount() == 0);
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  CHECK(sb->max_files >= 4096 && sb->num_files == FILES - FILES / 3 + 101);
+  CHECK(sb->inode_map_block >= sb->data_block);
+  for (int i = 0; i < FILES; i++) {
+    snprintf(name, sizeof(name), i % 30 == 1 ? "r%d" : "f%d", i);
+    int rc = fs_read_file(name, out, sizeof(out));
+    if (i % 3 == 0) {
+      CHECK(rc == -1);
+      continue;
+    }
+    CHECK(rc == (int)sizeof(i) && memcmp(out, &i, sizeof(i)) == 0);
+  }
+  CHECK(fs_is_directory("e") == 1 && fs_is_directory("d") == -1);
+  CHECK(fs_read_file("e/g99", out, sizeof(out)) == 0);
+
+  /* a lookup reads the bitmap and table sectors its probe touches, not
+   * the table */
+  CHECK(host_fs_remount() == 0);
+  host_disk_reset_stats();
+  CHECK(fs_read_file("f2999", out, sizeof(out)) == sizeof(int));
+  CHECK(host_disk_stats().reads <= 3);
+}
+
+static void test_space_reclaimed(void) {
+  static uint8_t big[4 << 20];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(big, sizeof(big), 3);
+  /* 16 MiB fs: three 4 MiB files fit, a fourth does not */
+  CHECK(fs_write_file("a", big, sizeof(big)) == 0);
+  CHECK(fs_write_file("b", big, sizeof(big)) == 0);
+  CHECK(fs_write_file("c", big, sizeof(big)) == 0);
+  CHECK(fs_write_file("d", big, sizeof(big)) == -2);
+  CHECK(fs_delete_file("b") == 0);
+  CHECK(fs_write_file("d", big, sizeof(big)) == 0);
+  /* rewriting a file in place must not leak its old extent */
+  for (int i = 0; i < 8; i++)
+    CHECK(fs_write_file("a", big, sizeof(big)) == 0);
+}
+
+static void test_failed_write_keeps_data(void) {
+  static uint8_t big[12 << 20];
+  uint8_t small[100], out[100];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(small, sizeof(small), 5);
+  CHECK(fs_write_file("keep", small, sizeof(small)) == 0);
+  CHECK(fs_write_file("hog", big, 8 << 20) == 0);
+  CHECK(fs_write_file("keep", big, sizeof(big)) == -2);
+  CHECK(fs_read_file("keep", out, sizeof(out)) == (int)sizeof(small));
+  CHECK(memcmp(small, out, sizeof(small)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("keep", out, sizeof(out)) == (int)sizeof(small));
+}
+
+static void test_write_behind(void) {
+  uint8_t in[2048], out[2048];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+  fill_pattern(in, sizeof(in), 11);
+
+  /* the write and its metadata update stay in the cache until a flush */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("lazy", in, sizeof(in)) == 0);
+  CHECK(host_disk_stats().writes == 0);
+  CHECK(fs_read_file("lazy", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().writes > 0);
+  host_disk_reset_stats();
+  CHECK(fs_flush() == 0); /* nothing left dirty */
+  CHECK(host_disk_stats().writes == 0);
+
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("lazy", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+}
+
+static uint32_t disk_data_block(void) {
+  return ((const fs_superblock_t *)host_disk_data())->data_block;
+}
+
+static void test_ordered_barrier(void) {
+  uint8_t in[2048];
+  const uint32_t *ops;
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+  fill_pattern(in, sizeof(in), 12);
+
+  /* data, FLUSH CACHE, metadata, FLUSH CACHE */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("ordered", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  uint32_t n = host_disk_log(&ops);
+  uint32_t meta_end = disk_data_block();
+  uint32_t i = 0;
+  while (i < n && ops[i] != HOST_DISK_FLUSH) {
+    CHECK(ops[i] >= meta_end);
+    i++;
+  }
+  CHECK(i == sizeof(in) / FS_SECTOR_SIZE);
+  CHECK(i < n && ops[i++] == HOST_DISK_FLUSH);
+  CHECK(i < n && ops[i] < meta_end);
+  while (i < n && ops[i] != HOST_DISK_FLUSH)
+    CHECK(ops[i++] < meta_end);
+  CHECK(i == n - 1);
+}
+
+static void check_writeback(void) {
+  uint8_t in[2048];
+  const uint32_t *ops;
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+  fill_pattern(in, sizeof(in), 13);
+
+  /* one LBA-ordered pass, a single FLUSH CACHE at the end */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("wb", in, sizeof(in)) == 0);
+  CHECK(host_disk_stats().writes == 0);
+  CHECK(fs_flush() == 0);
+  uint32_t n = host_disk_log(&ops);
+  CHECK(n > 1 && host_disk_stats().flushes == 1);
+  CHECK(ops[n - 1] == HOST_DISK_FLUSH);
+  for (uint32_t i = 1; i + 1 < n; i++)
+    CHECK(ops[i - 1] < ops[i]);
+}
+
+static void test_writeback_mode(void) {
+  bcache_set_mode(BCACHE_WRITEBACK);
+  check_writeback();
+  bcache_set_mode(BCACHE_ORDERED);
+}
+
+static void check_writethrough(void) {
+  uint8_t in[2048], out[2048];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(in, sizeof(in), 14);
+
+  /* on disk before the call returns, nothing left for a flush to do */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("wt", in, sizeof(in)) == 0);
+  CHECK(host_disk_stats().writes > sizeof(in) / FS_SECTOR_SIZE);
+  CHECK(bcache_stats().dirty == 0);
+  CHECK(fs_read_file("wt", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* the drive cache is off, so barriers cost nothing */
+  CHECK(host_disk_stats().flushes == 0);
+  bcache_invalidate();
+  CHECK(fs_init() == 0);
+  CHECK(fs_read_file("wt", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+}
+
+static void test_writethrough_mode(void) {
+  bcache_set_mode(BCACHE_WRITETHROUGH);
+  check_writethrough();
+  bcache_set_mode(BCACHE_ORDERED);
+}
+
+static void test_mode_switch(void) {
+  uint8_t in[2048];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(in, sizeof(in), 15);
+
+  /* what ordered left dirty goes out in ordered's way: data, barrier,
+   * metadata, barrier, before writethrough may write anything directly */
+  CHECK(fs_write_file("sw", in, sizeof(in)) == 0);
+  CHECK(bcache_stats().dirty > 0);
+  host_disk_reset_stats();
+  CHECK(bcache_set_mode(BCACHE_WRITETHROUGH) == 0);
+  CHECK(bcache_mode() == BCACHE_WRITETHROUGH);
+  CHECK(bcache_stats().dirty == 0);
+  CHECK(host_disk_stats().flushes == 2);
+  CHECK(bcache_set_mode(BCACHE_ORDERED) == 0);
+}
+
+static int disk_blocks_zero(uint32_t block, uint32_t count) {
+  const uint8_t *p =
+      host_disk_data() + (size_t)(disk_data_block() + block) * FS_SECTOR_SIZE;
+  for (size_t i = 0; i < (size_t)count * FS_SECTOR_SIZE; i++) {
+    if (p[i])
+      return 0;
+  }
+  return 1;
+}
+
+static void test_trim_on_delete(void) {
+  uint8_t in[4096];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(in, sizeof(in), 15);
+  CHECK(fs_write_file("gone", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(!disk_blocks_zero(0, 8));
+
+  /* queued with the delete, sent once the table freeing it is on disk */
+  host_disk_reset_stats();
+  CHECK(fs_delete_file("gone") == 0);
+  CHECK(host_disk_stats().trimmed == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 8);
+  CHECK(disk_blocks_zero(0, 8));
+}
+
+static void test_trim_on_overwrite(void) {
+  uint8_t a[4096], b[1024], big[8192], out[8192];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(a, sizeof(a), 16);
+  fill_pattern(b, sizeof(b), 17);
+  fill_pattern(big, sizeof(big), 18);
+  CHECK(fs_write_file("a", a, sizeof(a)) == 0); /* blocks 0-7 */
+  CHECK(fs_write_file("b", b, sizeof(b)) == 0); /* blocks 8-9 */
+  CHECK(fs_flush() == 0);
+
+  /* grows past b, so it moves and its old extent is freed */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("a", big, sizeof(big)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 8);
+  CHECK(disk_blocks_zero(0, 8));
+
+  /* shrinking in place only frees the tail */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("a", a, sizeof(a)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 16);
+
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)sizeof(a));
+  CHECK(memcmp(a, out, sizeof(a)) == 0);
+  CHECK(fs_read_file("b", out, sizeof(out)) == (int)sizeof(b));
+  CHECK(memcmp(b, out, sizeof(b)) == 0);
+}
+
+static void test_trim_reuse_cancelled(void) {
+  uint8_t x[4096], y[4096], out[4096];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(x, sizeof(x), 19);
+  fill_pattern(y, sizeof(y), 20);
+  CHECK(fs_write_file("x", x, sizeof(x)) == 0);
+  CHECK(fs_flush() == 0);
+
+  /* y lands on x's blocks before the TRIM goes out: it must not be sent */
+  host_disk_reset_stats();
+  CHECK(fs_delete_file("x") == 0);
+  CHECK(fs_write_file("y", y, sizeof(y)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("y", out, sizeof(out)) == (int)sizeof(y));
+  CHECK(memcmp(y, out, sizeof(y)) == 0);
+}
+
+static void test_fstrim(void) {
+  uint8_t a[4096], b[1024], out[4096];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(a, sizeof(a), 21);
+  fill_pattern(b, sizeof(b), 22);
+  CHECK(fs_write_file("a", a, sizeof(a)) == 0);
+  CHECK(fs_write_file("b", b, sizeof(b)) == 0);
+  CHECK(fs_write_file("a", b, sizeof(b)) == 0); /* leaves a hole at 2-7 */
+
+  host_disk_reset_stats();
+  int trimmed = fs_trim();
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  uint32_t free_blocks = sb->total_blocks - sb->data_block - 4;
+  CHECK(trimmed == (int)free_blocks);
+  CHECK(host_disk_stats().trimmed >= free_blocks);
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)sizeof(b));
+  CHECK(memcmp(b, out, sizeof(b)) == 0);
+  CHECK(fs_read_file("b", out, sizeof(out)) == (int)sizeof(b));
+  CHECK(memcmp(b, out, sizeof(b)) == 0);
+}
+
+/* the entry as it is on disk, after a flush */
+static const fs_file_entry_t *disk_entry(const char *name) {
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  const fs_file_entry_t *table =
+      (const fs_file_entry_t *)(host_disk_data() +
+                                (size_t)sb->file_table_block * FS_SECTOR_SIZE);
+  for (uint32_t i = 0; i < sb->max_files; i++) {
+    if (table[i].used && strcmp(table[i].name, name) == 0)
+      return &table[i];
+  }
+  return NULL;
+}
+
+static void test_append_in_place(void) {
+  static uint8_t expect[101 * 37];
+  static uint8_t out[sizeof(expect)];
+  uint8_t line[37];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < 100; i++) {
+    fill_pattern(line, sizeof(line), 30 + i);
+    host_disk_reset_stats();
+    CHECK(fs_append_file("log", line, sizeof(line)) == 0);
+    CHECK(host_disk_stats().reads == 0); /* the tail block is cached */
+    memcpy(expect + size, line, sizeof(line));
+    size += sizeof(line);
+  }
+  CHECK(fs_read_file("log", out, sizeof(out)) == (int)size);
+  CHECK(memcmp(expect, out, size) == 0);
+
+  /* grew in place from block 0, only the blocks touched are written */
+  host_disk_reset_stats();
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("log")->start_block == 0);
+  CHECK(host_disk_stats().writes <=
+        size / FS_SECTOR_SIZE + 1 + disk_data_block());
+
+  host_disk_reset_stats();
+  CHECK(fs_append_file("log", line, sizeof(line)) == 0);
+  CHECK(fs_flush() == 0);
+  /* tail block(s) + metadata */
+  CHECK(host_disk_stats().writes <= 2 + disk_data_block());
+
+  memcpy(expect + size, line, sizeof(line));
+  size += sizeof(line);
+
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("log", out, sizeof(out)) == (int)size);
+  CHECK(memcmp(expect, out, size) == 0);
+}
+
+static void test_append_moves_when_blocked(void) {
+  uint8_t a[1024], b[512], c[700], out[2048];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(a, sizeof(a), 40);
+  fill_pattern(b, sizeof(b), 41);
+  fill_pattern(c, sizeof(c), 42);
+  CHECK(fs_write_file("a", a, sizeof(a)) == 0); /* blocks 0-1 */
+  CHECK(fs_write_file("b", b, sizeof(b)) == 0); /* block 2 */
+
+  /* b sits right behind a, so a has to move, with headroom */
+  CHECK(fs_append_file("a", c, sizeof(c)) == 0);
+  CHECK(fs_flush() == 0);
+  const fs_file_entry_t *e = disk_entry("a");
+  CHECK(e->start_block == 3 && e->size == sizeof(a) + sizeof(c));
+  CHECK(e->prealloc == 1);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)(sizeof(a) + sizeof(c)));
+  CHECK(memcmp(a, out, sizeof(a)) == 0);
+  CHECK(memcmp(c, out + sizeof(a), sizeof(c)) == 0);
+  CHECK(fs_read_file("b", out, sizeof(out)) == (int)sizeof(b));
+  CHECK(memcmp(b, out, sizeof(b)) == 0);
+}
+
+static void test_fallocate(void) {
+  uint8_t line[300], other[512], out[4096];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(line, sizeof(line), 50);
+  fill_pattern(other, sizeof(other), 51);
+
+  /* reserved but still empty; the next file goes after the reservation */
+  CHECK(fs_fallocate("res", 4096) == 0);
+  CHECK(fs_write_file("other", other, sizeof(other)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("res")->size == 0 && disk_entry("res")->prealloc == 8);
+  CHECK(disk_entry("other")->start_block == 8);
+  CHECK(fs_read_file("res", out, sizeof(out)) == 0);
+
+  /* appends fill the reservation without moving */
+  for (uint32_t i = 0; i < 13; i++)
+    CHECK(fs_append_file("res", line, sizeof(line)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("res")->start_block == 0);
+  CHECK(disk_entry("res")->prealloc == 0);
+  CHECK(fs_read_file("res", out, sizeof(out)) == 13 * (int)sizeof(line));
+  CHECK(memcmp(out + 12 * sizeof(line), line, sizeof(line)) == 0);
+
+  /* shrinking what is reserved is a no-op; delete frees all of it */
+  CHECK(fs_fallocate("res", 100) == 0);
+  host_disk_reset_stats();
+  CHECK(fs_delete_file("res") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 8);
+}
+
+static void test_inline_data(void) {
+  uint8_t in[FS_INLINE_MAX + 1], out[512];
+  const uint32_t *ops;
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+  fill_pattern(in, sizeof(in), 80);
+
+  /* a small file only dirties the table */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("cfg", in, 40) == 0);
+  CHECK(fs_flush() == 0);
+  uint32_t n = host_disk_log(&ops);
+  for (uint32_t i = 0; i < n; i++)
+    CHECK(ops[i] == HOST_DISK_FLUSH || ops[i] < disk_data_block());
+  const fs_file_entry_t *e = disk_entry("cfg");
+  CHECK(e && e->is_inline && e->start_block == 0xFFFFFFFF && e->size == 40);
+  CHECK(e && memcmp(e->data, in, 40) == 0);
+
+  /* and reads back from its table sector alone once mounted, after the
+   * bitmap sector that finds it */
+  CHECK(host_fs_remount() == 0);
+  host_disk_reset_stats();
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == 40);
+  CHECK(memcmp(in, out, 40) == 0);
+  CHECK(host_disk_stats().reads == 2);
+  host_disk_reset_stats();
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == 40);
+  CHECK(host_disk_stats().reads == 0);
+
+  /* appends stay inline up to FS_INLINE_MAX, then move to a block */
+  CHECK(fs_append_file("cfg", in + 40, FS_INLINE_MAX - 40) == 0);
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == FS_INLINE_MAX);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("cfg")->is_inline);
+  CHECK(fs_append_file("cfg", in + FS_INLINE_MAX, 1) == 0);
+  CHECK(fs_flush() == 0);
+  e = disk_entry("cfg");
+  CHECK(e && !e->is_inline && e->start_block == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* shrinking back in gives the block up */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("cfg", in, 3) == 0);
+  CHECK(fs_flush() == 0);
+  e = disk_entry("cfg");
+  CHECK(e && e->is_inline && e->size == 3);
+  CHECK(host_disk_stats().trimmed == 1); /* its one 512-byte block */
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == 3);
+  CHECK(memcmp(in, out, 3) == 0);
+
+  /* fallocate wants blocks, so the data moves out */
+  CHECK(fs_fallocate("cfg", 4096) == 0);
+  CHECK(fs_read_file("cfg", out, sizeof(out)) == 3);
+  CHECK(memcmp(in, out, 3) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(!disk_entry("cfg")->is_inline);
+}
+
+/* log-like text: compresses well, but not to nothing */
+static uint32_t fill_text(uint8_t *buf, uint32_t len, uint32_t seed) {
+  uint32_t n = 0;
+  while (n < len) {
+    char line[64];
+    int w = snprintf(line, sizeof(line), "t=%u cpu%u fs: wrote block %u\n",
+                     seed * 977 + n, seed % 4, (seed * 31 + n) % 4099);
+    for (int i = 0; i < w && n < len; i++)
+      buf[n++] = (uint8_t)line[i];
+  }
+  return n;
+}
+
+static void test_compression(void) {
+  static uint8_t in[64 * 1024 + 300], out[sizeof(in)];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_flush() == 0);
+  fill_text(in, sizeof(in), 1);
+
+  CHECK(fs_create_file("log") == 0);
+  CHECK(fs_set_compress("log", 1) == 0);
+  host_disk_reset_stats();
+  CHECK(fs_write_file("log", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  const fs_file_entry_t *e = disk_entry("log");
+  CHECK(e && e->is_compressed && e->size == sizeof(in));
+  CHECK(e && e->ext.stored < sizeof(in) / 2);
+  CHECK(e && host_disk_stats().writes <=
+                 e->ext.stored / FS_SECTOR_SIZE + disk_data_block());
+  CHECK(host_fs_remount() == 0);
+  host_disk_reset_stats();
+  CHECK(fs_read_file("log", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  CHECK(host_disk_stats().reads < sizeof(in) / FS_SECTOR_SIZE / 2);
+
+  /* appends re-encode only the last chunk */
+  static uint8_t grown[sizeof(in) + 20 * 1000];
+  uint32_t size = sizeof(in);
+  memcpy(grown, in, size);
+  for (uint32_t i = 0; i < 20; i++) {
+    uint32_t n = fill_text(grown + size, 1000, 100 + i);
+    uint32_t tail = disk_entry("log")->ext.tail;
+    host_disk_reset_stats();
+    CHECK(fs_append_file("log", grown + size, n) == 0);
+    CHECK(fs_flush() == 0);
+    CHECK(host_disk_stats().writes <= 2 * FS_CHUNK_SIZE / FS_SECTOR_SIZE +
+                                          disk_data_block());
+    CHECK(disk_entry("log")->ext.tail >= tail);
+    size += n;
+  }
+  CHECK(host_fs_remount() == 0);
+  static uint8_t back[sizeof(grown)];
+  CHECK(fs_read_file("log", back, sizeof(back)) == (int)size);
+  CHECK(memcmp(grown, back, size) == 0);
+
+  /* data that doesn't compress is kept raw, chunk by chunk */
+  for (uint32_t i = 0, x = 7; i < sizeof(in); i++) {
+    x = x * 1103515245 + 12345;
+    in[i] = (uint8_t)(x >> 24);
+  }
+  CHECK(fs_write_file("log", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  e = disk_entry("log");
+  CHECK(e && e->is_compressed && e->ext.stored >= sizeof(in));
+  CHECK(fs_read_file("log", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* turning it off applies to the next write */
+  CHECK(fs_set_compress("log", 0) == 0);
+  CHECK(fs_append_file("log", in, 10) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("log")->is_compressed);
+  CHECK(fs_write_file("log", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(!disk_entry("log")->is_compressed);
+  CHECK(fs_set_compress("nope", 1) == -1);
+}
+
+static void test_compressed_dir(void) {
+  static uint8_t in[20000], out[sizeof(in)];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_create_directory("logs") == 0);
+  CHECK(fs_set_compress("logs", 1) == 0);
+  fill_text(in, sizeof(in), 5);
+
+  /* inline while tiny, then chunks as it grows */
+  CHECK(fs_change_directory("logs") == 0);
+  CHECK(fs_append_file("boot", in, 50) == 0);
+  CHECK(fs_write_file("plain", in, 50) == 0);
+  CHECK(fs_change_directory("/") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("logs/boot")->is_inline);
+  for (uint32_t off = 50; off < sizeof(in); off += 950) {
+    uint32_t n = sizeof(in) - off < 950 ? sizeof(in) - off : 950;
+    CHECK(fs_append_file("/logs/boot", in + off, n) == 0);
+  }
+  CHECK(fs_write_file("top", in, sizeof(in)) == 0);
+  CHECK(host_fs_remount() == 0);
+  const fs_file_entry_t *e = disk_entry("logs/boot");
+  CHECK(e && e->is_compressed && !e->is_inline && e->ext.stored < sizeof(in));
+  CHECK(fs_read_file("/logs/boot", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  CHECK(disk_entry("logs/plain")->compress);
+  CHECK(!disk_entry("top")->is_compressed);
+}
+
+static void test_reflink(void) {
+  static uint8_t in[256 * 1024], out[sizeof(in)];
+  uint8_t line[100];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(in, sizeof(in), 40);
+  CHECK(fs_write_file("big", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+
+  /* the copy is one table update, however big the file */
+  host_disk_reset_stats();
+  CHECK(fs_copy_file("big", "copy") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().reads == 0);
+  CHECK(host_disk_stats().writes <= disk_data_block());
+  CHECK(disk_entry("copy")->start_block == disk_entry("big")->start_block);
+  CHECK(fs_read_file("copy", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* deleting one side frees nothing the other still uses */
+  CHECK(fs_copy_file("big", "copy2") == 0);
+  host_disk_reset_stats();
+  CHECK(fs_delete_file("big") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == 0);
+
+  /* writing one side moves it off the shared blocks */
+  fill_pattern(line, sizeof(line), 41);
+  CHECK(fs_append_file("copy", line, sizeof(line)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(disk_entry("copy")->start_block != disk_entry("copy2")->start_block);
+  CHECK(fs_read_file("copy2", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  static uint8_t grown[sizeof(in) + sizeof(line)];
+  CHECK(fs_read_file("copy", grown, sizeof(grown)) == (int)sizeof(grown));
+  CHECK(memcmp(grown, in, sizeof(in)) == 0);
+  CHECK(memcmp(grown + sizeof(in), line, sizeof(line)) == 0);
+
+  /* with the last sharer gone the blocks are finally discarded */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("copy2", line, 20) == 0); /* inline, no blocks */
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().trimmed == sizeof(in) / FS_SECTOR_SIZE);
+
+  /* copies of inline and compressed files, and onto an existing file */
+  CHECK(fs_write_file("tiny", line, 20) == 0);
+  CHECK(fs_copy_file("tiny", "copy") == 0);
+  CHECK(fs_read_file("copy", out, sizeof(out)) == 20);
+  CHECK(memcmp(out, line, 20) == 0);
+  CHECK(fs_create_file("z") == 0);
+  CHECK(fs_set_compress("z", 1) == 0);
+  memset(in, 'x', sizeof(in));
+  CHECK(fs_write_file("z", in, sizeof(in)) == 0);
+  CHECK(fs_copy_file("z", "z2") == 0);
+  CHECK(fs_append_file("z2", line, sizeof(line)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("z", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  CHECK(fs_read_file("z2", grown, sizeof(grown)) == (int)sizeof(grown));
+  CHECK(memcmp(grown, in, sizeof(in)) == 0);
+  CHECK(memcmp(grown + sizeof(in), line, sizeof(line)) == 0);
+
+  CHECK(fs_copy_file("missing", "x") == -1);
+  CHECK(fs_create_directory("d") == 0);
+  CHECK(fs_copy_file("d", "x") == -3);
+  CHECK(fs_copy_file("z", "d") == -3);
+}
+
+static void test_rename(void) {
+  uint8_t out[64];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_write_file("a", (const uint8_t *)"alpha", 5) == 0);
+  CHECK(fs_write_file("b", (const uint8_t *)"beta", 4) == 0);
+  CHECK(fs_create_directory("docs") == 0);
+  CHECK(fs_write_file("docs/readme", (const uint8_t *)"hi", 2) == 0);
+
+  host_disk_reset_stats();
+  CHECK(fs_rename("a", "c") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().reads == 0);
+  CHECK(host_disk_stats().writes <= disk_data_block());
+  CHECK(fs_read_file("a", out, sizeof(out)) == -1);
+  CHECK(fs_read_file("c", out, sizeof(out)) == 5);
+  CHECK(fs_rename("c", "b") == -2);
+  CHECK(fs_rename("nope", "d") == -1);
+  CHECK(fs_rename("c", "this-name-is-far-too-long-for-an-entry") == -3);
+
+  /* a directory takes its files along, and cwd follows it */
+  CHECK(fs_change_directory("docs") == 0);
+  CHECK(fs_rename("/docs", "/notes") == 0);
+  CHECK(strcmp(fs_get_current_dir(), "notes") == 0);
+  CHECK(fs_read_file("readme", out, sizeof(out)) == 2);
+  CHECK(fs_rename("/c", "c") == 0); /* into the current directory */
+  CHECK(fs_change_directory("/") == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_is_directory("notes") == 1);
+  CHECK(fs_read_file("notes/readme", out, sizeof(out)) == 2);
+  CHECK(fs_read_file("notes/c", out, sizeof(out)) == 5);
+  CHECK(memcmp(out, "alpha", 5) == 0);
+  CHECK(fs_rename("notes", "notes/sub") == -3);
+}
+
+static void test_dedup(void) {
+  static uint8_t in[64 * 1024], out[sizeof(in)];
+  uint8_t line[100];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_set_dedup(1) == 0);
+  fs_dedup_stats_t before = fs_dedup_stats();
+  fill_pattern(in, sizeof(in), 50);
+  CHECK(fs_write_file("a", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+
+  /* the same bytes again: only the table is written */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("b", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().writes <= disk_data_block());
+  CHECK(disk_entry("b")->start_block == disk_entry("a")->start_block);
+  fs_dedup_stats_t st = fs_dedup_stats();
+  CHECK(st.hits == before.hits + 1);
+  CHECK(st.deduped == before.deduped + sizeof(in));
+  CHECK(st.sectors_saved == before.sectors_saved + sizeof(in) / FS_SECTOR_SIZE);
+
+  /* same size, different bytes: written out, not shared */
+  fill_pattern(in, sizeof(in), 51);
+  CHECK(fs_write_file("c", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("c")->start_block != disk_entry("a")->start_block);
+  CHECK(fs_dedup_stats().hits == st.hits);
+
+  /* rewriting a file with what it already holds writes no data */
+  host_disk_reset_stats();
+  CHECK(fs_write_file("c", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(host_disk_stats().writes <= disk_data_block());
+  CHECK(fs_dedup_stats().hits == st.hits + 1);
+
+  /* appending to one side moves it off the shared blocks */
+  fill_pattern(in, sizeof(in), 50);
+  fill_pattern(line, sizeof(line), 52);
+  CHECK(fs_append_file("b", line, sizeof(line)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(disk_entry("b")->start_block != disk_entry("a")->start_block);
+  CHECK(disk_entry("b")->ext.hash == 0);
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* fingerprints are on disk, so a match survives the remount */
+  CHECK(fs_write_file("d", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("d")->start_block == disk_entry("a")->start_block);
+
+  /* compressed extents are matched and shared as well */
+  CHECK(fs_create_file("z") == 0);
+  CHECK(fs_set_compress("z", 1) == 0);
+  memset(in, 'x', sizeof(in));
+  CHECK(fs_write_file("z", in, sizeof(in)) == 0);
+  CHECK(fs_write_file("z2", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("z2")->start_block == disk_entry("z")->start_block);
+  CHECK(fs_read_file("z2", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* a twin among many files is found through the fingerprint index, not
+   * by reading every entry of the table */
+  char name[8];
+  for (uint32_t i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "n%u", i);
+    fill_pattern(in, 1000, 60 + i);
+    CHECK(fs_write_file(name, in, 1000) == 0);
+  }
+  CHECK(host_fs_remount() == 0);
+  fill_pattern(in, 1000, 61);
+  CHECK(fs_write_file("t1", in, 1000) == 0); /* builds the index */
+  fill_pattern(in, 1000, 259);
+  bcache_stats_t bs = bcache_stats();
+  CHECK(fs_write_file("t2", in, 1000) == 0);
+  CHECK(bcache_stats().hits + bcache_stats().misses - bs.hits - bs.misses <
+        50);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("t2")->start_block == disk_entry("n199")->start_block);
+
+  CHECK(fs_set_dedup(0) == 0);
+  CHECK(fs_write_file("z3", in, sizeof(in)) == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(disk_entry("z3")->start_block != disk_entry("z")->start_block);
+}
+
+static void test_next_entry(void) {
+  fs_dirent_t d;
+  uint32_t cursor = 0, files = 0, dirs = 0;
+  char full[FS_FILENAME_LEN * 2];
+  CHECK(host_fs_format() == 0);
+  CHECK(fs_create_directory("logs") == 0);
+  CHECK(fs_change_directory("logs") == 0);
+  CHECK(fs_write_file("a.log", (const uint8_t *)"x", 1) == 0);
+  fs_resolve_path("b.log", full);
+  CHECK(strcmp(full, "logs/b.log") == 0);
+  CHECK(fs_change_directory("/") == 0);
+  CHECK(fs_write_file("top", (const uint8_t *)"yy", 2) == 0);
+
+  while (fs_next_entry(&cursor, &d) == 0) {
+    if (d.is_directory) {
+      CHECK(strcmp(d.name, "logs") == 0);
+      dirs++;
+    } else {
+      CHECK(strcmp(d.name, "logs/a.log") == 0 || strcmp(d.name, "top") == 0);
+      CHECK(d.size == (strcmp(d.name, "top") == 0 ? 2u : 1u));
+      files++;
+    }
+  }
+  CHECK(files == 2 && dirs == 1);
+  CHECK(fs_next_entry(&cursor, &d) == -1);
+}
+
+/* A map sector that can't be read fails what needs it and changes
+ * nothing, rather than being taken for zeros: free blocks, free slots */
+static void test_unreadable_map(void) {
+  uint8_t data[2000], out[2000];
+  CHECK(host_fs_format() == 0);
+  fill_pattern(data, sizeof(data), 9);
+  CHECK(fs_write_file("a", data, sizeof(data)) == 0);
+  CHECK(fs_create_file("b") == 0);
+  CHECK(host_fs_remount() == 0);
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  uint32_t spb = sb->block_size / HOST_SECTOR_SIZE;
+
+  host_disk_fail_reads(sb->inode_map_block * spb, 1);
+  CHECK(fs_delete_file("b") == -1);
+  CHECK(fs_create_file("d") < 0);
+  host_disk_fail_reads(sb->ref_map_block * spb, 1);
+  CHECK(fs_delete_file("a") == -1);
+  CHECK(fs_write_file("c", data, sizeof(data)) < 0);
+  host_disk_fail_reads(0, 0);
+
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)sizeof(data));
+  CHECK(memcmp(out, data, sizeof(data)) == 0);
+  CHECK(fs_is_directory("b") == 0);
+  CHECK(fs_delete_file("b") == 0);
+  CHECK(fs_write_file("c", data, sizeof(data)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("a", out, sizeof(out)) == (int)sizeof(data));
+  CHECK(memcmp(out, data, sizeof(data)) == 0);
+  CHECK(fs_read_file("c", out, sizeof(out)) == (int)sizeof(data));
+  CHECK(memcmp(out, data, sizeof(data)) == 0);
+}
+
+/* a table growth that fails part way leaves the old table in use and
+ * gives its new extent back */
+static void test_failed_growth(void) {
+  char name[8];
+  uint8_t out[8];
+  CHECK(host_fs_format() == 0);
+  for (uint32_t i = 0; i < 96; i++) {
+    snprintf(name, sizeof(name), "f%u", i);
+    CHECK(fs_write_file(name, (const uint8_t *)name, strlen(name)) == 0);
+  }
+  int free_blocks = fs_trim();
+  CHECK(free_blocks > 0);
+  CHECK(host_fs_remount() == 0);
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  uint32_t spb = sb->block_size / HOST_SECTOR_SIZE;
+
+  host_disk_fail_reads(sb->file_table_block * spb + 5, 1);
+  CHECK(fs_create_file("x") == 0); /* into what is left of the table */
+  host_disk_fail_reads(0, 0);
+  CHECK(fs_trim() == free_blocks);
+  CHECK(sb->max_files == FS_MAX_FILES);
+
+  CHECK(host_fs_remount() == 0);
+  for (uint32_t i = 0; i < 96; i++) {
+    snprintf(name, sizeof(name), "f%u", i);
+    CHECK(fs_read_file(name, out, sizeof(out)) == (int)strlen(name));
+    CHECK(memcmp(out, name, strlen(name)) == 0);
+  }
+  CHECK(fs_is_directory("x") == 0);
+  CHECK(fs_create_file("y") == 0);
+  CHECK(fs_flush() == 0);
+  CHECK(sb->max_files == 2 * FS_MAX_FILES);
+  CHECK(fs_is_directory("x") == 0 && fs_is_directory("f95") == 0);
+}
+
+/* In a batch the table reaches the disk once, at the end, even when every
+ * write would otherwise go straight through: past what icache holds, for
+ * removes and renames, and when the table grows */
+static void test_batch(void) {
+  char name[8];
+  uint8_t out[16];
+  bcache_set_mode(BCACHE_WRITETHROUGH);
+  CHECK(host_fs_format() == 0);
+  for (uint32_t i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "p%u", i);
+    CHECK(fs_create_file(name) == 0);
+  }
+  const fs_superblock_t *sb = (const fs_superblock_t *)host_disk_data();
+  uint32_t spb = sb->block_size / HOST_SECTOR_SIZE;
+  uint32_t meta_end = sb->data_block * spb;
+  uint32_t table = sb->inode_map_block * spb;
+  uint32_t table_end = table + sb->table_blocks * spb;
+  CHECK(table >= meta_end); /* grown into the data area already */
+
+  host_disk_reset_stats();
+  fs_batch_begin();
+  fs_batch_begin();
+  CHECK(fs_create_directory("d") == 0);
+  for (uint32_t i = 0; i < 90; i++) {
+    snprintf(name, sizeof(name), "f%u", i);
+    CHECK(fs_write_file(name, (const uint8_t *)name, strlen(name)) == 0);
+  }
+  CHECK(fs_delete_file("f0") == 0);
+  CHECK(fs_rename("f1", "g1") == 0);
+  CHECK(fs_batch_end() == 0);
+  CHECK(host_disk_stats().writes == 0);
+
+  /* the table doubles: the new one is written, the old one left alone */
+  for (uint32_t i = 90; i < 200; i++) {
+    snprintf(name, sizeof(name), "f%u", i);
+    CHECK(fs_write_file(name, (const uint8_t *)name, strlen(name)) == 0);
+  }
+  const uint32_t *ops;
+  uint32_t n = host_disk_log(&ops);
+  CHECK(n > 0);
+  for (uint32_t i = 0; i < n; i++) {
+    CHECK(ops[i] == HOST_DISK_FLUSH || ops[i] >= meta_end);
+    CHECK(ops[i] < table || ops[i] >= table_end);
+  }
+  CHECK(sb->max_files == 256);
+  CHECK(fs_batch_end() == 0);
+  CHECK(sb->max_files == 512);
+
+  bcache_set_mode(BCACHE_ORDERED);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_is_directory("d") == 1);
+  CHECK(fs_read_file("f0", out, sizeof(out)) < 0);
+  CHECK(fs_read_file("f1", out, sizeof(out)) < 0);
+  CHECK(fs_read_file("g1", out, sizeof(out)) == 2);
+  CHECK(memcmp(out, "f1", 2) == 0);
+  CHECK(fs_read_file("f199", out, sizeof(out)) == 4);
+  CHECK(memcmp(out, "f199", 4) == 0);
+  CHECK(fs_is_directory("p99") == 0);
+}
+
+/* A batch changing more entries than it can hold commits part way, between
+ * operations, and says so */
+static void test_batch_overflow(void) {
+  char name[8];
+  uint8_t out[16];
+  CHECK(host_fs_format() == 0);
+  for (uint32_t i = 0; i < 1100; i++) {
+    snprintf(name, sizeof(name), "o%u", i);
+    CHECK(fs_create_file(name) == 0);
+  }
+  CHECK(fs_flush() == 0);
+
+  fs_batch_begin();
+  for (uint32_t i = 0; i < 1100; i++) {
+    snprintf(name, sizeof(name), "o%u", i);
+    CHECK(fs_write_file(name, (const uint8_t *)name, strlen(name)) == 0);
+  }
+  CHECK(fs_batch_end() == 1);
+  fs_batch_begin();
+  CHECK(fs_write_file("o0", (const uint8_t *)"x", 1) == 0);
+  CHECK(fs_batch_end() == 0); /* the next one starts whole again */
+
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("o0", out, sizeof(out)) == 1);
+  for (uint32_t i = 1; i < 1100; i++) {
+    snprintf(name, sizeof(name), "o%u", i);
+    CHECK(fs_read_file(name, out, sizeof(out)) == (int)strlen(name));
+    CHECK(memcmp(out, name, strlen(name)) == 0);
+  }
+}
+
+/* A version 1 image, laid out by hand: 44-byte entries, no inline data */
+static void test_v1_image(void) {
+  const uint32_t v1_entry = 44;
+  uint8_t *disk = host_disk_data();
+  uint8_t in[20], out[64];
+
+  CHECK(fs_flush() == 0);
+  host_disk_wipe();
+  fs_superblock_t *sb = (fs_superblock_t *)disk;
+  sb->magic = FS_MAGIC;
+  sb->version = 1;
+  sb->max_files = FS_MAX_FILES;
+  sb->num_files = 1;
+  sb->block_size = FS_SECTOR_SIZE;
+  sb->total_blocks = FS_DISK_SECTORS;
+  sb->file_table_block = 1;
+  sb->data_block = 1 + (FS_MAX_FILES * v1_entry + 511) / 512;
+  fs_file_entry_t *old = (fs_file_entry_t *)(disk + FS_SECTOR_SIZE);
+  strcpy(old->name, "old");
+  old->size = 5;
+  old->start_block = 0;
+  old->used = 1;
+  memcpy(disk + (size_t)sb->data_block * FS_SECTOR_SIZE, "hello", 5);
+  bcache_invalidate();
+  CHECK(fs_init() == 0);
+  host_console_clear();
+
+  CHECK(fs_read_file("old", out, sizeof(out)) == 5);
+  CHECK(memcmp(out, "hello", 5) == 0);
+  fill_pattern(in, sizeof(in), 90);
+  CHECK(fs_write_file("new", in, sizeof(in)) == 0);
+  CHECK(host_fs_remount() == 0);
+  CHECK(fs_read_file("new", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+  /* still version 1: the second entry follows 44 bytes on, with a block */
+  CHECK(sb->version == 1 && sb->num_files == 2);
+  fs_file_entry_t e;
+  memcpy(&e, disk + FS_SECTOR_SIZE + v1_entry, v1_entry);
+  CHECK(strcmp(e.name, "new") == 0 && e.size == sizeof(in));
+  CHECK(e.start_block == 1);
+  CHECK(fs_set_compress("new", 1) == -3);
+  CHECK(fs_set_dedup(1) == -3);
+}
+
+static void check_block_size(uint32_t bs) {
+  static uint8_t in[3 * 65536 + 100], out[sizeof(in)];
+  const uint32_t sizes[] = {1, 511, 512, 4096, 70000, sizeof(in)};
+  char name[16];
+  host_disk_wipe();
+  bcache_invalidate();
+  CHECK(fs_format(bs) == 0);
+  CHECK(fs_block_size() == bs);
+
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    snprintf(name, sizeof(name), "f%u", i);
+    fill_pattern(in, sizes[i], 60 + i);
+    CHECK(fs_write_file(name, in, sizes[i]) == 0);
+  }
+  fill_pattern(in, 1000, 60);
+  CHECK(fs_append_file("f0", in + 1, 999) == 0);
+
+  /* a big file is read back in a handful of transfers, not one per
+   * sector, after the ones for its entry */
+  CHECK(host_fs_remount() == 0);
+  CHECK(((const fs_superblock_t *)host_disk_data())->block_size == bs);
+  host_disk_reset_stats();
+  fill_pattern(in, sizeof(in), 65);
+  CHECK(fs_read_file("f5", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(memcmp(in, out, sizeof(in)) == 0);
+  CHECK(host_disk_stats().read_cmds <= 4);
+
+  for (uint32_t i = 0; i < 5; i++) {
+    uint32_t len = i == 0 ? 1000 : sizes[i]; /* f0 was appended to */
+    snprintf(name, sizeof(name), "f%u", i);
+    fill_pattern(in, len, 60 + i);
+    CHECK(fs_read_file(name, out, sizeof(out)) == (int)len);
+    CHECK(memcmp(in, out, len) == 0);
+  }
+
+  /* enough entries to double the table, whose extent is one block here */
+  for (uint32_t i = 0; i < FS_MAX_FILES; i++) {
+    snprintf(name, sizeof(name), "g%u", i);
+    CHECK(fs_create_file(name) == 0);
+  }
+  CHECK(host_fs_remount() == 0);
+  CHECK(((const fs_superblock_t *)host_disk_data())->max_files > FS_MAX_FILES);
+  CHECK(fs_read_file("f5", out, sizeof(out)) == (int)sizeof(in));
+  CHECK(fs_read_file("g127", out, sizeof(out)) == 0);
+}
+
+static void test_block_sizes(void) {
+  static const uint32_t sizes[] = {1024, 4096, 65536};
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int before = failures;
+    check_block_size(sizes[i]);
+    if (failures != before) {
+      fprintf(stderr, "  (block size %u)\n", sizes[i]);
+      return;
+    }
+  }
+  /* not a power of two, or out of range */
+  CHECK(fs_format(3072) == -1);
+  CHECK(fs_format(256) == -1);
+  CHECK(fs_format(131072) == -1);
+}
+
+static void check_read_at(const char *name, const uint8_t *in, uint32_t size,
+                          uint32_t off, uint32_t len) {
+  static uint8_t out[FS_CHUNK_SIZE * 3];
+  uint32_t want = off >= size ? 0 : size - off < len ? size - off : len;
+  memset(out, 0xAA, sizeof(out));
+  CHECK(fs_read_at(name, off, out, len) == (int)want);
+  CHECK(memcmp(out, in + off, want) == 0);
+  CHECK(out[want] == 0xAA);
+}
+
+static void test_read_at(void) {
+  static uint8_t in[5 * FS_CHUNK_SIZE + 777];
+  static const uint32_t offs[] = {0, 1, 511, 512, 4095, FS_CHUNK_SIZE - 3,
+                                  3 * FS_CHUNK_SIZE + 5, sizeof(in) - 10,
+                                  sizeof(in), sizeof(in) + 1};
+  CHECK(host_fs_format() == 0);
+  fill_text(in, sizeof(in), 7);
+  CHECK(fs_write_file("plain", in, sizeof(in)) == 0);
+  CHECK(fs_create_file("packed") == 0);
+  CHECK(fs_set_compress("packed", 1) == 0);
+  CHECK(fs_write_file("packed", in, sizeof(in)) == 0);
+  CHECK(fs_write_file("tiny", in, 40) == 0);
+  CHECK(fs_read_at("missing", 0, in, 1) == -1);
+
+  for (uint32_t i = 0; i < sizeof(offs) / sizeof(offs[0]); i++) {
+    check_read_at("plain", in, sizeof(in), offs[i], 1);
+    check_read_at("plain", in, sizeof(in), offs[i], 1000);
+    check_read_at("packed", in, sizeof(in), offs[i], 1);
+    check_read_at("packed", in, sizeof(in), offs[i], 2 * FS_CHUNK_SIZE + 9);
+    check_read_at("tiny", in, 40, offs[i] % 48, 7);
+  }
+
+  /* a page from the middle of a big file reads that page and the
+   * sectors that find its entry, not the file */
+  CHECK(host_fs_remount() == 0);
+  host_disk_reset_stats();
+  check_read_at("plain", in, sizeof(in), 3 * 4096, 4096);
+  CHECK(host_disk_stats().reads == 2 + 4096 / FS_SECTOR_SIZE);
+}
+
+static void test_blank_disk_default(void) {
+  host_disk_wipe();
+  bcache_invalidate();
+  CHECK(fs_init() == 0);
+  CHECK(fs_block_size() == FS_DEFAULT_BLOCK_SIZE);
+  host_console_clear();
+}
+
+/* ===== runner ===== */
+
+typedef struct {
+  const char *name;
+  void (*fn)(void);
+} test_case_t;
+
+#define TEST_CASE(fn) {#fn, fn}
+
+static const test_case_t tests[] = {
+    TEST_CASE(test_format_and_remount),
+    TEST_CASE(test_create_duplicate),
+    TEST_CASE(test_roundtrip_sizes),
+    TEST_CASE(test_read_buffer_too_small),
+    TEST_CASE(test_delete),
+    TEST_CASE(test_persistence),
+    TEST_CASE(test_directories),
+    TEST_CASE(test_table_grows),
+    TEST_CASE(test_space_reclaimed),
+    TEST_CASE(test_failed_write_keeps_data),
+    TEST_CASE(test_write_behind),
+    TEST_CASE(test_ordered_barrier),
+    TEST_CASE(test_writeback_mode),
+    TEST_CASE(test_writethrough_mode),
+    TEST_CASE(test_mode_switch),
+    TEST_CASE(test_trim_on_delete),
+    TEST_CASE(test_trim_on_overwrite),
+    TEST_CASE(test_trim_reuse_cancelled),
+    TEST_CASE(test_fstrim),
+    TEST_CASE(test_append_in_place),
+    TEST_CASE(test_append_moves_when_blocked),
+    TEST_CASE(test_fallocate),
+    TEST_CASE(test_block_sizes),
+    TEST_CASE(test_inline_data),
+    TEST_CASE(test_v1_image),
+    TEST_CASE(test_compression),
+    TEST_CASE(test_compressed_dir),
+    TEST_CASE(test_reflink),
+    TEST_CASE(test_rename),
+    TEST_CASE(test_dedup),
+    TEST_CASE(test_batch),
+    TEST_CASE(test_batch_overflow),
+    TEST_CASE(test_unreadable_map),
+    TEST_CASE(test_failed_growth),
+    TEST_CASE(test_next_entry),
+    TEST_CASE(test_read_at),
+    TEST_CASE(test_blank_disk_default),
+};
+
+int run_tests(void) {
+  uint32_t n = sizeof(tests) / sizeof(tests[0]);
+  for (uint32_t i = 0; i < n; i++) {
+    int before = failures;
+    current_test = tests[i].name;
+    tests[i].fn();
+    printf("%s %s\n", failures == before ? "PASS" : "FAIL", tests[i].name);
+  }
+  printf("%u tests, %d failed\n", n, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef FSHOST_H
+#define FSHOST_H
+
+/* Host-side harness for src/fs: a file-backed block device standing in for
+ * the ATA driver, plus the test, fuzz and bench front ends. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOST_SECTOR_SIZE 512
+#define HOST_DISK_SECTORS 32768 /* 16 MiB, what fs_init formats */
+
+typedef struct {
+  uint64_t reads;      /* sectors read through disk_read_lba(s) */
+  uint64_t writes;     /* sectors written through disk_write_lba(s) */
+  uint64_t read_cmds;  /* transfers those took */
+  uint64_t write_cmds;
+  uint64_t flushes; /* disk_flush calls while the write cache was on */
+  uint64_t trimmed; /* sectors discarded through disk_trim */
+} host_disk_stats_t;
+
+/* every write (its LBA) and cache flush (HOST_DISK_FLUSH) since the last
+ * reset, in order, so tests can check what reached the disk first */
+#define HOST_DISK_FLUSH 0xFFFFFFFFu
+#define HOST_DISK_LOG_MAX 4096
+
+int host_disk_open(const char *path, uint32_t sectors);
+void host_disk_close(void);
+void host_disk_wipe(void); /* zero the whole image (next fs_init formats) */
+uint8_t *host_disk_data(void);
+uint32_t host_disk_sectors(void);
+host_disk_stats_t host_disk_stats(void);
+void host_disk_reset_stats(void);
+uint32_t host_disk_log(const uint32_t **ops);
+/* reads touching [lba, lba + count) fail until this is called again;
+ * count 0 ends it (so does host_fs_format) */
+void host_disk_fail_reads(uint32_t lba, uint32_t count);
+
+/* console output from the fs (vga_putstr/vga_putchar) is captured here */
+void host_console_set_echo(int echo);
+const char *host_console_text(void);
+void host_console_clear(void);
+
+/* fresh filesystem with host_block_size blocks on a wiped image, console
+ * output discarded. The tests are written for 512-byte blocks, the default. */
+extern uint32_t host_block_size;
+int host_fs_format(void);
+/* flush, drop the block cache and re-run fs_init, as a clean reboot would */
+int host_fs_remount(void);
+
+uint64_t host_now_ns(void);
+
+int run_tests(void);
+int run_fuzz(uint32_t seed, uint32_t ops);
+int run_bench(uint32_t files);
+
+#endif
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE /* fallocate */
+#include "host.h"
+#include "../../src/bcache/bcache.h"
+#include "../../src/disk/disk.h"
+#include "../../src/fs/fs.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static int disk_fd = -1;
+static uint8_t *disk_map = NULL;
+static uint32_t disk_sectors = 0;
+static host_disk_stats_t stats;
+static uint32_t op_log[HOST_DISK_LOG_MAX];
+static uint32_t op_log_len = 0;
+static int write_cache = 1;
+static uint32_t fail_lba = 0, fail_count = 0; /* reads that fail */
+
+static char console[1 << 16];
+static size_t console_len = 0;
+static int console_echo = 0;
+
+int host_disk_open(const char *path, uint32_t sectors) {
+  size_t bytes = (size_t)sectors * HOST_SECTOR_SIZE;
+
+  disk_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (disk_fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (ftruncate(disk_fd, (off_t)bytes) != 0) {
+    perror("ftruncate");
+    close(disk_fd);
+    return -1;
+  }
+  disk_map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, disk_fd, 0);
+  if (disk_map == MAP_FAILED) {
+    perror("mmap");
+    close(disk_fd);
+    disk_map = NULL;
+    return -1;
+  }
+  disk_sectors = sectors;
+  return 0;
+}
+
+void host_disk_close(void) {
+  if (disk_map) {
+    msync(disk_map, (size_t)disk_sectors * HOST_SECTOR_SIZE, MS_SYNC);
+    munmap(disk_map, (size_t)disk_sectors * HOST_SECTOR_SIZE);
+  }
+  if (disk_fd >= 0)
+    close(disk_fd);
+  disk_map = NULL;
+  disk_fd = -1;
+}
+
+void host_disk_wipe(void) {
+  memset(disk_map, 0, (size_t)disk_sectors * HOST_SECTOR_SIZE);
+}
+
+uint8_t *host_disk_data(void) { return disk_map; }
+uint32_t host_disk_sectors(void) { return disk_sectors; }
+host_disk_stats_t host_disk_stats(void) { return stats; }
+void host_disk_reset_stats(void) {
+  memset(&stats, 0, sizeof(stats));
+  op_log_len = 0;
+}
+
+void host_disk_fail_reads(uint32_t lba, uint32_t count) {
+  fail_lba = lba;
+  fail_count = count;
+}
+
+uint32_t host_disk_log(const uint32_t **ops) {
+  *ops = op_log;
+  return op_log_len;
+}
+
+static void log_op(uint32_t op) {
+  if (op_log_len < HOST_DISK_LOG_MAX)
+    op_log[op_log_len++] = op;
+}
+
+/* ===== kernel symbols fs.c links against ===== */
+
+int disk_read_lbas(uint32_t lba, uint32_t count, void *buffer) {
+  if (lba >= disk_sectors || count > disk_sectors - lba)
+    return -1;
+  if (lba < fail_lba + fail_count && fail_lba < lba + count)
+    return -1;
+  memcpy(buffer, disk_map + (size_t)lba * HOST_SECTOR_SIZE,
+         (size_t)count * HOST_SECTOR_SIZE);
+  stats.reads += count;
+  stats.read_cmds++;
+  return 0;
+}
+
+int disk_write_lbas(uint32_t lba, uint32_t count, const void *buffer) {
+  if (lba >= disk_sectors || count > disk_sectors - lba)
+    return -1;
+  memcpy(disk_map + (size_t)lba * HOST_SECTOR_SIZE, buffer,
+         (size_t)count * HOST_SECTOR_SIZE);
+  stats.writes += count;
+  stats.write_cmds++;
+  for (uint32_t i = 0; i < count; i++)
+    log_op(lba + i);
+  return 0;
+}
+
+int disk_read_lba(uint32_t lba, void *buffer) {
+  return disk_read_lbas(lba, 1, buffer);
+}
+
+int disk_write_lba(uint32_t lba, const void *buffer) {
+  return disk_write_lbas(lba, 1, buffer);
+}
+
+int disk_set_write_cache(int enable) {
+  write_cache = enable;
+  return 0;
+}
+
+int disk_flush(void) {
+  if (!write_cache)
+    return 0;
+  stats.flushes++;
+  log_op(HOST_DISK_FLUSH);
+  return 0;
+}
+
+/* punch a hole, so the image file shrinks the way a thin-provisioned
+ * backing store would; reads of the range return zeros afterwards */
+int disk_trim(uint32_t lba, uint32_t count) {
+  if (lba >= disk_sectors || count > disk_sectors - lba)
+    return -1;
+  off_t off = (off_t)lba * HOST_SECTOR_SIZE;
+  off_t len = (off_t)count * HOST_SECTOR_SIZE;
+  if (fallocate(disk_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+                len) != 0)
+    memset(disk_map + off, 0, (size_t)len);
+  stats.trimmed += count;
+  return 0;
+}
+
+void vga_putchar(char c, unsigned char color) {
+  (void)color;
+  if (console_len < sizeof(console) - 1) {
+    console[console_len++] = c;
+    console[console_len] = '\0';
+  }
+  if (console_echo)
+    fputc(c, stderr);
+}
+
+void vga_putstr(const char *str, unsigned char color) {
+  while (*str)
+    vga_putchar(*str++, color);
+}
+
+/* ===== console capture ===== */
+
+void host_console_set_echo(int echo) { console_echo = echo; }
+const char *host_console_text(void) { return console; }
+
+void host_console_clear(void) {
+  console_len = 0;
+  console[0] = '\0';
+}
+
+/* ===== helpers ===== */
+
+uint32_t host_block_size = FS_MIN_BLOCK_SIZE;
+
+int host_fs_format(void) {
+  host_disk_fail_reads(0, 0);
+  host_disk_wipe();
+  bcache_invalidate(); /* everything cached is stale now */
+  int rc = fs_format(host_block_size);
+  host_console_clear();
+  return rc;
+}
+
+int host_fs_remount(void) {
+  if (fs_flush() != 0)
+    return -1;
+  bcache_invalidate();
+  fs_change_directory("/");
+  int rc = fs_init();
+  host_console_clear();
+  return rc;
+}
+
+uint64_t host_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
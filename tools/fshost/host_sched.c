@@ -0,0 +1,23 @@
+#include "host.h"
+#include "../../src/sched/sched.h"
+#include "../../src/timer/timer.h"
+
+/* The harness is single-threaded: locks are no-ops, no background threads
+ * are started (tests flush explicitly) and timer ticks are host
+ * milliseconds. */
+
+void mutex_lock(mutex_t *m) { m->locked = 1; }
+void mutex_unlock(mutex_t *m) { m->locked = 0; }
+
+thread_t *thread_create(const char *name, thread_entry_t entry, void *arg,
+                        uint8_t priority) {
+  (void)name;
+  (void)entry;
+  (void)arg;
+  (void)priority;
+  return NULL;
+}
+
+void sched_sleep_ms(uint32_t ms) { (void)ms; }
+
+uint64_t timer_ticks(void) { return host_now_ns() / (1000000000ull / TIMER_HZ); }
@@ -0,0 +1,73 @@
+#include "host.h"
+#include "../../src/fs/fs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(void) {
+  fprintf(stderr, "usage: fshost test <image>\n"
+                  "       fshost fuzz <image> [seed] [ops] [block_size]\n"
+                  "       fshost bench <image> [files] [block_size]\n"
+                  "       fshost put <image> <file>...\n");
+}
+
+/* copy host files into the image's root under their base names, formatting
+ * it first if it is blank */
+static int put_files(int argc, char **argv) {
+  static uint8_t data[1 << 20];
+
+  host_console_set_echo(1);
+  if (fs_init() != 0)
+    return 1;
+  for (int i = 0; i < argc; i++) {
+    const char *slash = strrchr(argv[i], '/');
+    const char *name = slash ? slash + 1 : argv[i];
+    FILE *f = fopen(argv[i], "rb");
+    if (!f) {
+      perror(argv[i]);
+      return 1;
+    }
+    size_t n = fread(data, 1, sizeof(data), f);
+    int too_big = !feof(f);
+    fclose(f);
+    if (too_big || fs_write_file(name, data, (uint32_t)n) != 0) {
+      fprintf(stderr, "%s: cannot store it\n", argv[i]);
+      return 1;
+    }
+  }
+  return fs_flush() == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 2;
+  }
+  if (host_disk_open(argv[2], HOST_DISK_SECTORS) != 0)
+    return 2;
+
+  int rc;
+  if (strcmp(argv[1], "test") == 0) {
+    rc = run_tests();
+  } else if (strcmp(argv[1], "fuzz") == 0) {
+    uint32_t seed = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 1;
+    uint32_t ops = argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 0) : 5000;
+    if (argc > 5)
+      host_block_size = (uint32_t)strtoul(argv[5], NULL, 0);
+    rc = run_fuzz(seed, ops);
+  } else if (strcmp(argv[1], "bench") == 0) {
+    uint32_t files = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 4096;
+    if (argc > 4)
+      host_block_size = (uint32_t)strtoul(argv[4], NULL, 0);
+    rc = run_bench(files);
+  } else if (strcmp(argv[1], "put") == 0) {
+    rc = put_files(argc - 3, argv + 3);
+  } else {
+    usage();
+    rc = 2;
+  }
+
+  host_disk_close();
+  return rc;
+}
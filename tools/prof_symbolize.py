@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Symbolize a BottleOS `prof dump` against the kernel image.
+
+Reads the dump (a file written by `prof dump <file>` or a captured serial
+log; anything outside the "# bottleos-prof" ... "# end" block is ignored)
+and prints folded stacks, one "root;caller;leaf count" line per stack, ready
+for flamegraph.pl or speedscope.
+
+usage: prof_symbolize.py [--kernel build/kernel.bin] [--top N] dump.txt
+"""
+
+import argparse
+import bisect
+import subprocess
+import sys
+from collections import Counter
+
+
+def load_symbols(kernel):
+    out = subprocess.run(["nm", "-n", "--defined-only", kernel],
+                         check=True, capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 3 or parts[1] not in "tTwW":
+            continue
+        addrs.append(int(parts[0], 16))
+        names.append(parts[2])
+    return addrs, names
+
+
+def symbolize(pc, addrs, names):
+    i = bisect.bisect_right(addrs, pc) - 1
+    if i < 0:
+        return "0x%x" % pc
+    return names[i]
+
+
+def parse_dump(stream):
+    stacks = []
+    header = None
+    inside = False
+    for line in stream:
+        line = line.strip()
+        if line.startswith("# bottleos-prof"):
+            inside = True
+            header = line
+            stacks = []  # keep only the last dump in a log
+            continue
+        if line == "# end":
+            inside = False
+            continue
+        if not inside or not line:
+            continue
+        fields = line.split()
+        count = int(fields[0])
+        pcs = [int(x, 16) for x in fields[1:]]
+        stacks.append((count, pcs))
+    return header, stacks
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("dump", help="prof dump file or serial log ('-' = stdin)")
+    ap.add_argument("--kernel", default="build/kernel.bin")
+    ap.add_argument("--top", type=int, default=0,
+                    help="also print the N hottest functions to stderr")
+    args = ap.parse_args()
+
+    addrs, names = load_symbols(args.kernel)
+    stream = sys.stdin if args.dump == "-" else open(args.dump)
+    header, stacks = parse_dump(stream)
+    if header is None:
+        sys.exit("no '# bottleos-prof' block found in %s" % args.dump)
+
+    folded = Counter()
+    flat = Counter()
+    for count, pcs in stacks:
+        # pcs[0] is the interrupted EIP; the rest are return addresses, which
+        # point just past the call, so look up pc - 1 for those
+        frames = [symbolize(pcs[0], addrs, names)]
+        frames += [symbolize(pc - 1, addrs, names) for pc in pcs[1:]]
+        folded[";".join(reversed(frames))] += count
+        flat[frames[0]] += count
+
+    for stack, count in sorted(folded.items()):
+        print("%s %d" % (stack, count))
+
+    if args.top:
+        total = sum(flat.values()) or 1
+        print(header, file=sys.stderr)
+        for name, count in flat.most_common(args.top):
+            print("%6.2f%% %8d  %s" % (100.0 * count / total, count, name),
+                  file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
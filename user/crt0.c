@@ -0,0 +1,5 @@
+#include "sys.h"
+
+int main(int argc, char **argv);
+
+void _start(int argc, char **argv) { sys_exit(main(argc, argv)); }
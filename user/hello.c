@@ -0,0 +1,22 @@
+#include "sys.h"
+
+static unsigned len(const char *s) {
+  unsigned n = 0;
+  while (s[n])
+    n++;
+  return n;
+}
+
+/* greet each argument, or the world */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    sys_puts("Hello, world!\n", 14);
+    return 0;
+  }
+  for (int i = 1; i < argc; i++) {
+    sys_puts("Hello, ", 7);
+    sys_puts(argv[i], len(argv[i]));
+    sys_puts("!\n", 2);
+  }
+  return 0;
+}
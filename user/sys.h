@@ -0,0 +1,41 @@
+#ifndef USER_SYS_H
+#define USER_SYS_H
+
+/* System call stubs for programs run by the kernel's exec (src/exec). */
+
+#define SYSCALL_USER
+#include "../src/syscall/syscall.h"
+
+static inline int syscall4(int num, int a, int b, int c, int d) {
+  int ret;
+  __asm__ volatile("int $0x80"
+                   : "=a"(ret)
+                   : "a"(num), "b"(a), "c"(b), "d"(c), "S"(d)
+                   : "memory");
+  return ret;
+}
+
+static inline void sys_exit(int status) {
+  syscall4(SYS_EXIT, status, 0, 0, 0);
+  __builtin_unreachable();
+}
+
+static inline int sys_puts(const char *buf, unsigned len) {
+  return syscall4(SYS_PUTS, (int)buf, (int)len, 0, 0);
+}
+
+static inline int sys_read(const char *name, unsigned offset, void *buf,
+                           unsigned len) {
+  return syscall4(SYS_READ, (int)name, (int)offset, (int)buf, (int)len);
+}
+
+static inline int sys_write(const char *name, const void *buf, unsigned len) {
+  return syscall4(SYS_WRITE, (int)name, (int)buf, (int)len, 0);
+}
+
+static inline int sys_append(const char *name, const void *buf,
+                             unsigned len) {
+  return syscall4(SYS_APPEND, (int)name, (int)buf, (int)len, 0);
+}
+
+#endif